@@ -0,0 +1,313 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// SSE is always there on x64, and on x86 when the compiler is allowed to use it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIMATION_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// the keyframes of one node, times are in seconds
+struct AnimationChannel {
+    int node;
+    std::vector<float> positionTimes;
+    std::vector<glm::vec3> positions;
+    std::vector<float> rotationTimes;
+    std::vector<glm::quat> rotations;
+    std::vector<float> scaleTimes;
+    std::vector<glm::vec3> scales;
+};
+
+struct AnimationClip {
+    std::string name;
+    float duration;     // in seconds
+    std::vector<AnimationChannel> channels;
+};
+
+// what's needed to turn node transforms into bone matrices
+struct Skeleton {
+    // parent of every node (parents come first) and its local transform when it isn't animated
+    std::vector<int> parents;
+    std::vector<glm::mat4> bindTransforms;
+    // the node that drives each bone, and the matrix that takes a vertex from mesh space into the bone's space
+    std::vector<int> boneNodes;
+    std::vector<glm::mat4> boneOffsets;
+    glm::mat4 globalInverse = glm::mat4(1.0f);
+};
+
+// a = b * c. Four columns of four multiply-adds, done a whole column at a time with SSE.
+inline void multiplyTransform(const glm::mat4& b, const glm::mat4& c, glm::mat4& a)
+{
+#ifdef ANIMATION_SSE
+    __m128 b0 = _mm_loadu_ps(&b[0][0]);
+    __m128 b1 = _mm_loadu_ps(&b[1][0]);
+    __m128 b2 = _mm_loadu_ps(&b[2][0]);
+    __m128 b3 = _mm_loadu_ps(&b[3][0]);
+    glm::mat4 result;
+    for (int i = 0; i < 4; i++)
+    {
+        __m128 column = _mm_mul_ps(b0, _mm_set1_ps(c[i][0]));
+        column = _mm_add_ps(column, _mm_mul_ps(b1, _mm_set1_ps(c[i][1])));
+        column = _mm_add_ps(column, _mm_mul_ps(b2, _mm_set1_ps(c[i][2])));
+        column = _mm_add_ps(column, _mm_mul_ps(b3, _mm_set1_ps(c[i][3])));
+        _mm_storeu_ps(&result[i][0], column);
+    }
+    a = result;
+#else
+    a = b * c;
+#endif
+}
+
+// normalized linear interpolation between two rotations, along the shorter arc. Close enough to slerp for
+// keyframes that are only a frame apart, and a lot cheaper.
+inline glm::quat nlerp(const glm::quat& a, const glm::quat& b, float t)
+{
+#ifdef ANIMATION_SSE
+    // glm stores quaternions as x, y, z, w
+    __m128 qa = _mm_loadu_ps(&a.x);
+    __m128 qb = _mm_loadu_ps(&b.x);
+    __m128 products = _mm_mul_ps(qa, qb);
+    products = _mm_add_ps(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 3, 0, 1)));
+    products = _mm_add_ps(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(1, 0, 3, 2)));
+    // flip b when the dot product is negative, by xor-ing in its sign bit
+    __m128 sign = _mm_and_ps(products, _mm_set1_ps(-0.0f));
+    qb = _mm_xor_ps(qb, sign);
+
+    __m128 result = _mm_add_ps(qa, _mm_mul_ps(_mm_sub_ps(qb, qa), _mm_set1_ps(t)));
+    __m128 lengthSquared = _mm_mul_ps(result, result);
+    lengthSquared = _mm_add_ps(lengthSquared, _mm_shuffle_ps(lengthSquared, lengthSquared, _MM_SHUFFLE(2, 3, 0, 1)));
+    lengthSquared = _mm_add_ps(lengthSquared, _mm_shuffle_ps(lengthSquared, lengthSquared, _MM_SHUFFLE(1, 0, 3, 2)));
+    result = _mm_div_ps(result, _mm_sqrt_ps(lengthSquared));
+
+    glm::quat q;
+    _mm_storeu_ps(&q.x, result);
+    return q;
+#else
+    glm::quat target = glm::dot(a, b) < 0.0f ? -b : b;
+    return glm::normalize(a + (target - a) * t);
+#endif
+}
+
+// plays animation clips on many copies of the same skeleton. Every update samples the keyframes and walks the node
+// hierarchy for all instances, split into batches that run on the thread pool, and leaves a bone palette per instance.
+// Keys are sampled one instance at a time, a binary search and a lerp or nlerp per track. Only the nlerp and the
+// matrix products use SSE: doing four instances at once needs the keys gathered and turned around, and that costs
+// more than the arithmetic it saves.
+class Animator
+{
+public:
+    struct Instance {
+        glm::mat4 transform;    // placement in the world
+        int clip;               // -1 keeps the bind pose
+        float time;             // in seconds
+        float speed;
+    };
+
+    std::vector<Instance> instances;
+
+    // instances per job, small enough to spread a few hundred characters over all workers
+    static const unsigned int batchSize = 16;
+
+    // the animator refers to the skeleton and clips, they have to stay alive (they normally belong to a Model)
+    Animator(const Skeleton& _skeleton, const std::vector<AnimationClip>& _clips) : skeleton(&_skeleton), clips(&_clips) {}
+
+    // returns the index of the new instance
+    unsigned int addInstance(const glm::mat4& transform, int clip, float time = 0.0f, float speed = 1.0f)
+    {
+        Instance instance;
+        instance.transform = transform;
+        instance.clip = clip < static_cast<int>(clips->size()) ? clip : -1;
+        instance.time = time;
+        instance.speed = speed;
+        instances.push_back(instance);
+        return static_cast<unsigned int>(instances.size() - 1);
+    }
+
+    unsigned int nodeCount() const
+    {
+        return static_cast<unsigned int>(skeleton->parents.size());
+    }
+
+    unsigned int boneCount() const
+    {
+        return static_cast<unsigned int>(skeleton->boneNodes.size());
+    }
+
+    // bone matrices of an instance, in the space of the model. Valid after update.
+    const glm::mat4* palette(unsigned int instance) const
+    {
+        return &palettes[instance * boneCount()];
+    }
+
+    // the animated model space transform of a node
+    const glm::mat4& nodeTransform(unsigned int instance, unsigned int node) const
+    {
+        return globals[instance * nodeCount() + node];
+    }
+
+    // advances every instance and evaluates its pose. Without a pool everything runs on the calling thread.
+    void update(float deltaTime, ThreadPool* pool = nullptr)
+    {
+        for (unsigned int i = 0; i < instances.size(); i++)
+        {
+            Instance& instance = instances[i];
+            if (instance.clip < 0)
+                continue;
+            float duration = (*clips)[instance.clip].duration;
+            instance.time += deltaTime * instance.speed;
+            // loop, also when playing backwards
+            if (duration > 0.0f)
+            {
+                instance.time = std::fmod(instance.time, duration);
+                if (instance.time < 0.0f)
+                    instance.time += duration;
+            }
+        }
+
+        globals.resize(instances.size() * nodeCount());
+        palettes.resize(instances.size() * boneCount());
+
+        unsigned int count = static_cast<unsigned int>(instances.size());
+        if (!pool || count <= batchSize)
+        {
+            evaluate(0, count);
+            return;
+        }
+
+        std::vector<std::future<void>> batches;
+        for (unsigned int begin = 0; begin < count; begin += batchSize)
+        {
+            unsigned int end = std::min(begin + batchSize, count);
+            batches.push_back(pool->async([this, begin, end] { evaluate(begin, end); }));
+        }
+        for (unsigned int i = 0; i < batches.size(); i++)
+            batches[i].wait();
+    }
+
+private:
+    const Skeleton* skeleton;
+    const std::vector<AnimationClip>* clips;
+    // nodeCount model space node transforms per instance, and boneCount bone matrices per instance
+    std::vector<glm::mat4> globals;
+    std::vector<glm::mat4> palettes;
+
+    // index of the last key at or before time
+    static unsigned int findKey(const std::vector<float>& times, float time)
+    {
+        std::vector<float>::const_iterator next = std::upper_bound(times.begin(), times.end(), time);
+        return next == times.begin() ? 0 : static_cast<unsigned int>(next - times.begin() - 1);
+    }
+
+    // how far time is between key and key + 1
+    static float keyFactor(const std::vector<float>& times, unsigned int key, float time)
+    {
+        float length = times[key + 1] - times[key];
+        return length > 0.0f ? glm::clamp((time - times[key]) / length, 0.0f, 1.0f) : 0.0f;
+    }
+
+    static glm::vec3 sample(const std::vector<float>& times, const std::vector<glm::vec3>& values, float time, const glm::vec3& fallback)
+    {
+        if (values.empty())
+            return fallback;
+        unsigned int key = findKey(times, time);
+        if (key + 1 >= values.size())
+            return values[key];
+        float t = keyFactor(times, key, time);
+        return values[key] + (values[key + 1] - values[key]) * t;
+    }
+
+    static glm::quat sample(const std::vector<float>& times, const std::vector<glm::quat>& values, float time)
+    {
+        if (values.empty())
+            return glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        unsigned int key = findKey(times, time);
+        if (key + 1 >= values.size())
+            return values[key];
+        return nlerp(values[key], values[key + 1], keyFactor(times, key, time));
+    }
+
+    // samples the clips and walks the hierarchy for instances [begin, end)
+    void evaluate(unsigned int begin, unsigned int end)
+    {
+        unsigned int nodes = nodeCount();
+        unsigned int bones = boneCount();
+
+        // local transforms of the whole batch, start from the bind pose and overwrite the animated nodes
+        std::vector<glm::mat4> locals((end - begin) * nodes);
+        for (unsigned int i = begin; i < end; i++)
+            std::copy(skeleton->bindTransforms.begin(), skeleton->bindTransforms.end(), locals.begin() + (i - begin) * nodes);
+
+        // channels in the outer loop and instances in the inner one, so the keys of a channel are read once per batch
+        // instead of once per instance. Batches usually hold only one or two different clips.
+        std::vector<int> batchClips;
+        for (unsigned int i = begin; i < end; i++)
+        {
+            if (instances[i].clip >= 0 && std::find(batchClips.begin(), batchClips.end(), instances[i].clip) == batchClips.end())
+                batchClips.push_back(instances[i].clip);
+        }
+        for (unsigned int c = 0; c < batchClips.size(); c++)
+        {
+            const AnimationClip& clip = (*clips)[batchClips[c]];
+            for (unsigned int j = 0; j < clip.channels.size(); j++)
+            {
+                const AnimationChannel& channel = clip.channels[j];
+                if (channel.node < 0 || channel.node >= static_cast<int>(nodes))
+                    continue;
+                for (unsigned int i = begin; i < end; i++)
+                {
+                    if (instances[i].clip != batchClips[c])
+                        continue;
+                    float time = instances[i].time;
+                    glm::vec3 position = sample(channel.positionTimes, channel.positions, time, glm::vec3(0.0f));
+                    glm::quat rotation = sample(channel.rotationTimes, channel.rotations, time);
+                    glm::vec3 scale = sample(channel.scaleTimes, channel.scales, time, glm::vec3(1.0f));
+
+                    // translation * rotation * scale, written out instead of multiplying three matrices
+                    glm::mat4 local = glm::mat4_cast(rotation);
+                    local[0] *= scale.x;
+                    local[1] *= scale.y;
+                    local[2] *= scale.z;
+                    local[3] = glm::vec4(position, 1.0f);
+                    locals[(i - begin) * nodes + channel.node] = local;
+                }
+            }
+        }
+
+        // parents come first, so a single pass builds the model space transforms
+        for (unsigned int i = begin; i < end; i++)
+        {
+            const glm::mat4* local = &locals[(i - begin) * nodes];
+            glm::mat4* global = &globals[i * nodes];
+            for (unsigned int n = 0; n < nodes; n++)
+            {
+                int parent = skeleton->parents[n];
+                if (parent >= 0)
+                    multiplyTransform(global[parent], local[n], global[n]);
+                else
+                    global[n] = local[n];
+            }
+
+            glm::mat4* palette = &palettes[i * bones];
+            for (unsigned int b = 0; b < bones; b++)
+            {
+                int node = skeleton->boneNodes[b];
+                glm::mat4 boneGlobal = node >= 0 ? global[node] : glm::mat4(1.0f);
+                multiplyTransform(boneGlobal, skeleton->boneOffsets[b], palette[b]);
+                multiplyTransform(skeleton->globalInverse, palette[b], palette[b]);
+            }
+        }
+    }
+};
+#endif
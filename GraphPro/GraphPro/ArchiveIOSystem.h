@@ -0,0 +1,83 @@
+#ifndef ARCHIVE_IO_SYSTEM_H
+#define ARCHIVE_IO_SYSTEM_H
+
+#include <cstring>
+#include <string>
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include "AssetArchive.h"
+
+// lets Assimp read the model and everything it references (material libraries, external buffers) through the asset
+// archive, falling back to loose files like every other loader
+class ArchiveIOStream : public Assimp::IOStream
+{
+public:
+    ArchiveIOStream(const AssetData& _asset) : asset(_asset) {}
+
+    size_t Read(void* buffer, size_t size, size_t count)
+    {
+        if (size == 0)
+            return 0;
+        size_t available = (asset.size - position) / size;
+        if (count > available)
+            count = available;
+        memcpy(buffer, asset.data() + position, size * count);
+        position += size * count;
+        return count;
+    }
+
+    size_t Write(const void* /*buffer*/, size_t /*size*/, size_t /*count*/)
+    {
+        return 0;
+    }
+
+    aiReturn Seek(size_t offset, aiOrigin origin)
+    {
+        size_t target = origin == aiOrigin_SET ? offset : origin == aiOrigin_CUR ? position + offset : asset.size + offset;
+        if (target > asset.size)
+            return aiReturn_FAILURE;
+        position = target;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const { return position; }
+    size_t FileSize() const { return asset.size; }
+    void Flush() {}
+
+private:
+    AssetData asset;
+    size_t position = 0;
+};
+
+class ArchiveIOSystem : public Assimp::IOSystem
+{
+public:
+    bool Exists(const char* path) const
+    {
+        return AssetArchive::exists(path);
+    }
+
+    char getOsSeparator() const
+    {
+        return '/';
+    }
+
+    Assimp::IOStream* Open(const char* path, const char* mode = "rb")
+    {
+        // read only, writing isn't something a model loader does
+        if (strchr(mode, 'w') || strchr(mode, 'a'))
+            return nullptr;
+        AssetData asset;
+        if (!AssetArchive::load(path, asset))
+            return nullptr;
+        return new ArchiveIOStream(asset);
+    }
+
+    void Close(Assimp::IOStream* stream)
+    {
+        delete stream;
+    }
+};
+#endif
@@ -0,0 +1,58 @@
+#include "AssetArchive.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+bool AssetArchive::listFiles(const std::string& directory, std::vector<std::string>& files)
+{
+    DWORD attributes = GetFileAttributesA(directory.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY))
+        return false;
+
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((directory + "/*").c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE)
+        return true;
+    do
+    {
+        std::string name = found.cFileName;
+        if (name == "." || name == "..")
+            continue;
+        std::string path = directory + "/" + name;
+        if (!listFiles(path, files))
+            files.push_back(path);
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+    return true;
+}
+
+#else
+
+bool AssetArchive::listFiles(const std::string& directory, std::vector<std::string>& files)
+{
+    DIR* search = opendir(directory.c_str());
+    if (!search)
+        return false;
+
+    while (dirent* found = readdir(search))
+    {
+        std::string name = found->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string path = directory + "/" + name;
+        if (!listFiles(path, files))
+            files.push_back(path);
+    }
+    closedir(search);
+    return true;
+}
+
+#endif
@@ -0,0 +1,438 @@
+#ifndef ASSET_ARCHIVE_H
+#define ASSET_ARCHIVE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Lz4.h"
+#include "MappedFile.h"
+
+// the bytes of one asset. They either point straight into a mapping (a loose file or a stored archive entry) or into
+// a buffer the asset was decompressed to, whichever it is the pointer keeps it alive.
+struct AssetData {
+    std::shared_ptr<void> bytes;
+    size_t size = 0;
+
+    const char* data() const { return static_cast<const char*>(bytes.get()); }
+};
+
+// a single file holding all assets, so a cold start opens and maps one file and reads it front to back instead of
+// seeking between hundreds of small ones.
+//
+// layout, little endian:
+//   header   magic "GPAK", version, entry count, reserved, index offset (64 bit), index size (64 bit)
+//   entries  each starts on a 4K boundary. Stored entries are the file as is. LZ4 entries start with a table of the
+//            compressed size of every 64K chunk, followed by the chunks; a chunk that didn't shrink is kept raw.
+//   index    per entry: path length, path, offset, size, stored size (64 bit each), flags, chunk count
+//
+// Paths are relative to the working directory with forward slashes, the same ones the loaders ask for.
+class AssetArchive
+{
+public:
+    static const uint32_t magic = 0x4B415047;
+    static const uint32_t version = 1;
+    static const size_t alignment = 4096;
+    static const size_t chunkSize = 64 * 1024;
+    static const uint32_t flagLz4 = 1;
+
+    // maps an archive and reads its index, returns false if it isn't one
+    bool open(const std::string& path)
+    {
+        entries.clear();
+        archivePath = path;
+        file = std::make_shared<MappedFile>();
+        if (!file->open(path) || file->size() < headerSize)
+            return false;
+
+        const char* data = file->data();
+        uint32_t entryCount = readValue<uint32_t>(data + 8);
+        uint64_t indexOffset = readValue<uint64_t>(data + 16);
+        uint64_t indexSize = readValue<uint64_t>(data + 24);
+        if (readValue<uint32_t>(data) != magic || readValue<uint32_t>(data + 4) != version
+            || indexOffset > file->size() || indexSize > file->size() - indexOffset)
+        {
+            std::cout << "ERROR::ARCHIVE:: " << path << " is not an asset archive" << std::endl;
+            return false;
+        }
+
+        const char* p = data + indexOffset;
+        const char* end = p + indexSize;
+        for (uint32_t i = 0; i < entryCount; i++)
+        {
+            if (end - p < 4)
+                return false;
+            uint32_t pathLength = readValue<uint32_t>(p);
+            if (static_cast<uint64_t>(end - p) < 4 + pathLength + 32)
+                return false;
+
+            std::string name(p + 4, pathLength);
+            p += 4 + pathLength;
+            Entry entry;
+            entry.offset = readValue<uint64_t>(p);
+            entry.size = readValue<uint64_t>(p + 8);
+            entry.storedSize = readValue<uint64_t>(p + 16);
+            entry.flags = readValue<uint32_t>(p + 24);
+            entry.chunkCount = readValue<uint32_t>(p + 28);
+            p += 32;
+            if (entry.offset > file->size() || entry.storedSize > file->size() - entry.offset)
+                return false;
+            // LZ4 entries have a chunk per chunkSize bytes, unpack relies on that to fill the whole asset
+            if ((entry.flags & flagLz4) && entry.chunkCount != (entry.size + chunkSize - 1) / chunkSize)
+            {
+                std::cout << "ERROR::ARCHIVE:: " << path << " is corrupt" << std::endl;
+                return false;
+            }
+            entries[name] = entry;
+        }
+        return true;
+    }
+
+    bool contains(const std::string& path) const
+    {
+        return entries.count(normalize(path)) != 0;
+    }
+
+    size_t entryCount() const { return entries.size(); }
+
+    const std::string& path() const { return archivePath; }
+
+    // the bytes of an entry. Stored entries aren't copied, LZ4 ones are decompressed into a new buffer.
+    bool read(const std::string& path, AssetData& asset) const
+    {
+        uint64_t offset, storedSize;
+        if (!locate(path, offset, storedSize))
+            return false;
+
+        AssetData stored;
+        stored.bytes = std::shared_ptr<void>(file, const_cast<char*>(file->data() + offset));
+        stored.size = static_cast<size_t>(storedSize);
+        return unpack(path, stored, asset);
+    }
+
+    // where the stored bytes of an entry are in the archive, for readers that fetch them on their own
+    bool locate(const std::string& path, uint64_t& offset, uint64_t& storedSize) const
+    {
+        auto found = entries.find(normalize(path));
+        if (found == entries.end())
+            return false;
+        offset = found->second.offset;
+        storedSize = found->second.storedSize;
+        return true;
+    }
+
+    // turns the stored bytes of an entry into the asset: stored entries are passed on as they are, LZ4 ones are
+    // decompressed into a new buffer
+    bool unpack(const std::string& path, const AssetData& stored, AssetData& asset) const
+    {
+        auto found = entries.find(normalize(path));
+        if (found == entries.end() || stored.size != found->second.storedSize)
+            return false;
+
+        const Entry& entry = found->second;
+        if (!(entry.flags & flagLz4))
+        {
+            asset = stored;
+            return true;
+        }
+        const char* data = stored.data();
+
+        size_t tableSize = entry.chunkCount * sizeof(uint32_t);
+        if (entry.storedSize < tableSize)
+            return false;
+        std::shared_ptr<unsigned char> buffer(new unsigned char[entry.size > 0 ? static_cast<size_t>(entry.size) : 1], [](unsigned char* p) { delete[] p; });
+        const unsigned char* chunk = reinterpret_cast<const unsigned char*>(data) + tableSize;
+        const unsigned char* storedEnd = reinterpret_cast<const unsigned char*>(data) + entry.storedSize;
+        size_t written = 0;
+        for (uint32_t i = 0; i < entry.chunkCount; i++)
+        {
+            size_t compressed = readValue<uint32_t>(data + i * sizeof(uint32_t));
+            size_t remaining = static_cast<size_t>(entry.size) - written;
+            size_t target = remaining < chunkSize ? remaining : chunkSize;
+            if (compressed > static_cast<size_t>(storedEnd - chunk))
+                return false;
+            if (compressed == target)
+                memcpy(buffer.get() + written, chunk, target);
+            else if (!Lz4::decompress(chunk, compressed, buffer.get() + written, target))
+            {
+                std::cout << "ERROR::ARCHIVE:: " << path << " is corrupt" << std::endl;
+                return false;
+            }
+            chunk += compressed;
+            written += target;
+        }
+        if (written != entry.size)
+        {
+            std::cout << "ERROR::ARCHIVE:: " << path << " is corrupt" << std::endl;
+            return false;
+        }
+
+        asset.bytes = buffer;
+        asset.size = static_cast<size_t>(entry.size);
+        return true;
+    }
+
+    // asks the OS to read the whole archive in now, one long sequential read
+    void prefetch() const
+    {
+        if (file)
+            file->prefetch();
+    }
+
+    // mounts the archive everything is loaded from. Call it once at startup, before any loading starts.
+    static bool mount(const std::string& path)
+    {
+        std::shared_ptr<AssetArchive> archive = std::make_shared<AssetArchive>();
+        if (!archive->open(path))
+            return false;
+        archive->prefetch();
+        mounted() = archive;
+        return true;
+    }
+
+    static void unmount()
+    {
+        mounted().reset();
+    }
+
+    // the mounted archive, null when there is none
+    static std::shared_ptr<AssetArchive> current()
+    {
+        return mounted();
+    }
+
+    // reads an asset from the mounted archive, or maps the loose file if it isn't packed
+    static bool load(const std::string& path, AssetData& asset)
+    {
+        const std::shared_ptr<AssetArchive>& archive = mounted();
+        if (archive && archive->read(path, asset))
+            return true;
+
+        std::shared_ptr<MappedFile> loose = std::make_shared<MappedFile>();
+        if (!loose->open(path))
+            return false;
+        // an empty file has no mapping, point at something so the bytes are never null
+        static const char empty = 0;
+        asset.bytes = std::shared_ptr<void>(loose, const_cast<char*>(loose->size() > 0 ? loose->data() : &empty));
+        asset.size = loose->size();
+        return true;
+    }
+
+    static bool exists(const std::string& path)
+    {
+        const std::shared_ptr<AssetArchive>& archive = mounted();
+        if (archive && archive->contains(path))
+            return true;
+        MappedFile loose;
+        return loose.open(path);
+    }
+
+    // forward slashes, no "." or empty segments, ".." folded into the segment before it
+    static std::string normalize(const std::string& path)
+    {
+        std::vector<std::string> segments;
+        size_t start = 0;
+        while (start <= path.size())
+        {
+            size_t end = path.find_first_of("/\\", start);
+            if (end == std::string::npos)
+                end = path.size();
+            std::string segment = path.substr(start, end - start);
+            if (segment == "..")
+            {
+                if (!segments.empty() && segments.back() != "..")
+                    segments.pop_back();
+                else
+                    segments.push_back(segment);
+            }
+            else if (!segment.empty() && segment != ".")
+                segments.push_back(segment);
+            start = end + 1;
+        }
+
+        std::string normalized;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            if (i > 0)
+                normalized += '/';
+            normalized += segments[i];
+        }
+        return normalized;
+    }
+
+    // writes an archive of the given files. With compress set, every entry LZ4 would shrink by at least an eighth is
+    // compressed; already compressed formats like JPEG and PNG don't, and stay stored so they can be read in place.
+    static bool pack(const std::string& archivePath, const std::vector<std::string>& paths, bool compress = true)
+    {
+        FILE* out = fopen(archivePath.c_str(), "wb");
+        if (!out)
+        {
+            std::cout << "could not create " << archivePath << std::endl;
+            return false;
+        }
+
+        std::vector<unsigned char> index;
+        uint64_t offset = headerSize;
+        uint32_t count = 0;
+        uint64_t totalSize = 0, totalStored = 0;
+        bool written = fwrite(std::vector<char>(headerSize, 0).data(), headerSize, 1, out) == 1;
+        for (unsigned int i = 0; i < paths.size() && written; i++)
+        {
+            MappedFile source;
+            if (!source.open(paths[i]))
+            {
+                std::cout << "could not open " << paths[i] << ", skipped" << std::endl;
+                continue;
+            }
+            std::string name = normalize(paths[i]);
+
+            Entry entry;
+            entry.size = source.size();
+            entry.flags = 0;
+            entry.chunkCount = 0;
+            std::vector<unsigned char> packed;
+            if (compress && source.size() > 0)
+                packed = compressChunks(reinterpret_cast<const unsigned char*>(source.data()), source.size(), entry.chunkCount);
+            if (!packed.empty() && packed.size() <= source.size() - source.size() / 8)
+                entry.flags = flagLz4;
+            else
+                entry.chunkCount = 0;
+            entry.storedSize = entry.flags & flagLz4 ? packed.size() : source.size();
+
+            // pad to the next 4K boundary, so stored entries can be handed out page aligned
+            uint64_t aligned = (offset + alignment - 1) / alignment * alignment;
+            std::vector<char> padding(static_cast<size_t>(aligned - offset), 0);
+            if (!padding.empty())
+                written = fwrite(padding.data(), padding.size(), 1, out) == 1;
+            entry.offset = aligned;
+            if (written && entry.storedSize > 0)
+                written = fwrite(entry.flags & flagLz4 ? static_cast<const void*>(packed.data()) : static_cast<const void*>(source.data()), static_cast<size_t>(entry.storedSize), 1, out) == 1;
+            offset = aligned + entry.storedSize;
+
+            appendValue(index, static_cast<uint32_t>(name.size()));
+            index.insert(index.end(), name.begin(), name.end());
+            appendValue(index, entry.offset);
+            appendValue(index, entry.size);
+            appendValue(index, entry.storedSize);
+            appendValue(index, entry.flags);
+            appendValue(index, entry.chunkCount);
+            count++;
+            totalSize += entry.size;
+            totalStored += entry.storedSize;
+        }
+
+        if (written && !index.empty())
+            written = fwrite(index.data(), index.size(), 1, out) == 1;
+
+        std::vector<unsigned char> header;
+        appendValue(header, magic);
+        appendValue(header, version);
+        appendValue(header, count);
+        appendValue(header, static_cast<uint32_t>(0));
+        appendValue(header, offset);
+        appendValue(header, static_cast<uint64_t>(index.size()));
+        if (written)
+            written = fseek(out, 0, SEEK_SET) == 0 && fwrite(header.data(), header.size(), 1, out) == 1;
+        written = fclose(out) == 0 && written;
+
+        if (!written)
+        {
+            std::cout << "could not write " << archivePath << std::endl;
+            remove(archivePath.c_str());
+            return false;
+        }
+        std::cout << "packed " << count << " files, " << totalSize / 1024 << " KB into " << totalStored / 1024 << " KB, " << archivePath << std::endl;
+        return true;
+    }
+
+    // the command line tool: GraphPro --pack-assets <archive> [--store] <files or directories...>
+    // Directories are packed with everything below them. Returns false if the arguments aren't for the packer.
+    static bool run(int argc, char** argv)
+    {
+        if (argc < 2 || strcmp(argv[1], "--pack-assets") != 0)
+            return false;
+        if (argc < 4)
+        {
+            std::cout << "usage: --pack-assets <archive> [--store] <files or directories...>" << std::endl;
+            return true;
+        }
+
+        bool compress = true;
+        std::vector<std::string> paths;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--store") == 0)
+                compress = false;
+            else if (!listFiles(argv[i], paths))
+                paths.push_back(argv[i]);
+        }
+        pack(argv[2], paths, compress);
+        return true;
+    }
+
+    // appends every file below a directory, returns false if the path isn't a directory (AssetArchive.cpp)
+    static bool listFiles(const std::string& directory, std::vector<std::string>& files);
+
+private:
+    static const size_t headerSize = 32;
+
+    struct Entry {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t storedSize;
+        uint32_t flags;
+        uint32_t chunkCount;
+    };
+
+    std::string archivePath;
+    std::shared_ptr<MappedFile> file;
+    std::unordered_map<std::string, Entry> entries;
+
+    static std::shared_ptr<AssetArchive>& mounted()
+    {
+        static std::shared_ptr<AssetArchive> archive;
+        return archive;
+    }
+
+    // the chunk size table followed by the chunks
+    static std::vector<unsigned char> compressChunks(const unsigned char* data, size_t size, uint32_t& chunkCount)
+    {
+        chunkCount = static_cast<uint32_t>((size + chunkSize - 1) / chunkSize);
+        std::vector<unsigned char> table, chunks;
+        for (size_t start = 0; start < size; start += chunkSize)
+        {
+            size_t length = size - start < chunkSize ? size - start : chunkSize;
+            std::vector<unsigned char> compressed = Lz4::compress(data + start, length);
+            // a chunk that doesn't shrink is kept raw, the reader tells by its size
+            if (compressed.size() >= length)
+                chunks.insert(chunks.end(), data + start, data + start + length);
+            else
+                chunks.insert(chunks.end(), compressed.begin(), compressed.end());
+            appendValue(table, static_cast<uint32_t>(std::min(compressed.size(), length)));
+        }
+        table.insert(table.end(), chunks.begin(), chunks.end());
+        return table;
+    }
+
+    template<typename T>
+    static T readValue(const char* p)
+    {
+        T value;
+        memcpy(&value, p, sizeof(T));
+        return value;
+    }
+
+    template<typename T>
+    static void appendValue(std::vector<unsigned char>& out, T value)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+};
+#endif
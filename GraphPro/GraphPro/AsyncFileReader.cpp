@@ -0,0 +1,457 @@
+#include "AsyncFileReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+struct AsyncFileReader::Request {
+    std::string path;
+    uint64_t offset;
+    size_t size;
+    Completion done;
+    std::shared_ptr<unsigned char> buffer;
+    size_t bytesRead = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int file = -1;
+#endif
+#ifdef __linux__
+    iovec target;
+#endif
+};
+
+#ifdef __linux__
+
+// the rings shared with the kernel, mapped the way io_uring_setup describes. Only the ring thread touches them.
+struct AsyncFileReader::Ring {
+    int fd = -1;
+    // written to when requests are queued, a read on it sits in the ring so the thread wakes up for new work
+    int wakeFd = -1;
+    uint64_t wakeValue = 0;
+    iovec wakeTarget;
+
+    unsigned int entries = 0;
+    void* sqMemory = MAP_FAILED;
+    size_t sqMemorySize = 0;
+    void* cqMemory = MAP_FAILED;
+    size_t cqMemorySize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned int* sqHead = nullptr;
+    unsigned int* sqTail = nullptr;
+    unsigned int* sqMask = nullptr;
+    unsigned int* sqArray = nullptr;
+    unsigned int* cqHead = nullptr;
+    unsigned int* cqTail = nullptr;
+    unsigned int* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    unsigned int toSubmit = 0;
+    unsigned int inFlight = 0;
+
+    // queued by read(), taken by the ring thread (guarded by the reader's mutex)
+    std::deque<Request*> pending;
+    // taken from pending, waiting for room in the ring (ring thread only)
+    std::deque<Request*> waiting;
+    bool stopping = false;
+    std::thread thread;
+
+    bool setup(unsigned int depth)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (fd < 0)
+            return false;
+        entries = params.sq_entries;
+
+        sqMemorySize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cqMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        // newer kernels map both rings in one go
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            sqMemorySize = cqMemorySize = std::max(sqMemorySize, cqMemorySize);
+
+        sqMemory = mmap(nullptr, sqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMemory == MAP_FAILED)
+            return false;
+        if (single)
+            cqMemory = sqMemory;
+        else
+        {
+            cqMemory = mmap(nullptr, cqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqMemory == MAP_FAILED)
+                return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return false;
+
+        char* sq = static_cast<char*>(sqMemory);
+        sqHead = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqMemory);
+        cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        return wakeFd >= 0;
+    }
+
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cqMemory != MAP_FAILED && cqMemory != sqMemory)
+            munmap(cqMemory, cqMemorySize);
+        if (sqMemory != MAP_FAILED)
+            munmap(sqMemory, sqMemorySize);
+        if (wakeFd >= 0)
+            close(wakeFd);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // the next free submission entry, cleared. There is always one, at most entries reads are in flight.
+    io_uring_sqe* nextEntry()
+    {
+        unsigned int tail = *sqTail;
+        unsigned int index = tail & *sqMask;
+        io_uring_sqe* entry = &sqes[index];
+        memset(entry, 0, sizeof(*entry));
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+        return entry;
+    }
+
+    void queueRead(int file, iovec* target, uint64_t offset, uint64_t userData)
+    {
+        io_uring_sqe* entry = nextEntry();
+        entry->opcode = IORING_OP_READV;
+        entry->fd = file;
+        entry->off = offset;
+        entry->addr = reinterpret_cast<uint64_t>(target);
+        entry->len = 1;
+        entry->user_data = userData;
+        inFlight++;
+    }
+
+    void queueWake()
+    {
+        wakeTarget.iov_base = &wakeValue;
+        wakeTarget.iov_len = sizeof(wakeValue);
+        queueRead(wakeFd, &wakeTarget, 0, 0);
+    }
+
+    void queueRequest(Request* request)
+    {
+        request->target.iov_base = request->buffer.get() + request->bytesRead;
+        request->target.iov_len = request->size - request->bytesRead;
+        queueRead(request->file, &request->target, request->offset + request->bytesRead, reinterpret_cast<uint64_t>(request));
+    }
+
+    // submits what's queued and waits for at least one completion
+    void submitAndWait()
+    {
+        int submitted;
+        do
+        {
+            submitted = static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+        } while (submitted < 0 && errno == EINTR);
+        if (submitted > 0)
+            toSubmit -= static_cast<unsigned int>(submitted);
+    }
+};
+
+#else
+
+struct AsyncFileReader::Ring {
+};
+
+#endif
+
+AsyncFileReader::AsyncFileReader(ThreadPool& _workers, unsigned int queueDepth) : workers(_workers)
+{
+#ifdef __linux__
+    ring.reset(new Ring());
+    if (!ring->setup(queueDepth))
+    {
+        ring.reset();
+        return;
+    }
+    ring->thread = std::thread([this] { ringLoop(); });
+#endif
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+    wait();
+#ifdef __linux__
+    if (ring)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ring->stopping = true;
+        }
+        uint64_t one = 1;
+        ssize_t written = ::write(ring->wakeFd, &one, sizeof(one));
+        (void)written;
+        ring->thread.join();
+    }
+#endif
+}
+
+void AsyncFileReader::read(const std::string& path, uint64_t offset, size_t size, Completion done)
+{
+    Request* request = new Request();
+    request->path = path;
+    request->offset = offset;
+    request->size = size;
+    request->done = done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        outstanding++;
+    }
+
+#ifdef __linux__
+    if (ring)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ring->pending.push_back(request);
+        }
+        uint64_t one = 1;
+        ssize_t written = ::write(ring->wakeFd, &one, sizeof(one));
+        (void)written;
+        return;
+    }
+#endif
+
+    workers.submit([this, request] {
+        bool ok = openRequest(*request) && readRequest(*request);
+        finish(request, ok);
+    });
+}
+
+void AsyncFileReader::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return outstanding == 0; });
+}
+
+const char* AsyncFileReader::backend() const
+{
+    return ring ? "io_uring" : "thread pool";
+}
+
+void AsyncFileReader::finish(Request* request, bool ok)
+{
+    closeRequest(*request);
+    AssetData data;
+    if (ok)
+    {
+        data.bytes = request->buffer;
+        data.size = request->size;
+    }
+    request->done(ok, data);
+    delete request;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--outstanding == 0)
+        idle.notify_all();
+}
+
+void AsyncFileReader::ringLoop()
+{
+#ifdef __linux__
+    ring->queueWake();
+    while (true)
+    {
+        ring->submitAndWait();
+
+        // completions: finished reads go to the workers, short reads are continued
+        bool woken = false;
+        unsigned int head = *ring->cqHead;
+        unsigned int tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const io_uring_cqe& completion = ring->cqes[head & *ring->cqMask];
+            ring->inFlight--;
+            if (completion.user_data == 0)
+            {
+                woken = true;
+                continue;
+            }
+
+            Request* request = reinterpret_cast<Request*>(completion.user_data);
+            int result = completion.res;
+            if (result == -EINTR || result == -EAGAIN)
+            {
+                ring->queueRequest(request);
+                continue;
+            }
+            if (result > 0)
+                request->bytesRead += static_cast<size_t>(result);
+            if (result > 0 && request->bytesRead < request->size)
+            {
+                ring->queueRequest(request);
+                continue;
+            }
+            // an error, or the file ended early
+            bool ok = request->bytesRead == request->size;
+            workers.submit([this, request, ok] { finish(request, ok); });
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+        if (woken)
+        {
+            std::deque<Request*> arrived;
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                arrived.swap(ring->pending);
+                stopping = ring->stopping;
+            }
+            // the destructor only stops the thread once everything has completed
+            if (stopping && arrived.empty() && ring->waiting.empty() && ring->inFlight == 0)
+                return;
+            ring->queueWake();
+            ring->waiting.insert(ring->waiting.end(), arrived.begin(), arrived.end());
+        }
+
+        // start as many waiting requests as the ring has room for. Opening is blocking but cheap next to the read,
+        // and it's off the threads that asked.
+        while (!ring->waiting.empty() && ring->inFlight < ring->entries)
+        {
+            Request* request = ring->waiting.front();
+            ring->waiting.pop_front();
+            bool opened = openRequest(*request);
+            if (!opened || request->size == 0)
+            {
+                workers.submit([this, request, opened] { finish(request, opened); });
+                continue;
+            }
+            ring->queueRequest(request);
+        }
+    }
+#endif
+}
+
+#ifdef _WIN32
+
+bool AsyncFileReader::openRequest(Request& request)
+{
+    request.file = CreateFileA(request.path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (request.file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(request.file, &fileSize) || request.offset > static_cast<uint64_t>(fileSize.QuadPart))
+        return false;
+    uint64_t available = static_cast<uint64_t>(fileSize.QuadPart) - request.offset;
+    if (request.size == wholeFile)
+        request.size = static_cast<size_t>(available);
+    else if (request.size > available)
+        return false;
+
+    request.buffer.reset(new unsigned char[request.size > 0 ? request.size : 1], [](unsigned char* p) { delete[] p; });
+    return true;
+}
+
+bool AsyncFileReader::readRequest(Request& request)
+{
+    while (request.bytesRead < request.size)
+    {
+        // a positioned read, the handle's file pointer isn't used
+        uint64_t position = request.offset + request.bytesRead;
+        OVERLAPPED at;
+        memset(&at, 0, sizeof(at));
+        at.Offset = static_cast<DWORD>(position);
+        at.OffsetHigh = static_cast<DWORD>(position >> 32);
+        size_t remaining = request.size - request.bytesRead;
+        DWORD length = remaining > 0x40000000 ? 0x40000000 : static_cast<DWORD>(remaining);
+        DWORD read = 0;
+        if (!ReadFile(request.file, request.buffer.get() + request.bytesRead, length, &read, &at) || read == 0)
+            return false;
+        request.bytesRead += read;
+    }
+    return true;
+}
+
+void AsyncFileReader::closeRequest(Request& request)
+{
+    if (request.file != INVALID_HANDLE_VALUE)
+        CloseHandle(request.file);
+    request.file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool AsyncFileReader::openRequest(Request& request)
+{
+    request.file = ::open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (request.file < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(request.file, &info) != 0 || request.offset > static_cast<uint64_t>(info.st_size))
+        return false;
+    uint64_t available = static_cast<uint64_t>(info.st_size) - request.offset;
+    if (request.size == wholeFile)
+        request.size = static_cast<size_t>(available);
+    else if (request.size > available)
+        return false;
+
+    request.buffer.reset(new unsigned char[request.size > 0 ? request.size : 1], [](unsigned char* p) { delete[] p; });
+    return true;
+}
+
+bool AsyncFileReader::readRequest(Request& request)
+{
+    while (request.bytesRead < request.size)
+    {
+        ssize_t result = pread(request.file, request.buffer.get() + request.bytesRead, request.size - request.bytesRead, static_cast<off_t>(request.offset + request.bytesRead));
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+        request.bytesRead += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+void AsyncFileReader::closeRequest(Request& request)
+{
+    if (request.file >= 0)
+        ::close(request.file);
+    request.file = -1;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef ASYNC_FILE_READER_H
+#define ASYNC_FILE_READER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "AssetArchive.h"
+#include "ThreadPool.h"
+
+// reads files without blocking the thread that asks. Requests are queued and batched, and each completion runs on a
+// worker of the pool, so loaders can decode what they read right there.
+//
+// On Linux the reads go through io_uring: one thread opens the files, submits the whole batch with a single syscall
+// and hands the completions to the workers. Where io_uring isn't available (older kernels, sandboxes that block it,
+// Windows) every request becomes a job that does a blocking positioned read on a worker.
+class AsyncFileReader
+{
+public:
+    // done gets false and no bytes if the file can't be opened or read
+    typedef std::function<void(bool, AssetData)> Completion;
+
+    // queueDepth is how many reads io_uring keeps in flight at once
+    AsyncFileReader(ThreadPool& workers, unsigned int queueDepth = 64);
+
+    // waits for every queued read to complete
+    ~AsyncFileReader();
+
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+    // reads size bytes from offset, or everything from offset to the end of the file when size is wholeFile
+    void read(const std::string& path, uint64_t offset, size_t size, Completion done);
+
+    // reads an asset from the mounted archive or the loose file, like AssetArchive::load. Archive entries are read
+    // as one range of the archive and decompressed on the worker.
+    void loadAsset(const std::string& path, Completion done)
+    {
+        std::shared_ptr<AssetArchive> archive = AssetArchive::current();
+        uint64_t offset, storedSize;
+        if (!archive || !archive->locate(path, offset, storedSize))
+        {
+            read(path, 0, wholeFile, done);
+            return;
+        }
+        read(archive->path(), offset, static_cast<size_t>(storedSize), [archive, path, done](bool ok, AssetData stored) {
+            AssetData asset;
+            ok = ok && archive->unpack(path, stored, asset);
+            done(ok, asset);
+        });
+    }
+
+    // blocks until every read queued so far has completed
+    void wait();
+
+    // "io_uring" or "thread pool"
+    const char* backend() const;
+
+    static const size_t wholeFile = ~static_cast<size_t>(0);
+
+private:
+    struct Request;
+    struct Ring;
+
+    ThreadPool& workers;
+    // null when reads fall back to the workers
+    std::unique_ptr<Ring> ring;
+
+    std::mutex mutex;
+    std::condition_variable idle;
+    unsigned int outstanding = 0;
+
+    void ringLoop();
+    void finish(Request* request, bool ok);
+
+    // platform parts, blocking
+    static bool openRequest(Request& request);
+    static bool readRequest(Request& request);
+    static void closeRequest(Request& request);
+};
+#endif
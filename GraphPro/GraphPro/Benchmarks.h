@@ -0,0 +1,378 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FrustumCulling.h"
+#include "ImageDecoder.h"
+#include "MappedFile.h"
+#include "mesh.h"
+#include "ObjLoader.h"
+#include "OcclusionCuller.h"
+#include "ThreadPool.h"
+
+// micro-benchmarks and checks that can be run from the command line instead of starting the renderer, e.g.
+//   GraphPro --bench-obj "models/obj/wooden watch tower2.obj"
+//   GraphPro --bench-decode textures/dirt.jpg textures/grass.png
+//   GraphPro --bench-cull
+//   GraphPro --bench-occlusion
+//   GraphPro --check-obj
+// none of them need a GL context.
+
+typedef std::chrono::high_resolution_clock BenchmarkClock;
+
+inline double millisecondsSince(BenchmarkClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+// parses an obj file with Assimp (same flags and vertex conversion as Model) and with ObjLoader, and prints the average times
+void benchmarkObjImport(const std::string& path, int iterations = 5)
+{
+    double assimpTime = 0.0, nativeTime = 0.0;
+    size_t assimpVertices = 0, nativeVertices = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        if (!scene)
+        {
+            std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+            return;
+        }
+        assimpVertices = 0;
+        for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+        {
+            const aiMesh* mesh = scene->mMeshes[m];
+            std::vector<Vertex> vertices(mesh->mNumVertices);
+            for (unsigned int v = 0; v < mesh->mNumVertices; v++)
+            {
+                vertices[v].Position = glm::vec3(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z);
+                vertices[v].Normal = glm::vec3(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z);
+                if (mesh->mTextureCoords[0])
+                {
+                    vertices[v].TexCoords = glm::vec2(mesh->mTextureCoords[0][v].x, mesh->mTextureCoords[0][v].y);
+                    vertices[v].Tangent = glm::vec3(mesh->mTangents[v].x, mesh->mTangents[v].y, mesh->mTangents[v].z);
+                    vertices[v].Bitangent = glm::vec3(mesh->mBitangents[v].x, mesh->mBitangents[v].y, mesh->mBitangents[v].z);
+                }
+            }
+            std::vector<unsigned int> indices;
+            indices.reserve(mesh->mNumFaces * 3);
+            for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+                indices.insert(indices.end(), mesh->mFaces[f].mIndices, mesh->mFaces[f].mIndices + mesh->mFaces[f].mNumIndices);
+            assimpVertices += vertices.size();
+        }
+        assimpTime += millisecondsSince(start);
+
+        start = BenchmarkClock::now();
+        std::vector<ObjLoader::Group> groups;
+        std::vector<ObjLoader::Material> materials;
+        if (!ObjLoader::load(path, groups, materials))
+            return;
+        nativeVertices = 0;
+        for (unsigned int g = 0; g < groups.size(); g++)
+            nativeVertices += groups[g].vertices.size();
+        nativeTime += millisecondsSince(start);
+    }
+
+    std::cout << "obj import of " << path << ", average of " << iterations << " runs" << std::endl;
+    std::cout << "  assimp:    " << assimpTime / iterations << " ms, " << assimpVertices << " vertices" << std::endl;
+    std::cout << "  ObjLoader: " << nativeTime / iterations << " ms, " << nativeVertices << " vertices" << std::endl;
+}
+
+// writes an obj that is split into two chunks right before a usemtl, loads it and checks that the faces of the second
+// chunk get the material it switches to. Prints whether they did and returns it.
+bool checkObjChunkMaterials()
+{
+    const char* objPath = "./obj_chunk_check.obj";
+    const char* mtlPath = "./obj_chunk_check.mtl";
+    {
+        std::ofstream mtl(mtlPath);
+        mtl << "newmtl first\nnewmtl second\n";
+    }
+
+    // the first half ends with the usemtl, the second half is enough faces that the file is worth two chunks
+    const size_t secondFaces = ObjLoader::minChunkSize / 8 + 1;
+    std::string second;
+    for (size_t i = 0; i < secondFaces; i++)
+        second += "f 1 2 3\n";
+    std::string first = "mtllib obj_chunk_check.mtl\nv 0 0 0\nv 1 0 0\nv 0 1 0\nusemtl first\nf 1 2 3\nusemtl second\n";
+    // pad the first half so that the middle of the file is its last line break, the chunk ends right there
+    first = "#" + std::string(second.size() + 2 - first.size() - 2, ' ') + "\n" + first;
+    {
+        std::ofstream obj(objPath, std::ios::binary);
+        obj << first << second;
+    }
+
+    std::vector<ObjLoader::Group> groups;
+    std::vector<ObjLoader::Material> materials;
+    bool loaded = ObjLoader::load(objPath, groups, materials, 2);
+    std::remove(objPath);
+    std::remove(mtlPath);
+
+    size_t firstFaces = 0, secondFound = 0;
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        if (groups[g].material < 0)
+            continue;
+        size_t faces = groups[g].indices.size() / 3;
+        if (materials[groups[g].material].name == "first")
+            firstFaces += faces;
+        else if (materials[groups[g].material].name == "second")
+            secondFound += faces;
+    }
+    bool passed = loaded && firstFaces == 1 && secondFound == secondFaces;
+    std::cout << "obj usemtl at a chunk boundary: " << firstFaces << " + " << secondFound << " faces, "
+              << (passed ? "ok" : "FAILED") << std::endl;
+    return passed;
+}
+
+// decodes each image with every backend that accepts it and prints the average times. The file is mapped and touched
+// once up front, so only decoding is measured.
+void benchmarkImageDecode(const std::vector<std::string>& paths, int iterations = 5)
+{
+    const std::vector<std::shared_ptr<ImageDecoder>>& backends = ImageDecoder::backends();
+    for (unsigned int p = 0; p < paths.size(); p++)
+    {
+        MappedFile file;
+        if (!file.open(paths[p]) || file.size() == 0)
+        {
+            std::cout << "could not open " << paths[p] << std::endl;
+            continue;
+        }
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(file.data());
+        volatile unsigned char checksum = 0;
+        for (size_t i = 0; i < file.size(); i += 4096)
+            checksum ^= bytes[i];
+
+        std::cout << paths[p] << " (" << file.size() / 1024 << " KB), average of " << iterations << " runs" << std::endl;
+        for (unsigned int b = 0; b < backends.size(); b++)
+        {
+            if (!backends[b]->accepts(bytes, file.size()))
+                continue;
+            double time = 0.0;
+            DecodedImage image;
+            bool decoded = true;
+            for (int i = 0; i < iterations && decoded; i++)
+            {
+                BenchmarkClock::time_point start = BenchmarkClock::now();
+                decoded = backends[b]->decode(bytes, file.size(), 0, image);
+                time += millisecondsSince(start);
+            }
+            if (!decoded)
+            {
+                std::cout << "  " << backends[b]->name() << ": failed" << std::endl;
+                continue;
+            }
+            double megapixels = static_cast<double>(image.width) * image.height / 1e6;
+            std::cout << "  " << backends[b]->name() << ": " << time / iterations << " ms, " << image.width << "x" << image.height << "x" << image.channels
+                      << ", " << megapixels / (time / iterations / 1000.0) << " MP/s" << std::endl;
+        }
+    }
+}
+
+// tests a million random boxes against a camera frustum, one box at a time with Frustum::intersectsAABB and in batches
+// with FrustumCulling, and prints the average times. The boxes are spread around the camera so about a quarter of them
+// are visible.
+void benchmarkFrustumCulling(size_t count = 1000000, int iterations = 20)
+{
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> position(-2000.0f, 2000.0f);
+    std::uniform_real_distribution<float> size(0.5f, 20.0f);
+    std::vector<glm::vec3> mins(count), maxs(count);
+    BoxArray boxes;
+    boxes.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 center(position(random), position(random) * 0.1f, position(random));
+        glm::vec3 extent(size(random), size(random), size(random));
+        mins[i] = center - extent;
+        maxs[i] = center + extent;
+        boxes.set(i, mins[i], maxs[i]);
+    }
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 4000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 50.0f, 0.0f), glm::vec3(1.0f, 50.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum(projection * view);
+
+    double scalarTime = 0.0, batchTime = 0.0;
+    size_t scalarVisible = 0, batchVisible = 0;
+    std::vector<uint32_t> scalarList, batchList;
+    for (int i = 0; i < iterations; i++)
+    {
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        scalarList.clear();
+        for (size_t b = 0; b < count; b++)
+        {
+            if (frustum.intersectsAABB(mins[b], maxs[b]))
+                scalarList.push_back(static_cast<uint32_t>(b));
+        }
+        scalarTime += millisecondsSince(start);
+        scalarVisible = scalarList.size();
+
+        start = BenchmarkClock::now();
+        batchVisible = FrustumCulling::cullBoxes(frustum, boxes, batchList);
+        batchTime += millisecondsSince(start);
+    }
+
+    // the two tests only round differently, boxes right on a plane may come out either way
+    size_t differences = 0;
+    for (size_t a = 0, b = 0; a < scalarList.size() || b < batchList.size();)
+    {
+        if (b == batchList.size() || (a < scalarList.size() && scalarList[a] < batchList[b]))
+            a++;
+        else if (a == scalarList.size() || batchList[b] < scalarList[a])
+            b++;
+        else
+        {
+            a++;
+            b++;
+            continue;
+        }
+        differences++;
+    }
+
+#if defined(CULLING_AVX)
+    const char* kernel = "AVX";
+#elif defined(CULLING_SSE)
+    const char* kernel = "SSE";
+#else
+    const char* kernel = "scalar";
+#endif
+    std::cout << "frustum culling of " << count << " boxes, average of " << iterations << " runs" << std::endl;
+    std::cout << "  Frustum::intersectsAABB:  " << scalarTime / iterations << " ms, " << scalarVisible << " visible" << std::endl;
+    std::cout << "  FrustumCulling (" << kernel << "): " << batchTime / iterations << " ms, " << batchVisible << " visible, "
+              << count / (batchTime / iterations / 1000.0) / 1e6 << " M boxes/s, " << differences << " differ" << std::endl;
+}
+
+// rasterizes a field of rolling hills into an OcclusionCuller on one thread and on a pool, and tests boxes standing
+// on the hills against it. Prints the average times, how many boxes were hidden and whether both buffers came out
+// the same.
+void benchmarkOcclusionCulling(size_t count = 20000, int iterations = 50)
+{
+    // 128 x 128 quads, 10 units apart, about the size of the terrain's occluder
+    const int quads = 128;
+    const float spacing = 10.0f;
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    auto hillHeight = [](float x, float z) { return 40.0f * std::sin(x * 0.01f) * std::cos(z * 0.013f) + 20.0f * std::sin(x * 0.031f + z * 0.017f); };
+    for (int z = 0; z <= quads; z++)
+    {
+        for (int x = 0; x <= quads; x++)
+            vertices.push_back(glm::vec3(x * spacing - 640.0f, hillHeight(x * spacing, z * spacing), z * spacing - 640.0f));
+    }
+    for (uint32_t z = 0; z < quads; z++)
+    {
+        for (uint32_t x = 0; x < quads; x++)
+        {
+            uint32_t vertex = z * (quads + 1) + x;
+            indices.insert(indices.end(), { vertex, vertex + quads + 1, vertex + quads + 2, vertex, vertex + quads + 2, vertex + 1 });
+        }
+    }
+
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> position(-640.0f, 640.0f);
+    std::vector<glm::vec3> mins(count), maxs(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        float x = position(random), z = position(random);
+        float ground = hillHeight(x + 640.0f, z + 640.0f);
+        mins[i] = glm::vec3(x - 2.0f, ground, z - 2.0f);
+        maxs[i] = glm::vec3(x + 2.0f, ground + 8.0f, z + 2.0f);
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 4000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(-600.0f, 40.0f, -600.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 viewProjection = projection * view;
+
+    ThreadPool pool;
+    OcclusionCuller single(320, 180), threaded(320, 180);
+    single.addOccluder(vertices, indices);
+    threaded.addOccluder(vertices, indices);
+
+    double singleTime = 0.0, threadedTime = 0.0, testTime = 0.0;
+    size_t hidden = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        single.render(viewProjection);
+        singleTime += millisecondsSince(start);
+
+        start = BenchmarkClock::now();
+        threaded.render(viewProjection, &pool);
+        threadedTime += millisecondsSince(start);
+
+        start = BenchmarkClock::now();
+        hidden = 0;
+        for (size_t b = 0; b < count; b++)
+            hidden += threaded.visible(mins[b], maxs[b]) ? 0 : 1;
+        testTime += millisecondsSince(start);
+    }
+
+#if defined(OCCLUSION_SSE)
+    const char* kernel = "SSE";
+#else
+    const char* kernel = "scalar";
+#endif
+    std::cout << "occlusion culling, " << indices.size() / 3 << " occluder triangles into " << threaded.bufferWidth() << "x" << threaded.bufferHeight()
+              << " (" << kernel << "), average of " << iterations << " runs" << std::endl;
+    std::cout << "  render, 1 thread:  " << singleTime / iterations << " ms" << std::endl;
+    std::cout << "  render, " << pool.size() << " workers: " << threadedTime / iterations << " ms, buffers "
+              << (single.buffer() == threaded.buffer() ? "match" : "differ") << std::endl;
+    std::cout << "  test " << count << " boxes: " << testTime / iterations << " ms, " << hidden << " hidden" << std::endl;
+}
+
+// runs the benchmark asked for on the command line. Returns false if there was none, so the renderer should start.
+bool runBenchmarks(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--bench-obj") == 0)
+        {
+            benchmarkObjImport(i + 1 < argc ? argv[i + 1] : "models/obj/wooden watch tower2.obj");
+            return true;
+        }
+        if (std::strcmp(argv[i], "--check-obj") == 0)
+        {
+            checkObjChunkMaterials();
+            return true;
+        }
+        if (std::strcmp(argv[i], "--bench-decode") == 0)
+        {
+            std::vector<std::string> paths(argv + i + 1, argv + argc);
+            // the bundled textures: JPEG color maps and PNGs of every channel count
+            if (paths.empty())
+                paths = { "textures/dirt.jpg", "textures/rock.jpg", "textures/sand.jpg", "textures/snow.jpg", "models/obj/textures/Wood_Tower_Col.jpg",
+                          "models/obj/textures/Wood_Tower_Nor.jpg", "textures/grass.png", "textures/container2.png", "textures/brick_normal.png", "textures/Heightmap2.png" };
+            benchmarkImageDecode(paths);
+            return true;
+        }
+        if (std::strcmp(argv[i], "--bench-cull") == 0)
+        {
+            benchmarkFrustumCulling();
+            return true;
+        }
+        if (std::strcmp(argv[i], "--bench-occlusion") == 0)
+        {
+            benchmarkOcclusionCulling();
+            return true;
+        }
+    }
+    return false;
+}
+#endif
@@ -0,0 +1,60 @@
+#ifndef COMPRESSED_IMAGE_H
+#define COMPRESSED_IMAGE_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <memory>
+
+// S3TC isn't core, but every desktop driver has it. The enums come from EXT_texture_compression_s3tc.
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// a block-compressed image with its whole mip chain. The levels are stored back to back, biggest first,
+// exactly the way they're passed to glCompressedTexImage2D.
+struct CompressedImage {
+    GLenum format = 0;      // BC1 (DXT1), BC3 (DXT5) or BC5 (RGTC2)
+    int width = 0, height = 0;
+    int levels = 0;
+    std::shared_ptr<void> data;
+    size_t size = 0;
+
+    bool valid() const
+    {
+        return format != 0 && data && levels > 0;
+    }
+
+    // bytes per 4x4 block
+    static size_t blockBytes(GLenum format)
+    {
+        return format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+    }
+
+    static int levelDimension(int size, int level)
+    {
+        return std::max(1, size >> level);
+    }
+
+    static size_t levelSize(GLenum format, int width, int height)
+    {
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+    }
+
+    size_t levelSize(int level) const
+    {
+        return levelSize(format, levelDimension(width, level), levelDimension(height, level));
+    }
+
+    size_t levelOffset(int level) const
+    {
+        size_t offset = 0;
+        for (int i = 0; i < level; i++)
+            offset += levelSize(i);
+        return offset;
+    }
+};
+#endif
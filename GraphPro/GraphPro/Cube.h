@@ -8,6 +8,9 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.h"
+#include "Shader.h"
+#include "GLState.h"
+#include "FrameUniforms.h"
 
 class Cube
 {
@@ -17,59 +20,56 @@ class Cube
     int boxSize, boxIndexCount;
     GLuint tex, normal, specular;
     glm::vec3 cubePosition;
+    Sampler mainTex, normalTex, specularTex;
+    //the program may still be compiling, its handles are looked up before the first draw
+    const Shader* shader;
+    bool resolved = false;
+
+    bool resolveUniforms() {
+        if (resolved) return true;
+        if (!shader->ready()) return false;
+        program = shader->id;
+        mainTex = shader->sampler("mainTex");
+        normalTex = shader->sampler("normalTex");
+        specularTex = shader->sampler("specularTex");
+        resolved = true;
+        return true;
+    }
 
     public:
-    Cube(GLuint& _program, glm::vec3 _position , GLuint _tex, GLuint _normal, GLuint _specular) {
+    Cube(const Shader& _program, glm::vec3 _position , GLuint _tex, GLuint _normal, GLuint _specular) {
         createGeometry(VAO, EBO, boxSize, boxIndexCount);
-        program = _program;
+        shader = &_program;
         tex = _tex;
         normal = _normal;
         specular = _specular;
         cubePosition = _position;
     }
 
-    Cube(GLuint& _program, glm::vec3 _position , GLuint _tex, GLuint _normal) {
+    Cube(const Shader& _program, glm::vec3 _position , GLuint _tex, GLuint _normal) {
         createGeometry(VAO, EBO, boxSize, boxIndexCount);
-        program = _program;
+        shader = &_program;
         tex = _tex;
         normal = _normal;
+        specular = 0;
         cubePosition = _position;
     }
 
-    void renderCube(Camera _cam, glm::vec3 _lightDir, glm::mat4 _projection) {
-        
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-
-        glCullFace(GL_BACK);
-
-        glUseProgram(program);
+    //the camera, projection and light come from the frame uniforms
+    void renderCube(FrameUniforms& _frame) {
+        if (!resolveUniforms()) return;
 
-        //set texture channels
-        glUniform1i(glGetUniformLocation(program, "mainTex"), 0);
-        glUniform1i(glGetUniformLocation(program, "normalTex"), 1);
-        glUniform1i(glGetUniformLocation(program, "specularTex"), 2);
+        GLState& state = GLState::get();
+        state.enable(GL_DEPTH_TEST);
+        state.enable(GL_CULL_FACE);
+        state.cullFace(GL_BACK);
 
-        //matrices
-        glm::mat4 world = glm::mat4(1.0f);
-        world = glm::rotate(world, glm::radians(45.0f), glm::vec3(0, 1, 0));
-        world = glm::scale(world, glm::vec3(1, 1, 1));
-        world = glm::translate(world, _cam.Position);
-
-        glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
-        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(_cam.GetViewMatrix()));
-        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(_projection));
-
-        glUniform3fv(glGetUniformLocation(program, "lightPosition"), 1, glm::value_ptr(_lightDir));
-        glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(_cam.Position));
+        state.useProgram(program);
 
         //bind textures
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tex);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, normal);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, specular);
+        mainTex.bind(tex);
+        normalTex.bind(normal);
+        specularTex.bind(specular);
 
         //// create transformations
         glm::mat4 transform = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
@@ -77,12 +77,9 @@ class Cube
         //transform = glm::rotate(transform, (float)glfwGetTime(), glm::vec3(0.0f, 0.0f, 1.0f));
 
         // get matrix's uniform location and set matrix
-        glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(transform));
-        glBindVertexArray(VAO);
+        _frame.setWorld(transform);
+        state.bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, boxIndexCount, GL_UNSIGNED_INT, 0);
-
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
     }
 
     void createGeometry(GLuint& VAO, GLuint& EBO, int& size, int& numIndices)
@@ -156,7 +153,7 @@ class Cube
         //referentie naar de vertex array
         glGenVertexArrays(1, &VAO);
         //configuratie id, binding
-        glBindVertexArray(VAO);
+        GLState::get().bindVertexArray(VAO);
 
         GLuint VBO;
         glGenBuffers(1, &VBO);
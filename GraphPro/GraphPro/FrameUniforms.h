@@ -0,0 +1,87 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "camera.h"
+#include "GLState.h"
+#include "UniformRing.h"
+
+// the uniforms every program shares. The Frame block (camera, projection and light) is written once per frame into a
+// single buffer, the Object block (the world matrix) comes from a ring with a slot per draw. Both sit at fixed binding
+// points, a program only has to have its blocks bound to them once, which Shader::bindBlock does when it's created.
+//
+// The blocks as the shaders declare them:
+//   layout(std140) uniform Frame { mat4 view; mat4 projection; mat4 viewProjection; vec3 cameraPosition; vec3 lightPosition; };
+//   layout(std140) uniform Object { mat4 world; };
+class FrameUniforms
+{
+public:
+    static const unsigned int FRAME_BLOCK_BINDING = 0;
+    // 1 is the material table of Model
+    static const unsigned int OBJECT_BLOCK_BINDING = 2;
+
+    // the Frame block in std140 layout, a vec3 takes 16 bytes when another vec3 follows it
+    struct Data {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        glm::vec3 cameraPosition;
+        float padding0;
+        glm::vec3 lightPosition;
+        float padding1;
+    };
+
+    FrameUniforms() : objects(sizeof(glm::mat4))
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    ~FrameUniforms()
+    {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // fills the Frame block, the view matrix is made once here for everything drawn this frame
+    void update(const Camera& camera, const glm::mat4& projection, const glm::vec3& lightPosition)
+    {
+        data.view = camera.GetViewMatrix();
+        data.projection = projection;
+        data.viewProjection = projection * data.view;
+        data.cameraPosition = camera.Position;
+        data.padding0 = 0.0f;
+        data.lightPosition = lightPosition;
+        data.padding1 = 0.0f;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        // orphan, the previous frame's draws might still read the old values
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Data), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        GLState::get().bindUniformBuffer(FRAME_BLOCK_BINDING, buffer);
+
+        objects.beginFrame();
+    }
+
+    // the world matrix of the next draw
+    void setWorld(const glm::mat4& world)
+    {
+        objects.bind(OBJECT_BLOCK_BINDING, &world, sizeof(world));
+    }
+
+    const glm::mat4& view() const { return data.view; }
+    const glm::mat4& projection() const { return data.projection; }
+    const glm::mat4& viewProjection() const { return data.viewProjection; }
+    const glm::vec3& cameraPosition() const { return data.cameraPosition; }
+
+private:
+    GLuint buffer = 0;
+    Data data;
+    UniformRing objects;
+};
+#endif
@@ -0,0 +1,62 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// the six clip planes of a camera, stored as (normal, distance) with the normals pointing inwards
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum() {}
+
+    Frustum(const glm::mat4& viewProjection)
+    {
+        extract(viewProjection);
+    }
+
+    // extracts the planes from a (projection * view) matrix, see Gribb & Hartmann
+    void extract(const glm::mat4& m)
+    {
+        // glm is column-major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        planes[0] = row3 + row0;  // left
+        planes[1] = row3 - row0;  // right
+        planes[2] = row3 + row1;  // bottom
+        planes[3] = row3 - row1;  // top
+        planes[4] = row3 + row2;  // near
+        planes[5] = row3 - row2;  // far
+
+        // normalize so the distance to a plane is in world units
+        for (int i = 0; i < 6; i++)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+
+    // returns false if the sphere lies completely outside one of the planes
+    bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    // returns false if the box lies completely outside one of the planes
+    bool intersectsAABB(const glm::vec3& min, const glm::vec3& max) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            // test the corner that lies furthest along the plane normal
+            glm::vec3 positive(planes[i].x > 0 ? max.x : min.x, planes[i].y > 0 ? max.y : min.y, planes[i].z > 0 ? max.z : min.z);
+            if (glm::dot(glm::vec3(planes[i]), positive) + planes[i].w < 0)
+                return false;
+        }
+        return true;
+    }
+};
+#endif
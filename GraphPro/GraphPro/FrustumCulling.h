@@ -0,0 +1,289 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.h"
+
+// SSE is always there on x64, and on x86 when the compiler is allowed to use it. AVX only when the compiler targets
+// it (/arch:AVX or -mavx), then eight bounds are tested at a time instead of four.
+#if defined(__AVX__)
+#define CULLING_AVX 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// axis aligned boxes as center and half extent, one array per component, so the culling kernel loads the same
+// component of several boxes with one instruction. The arrays are padded to a multiple of the widest batch, the padding
+// is never reported visible.
+struct BoxArray {
+    std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    void clear()
+    {
+        resize(0);
+    }
+
+    void resize(size_t n)
+    {
+        count = n;
+        size_t padded = (n + BATCH - 1) / BATCH * BATCH;
+        centerX.resize(padded);
+        centerY.resize(padded);
+        centerZ.resize(padded);
+        extentX.resize(padded);
+        extentY.resize(padded);
+        extentZ.resize(padded);
+    }
+
+    void set(size_t i, const glm::vec3& min, const glm::vec3& max)
+    {
+        glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        extentX[i] = extent.x;
+        extentY[i] = extent.y;
+        extentZ[i] = extent.z;
+    }
+
+    // a box moved by a transform, as the box around the moved box. The extent goes through the absolute values of the
+    // matrix, see Arvo, "Transforming axis-aligned bounding boxes".
+    void set(size_t i, const glm::mat4& transform, const glm::vec3& min, const glm::vec3& max)
+    {
+        glm::vec3 center = glm::vec3(transform * glm::vec4((min + max) * 0.5f, 1.0f));
+        glm::vec3 extent = (max - min) * 0.5f;
+        glm::mat3 absolute(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+        extent = absolute * extent;
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        extentX[i] = extent.x;
+        extentY[i] = extent.y;
+        extentZ[i] = extent.z;
+    }
+
+    void push(const glm::vec3& min, const glm::vec3& max)
+    {
+        resize(count + 1);
+        set(count - 1, min, max);
+    }
+
+    // the widest batch the kernel tests
+    static const size_t BATCH = 8;
+
+private:
+    size_t count = 0;
+};
+
+// spheres the same way, center and radius
+struct SphereArray {
+    std::vector<float> centerX, centerY, centerZ, radius;
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    void clear()
+    {
+        resize(0);
+    }
+
+    void resize(size_t n)
+    {
+        count = n;
+        size_t padded = (n + BoxArray::BATCH - 1) / BoxArray::BATCH * BoxArray::BATCH;
+        centerX.resize(padded);
+        centerY.resize(padded);
+        centerZ.resize(padded);
+        radius.resize(padded);
+    }
+
+    void set(size_t i, const glm::vec3& center, float r)
+    {
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        radius[i] = r;
+    }
+
+    void push(const glm::vec3& center, float r)
+    {
+        resize(count + 1);
+        set(count - 1, center, r);
+    }
+
+private:
+    size_t count = 0;
+};
+
+// tests whole arrays of bounds against the six planes of a frustum and lists the ones that aren't completely outside
+// any of them. Same answers as Frustum::intersectsAABB and intersectsSphere, but without a branch per plane: every
+// plane is tested, and a batch of four (SSE) or eight (AVX) bounds goes through each test together. A box is outside a
+// plane when the corner furthest along the normal is, that's when dot(n, center) + dot(|n|, extent) + d < 0.
+class FrustumCulling
+{
+public:
+    // writes the indices of the visible boxes to visible, returns how many there are
+    static size_t cullBoxes(const Frustum& frustum, const BoxArray& boxes, std::vector<uint32_t>& visible)
+    {
+        size_t count = boxes.size();
+        visible.resize(count + BoxArray::BATCH);
+        size_t n = 0, i = 0;
+#if defined(CULLING_AVX)
+        __m256 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+        for (int p = 0; p < 6; p++)
+        {
+            nx[p] = _mm256_set1_ps(frustum.planes[p].x);
+            ny[p] = _mm256_set1_ps(frustum.planes[p].y);
+            nz[p] = _mm256_set1_ps(frustum.planes[p].z);
+            ax[p] = _mm256_set1_ps(glm::abs(frustum.planes[p].x));
+            ay[p] = _mm256_set1_ps(glm::abs(frustum.planes[p].y));
+            az[p] = _mm256_set1_ps(glm::abs(frustum.planes[p].z));
+            d[p] = _mm256_set1_ps(frustum.planes[p].w);
+        }
+        const __m256 zero = _mm256_setzero_ps();
+        for (; i < count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]), cy = _mm256_loadu_ps(&boxes.centerY[i]), cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]), ey = _mm256_loadu_ps(&boxes.extentY[i]), ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+            __m256 outside = zero;
+            for (int p = 0; p < 6; p++)
+            {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy)), _mm256_add_ps(_mm256_mul_ps(nz[p], cz), d[p]));
+                __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_LT_OQ));
+            }
+            n = append(~_mm256_movemask_ps(outside) & 0xFF, i, 8, count, &visible[0], n);
+        }
+#elif defined(CULLING_SSE)
+        __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+        for (int p = 0; p < 6; p++)
+        {
+            nx[p] = _mm_set1_ps(frustum.planes[p].x);
+            ny[p] = _mm_set1_ps(frustum.planes[p].y);
+            nz[p] = _mm_set1_ps(frustum.planes[p].z);
+            ax[p] = _mm_set1_ps(glm::abs(frustum.planes[p].x));
+            ay[p] = _mm_set1_ps(glm::abs(frustum.planes[p].y));
+            az[p] = _mm_set1_ps(glm::abs(frustum.planes[p].z));
+            d[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        const __m128 zero = _mm_setzero_ps();
+        for (; i < count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&boxes.centerX[i]), cy = _mm_loadu_ps(&boxes.centerY[i]), cz = _mm_loadu_ps(&boxes.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&boxes.extentX[i]), ey = _mm_loadu_ps(&boxes.extentY[i]), ez = _mm_loadu_ps(&boxes.extentZ[i]);
+            __m128 outside = zero;
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), d[p]));
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+            }
+            n = append(~_mm_movemask_ps(outside) & 0xF, i, 4, count, &visible[0], n);
+        }
+#else
+        for (; i < count; i++)
+        {
+            bool inside = true;
+            for (int p = 0; p < 6; p++)
+            {
+                const glm::vec4& plane = frustum.planes[p];
+                float distance = plane.x * boxes.centerX[i] + plane.y * boxes.centerY[i] + plane.z * boxes.centerZ[i] + plane.w;
+                float reach = glm::abs(plane.x) * boxes.extentX[i] + glm::abs(plane.y) * boxes.extentY[i] + glm::abs(plane.z) * boxes.extentZ[i];
+                inside = inside && distance + reach >= 0.0f;
+            }
+            visible[n] = static_cast<uint32_t>(i);
+            n += inside ? 1 : 0;
+        }
+#endif
+        visible.resize(n);
+        return n;
+    }
+
+    // the same for spheres, which are outside a plane when dot(n, center) + d < -radius
+    static size_t cullSpheres(const Frustum& frustum, const SphereArray& spheres, std::vector<uint32_t>& visible)
+    {
+        size_t count = spheres.size();
+        visible.resize(count + BoxArray::BATCH);
+        size_t n = 0, i = 0;
+#if defined(CULLING_AVX)
+        __m256 nx[6], ny[6], nz[6], d[6];
+        for (int p = 0; p < 6; p++)
+        {
+            nx[p] = _mm256_set1_ps(frustum.planes[p].x);
+            ny[p] = _mm256_set1_ps(frustum.planes[p].y);
+            nz[p] = _mm256_set1_ps(frustum.planes[p].z);
+            d[p] = _mm256_set1_ps(frustum.planes[p].w);
+        }
+        for (; i < count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&spheres.centerX[i]), cy = _mm256_loadu_ps(&spheres.centerY[i]), cz = _mm256_loadu_ps(&spheres.centerZ[i]);
+            __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&spheres.radius[i]));
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++)
+            {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy)), _mm256_add_ps(_mm256_mul_ps(nz[p], cz), d[p]));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, negativeRadius, _CMP_LT_OQ));
+            }
+            n = append(~_mm256_movemask_ps(outside) & 0xFF, i, 8, count, &visible[0], n);
+        }
+#elif defined(CULLING_SSE)
+        __m128 nx[6], ny[6], nz[6], d[6];
+        for (int p = 0; p < 6; p++)
+        {
+            nx[p] = _mm_set1_ps(frustum.planes[p].x);
+            ny[p] = _mm_set1_ps(frustum.planes[p].y);
+            nz[p] = _mm_set1_ps(frustum.planes[p].z);
+            d[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        for (; i < count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&spheres.centerX[i]), cy = _mm_loadu_ps(&spheres.centerY[i]), cz = _mm_loadu_ps(&spheres.centerZ[i]);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), d[p]));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+            }
+            n = append(~_mm_movemask_ps(outside) & 0xF, i, 4, count, &visible[0], n);
+        }
+#else
+        for (; i < count; i++)
+        {
+            glm::vec3 center(spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i]);
+            visible[n] = static_cast<uint32_t>(i);
+            n += frustum.intersectsSphere(center, spheres.radius[i]) ? 1 : 0;
+        }
+#endif
+        visible.resize(n);
+        return n;
+    }
+
+private:
+    // adds the indices of the set bits of a batch's mask, without branching on them. Bits of the padding past count
+    // are dropped.
+    static size_t append(int mask, size_t first, size_t width, size_t count, uint32_t* visible, size_t n)
+    {
+        size_t batch = count - first < width ? count - first : width;
+        for (size_t bit = 0; bit < batch; bit++)
+        {
+            visible[n] = static_cast<uint32_t>(first + bit);
+            n += (mask >> bit) & 1;
+        }
+        return n;
+    }
+};
+#endif
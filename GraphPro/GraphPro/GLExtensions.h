@@ -0,0 +1,140 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// glad only has GL 3.3 core, the entry points and enums of newer versions and extensions are declared here and loaded
+// once the context exists. Each feature has a flag, its functions are only non-null when the flag is set.
+
+// ARB_get_program_binary, core in 4.1
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// KHR_parallel_shader_compile (or the ARB version of it, same enums)
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// ARB_pipeline_statistics_query, core in 4.6. The queries themselves are GL 3.3 calls, only the targets are new.
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+// compute shaders, shader storage buffers and indirect draws, core in 4.3. Image load/store is 4.2, which 4.3 includes.
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+
+class GLExtensions
+{
+public:
+    bool programBinary = false;
+    PFNGLGETPROGRAMBINARYPROC GetProgramBinary = nullptr;
+    PFNGLPROGRAMBINARYPROC ProgramBinary = nullptr;
+    PFNGLPROGRAMPARAMETERIPROC ProgramParameteri = nullptr;
+
+    // GL_COMPLETION_STATUS_KHR can be asked without blocking, compiles and links run on the driver's threads
+    bool parallelShaderCompile = false;
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC MaxShaderCompilerThreads = nullptr;
+
+    // the query targets of ARB_pipeline_statistics_query can be used
+    bool pipelineStatistics = false;
+
+    // GL 4.3: compute shaders write draw commands into buffers the draws read
+    bool gpuCulling = false;
+    PFNGLDISPATCHCOMPUTEPROC DispatchCompute = nullptr;
+    // glMemoryBarrier, winnt.h has a MemoryBarrier macro
+    PFNGLMEMORYBARRIERPROC Barrier = nullptr;
+    PFNGLBINDIMAGETEXTUREPROC BindImageTexture = nullptr;
+    PFNGLMULTIDRAWELEMENTSINDIRECTPROC MultiDrawElementsIndirect = nullptr;
+
+    // the loaded entry points, load() has to have been called on the GL thread first
+    static GLExtensions& get()
+    {
+        static GLExtensions extensions;
+        return extensions;
+    }
+
+    // call once after gladLoadGLLoader, with the context current
+    static void load()
+    {
+        GLExtensions& gl = get();
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        int version = major * 10 + minor;
+
+        // a driver can have the entry points and still not offer a single binary format, then there's nothing to cache
+        GLint binaryFormats = 0;
+        if (version >= 41 || glfwExtensionSupported("GL_ARB_get_program_binary"))
+        {
+            gl.GetProgramBinary = reinterpret_cast<PFNGLGETPROGRAMBINARYPROC>(glfwGetProcAddress("glGetProgramBinary"));
+            gl.ProgramBinary = reinterpret_cast<PFNGLPROGRAMBINARYPROC>(glfwGetProcAddress("glProgramBinary"));
+            gl.ProgramParameteri = reinterpret_cast<PFNGLPROGRAMPARAMETERIPROC>(glfwGetProcAddress("glProgramParameteri"));
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+        }
+        gl.programBinary = gl.GetProgramBinary && gl.ProgramBinary && gl.ProgramParameteri && binaryFormats > 0;
+
+        if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+            gl.MaxShaderCompilerThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+        else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+            gl.MaxShaderCompilerThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+        gl.parallelShaderCompile = gl.MaxShaderCompilerThreads != nullptr;
+        // 0xFFFFFFFF lets the driver pick how many threads it uses
+        if (gl.parallelShaderCompile)
+            gl.MaxShaderCompilerThreads(0xFFFFFFFFu);
+
+        gl.pipelineStatistics = version >= 46 || glfwExtensionSupported("GL_ARB_pipeline_statistics_query");
+
+        if (version >= 43)
+        {
+            gl.DispatchCompute = reinterpret_cast<PFNGLDISPATCHCOMPUTEPROC>(glfwGetProcAddress("glDispatchCompute"));
+            gl.Barrier = reinterpret_cast<PFNGLMEMORYBARRIERPROC>(glfwGetProcAddress("glMemoryBarrier"));
+            gl.BindImageTexture = reinterpret_cast<PFNGLBINDIMAGETEXTUREPROC>(glfwGetProcAddress("glBindImageTexture"));
+            gl.MultiDrawElementsIndirect = reinterpret_cast<PFNGLMULTIDRAWELEMENTSINDIRECTPROC>(glfwGetProcAddress("glMultiDrawElementsIndirect"));
+        }
+        gl.gpuCulling = gl.DispatchCompute && gl.Barrier && gl.BindImageTexture && gl.MultiDrawElementsIndirect;
+    }
+};
+#endif
@@ -0,0 +1,303 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+// shadows the GL state the renderers change: the program, the vertex array, the textures bound to each unit, the
+// enable bits, the cull and depth settings, the color mask and whole uniform buffer bindings. A call that wouldn't change anything is
+// dropped before it reaches the driver, so a draw can set all the state it needs without caring what was drawn before
+// it, and nothing has to be set back afterwards.
+//
+// The shadow is only right as long as every change goes through here. Textures that are bound to be filled or to have
+// their parameters changed use editTexture, which works on a unit of its own so the bindings of the draws stay put.
+// After code that changes state directly, call invalidate.
+class GLState
+{
+public:
+    // units 0 to MAX_UNITS - 2 are for drawing, GL 3.3 has at least 48
+    static const int MAX_UNITS = 32;
+    static const int EDIT_UNIT = MAX_UNITS - 1;
+
+    // per kind of call
+    struct Counters {
+        unsigned int programs = 0;
+        unsigned int vertexArrays = 0;
+        unsigned int textures = 0;
+        unsigned int activeUnits = 0;
+        unsigned int capabilities = 0;
+        unsigned int cullFaces = 0;
+        unsigned int depthFuncs = 0;
+        unsigned int depthMasks = 0;
+        unsigned int colorMasks = 0;
+        unsigned int uniformBuffers = 0;
+
+        unsigned int total() const
+        {
+            return programs + vertexArrays + textures + activeUnits + capabilities + cullFaces + depthFuncs + depthMasks + colorMasks + uniformBuffers;
+        }
+    };
+
+    // the state of the GL thread's context
+    static GLState& get()
+    {
+        static GLState state;
+        return state;
+    }
+
+    void useProgram(GLuint program)
+    {
+        if (program == currentProgram)
+        {
+            removing.programs++;
+            return;
+        }
+        currentProgram = program;
+        issuing.programs++;
+        glUseProgram(program);
+    }
+
+    void bindVertexArray(GLuint vertexArray)
+    {
+        if (vertexArray == currentVertexArray)
+        {
+            removing.vertexArrays++;
+            return;
+        }
+        currentVertexArray = vertexArray;
+        issuing.vertexArrays++;
+        glBindVertexArray(vertexArray);
+    }
+
+    // binds a texture to a unit for drawing. The active unit is left wherever it ends up.
+    void bindTexture(int unit, GLenum target, GLuint texture)
+    {
+        int slot = targetSlot(target);
+        if (slot >= 0 && unit >= 0 && unit < MAX_UNITS && textures[unit][slot] == texture)
+        {
+            removing.textures++;
+            return;
+        }
+        activeUnit(unit);
+        if (slot >= 0 && unit >= 0 && unit < MAX_UNITS)
+            textures[unit][slot] = texture;
+        issuing.textures++;
+        glBindTexture(target, texture);
+    }
+
+    // binds a texture to be uploaded to or changed, the calls that follow act on it through the active unit
+    void editTexture(GLenum target, GLuint texture)
+    {
+        bindTexture(EDIT_UNIT, target, texture);
+        activeUnit(EDIT_UNIT);
+    }
+
+    // binds a whole buffer to a uniform block binding. Ranges (UniformRing) bypass the cache, they keep to binding
+    // points of their own.
+    void bindUniformBuffer(GLuint binding, GLuint buffer)
+    {
+        if (binding < UNIFORM_BINDINGS && uniformBuffers[binding] == buffer)
+        {
+            removing.uniformBuffers++;
+            return;
+        }
+        if (binding < UNIFORM_BINDINGS)
+            uniformBuffers[binding] = buffer;
+        issuing.uniformBuffers++;
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+
+    // deletes textures, a deleted name can come back from glGenTextures and must not look bound
+    void deleteTextures(GLsizei count, const GLuint* names)
+    {
+        for (GLsizei i = 0; i < count; i++)
+        {
+            for (int unit = 0; unit < MAX_UNITS; unit++)
+            {
+                for (int slot = 0; slot < TARGETS; slot++)
+                {
+                    if (textures[unit][slot] == names[i])
+                        textures[unit][slot] = 0;
+                }
+            }
+        }
+        glDeleteTextures(count, names);
+    }
+
+    void enable(GLenum capability)
+    {
+        setCapability(capability, true);
+    }
+
+    void disable(GLenum capability)
+    {
+        setCapability(capability, false);
+    }
+
+    void cullFace(GLenum mode)
+    {
+        if (mode == currentCullFace)
+        {
+            removing.cullFaces++;
+            return;
+        }
+        currentCullFace = mode;
+        issuing.cullFaces++;
+        glCullFace(mode);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if (func == currentDepthFunc)
+        {
+            removing.depthFuncs++;
+            return;
+        }
+        currentDepthFunc = func;
+        issuing.depthFuncs++;
+        glDepthFunc(func);
+    }
+
+    void depthMask(GLboolean mask)
+    {
+        GLenum value = mask ? GL_TRUE : GL_FALSE;
+        if (value == currentDepthMask)
+        {
+            removing.depthMasks++;
+            return;
+        }
+        currentDepthMask = value;
+        issuing.depthMasks++;
+        glDepthMask(mask);
+    }
+
+    // all four channels at once, a depth only pass turns them off
+    void colorMask(GLboolean mask)
+    {
+        GLenum value = mask ? GL_TRUE : GL_FALSE;
+        if (value == currentColorMask)
+        {
+            removing.colorMasks++;
+            return;
+        }
+        currentColorMask = value;
+        issuing.colorMasks++;
+        glColorMask(mask, mask, mask, mask);
+    }
+
+    // forgets the whole shadow, the next call of every kind goes through
+    void invalidate()
+    {
+        currentProgram = UNKNOWN;
+        currentVertexArray = UNKNOWN;
+        currentUnit = -1;
+        for (int unit = 0; unit < MAX_UNITS; unit++)
+        {
+            for (int slot = 0; slot < TARGETS; slot++)
+                textures[unit][slot] = UNKNOWN;
+        }
+        for (int i = 0; i < CAPABILITIES; i++)
+            capabilities[i] = -1;
+        currentCullFace = UNKNOWN;
+        currentDepthFunc = UNKNOWN;
+        currentDepthMask = UNKNOWN;
+        currentColorMask = UNKNOWN;
+        for (GLuint i = 0; i < UNIFORM_BINDINGS; i++)
+            uniformBuffers[i] = UNKNOWN;
+    }
+
+    // starts counting a new frame, the counts of the frame that ended can be read until the next call
+    void beginFrame()
+    {
+        issued = issuing;
+        removed = removing;
+        issuing = Counters();
+        removing = Counters();
+    }
+
+    // the calls of the last whole frame that reached GL, and the ones that were dropped
+    Counters issued, removed;
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+    static const int TARGETS = 5;
+    static const int CAPABILITIES = 6;
+    static const GLuint UNIFORM_BINDINGS = 8;
+
+    GLuint currentProgram;
+    GLuint currentVertexArray;
+    int currentUnit;
+    GLuint textures[MAX_UNITS][TARGETS];
+    // -1 unknown, 0 disabled, 1 enabled
+    signed char capabilities[CAPABILITIES];
+    GLenum currentCullFace;
+    GLenum currentDepthFunc;
+    GLenum currentDepthMask;
+    GLenum currentColorMask;
+    GLuint uniformBuffers[UNIFORM_BINDINGS];
+
+    Counters issuing, removing;
+
+    GLState()
+    {
+        invalidate();
+    }
+
+    void activeUnit(int unit)
+    {
+        if (unit == currentUnit)
+        {
+            removing.activeUnits++;
+            return;
+        }
+        currentUnit = unit;
+        issuing.activeUnits++;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void setCapability(GLenum capability, bool on)
+    {
+        int slot = capabilitySlot(capability);
+        signed char value = on ? 1 : 0;
+        if (slot >= 0 && capabilities[slot] == value)
+        {
+            removing.capabilities++;
+            return;
+        }
+        if (slot >= 0)
+            capabilities[slot] = value;
+        issuing.capabilities++;
+        if (on)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    // the texture targets that are shadowed, others always go through
+    static int targetSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        case GL_TEXTURE_CUBE_MAP: return 2;
+        case GL_TEXTURE_BUFFER: return 3;
+        case GL_TEXTURE_3D: return 4;
+        default: return -1;
+        }
+    }
+
+    static int capabilitySlot(GLenum capability)
+    {
+        switch (capability)
+        {
+        case GL_DEPTH_TEST: return 0;
+        case GL_CULL_FACE: return 1;
+        case GL_BLEND: return 2;
+        case GL_STENCIL_TEST: return 3;
+        case GL_SCISSOR_TEST: return 4;
+        case GL_POLYGON_OFFSET_FILL: return 5;
+        default: return -1;
+        }
+    }
+};
+#endif
@@ -0,0 +1,401 @@
+#ifndef GLTF_LOADER_H
+#define GLTF_LOADER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+#include "Json.h"
+#include "AssetArchive.h"
+
+// reads binary glTF 2.0 (.glb) files. Nothing is converted: the loader only works out which byte ranges of the
+// memory-mapped file hold vertex and index data and how GL should read them, so the buffer views can be uploaded as-is.
+// Quantized attributes (KHR_mesh_quantization) stay quantized, GL normalizes them while fetching.
+class GltfLoader
+{
+public:
+    // a byte range of the binary chunk that becomes one GL buffer
+    struct View {
+        size_t offset;  // from the start of the file
+        size_t size;
+    };
+
+    // one draw call worth of geometry. The buffer of every attribute and indexView refer to Scene::views.
+    struct Primitive {
+        vector<VertexAttribute> attributes;
+        int indexView;          // -1 when the primitive isn't indexed
+        GLenum indexType;
+        size_t indexOffset;
+        unsigned int elementCount;
+        glm::vec3 boundsMin, boundsMax;
+        int material;           // -1 for the default material
+    };
+
+    // texture maps of a material as indices into Scene::images, -1 when not set
+    struct Material {
+        int baseColor, metallicRoughness, normal, occlusion;
+    };
+
+    // an image is either a file next to the model or a range of the binary chunk
+    struct Image {
+        string uri;
+        size_t offset, size;
+    };
+
+    // nodes are stored parents-first, like ModelNode
+    struct Node {
+        string name;
+        int parent;
+        glm::mat4 localTransform;
+        vector<int> primitives;
+    };
+
+    struct Scene {
+        // keeps the bytes alive for as long as anything points into them
+        AssetData file;
+        vector<View> views;
+        vector<Primitive> primitives;
+        vector<Material> materials;
+        vector<Image> images;
+        vector<Node> nodes;
+
+        // pointer to the bytes of a view or embedded image, it shares ownership of the file
+        shared_ptr<void> bytes(size_t offset) const
+        {
+            return shared_ptr<void>(file.bytes, const_cast<char*>(file.data()) + offset);
+        }
+    };
+
+    static bool load(const string& path, Scene& scene)
+    {
+        if (!AssetArchive::load(path, scene.file))
+        {
+            cout << "ERROR::GLTF:: could not open " << path << endl;
+            return false;
+        }
+
+        // header: magic, version, total length; then the JSON chunk and an optional binary chunk
+        const char* data = scene.file.data();
+        size_t size = scene.file.size;
+        if (size < 20 || readUint32(data) != 0x46546C67 || readUint32(data + 4) != 2)
+        {
+            cout << "ERROR::GLTF:: " << path << " is not a binary glTF 2.0 file" << endl;
+            return false;
+        }
+
+        size_t jsonLength = readUint32(data + 12);
+        if (readUint32(data + 16) != chunkJson || 20 + jsonLength > size)
+        {
+            cout << "ERROR::GLTF:: " << path << " has no JSON chunk" << endl;
+            return false;
+        }
+        JsonValue json;
+        if (!JsonValue::parse(data + 20, data + 20 + jsonLength, json))
+        {
+            cout << "ERROR::GLTF:: " << path << " has invalid JSON" << endl;
+            return false;
+        }
+
+        // chunks are 4 byte aligned
+        size_t binaryStart = 0, binaryLength = 0;
+        size_t binaryHeader = (20 + jsonLength + 3) & ~size_t(3);
+        if (binaryHeader + 8 <= size && readUint32(data + binaryHeader + 4) == chunkBinary)
+        {
+            binaryStart = binaryHeader + 8;
+            binaryLength = std::min<size_t>(readUint32(data + binaryHeader), size - binaryStart);
+        }
+
+        const JsonValue& extensions = json["extensionsRequired"];
+        for (size_t i = 0; i < extensions.size(); i++)
+        {
+            if (extensions[i].asString() != "KHR_mesh_quantization")
+            {
+                cout << "ERROR::GLTF:: " << path << " requires unsupported extension " << extensions[i].asString() << endl;
+                return false;
+            }
+        }
+
+        // buffer views, only the GLB binary chunk (buffer 0 without uri) is supported
+        const JsonValue& bufferViews = json["bufferViews"];
+        for (size_t i = 0; i < bufferViews.size(); i++)
+        {
+            const JsonValue& view = bufferViews[i];
+            View range;
+            range.offset = binaryStart + view["byteOffset"].asSize();
+            range.size = view["byteLength"].asSize();
+            const JsonValue& buffer = json["buffers"][view["buffer"].asSize()];
+            if (view["buffer"].asInt() != 0 || buffer.has("uri") || binaryStart == 0 || view["byteOffset"].asSize() + range.size > binaryLength)
+            {
+                // keeps the indices of the other views valid, primitives that use it are skipped
+                range.size = 0;
+            }
+            scene.views.push_back(range);
+        }
+
+        const JsonValue& images = json["images"];
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            Image image;
+            image.uri = images[i]["uri"].asString();
+            image.offset = image.size = 0;
+            int view = images[i]["bufferView"].asInt(-1);
+            if (view >= 0 && view < static_cast<int>(scene.views.size()))
+            {
+                image.offset = scene.views[view].offset;
+                image.size = scene.views[view].size;
+            }
+            scene.images.push_back(image);
+        }
+
+        const JsonValue& materials = json["materials"];
+        for (size_t i = 0; i < materials.size(); i++)
+        {
+            const JsonValue& material = materials[i];
+            const JsonValue& pbr = material["pbrMetallicRoughness"];
+            Material result;
+            result.baseColor = textureImage(json, pbr["baseColorTexture"]);
+            result.metallicRoughness = textureImage(json, pbr["metallicRoughnessTexture"]);
+            result.normal = textureImage(json, material["normalTexture"]);
+            result.occlusion = textureImage(json, material["occlusionTexture"]);
+            scene.materials.push_back(result);
+        }
+
+        // every primitive of every mesh, meshPrimitives maps a mesh to its entries
+        const JsonValue& meshes = json["meshes"];
+        vector<vector<int>> meshPrimitives(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const JsonValue& primitives = meshes[i]["primitives"];
+            for (size_t j = 0; j < primitives.size(); j++)
+            {
+                Primitive primitive;
+                if (!readPrimitive(json, scene, primitives[j], primitive))
+                {
+                    cout << "ERROR::GLTF:: skipped primitive " << j << " of mesh " << i << " in " << path << endl;
+                    continue;
+                }
+                meshPrimitives[i].push_back(static_cast<int>(scene.primitives.size()));
+                scene.primitives.push_back(primitive);
+            }
+        }
+
+        // walk the node tree of the default scene, or every root if there are no scenes
+        const JsonValue& nodes = json["nodes"];
+        vector<int> roots;
+        const JsonValue& scenes = json["scenes"];
+        if (scenes.size() > 0)
+        {
+            const JsonValue& sceneNodes = scenes[json["scene"].asSize()]["nodes"];
+            for (size_t i = 0; i < sceneNodes.size(); i++)
+                roots.push_back(sceneNodes[i].asInt());
+        }
+        else
+        {
+            vector<bool> isChild(nodes.size(), false);
+            for (size_t i = 0; i < nodes.size(); i++)
+            {
+                const JsonValue& children = nodes[i]["children"];
+                for (size_t j = 0; j < children.size(); j++)
+                {
+                    if (children[j].asSize() < isChild.size())
+                        isChild[children[j].asSize()] = true;
+                }
+            }
+            for (size_t i = 0; i < nodes.size(); i++)
+            {
+                if (!isChild[i])
+                    roots.push_back(static_cast<int>(i));
+            }
+        }
+        for (size_t i = 0; i < roots.size(); i++)
+            readNode(nodes, meshPrimitives, roots[i], -1, scene, 0);
+
+        return true;
+    }
+
+private:
+    static const uint32_t chunkJson = 0x4E4F534A;
+    static const uint32_t chunkBinary = 0x004E4942;
+
+    static uint32_t readUint32(const char* p)
+    {
+        // glb is little-endian, like every platform we build for
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    // the image a textureInfo object points at, through the texture's source
+    static int textureImage(const JsonValue& json, const JsonValue& textureInfo)
+    {
+        if (textureInfo.isNull())
+            return -1;
+        const JsonValue& texture = json["textures"][textureInfo["index"].asSize()];
+        return texture["source"].asInt(-1);
+    }
+
+    static int componentCount(const string& type)
+    {
+        if (type == "SCALAR")
+            return 1;
+        if (type == "VEC2")
+            return 2;
+        if (type == "VEC3")
+            return 3;
+        if (type == "VEC4")
+            return 4;
+        return 0;
+    }
+
+    // turns a quantized min/max value into the value the shader sees
+    static float dequantize(double value, GLenum type, bool normalized)
+    {
+        if (!normalized)
+            return static_cast<float>(value);
+        switch (type)
+        {
+        case GL_BYTE: return std::max(static_cast<float>(value / 127.0), -1.0f);
+        case GL_UNSIGNED_BYTE: return static_cast<float>(value / 255.0);
+        case GL_SHORT: return std::max(static_cast<float>(value / 32767.0), -1.0f);
+        case GL_UNSIGNED_SHORT: return static_cast<float>(value / 65535.0);
+        default: return static_cast<float>(value);
+        }
+    }
+
+    // fills in how GL reads an accessor. Sparse accessors and accessors without a buffer view would need the data
+    // to be rewritten on the CPU, those aren't supported.
+    static bool readAccessor(const JsonValue& json, const Scene& scene, int index, GLuint location, VertexAttribute& attribute)
+    {
+        const JsonValue& accessor = json["accessors"][static_cast<size_t>(index)];
+        int view = accessor["bufferView"].asInt(-1);
+        if (accessor.isNull() || accessor.has("sparse") || view < 0 || view >= static_cast<int>(scene.views.size()) || scene.views[view].size == 0)
+            return false;
+
+        attribute.location = location;
+        // the buffer view index for now, replaced by the GL buffer once it exists
+        attribute.buffer = static_cast<GLuint>(view);
+        attribute.size = componentCount(accessor["type"].asString());
+        // glTF component types are the GL enums
+        attribute.type = static_cast<GLenum>(accessor["componentType"].asInt());
+        attribute.normalized = accessor["normalized"].boolean ? GL_TRUE : GL_FALSE;
+        attribute.integer = false;
+        attribute.stride = static_cast<GLsizei>(json["bufferViews"][static_cast<size_t>(view)]["byteStride"].asInt(0));
+        attribute.offset = accessor["byteOffset"].asSize();
+        return attribute.size > 0;
+    }
+
+    static bool readPrimitive(const JsonValue& json, const Scene& scene, const JsonValue& source, Primitive& primitive)
+    {
+        // only triangle lists, the renderer doesn't draw anything else
+        if (source["mode"].asInt(4) != 4)
+            return false;
+
+        // attribute locations of model.vs, quantized formats are allowed by KHR_mesh_quantization
+        static const char* names[] = { "POSITION", "NORMAL", "TEXCOORD_0", "TANGENT", "JOINTS_0", "WEIGHTS_0" };
+        static const GLuint locations[] = { 0, 1, 2, 3, 5, 6 };
+        const JsonValue& attributes = source["attributes"];
+        for (int i = 0; i < 6; i++)
+        {
+            if (!attributes.has(names[i]))
+                continue;
+            VertexAttribute attribute;
+            if (!readAccessor(json, scene, attributes[names[i]].asInt(), locations[i], attribute))
+                return false;
+            // joint indices are integers in the shader
+            attribute.integer = (locations[i] == 5);
+            primitive.attributes.push_back(attribute);
+        }
+
+        // positions are required, their accessor has to have min and max which we use as the bounds
+        const JsonValue& position = json["accessors"][attributes["POSITION"].asSize()];
+        if (!attributes.has("POSITION") || position["min"].size() < 3 || position["max"].size() < 3)
+            return false;
+        GLenum positionType = static_cast<GLenum>(position["componentType"].asInt());
+        bool positionNormalized = position["normalized"].boolean;
+        for (int i = 0; i < 3; i++)
+        {
+            primitive.boundsMin[i] = dequantize(position["min"][i].asNumber(), positionType, positionNormalized);
+            primitive.boundsMax[i] = dequantize(position["max"][i].asNumber(), positionType, positionNormalized);
+        }
+
+        primitive.material = source["material"].asInt(-1);
+        if (primitive.material >= static_cast<int>(scene.materials.size()))
+            primitive.material = -1;
+
+        if (source.has("indices"))
+        {
+            VertexAttribute indices;
+            if (!readAccessor(json, scene, source["indices"].asInt(), 0, indices))
+                return false;
+            primitive.indexView = static_cast<int>(indices.buffer);
+            primitive.indexType = indices.type;
+            primitive.indexOffset = indices.offset;
+            primitive.elementCount = json["accessors"][source["indices"].asSize()]["count"].asInt();
+        }
+        else
+        {
+            primitive.indexView = -1;
+            primitive.indexType = GL_NONE;
+            primitive.indexOffset = 0;
+            primitive.elementCount = position["count"].asInt();
+        }
+        return true;
+    }
+
+    static void readNode(const JsonValue& nodes, const vector<vector<int>>& meshPrimitives, int index, int parent, Scene& scene, int depth)
+    {
+        // a broken file could make the tree a cycle
+        if (index < 0 || index >= static_cast<int>(nodes.size()) || depth > 256)
+            return;
+        const JsonValue& source = nodes[static_cast<size_t>(index)];
+
+        Node node;
+        node.name = source["name"].asString();
+        node.parent = parent;
+        node.localTransform = glm::mat4(1.0f);
+        const JsonValue& matrix = source["matrix"];
+        if (matrix.size() == 16)
+        {
+            // column-major, same as glm
+            float values[16];
+            for (int i = 0; i < 16; i++)
+                values[i] = static_cast<float>(matrix[i].asNumber());
+            node.localTransform = glm::make_mat4(values);
+        }
+        else
+        {
+            const JsonValue& t = source["translation"];
+            const JsonValue& r = source["rotation"];
+            const JsonValue& s = source["scale"];
+            glm::vec3 translation(t[size_t(0)].asNumber(0.0), t[1].asNumber(0.0), t[2].asNumber(0.0));
+            // stored as x, y, z, w
+            glm::quat rotation(static_cast<float>(r[3].asNumber(1.0)), static_cast<float>(r[size_t(0)].asNumber(0.0)), static_cast<float>(r[1].asNumber(0.0)), static_cast<float>(r[2].asNumber(0.0)));
+            glm::vec3 scale(s[size_t(0)].asNumber(1.0), s[1].asNumber(1.0), s[2].asNumber(1.0));
+            node.localTransform = glm::translate(glm::mat4(1.0f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+        }
+
+        int mesh = source["mesh"].asInt(-1);
+        if (mesh >= 0 && mesh < static_cast<int>(meshPrimitives.size()))
+            node.primitives = meshPrimitives[mesh];
+
+        int nodeIndex = static_cast<int>(scene.nodes.size());
+        scene.nodes.push_back(node);
+
+        const JsonValue& children = source["children"];
+        for (size_t i = 0; i < children.size(); i++)
+            readNode(nodes, meshPrimitives, children[i].asInt(-1), nodeIndex, scene, depth + 1);
+    }
+};
+#endif
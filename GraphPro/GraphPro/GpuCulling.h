@@ -0,0 +1,398 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Frustum.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Shader.h"
+
+// GPU-driven culling of the copies of a model, GL 4.3. The CPU doesn't look at the copies at all: their transforms
+// stay in a buffer, a compute shader (shaders/instanceCull.shader) tests each one against the frustum and against a
+// hierarchical depth pyramid of the last frame, and writes the transforms of the visible ones and an indirect draw
+// command per mesh. The draws read their instance count from that buffer, so nothing is read back.
+//
+// The pyramid is built from the depth buffer after the frame is drawn (shaders/hizReduce.shader): level 0 is a copy of
+// it, every level above keeps the farthest depth of the 2x2 texels below. A copy is hidden when the nearest point of
+// its bounds, seen through last frame's view projection, is behind the farthest depth of the texels that cover it.
+// What comes into view from behind something shows up a frame late.
+
+// the transforms of a set of copies, uploaded once with set and culled every frame
+class GpuInstances
+{
+public:
+    GpuInstances()
+    {
+        glGenBuffers(1, &buffer);
+    }
+
+    ~GpuInstances()
+    {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    GpuInstances(const GpuInstances&) = delete;
+    GpuInstances& operator=(const GpuInstances&) = delete;
+
+    void set(const std::vector<glm::mat4>& transforms)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.empty() ? nullptr : &transforms[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        count = transforms.size();
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    GLuint id() const
+    {
+        return buffer;
+    }
+
+private:
+    GLuint buffer = 0;
+    size_t count = 0;
+};
+
+// the indirect draws of a model: a command per mesh, the transforms of the nodes that draw each mesh, and room for the
+// instances the cull writes, capacity copies of every node. Mesh m draws from instance firstNode(m) * capacity on.
+struct IndirectDraws {
+    // what a mesh draws, the element range of its index buffer and its nodes
+    struct MeshDraw {
+        GLuint count;
+        GLuint firstIndex;
+        std::vector<glm::mat4> nodes;
+    };
+
+    // the layout of glMultiDrawElementsIndirect's commands
+    struct Command {
+        GLuint count, instanceCount, firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    GLuint commands = 0, instances = 0, meshes = 0, nodes = 0, counter = 0;
+    size_t meshCount = 0, capacity = 0;
+
+    IndirectDraws() {}
+
+    ~IndirectDraws()
+    {
+        if (commands)
+        {
+            GLuint buffers[5] = { commands, instances, meshes, nodes, counter };
+            glDeleteBuffers(5, buffers);
+        }
+    }
+
+    IndirectDraws(const IndirectDraws&) = delete;
+    IndirectDraws& operator=(const IndirectDraws&) = delete;
+
+    // (re)creates the buffers for a set of meshes and up to capacity copies
+    void setup(const std::vector<MeshDraw>& draws, size_t _capacity)
+    {
+        if (!commands)
+        {
+            GLuint buffers[5];
+            glGenBuffers(5, buffers);
+            commands = buffers[0];
+            instances = buffers[1];
+            meshes = buffers[2];
+            nodes = buffers[3];
+            counter = buffers[4];
+        }
+        meshCount = draws.size();
+        capacity = _capacity;
+
+        std::vector<Command> commandData;
+        std::vector<glm::uvec4> meshData;
+        std::vector<glm::mat4> nodeData;
+        for (size_t i = 0; i < draws.size(); i++)
+        {
+            Command command = { draws[i].count, 0, draws[i].firstIndex, 0, static_cast<GLuint>(nodeData.size() * capacity) };
+            commandData.push_back(command);
+            meshData.push_back(glm::uvec4(static_cast<GLuint>(nodeData.size()), static_cast<GLuint>(draws[i].nodes.size()), 0, 0));
+            nodeData.insert(nodeData.end(), draws[i].nodes.begin(), draws[i].nodes.end());
+        }
+
+        upload(GL_DRAW_INDIRECT_BUFFER, commands, commandData.size() * sizeof(Command), commandData.empty() ? nullptr : &commandData[0], GL_DYNAMIC_DRAW);
+        upload(GL_SHADER_STORAGE_BUFFER, meshes, meshData.size() * sizeof(glm::uvec4), meshData.empty() ? nullptr : &meshData[0], GL_STATIC_DRAW);
+        upload(GL_SHADER_STORAGE_BUFFER, nodes, nodeData.size() * sizeof(glm::mat4), nodeData.empty() ? nullptr : &nodeData[0], GL_STATIC_DRAW);
+        // only the GPU writes and reads these
+        upload(GL_ARRAY_BUFFER, instances, std::max<size_t>(nodeData.size() * capacity, 1) * sizeof(glm::mat4), nullptr, GL_DYNAMIC_COPY);
+        upload(GL_SHADER_STORAGE_BUFFER, counter, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    }
+
+    // the byte offset of a mesh's command in the command buffer
+    static const void* commandOffset(size_t mesh)
+    {
+        return reinterpret_cast<const void*>(mesh * sizeof(Command));
+    }
+
+private:
+    static void upload(GLenum target, GLuint buffer, size_t size, const void* data, GLenum usage)
+    {
+        glBindBuffer(target, buffer);
+        glBufferData(target, size, data, usage);
+        glBindBuffer(target, 0);
+    }
+};
+
+class GpuCulling
+{
+public:
+    // whether the context has everything this needs
+    static bool supported()
+    {
+        return GLExtensions::get().gpuCulling;
+    }
+
+    // the sources of the two compute programs, with their includes expanded, and the size of the framebuffer
+    GpuCulling(const std::string& reduceSource, const std::string& cullSource, int width, int height)
+    {
+        GLuint reduceProgram = compileCompute(reduceSource);
+        GLuint cullProgram = compileCompute(cullSource);
+        if (reduceProgram)
+        {
+            reduce.reflect(reduceProgram);
+            reduceLevel = reduce.uniform("level");
+            reduceDepth = reduce.sampler("depth");
+        }
+        if (cullProgram)
+        {
+            cull.reflect(cullProgram);
+            stage = cull.uniform("stage");
+            copyCount = cull.uniform("copyCount");
+            meshCount = cull.uniform("meshCount");
+            capacity = cull.uniform("capacity");
+            planes = cull.uniform("planes");
+            bounds = cull.uniform("bounds");
+            useHiZ = cull.uniform("useHiZ");
+            hizViewProjection = cull.uniform("hizViewProjection");
+            hizLevels = cull.uniform("hizLevels");
+            hiz = cull.sampler("hiz");
+        }
+
+        resize(width, height);
+    }
+
+    ~GpuCulling()
+    {
+        GLState& state = GLState::get();
+        if (depthCopy)
+            state.deleteTextures(1, &depthCopy);
+        if (pyramid)
+            state.deleteTextures(1, &pyramid);
+        if (reduce.id)
+            glDeleteProgram(reduce.id);
+        if (cull.id)
+            glDeleteProgram(cull.id);
+    }
+
+    GpuCulling(const GpuCulling&) = delete;
+    GpuCulling& operator=(const GpuCulling&) = delete;
+
+    // false when a program didn't compile, nothing can be culled then
+    bool ready() const
+    {
+        return reduce.ready() && cull.ready();
+    }
+
+    // builds the pyramid from the depth buffer of the read framebuffer, once the frame seen through viewProjection is
+    // drawn. The next frame's cull tests against it.
+    void buildDepthPyramid(const glm::mat4& viewProjection)
+    {
+        if (!ready() || !pyramid)
+            return;
+        const GLExtensions& gl = GLExtensions::get();
+        GLState& state = GLState::get();
+
+        state.editTexture(GL_TEXTURE_2D, depthCopy);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+        reduce.use();
+        reduceDepth.bind(depthCopy);
+        for (int level = 0; level < levels; level++)
+        {
+            // level 0 reads nothing from the pyramid, the image only has to be bound to something
+            gl.BindImageTexture(0, pyramid, level > 0 ? level - 1 : 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            gl.BindImageTexture(1, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            reduceLevel.set(level);
+            gl.DispatchCompute((levelWidth(level) + 7) / 8, (levelHeight(level) + 7) / 8, 1);
+            gl.Barrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+        gl.Barrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        pyramidViewProjection = viewProjection;
+        pyramidValid = true;
+    }
+
+    // (re)creates the depth copy and the pyramid for a framebuffer of width x height, call it whenever the framebuffer
+    // changes size. The old pyramid covers another screen and is dropped. A minimized window is 0 x 0, nothing is
+    // built then until it comes back.
+    void resize(int _width, int _height)
+    {
+        invalidate();
+        if (_width == width && _height == height)
+            return;
+        width = std::max(_width, 0);
+        height = std::max(_height, 0);
+        levels = 1;
+        while ((width >> levels) > 0 || (height >> levels) > 0)
+            levels++;
+
+        GLState& state = GLState::get();
+        if (depthCopy)
+            state.deleteTextures(1, &depthCopy);
+        if (pyramid)
+            state.deleteTextures(1, &pyramid);
+        depthCopy = 0;
+        pyramid = 0;
+        if (width == 0 || height == 0)
+            return;
+
+        // the copy of the depth buffer, and the pyramid with all its levels
+        glGenTextures(1, &depthCopy);
+        state.editTexture(GL_TEXTURE_2D, depthCopy);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &pyramid);
+        state.editTexture(GL_TEXTURE_2D, pyramid);
+        for (int level = 0; level < levels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, levelWidth(level), levelHeight(level), 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // forgets the pyramid, the next culls only test the frustum until buildDepthPyramid makes a new one
+    void invalidate()
+    {
+        pyramidValid = false;
+    }
+
+    // culls the copies of a model with a bounding sphere (center, radius) in model space, and writes the commands and
+    // instances of draws. draws has to have room for all copies.
+    void cullInstances(const GpuInstances& copies, const Frustum& frustum, const glm::vec4& modelBounds, const IndirectDraws& draws)
+    {
+        if (!ready() || draws.capacity < copies.size())
+            return;
+        const GLExtensions& gl = GLExtensions::get();
+
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, draws.counter);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, copies.id());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, draws.commands);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, draws.instances);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, draws.meshes);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, draws.nodes);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, draws.counter);
+
+        cull.use();
+        copyCount.set(static_cast<int>(copies.size()));
+        meshCount.set(static_cast<int>(draws.meshCount));
+        capacity.set(static_cast<int>(draws.capacity));
+        planes.set(frustum.planes, 6);
+        bounds.set(modelBounds);
+        useHiZ.set(pyramidValid ? 1 : 0);
+        hizViewProjection.set(pyramidViewProjection);
+        hizLevels.set(levels);
+        hiz.bind(pyramid);
+
+        stage.set(0);
+        gl.DispatchCompute(static_cast<GLuint>((copies.size() + 63) / 64), 1, 1);
+        gl.Barrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        stage.set(1);
+        gl.DispatchCompute(static_cast<GLuint>((draws.meshCount + 63) / 64), 1, 1);
+        // the draws read the commands and the instance transforms
+        gl.Barrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    // the pyramid texture and its number of levels, level 0 is the size of the framebuffer. 0 while it's 0 x 0.
+    GLuint depthPyramid() const
+    {
+        return pyramid;
+    }
+
+    int pyramidLevels() const
+    {
+        return levels;
+    }
+
+private:
+    int width = 0, height = 0, levels = 1;
+    GLuint depthCopy = 0, pyramid = 0;
+    glm::mat4 pyramidViewProjection = glm::mat4(1.0f);
+    bool pyramidValid = false;
+
+    Shader reduce, cull;
+    Uniform reduceLevel;
+    Sampler reduceDepth;
+    Uniform stage, copyCount, meshCount, capacity, planes, bounds, useHiZ, hizViewProjection, hizLevels;
+    Sampler hiz;
+
+    // each level is half the one below, rounded down, and at least 1
+    int levelWidth(int level) const
+    {
+        return std::max(width >> level, 1);
+    }
+
+    int levelHeight(int level) const
+    {
+        return std::max(height >> level, 1);
+    }
+
+    // compiles and links a compute program right away, they're small. 0 if it fails.
+    static GLuint compileCompute(const std::string& source)
+    {
+        GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+        const char* text = source.c_str();
+        glShaderSource(shader, 1, &text, nullptr);
+        glCompileShader(shader);
+
+        char infoLog[512];
+        GLint success = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+            std::cout << "ERROR COMPILING COMPUTE SHADER\n" << infoLog << std::endl;
+            glDeleteShader(shader);
+            return 0;
+        }
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+        glDetachShader(program, shader);
+        glDeleteShader(shader);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(program, 512, nullptr, infoLog);
+            std::cout << "ERROR LINKING PROGRAM\n" << infoLog << std::endl;
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+};
+#endif
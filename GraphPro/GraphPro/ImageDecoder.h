@@ -0,0 +1,201 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AssetArchive.h"
+#include "stb_image.h"
+
+// optional backends, each needs its library on the include path and linked:
+//   GRAPHPRO_TURBOJPEG  libjpeg-turbo (turbojpeg.h), SIMD IDCT and color conversion for JPEG
+//   GRAPHPRO_LIBPNG     libpng (png.h), with its SSE2/NEON filter code for PNG
+#ifdef GRAPHPRO_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+#ifdef GRAPHPRO_LIBPNG
+#include <png.h>
+#endif
+
+// pixels of a decoded image, 8 bits per channel, rows tightly packed from the top
+struct DecodedImage {
+    int width = 0, height = 0, channels = 0;
+    std::shared_ptr<void> pixels;
+};
+
+// one way of decoding images. Backends are tried in order, the first one that accepts the bytes decodes them, and
+// stb_image is always last so every format it knows keeps working.
+class ImageDecoder
+{
+public:
+    virtual ~ImageDecoder() {}
+
+    virtual const char* name() const = 0;
+
+    // true if the bytes are in a format this backend reads, from the signature at the start
+    virtual bool accepts(const unsigned char* bytes, size_t size) const = 0;
+
+    // decodes to the given number of channels (1 to 4), converting on the way like stb_image does, or to the image's
+    // own count when channels is 0. Has to be safe to call from several threads at once.
+    virtual bool decode(const unsigned char* bytes, size_t size, int channels, DecodedImage& image) const = 0;
+
+    // the backends in the order they're tried. Add a backend at the front to prefer it.
+    static std::vector<std::shared_ptr<ImageDecoder>>& backends();
+
+    static bool decodeMemory(const unsigned char* bytes, size_t size, int channels, DecodedImage& image)
+    {
+        const std::vector<std::shared_ptr<ImageDecoder>>& list = backends();
+        for (unsigned int i = 0; i < list.size(); i++)
+        {
+            if (list[i]->accepts(bytes, size) && list[i]->decode(bytes, size, channels, image))
+                return true;
+        }
+        return false;
+    }
+
+    // reads the file through the asset archive and decodes it, stored and loose files are never copied
+    static bool decodeFile(const std::string& path, int channels, DecodedImage& image)
+    {
+        AssetData file;
+        if (!AssetArchive::load(path, file) || file.size == 0)
+            return false;
+        return decodeMemory(reinterpret_cast<const unsigned char*>(file.data()), file.size, channels, image);
+    }
+};
+
+// the portable fallback, reads everything stb_image supports
+class StbImageDecoder : public ImageDecoder
+{
+public:
+    const char* name() const { return "stb_image"; }
+
+    bool accepts(const unsigned char* /*bytes*/, size_t size) const
+    {
+        return size > 0;
+    }
+
+    bool decode(const unsigned char* bytes, size_t size, int channels, DecodedImage& image) const
+    {
+        int fileChannels;
+        unsigned char* data = stbi_load_from_memory(bytes, static_cast<int>(size), &image.width, &image.height, &fileChannels, channels);
+        if (!data)
+            return false;
+        image.channels = channels != 0 ? channels : fileChannels;
+        image.pixels = std::shared_ptr<void>(data, stbi_image_free);
+        return true;
+    }
+};
+
+#ifdef GRAPHPRO_TURBOJPEG
+class TurboJpegDecoder : public ImageDecoder
+{
+public:
+    const char* name() const { return "libjpeg-turbo"; }
+
+    bool accepts(const unsigned char* bytes, size_t size) const
+    {
+        return size >= 3 && bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF;
+    }
+
+    bool decode(const unsigned char* bytes, size_t size, int channels, DecodedImage& image) const
+    {
+        // a handle per call, creating one is cheap next to decoding and keeps the backend thread-safe
+        tjhandle handle = tjInitDecompress();
+        if (!handle)
+            return false;
+
+        int width, height, subsampling, colorspace;
+        if (tjDecompressHeader3(handle, bytes, static_cast<unsigned long>(size), &width, &height, &subsampling, &colorspace) != 0)
+        {
+            tjDestroy(handle);
+            return false;
+        }
+        if (channels == 0)
+            channels = colorspace == TJCS_GRAY ? 1 : 3;
+        // there is no two-channel pixel format, leave those to stb
+        if (channels == 2)
+        {
+            tjDestroy(handle);
+            return false;
+        }
+
+        int pixelFormat = channels == 1 ? TJPF_GRAY : channels == 3 ? TJPF_RGB : TJPF_RGBA;
+        unsigned char* data = static_cast<unsigned char*>(malloc(static_cast<size_t>(width) * height * channels));
+        bool decoded = data && tjDecompress2(handle, bytes, static_cast<unsigned long>(size), data, width, 0, height, pixelFormat, 0) == 0;
+        tjDestroy(handle);
+        if (!decoded)
+        {
+            free(data);
+            return false;
+        }
+
+        image.width = width;
+        image.height = height;
+        image.channels = channels;
+        image.pixels = std::shared_ptr<void>(data, free);
+        return true;
+    }
+};
+#endif
+
+#ifdef GRAPHPRO_LIBPNG
+class LibPngDecoder : public ImageDecoder
+{
+public:
+    const char* name() const { return "libpng"; }
+
+    bool accepts(const unsigned char* bytes, size_t size) const
+    {
+        static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        return size >= 8 && memcmp(bytes, signature, 8) == 0;
+    }
+
+    bool decode(const unsigned char* bytes, size_t size, int channels, DecodedImage& image) const
+    {
+        png_image png;
+        memset(&png, 0, sizeof(png));
+        png.version = PNG_IMAGE_VERSION;
+        if (!png_image_begin_read_from_memory(&png, bytes, size))
+            return false;
+
+        if (channels == 0)
+            channels = PNG_IMAGE_SAMPLE_CHANNELS(png.format);
+        // 8 bit sRGB output, libpng converts palettes, 16 bit samples and the channel count
+        png.format = channels == 1 ? PNG_FORMAT_GRAY : channels == 2 ? PNG_FORMAT_GA : channels == 3 ? PNG_FORMAT_RGB : PNG_FORMAT_RGBA;
+
+        unsigned char* data = static_cast<unsigned char*>(malloc(PNG_IMAGE_SIZE(png)));
+        if (!data || !png_image_finish_read(&png, nullptr, data, 0, nullptr))
+        {
+            free(data);
+            png_image_free(&png);
+            return false;
+        }
+
+        image.width = static_cast<int>(png.width);
+        image.height = static_cast<int>(png.height);
+        image.channels = channels;
+        image.pixels = std::shared_ptr<void>(data, free);
+        return true;
+    }
+};
+#endif
+
+inline std::vector<std::shared_ptr<ImageDecoder>>& ImageDecoder::backends()
+{
+    static std::vector<std::shared_ptr<ImageDecoder>> list = [] {
+        std::vector<std::shared_ptr<ImageDecoder>> defaults;
+#ifdef GRAPHPRO_TURBOJPEG
+        defaults.push_back(std::make_shared<TurboJpegDecoder>());
+#endif
+#ifdef GRAPHPRO_LIBPNG
+        defaults.push_back(std::make_shared<LibPngDecoder>());
+#endif
+        defaults.push_back(std::make_shared<StbImageDecoder>());
+        return defaults;
+    }();
+    return list;
+}
+#endif
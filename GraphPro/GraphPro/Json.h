@@ -0,0 +1,329 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// a small JSON document model, enough to read glTF headers. Objects keep their members in file order.
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    bool isNull() const { return type == Null; }
+    bool isNumber() const { return type == Number; }
+    bool isString() const { return type == String; }
+    bool isArray() const { return type == Array; }
+    bool isObject() const { return type == Object; }
+
+    // number of array elements or object members
+    size_t size() const
+    {
+        return type == Array ? array.size() : type == Object ? members.size() : 0;
+    }
+
+    // the member with the given name, or a null value when there is none
+    const JsonValue& operator[](const char* key) const
+    {
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            if (members[i].first == key)
+                return members[i].second;
+        }
+        return null();
+    }
+
+    // the array element at the given index, or a null value when it's out of range
+    const JsonValue& operator[](size_t index) const
+    {
+        return index < array.size() ? array[index] : null();
+    }
+
+    bool has(const char* key) const
+    {
+        return !(*this)[key].isNull();
+    }
+
+    double asNumber(double fallback = 0.0) const
+    {
+        return type == Number ? number : fallback;
+    }
+
+    int asInt(int fallback = 0) const
+    {
+        return type == Number ? static_cast<int>(number) : fallback;
+    }
+
+    size_t asSize(size_t fallback = 0) const
+    {
+        return type == Number && number >= 0.0 ? static_cast<size_t>(number) : fallback;
+    }
+
+    const std::string& asString() const
+    {
+        static const std::string empty;
+        return type == String ? string : empty;
+    }
+
+    static const JsonValue& null()
+    {
+        static const JsonValue value;
+        return value;
+    }
+
+    // parses the text between begin and end, returns false if it isn't valid JSON
+    static bool parse(const char* begin, const char* end, JsonValue& value)
+    {
+        const char* p = begin;
+        if (!parseValue(p, end, value, 0))
+            return false;
+        skipWhitespace(p, end);
+        // trailing padding (glTF pads its JSON chunk with spaces) is fine, anything else isn't
+        while (p < end && *p == '\0')
+            p++;
+        return p == end;
+    }
+
+private:
+    // deeper documents are rejected instead of running out of stack
+    static const int maxDepth = 256;
+
+    static void skipWhitespace(const char*& p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    static bool match(const char*& p, const char* end, const char* literal)
+    {
+        size_t length = strlen(literal);
+        if (static_cast<size_t>(end - p) < length || memcmp(p, literal, length) != 0)
+            return false;
+        p += length;
+        return true;
+    }
+
+    static bool parseValue(const char*& p, const char* end, JsonValue& value, int depth)
+    {
+        skipWhitespace(p, end);
+        if (p >= end || depth > maxDepth)
+            return false;
+
+        switch (*p)
+        {
+        case '{':
+            return parseObject(p, end, value, depth);
+        case '[':
+            return parseArray(p, end, value, depth);
+        case '"':
+            value.type = String;
+            return parseString(p, end, value.string);
+        case 't':
+            value.type = Bool;
+            value.boolean = true;
+            return match(p, end, "true");
+        case 'f':
+            value.type = Bool;
+            value.boolean = false;
+            return match(p, end, "false");
+        case 'n':
+            value.type = Null;
+            return match(p, end, "null");
+        default:
+            return parseNumber(p, end, value);
+        }
+    }
+
+    static bool parseNumber(const char*& p, const char* end, JsonValue& value)
+    {
+        // strtod needs a terminated string, numbers are short so copy them out
+        char buffer[64];
+        size_t length = 0;
+        while (p < end && length < sizeof(buffer) - 1 && (strchr("+-.eE", *p) || (*p >= '0' && *p <= '9')))
+            buffer[length++] = *p++;
+        if (length == 0)
+            return false;
+        buffer[length] = '\0';
+
+        char* parsedEnd;
+        value.type = Number;
+        value.number = strtod(buffer, &parsedEnd);
+        return parsedEnd == buffer + length;
+    }
+
+    static void appendUtf8(std::string& out, unsigned int codepoint)
+    {
+        if (codepoint < 0x80)
+        {
+            out += static_cast<char>(codepoint);
+        }
+        else if (codepoint < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (codepoint >> 6));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+        else if (codepoint < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (codepoint >> 12));
+            out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xF0 | (codepoint >> 18));
+            out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+    }
+
+    static bool parseHex4(const char*& p, const char* end, unsigned int& value)
+    {
+        if (end - p < 4)
+            return false;
+        value = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            char c = *p++;
+            value <<= 4;
+            if (c >= '0' && c <= '9')
+                value |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                value |= c - 'A' + 10;
+            else
+                return false;
+        }
+        return true;
+    }
+
+    static bool parseString(const char*& p, const char* end, std::string& out)
+    {
+        // skip the opening quote
+        p++;
+        while (p < end && *p != '"')
+        {
+            if (*p != '\\')
+            {
+                out += *p++;
+                continue;
+            }
+
+            p++;
+            if (p >= end)
+                return false;
+            char escape = *p++;
+            switch (escape)
+            {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u':
+            {
+                unsigned int codepoint;
+                if (!parseHex4(p, end, codepoint))
+                    return false;
+                // characters outside the basic plane come as a surrogate pair
+                if (codepoint >= 0xD800 && codepoint < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+                {
+                    p += 2;
+                    unsigned int low;
+                    if (!parseHex4(p, end, low))
+                        return false;
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(out, codepoint);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        if (p >= end)
+            return false;
+        // skip the closing quote
+        p++;
+        return true;
+    }
+
+    static bool parseArray(const char*& p, const char* end, JsonValue& value, int depth)
+    {
+        value.type = Array;
+        p++;
+        skipWhitespace(p, end);
+        if (p < end && *p == ']')
+        {
+            p++;
+            return true;
+        }
+
+        while (true)
+        {
+            value.array.push_back(JsonValue());
+            if (!parseValue(p, end, value.array.back(), depth + 1))
+                return false;
+            skipWhitespace(p, end);
+            if (p >= end)
+                return false;
+            if (*p == ']')
+            {
+                p++;
+                return true;
+            }
+            if (*p++ != ',')
+                return false;
+        }
+    }
+
+    static bool parseObject(const char*& p, const char* end, JsonValue& value, int depth)
+    {
+        value.type = Object;
+        p++;
+        skipWhitespace(p, end);
+        if (p < end && *p == '}')
+        {
+            p++;
+            return true;
+        }
+
+        while (true)
+        {
+            skipWhitespace(p, end);
+            if (p >= end || *p != '"')
+                return false;
+            value.members.push_back(std::make_pair(std::string(), JsonValue()));
+            if (!parseString(p, end, value.members.back().first))
+                return false;
+            skipWhitespace(p, end);
+            if (p >= end || *p++ != ':')
+                return false;
+            if (!parseValue(p, end, value.members.back().second, depth + 1))
+                return false;
+            skipWhitespace(p, end);
+            if (p >= end)
+                return false;
+            if (*p == '}')
+            {
+                p++;
+                return true;
+            }
+            if (*p++ != ',')
+                return false;
+        }
+    }
+};
+#endif
@@ -0,0 +1,180 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// the LZ4 block format: a compact byte-oriented LZ77 whose decoder is little more than memcpy, so decompressing is
+// close to the speed of reading memory. Blocks written here can be read by the reference implementation and the
+// other way around. The compressor is the simple greedy one, good enough for packing assets offline.
+class Lz4
+{
+public:
+    // largest possible compressed size of size bytes
+    static size_t compressBound(size_t size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    // compresses a block, returns the compressed bytes
+    static std::vector<unsigned char> compress(const unsigned char* source, size_t size)
+    {
+        std::vector<unsigned char> out;
+        out.reserve(compressBound(size));
+
+        const unsigned char* anchor = source;
+        const unsigned char* end = source + size;
+        // the format wants the last 5 bytes to be literals and the last match to start 12 bytes before the end
+        const unsigned char* matchLimit = end - lastLiterals;
+        const unsigned char* startLimit = end - minimumEnd;
+
+        if (size > static_cast<size_t>(minimumEnd))
+        {
+            // positions (plus one, zero is empty) of the last 4-byte sequences with each hash
+            std::vector<uint32_t> table(static_cast<size_t>(1) << hashBits, 0);
+            const unsigned char* p = source;
+            while (p < startLimit)
+            {
+                uint32_t sequence = read32(p);
+                uint32_t& slot = table[hash(sequence)];
+                const unsigned char* candidate = slot ? source + slot - 1 : nullptr;
+                slot = static_cast<uint32_t>(p - source) + 1;
+
+                if (!candidate || p - candidate > maxOffset || read32(candidate) != sequence)
+                {
+                    p++;
+                    continue;
+                }
+
+                size_t length = minMatch;
+                while (p + length < matchLimit && candidate[length] == p[length])
+                    length++;
+
+                writeSequence(out, anchor, p - anchor, static_cast<unsigned int>(p - candidate), length);
+                p += length;
+                anchor = p;
+            }
+        }
+
+        // the rest goes out as literals, in a sequence without a match
+        size_t literals = end - anchor;
+        out.push_back(static_cast<unsigned char>((literals >= 15 ? 15 : literals) << 4));
+        writeLength(out, literals);
+        out.insert(out.end(), anchor, end);
+        return out;
+    }
+
+    // decompresses a block into exactly targetSize bytes, returns false if the block is malformed
+    static bool decompress(const unsigned char* source, size_t size, unsigned char* target, size_t targetSize)
+    {
+        const unsigned char* p = source;
+        const unsigned char* end = source + size;
+        unsigned char* out = target;
+        unsigned char* outEnd = target + targetSize;
+
+        while (p < end)
+        {
+            unsigned int token = *p++;
+
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(p, end, literals))
+                return false;
+            if (static_cast<size_t>(end - p) < literals || static_cast<size_t>(outEnd - out) < literals)
+                return false;
+            memcpy(out, p, literals);
+            p += literals;
+            out += literals;
+
+            // the last sequence has no match
+            if (p == end)
+                break;
+
+            if (end - p < 2)
+                return false;
+            size_t offset = p[0] | (p[1] << 8);
+            p += 2;
+            if (offset == 0 || offset > static_cast<size_t>(out - target))
+                return false;
+
+            size_t length = token & 15;
+            if (length == 15 && !readLength(p, end, length))
+                return false;
+            length += minMatch;
+            if (static_cast<size_t>(outEnd - out) < length)
+                return false;
+
+            // the match may overlap what it's writing, which repeats the last offset bytes
+            const unsigned char* match = out - offset;
+            if (offset >= length)
+            {
+                memcpy(out, match, length);
+                out += length;
+            }
+            else
+            {
+                for (size_t i = 0; i < length; i++)
+                    *out++ = *match++;
+            }
+        }
+        return out == outEnd;
+    }
+
+private:
+    static const int minMatch = 4;
+    static const int lastLiterals = 5;
+    static const int minimumEnd = 12;
+    static const int maxOffset = 65535;
+    static const int hashBits = 14;
+
+    static uint32_t read32(const unsigned char* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uint32_t hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - hashBits);
+    }
+
+    // lengths of 15 and up continue in extra bytes of 255 until one is smaller
+    static void writeLength(std::vector<unsigned char>& out, size_t length)
+    {
+        if (length < 15)
+            return;
+        length -= 15;
+        while (length >= 255)
+        {
+            out.push_back(255);
+            length -= 255;
+        }
+        out.push_back(static_cast<unsigned char>(length));
+    }
+
+    static bool readLength(const unsigned char*& p, const unsigned char* end, size_t& length)
+    {
+        unsigned int extra;
+        do
+        {
+            if (p >= end)
+                return false;
+            extra = *p++;
+            length += extra;
+        } while (extra == 255);
+        return true;
+    }
+
+    static void writeSequence(std::vector<unsigned char>& out, const unsigned char* literals, size_t literalCount, unsigned int offset, size_t matchLength)
+    {
+        size_t matchCode = matchLength - minMatch;
+        out.push_back(static_cast<unsigned char>(((literalCount >= 15 ? 15 : literalCount) << 4) | (matchCode >= 15 ? 15 : matchCode)));
+        writeLength(out, literalCount);
+        out.insert(out.end(), literals, literals + literalCount);
+        out.push_back(static_cast<unsigned char>(offset & 0xFF));
+        out.push_back(static_cast<unsigned char>(offset >> 8));
+        writeLength(out, matchCode);
+    }
+};
+#endif
@@ -1,5 +1,9 @@
 #include <iostream>
-#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <cstdio>
+#include <cstring>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -7,12 +11,31 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include "camera.h"
 #include "Skybox.h"
 #include "Cube.h"
 #include "Terrain.h"
 #include "model.h"
+#include "ThreadPool.h"
+#include "UploadQueue.h"
+#include "Benchmarks.h"
+#include "TextureCooker.h"
+#include "TextureResidency.h"
+#include "ImageDecoder.h"
+#include "AssetArchive.h"
+#include "AsyncFileReader.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "PipelineStatistics.h"
+#include "OcclusionCuller.h"
+#include "GpuCulling.h"
+#include "ProgramCache.h"
+#include "FrameUniforms.h"
+#include "ShaderPreprocessor.h"
+#include "ShaderVariants.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -25,16 +48,55 @@ void processInput(GLFWwindow* window);
 int init(GLFWwindow* &window);
 
 void createShaders();
-void createProgram(GLuint& programID, const char* vertex, const char* fragment);
+void createProgram(Shader& program, const char* vertex, const char* fragment);
+bool loadProgramSources(const char* vertex, const char* fragment, std::string& vertexSource, std::string& fragmentSource);
+bool loadComputeSource(const char* path, std::string& source);
 GLuint loadTexture(const char* path, int comp = 0);
 
 //util
-void loadFile(const char* filename, char*& output);
-
-//program IDs
-GLuint simpleProgram, skyProgram, terrainProgram, modelProgram;
+void loadFiles(const char* const* filenames, char** outputs, int count);
+
+//background loading: files are read without blocking, decoding runs on the jobs, GL uploads get spread over frames by the queue
+ThreadPool* jobs;
+//work the frame waits on runs here, never queued behind a texture decode on the jobs
+ThreadPool* frameJobs;
+AsyncFileReader* fileReader;
+UploadQueue* uploadQueue;
+const float UPLOAD_BUDGET_MS = 2.0f;
+
+//textures only keep the mip levels the scene needs, within this much VRAM
+TextureResidency* residency;
+const size_t TEXTURE_BUDGET_MB = 256;
+const float STREAM_BUDGET_MS = 1.0f;
+
+//linked programs are kept on disk, a warm start loads them instead of compiling
+ProgramCache* programCache;
+
+//programs, with their uniforms and samplers reflected once they're linked
+Shader simpleProgram, skyProgram, terrainProgram;
+Shader terrainFeedbackProgram, terrainBakeProgram, terrainDepthProgram;
+//models are drawn with a variant per set of maps their materials have
+ShaderVariants* modelPrograms;
+
+//camera, projection and light for every program, filled once per frame, and the world matrix of each draw
+FrameUniforms* frameUniforms;
+
+//the draws of a frame, sorted before they're made
+RenderQueue* renderQueue;
+//fragment shader invocations per pass, to see what the depth pre-pass saves. P turns the pre-pass on and off.
+PipelineStatistics* passStatistics;
+bool depthPrepass = true;
+//the terrain rasterized on the CPU every frame, what's behind the hills isn't submitted. O turns it on and off.
+OcclusionCuller* occlusion;
+bool occlusionCulling = true;
+//with GL 4.3 the towers are culled by a compute shader against the depth of the last frame and drawn indirectly,
+//null without it. G switches between that and culling them on the CPU.
+GpuCulling* gpuCulling = nullptr;
+GpuInstances* towerCopies = nullptr;
+bool gpuCullingEnabled = true;
 
 const int WIDTH = 1280, HEIGHT = 720;
+const float FAR_PLANE = 4000.0f;
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 0.0f));
@@ -54,11 +116,29 @@ float lastFrame = 0.0f;
 
 //models
 Model* backpack;
-void renderModel(Model* model);
+void submitModel(Model* model);
+void submitModelInstances(Model* model, const std::vector<glm::mat4>& instances);
+
+//copies of the watch tower scattered over the terrain
+std::vector<glm::mat4> towers;
+void scatterOnTerrain(Terrain& terrain, std::vector<glm::mat4>& instances, int count, float scale);
 
+//plays the model's first animation on every tower, only when the model has animations
+Animator* towerAnimator = nullptr;
+void submitModelAnimated(Model* model, const Animator& animator);
+void requestModelTextures(Model* model, const std::vector<glm::mat4>& instances);
+void reportFrame(GLFWwindow* window, float time);
 
-int main()
+
+int main(int argc, char** argv)
 {
+    if (runBenchmarks(argc, argv) || TextureCooker::run(argc, argv) || AssetArchive::run(argc, argv))
+        return 0;
+
+    //everything is read from the packed archive when there is one, made with
+    //"GraphPro --pack-assets assets.gpak shaders textures models", otherwise from the loose files
+    AssetArchive::mount("assets.gpak");
+
     GLFWwindow* window;
     int result = init(window);
     if (result != 0) {
@@ -69,20 +149,64 @@ int main()
 
     camera.MovementSpeed = 100;
 
+    jobs = new ThreadPool();
+    frameJobs = new ThreadPool();
+    fileReader = new AsyncFileReader(*jobs);
+
+    programCache = new ProgramCache("shadercache");
     createShaders();
+    frameUniforms = new FrameUniforms();
+    renderQueue = new RenderQueue();
+    passStatistics = new PipelineStatistics();
+    renderQueue->setStatistics(passStatistics);
+    occlusion = new OcclusionCuller(WIDTH / 4, HEIGHT / 4);
+    if (GpuCulling::supported()) {
+        std::string reduceSource, cullSource;
+        //the pyramid has to cover what's drawn, on a HiDPI display the framebuffer is bigger than the window
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        if (loadComputeSource("shaders/hizReduce.shader", reduceSource) && loadComputeSource("shaders/instanceCull.shader", cullSource))
+            gpuCulling = new GpuCulling(reduceSource, cullSource, framebufferWidth, framebufferHeight);
+    }
+
+    uploadQueue = new UploadQueue(UPLOAD_BUDGET_MS);
+    residency = new TextureResidency(TEXTURE_BUDGET_MB * 1024 * 1024, STREAM_BUDGET_MS);
 
     Skybox skybox = Skybox(skyProgram);
     Cube crate = Cube(simpleProgram, glm::vec3(0, 0, 0), loadTexture("textures/container2.png"), loadTexture("textures/container2_normal.png"), loadTexture("textures/container2_specular.png"));
     Cube brick = Cube(simpleProgram, glm::vec3(-1.5f, -2.2f, -2.5f), loadTexture("textures/brick.png"), loadTexture("textures/brick_normal.png"));
-    Terrain terrain = Terrain(terrainProgram, "textures/Heightmap2.png", loadTexture("textures/Heightmap2_normal.png"), 250.0f, 5.0f);
+    Terrain terrain = Terrain(terrainProgram, "textures/Heightmap2.png", loadTexture("textures/Heightmap2_normal.png"), 250.0f, 5.0f, uploadQueue);
 
     terrain.assignTextures(loadTexture("textures/dirt.jpg"), loadTexture("textures/sand.jpg"), loadTexture("textures/grass.png", 4), loadTexture("textures/rock.jpg"), loadTexture("textures/snow.jpg"));
-
-    backpack = new Model("models/obj/wooden watch tower2.obj");
+    terrain.enableVirtualTexture(terrainFeedbackProgram, terrainBakeProgram, terrainProgram, WIDTH, HEIGHT);
+    terrain.enableDepthPrepass(terrainDepthProgram);
+    terrain.addOccluder(*occlusion);
+
+    //all models are imported side by side on the jobs, only the GL work happens here
+    std::vector<std::string> modelPaths = { "models/obj/wooden watch tower2.obj" };
+    std::vector<Model*> models = Model::LoadConcurrent(modelPaths, *jobs, uploadQueue, false, residency);
+    for (unsigned int i = 0; i < models.size(); i++)
+        models[i]->preparePrograms(*modelPrograms);
+    bool programsReported = false;
+    backpack = models[0];
+    scatterOnTerrain(terrain, towers, 2000, 10.0f);
+    //the towers don't move, their transforms are uploaded once
+    if (gpuCulling) {
+        towerCopies = new GpuInstances();
+        towerCopies->set(towers);
+    }
+    if (!backpack->animations.empty()) {
+        towerAnimator = new Animator(backpack->skeleton, backpack->animations);
+        //spread the start times so the copies don't move in lockstep
+        for (unsigned int i = 0; i < towers.size(); i++)
+            towerAnimator->addInstance(towers[i], 0, backpack->animations[0].duration * (i % 16) / 16.0f);
+    }
 
 
-    //create gl viewport
-    glViewport(0, 0, WIDTH, HEIGHT);
+    //create gl viewport, the size of the framebuffer which can differ from the window's
+    int viewportWidth, viewportHeight;
+    glfwGetFramebufferSize(window, &viewportWidth, &viewportHeight);
+    glViewport(0, 0, viewportWidth, viewportHeight);
 
     //render loop
     while (!glfwWindowShouldClose(window)) {
@@ -94,19 +218,64 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        //the state calls of the last frame, and how many of them the state cache dropped
+        GLState::get().beginFrame();
+        reportFrame(window, currentFrame);
+
+        //push queued textures and buffers to the GPU, within the frame budget
+        uploadQueue->process();
+
+        //pick up the programs the driver has finished compiling, draws that need one that isn't are skipped
+        if (programCache->poll() == 0 && !programsReported) {
+            std::cout << "programs: " << programCache->hits << " from the cache, " << programCache->misses << " compiled, " << modelPrograms->count() << " model variants" << std::endl;
+            programsReported = true;
+        }
+
+        //tell the residency manager what this frame needs, it streams mip levels in and out to stay within the budget
+        terrain.requestTextures(*residency);
+        requestModelTextures(backpack, towers);
+        residency->update();
+
         //pass projection matrix to shader (note that in this case it could change every frame)
-        projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, 0.1f, 4000.0f);
+        projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, 0.1f, FAR_PLANE);
         lightPosition = glm::normalize(glm::vec3(glm::sin(currentFrame), -0.5, glm::cos(currentFrame)));
+        frameUniforms->update(camera, projection, lightPosition);
+        view = frameUniforms->view();
+
+        //everything is queued first and drawn sorted by pass, program, material and distance. The frustum planes
+        //come from projection * view once here, everything that's submitted is culled against them.
+        renderQueue->begin(camera.Position, FAR_PLANE, frameUniforms->viewProjection());
+        renderQueue->setDepthPrepass(depthPrepass);
+        //the occluders go into the CPU depth buffer before anything is culled against it, the rows on the frame jobs
+        if (occlusionCulling)
+            occlusion->render(frameUniforms->viewProjection(), frameJobs);
+        renderQueue->setOcclusion(occlusionCulling ? occlusion : nullptr);
+        terrain.cull(renderQueue->frustum(), renderQueue->occlusion());
+
+        //bake the terrain pages the last feedback asked for and draw the feedback for the next ones
+        terrain.updateVirtualTexture(*frameUniforms);
 
         //rendering
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        skybox.renderSkyBox(camera, lightPosition, projection);
-        terrain.renderTerrain(camera, lightPosition, projection);
-        renderModel(backpack);
-        //brick.renderCube(camera, lightDirection, projection);
-        //crate.renderCube(camera, lightPosition, projection);
+        skybox.submit(*renderQueue);
+        terrain.submit(*renderQueue);
+        submitModel(backpack);
+        if (towerAnimator) {
+            //poses are evaluated on the frame jobs, the submit waits for them
+            towerAnimator->update(deltaTime, frameJobs);
+            submitModelAnimated(backpack, *towerAnimator);
+        }
+        else if (!(gpuCulling && gpuCullingEnabled && backpack->SubmitIndirect(*renderQueue, *modelPrograms, *gpuCulling, *towerCopies))) {
+            submitModelInstances(backpack, towers);
+        }
+        renderQueue->execute(*frameUniforms);
+        //the depth of this frame is what the next one culls the towers against
+        if (gpuCulling && gpuCullingEnabled)
+            gpuCulling->buildDepthPyramid(frameUniforms->viewProjection());
+        //brick.renderCube(*frameUniforms);
+        //crate.renderCube(*frameUniforms);
 
         //buffers swappen
         glfwSwapBuffers(window);
@@ -115,20 +284,30 @@ int main()
 
     }
 
+    //let running reads and decode jobs finish before the GL context goes away
+    delete fileReader;
+    jobs->wait();
+    delete towerAnimator;
+    delete jobs;
+    delete frameJobs;
+    delete uploadQueue;
+    delete residency;
+    delete modelPrograms;
+    delete programCache;
+    delete frameUniforms;
+    delete renderQueue;
+    delete passStatistics;
+    delete occlusion;
+    delete towerCopies;
+    delete gpuCulling;
+    terrain.releaseVirtualTexture();
+
     glfwTerminate();
     return 0;
 }
 
 
-void renderModel(Model* model) {
-
-    glEnable(GL_DEPTH);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-
-    glCullFace(GL_BACK);
-    glUseProgram(modelProgram);
-    //set texture channels
+void submitModel(Model* model) {
 
     //matrices
     glm::mat4 world = glm::mat4(1.0f);
@@ -139,21 +318,81 @@ void renderModel(Model* model) {
     //glm::vec3 rot = glm::vec3(0, t, 0);
     //world = world * glm::mat4(glm::quat(rot));
 
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "world"), 1, GL_FALSE, glm::value_ptr(world));
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "view"), 1, GL_FALSE, glm::value_ptr(camera.GetViewMatrix()));
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    model->Submit(*renderQueue, *modelPrograms, world);
+}
 
-    glUniform3fv(glGetUniformLocation(modelProgram, "lightPosition"), 1, glm::value_ptr(lightPosition));
-    glUniform3fv(glGetUniformLocation(modelProgram, "cameraPosition"), 1, glm::value_ptr(camera.Position));
 
-    model->Draw(modelProgram);
+void submitModelInstances(Model* model, const std::vector<glm::mat4>& instances) {
+    //the copies outside the view are culled before anything is queued
+    model->SubmitInstanced(*renderQueue, *modelPrograms, instances);
+}
 
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
+void submitModelAnimated(Model* model, const Animator& animator) {
+    model->SubmitAnimated(*renderQueue, *modelPrograms, animator);
 }
 
+//shows the frame time and the state calls of the last frame in the title, once a second
+void reportFrame(GLFWwindow* window, float time) {
+    static float lastReport = 0.0f;
+    if (time - lastReport < 1.0f) return;
+    lastReport = time;
+
+    const GLState& state = GLState::get();
+    char title[384];
+    int length = snprintf(title, sizeof(title), "GraphPro - %.2f ms - %u GL state calls, %u redundant dropped (%u programs, %u textures, %u enables)",
+        deltaTime * 1000.0f, state.issued.total(), state.removed.total(), state.removed.programs, state.removed.textures + state.removed.activeUnits, state.removed.capabilities);
+    //fragments shaded per pass, in thousands
+    if (passStatistics->available() && length > 0 && length < (int)sizeof(title)) {
+        snprintf(title + length, sizeof(title) - length, " - pre-pass %s, fragments: depth %lluk, opaque %lluk, sky %lluk", depthPrepass ? "on" : "off",
+            (unsigned long long)passStatistics->fragments(RenderQueue::PASS_DEPTH) / 1000, (unsigned long long)passStatistics->fragments(RenderQueue::PASS_OPAQUE) / 1000,
+            (unsigned long long)passStatistics->fragments(RenderQueue::PASS_SKY) / 1000);
+    }
+    length = (int)strlen(title);
+    if (length < (int)sizeof(title)) {
+        if (occlusionCulling)
+            snprintf(title + length, sizeof(title) - length, " - occlusion: %u of %u boxes hidden", occlusion->occluded, occlusion->tested);
+        else
+            snprintf(title + length, sizeof(title) - length, " - occlusion off");
+    }
+    length = (int)strlen(title);
+    if (gpuCulling && length < (int)sizeof(title))
+        snprintf(title + length, sizeof(title) - length, " - GPU culling %s", gpuCullingEnabled ? "on" : "off");
+    glfwSetWindowTitle(window, title);
+}
+
+//the model's textures are shared by all copies, so the closest one decides the mip level they need
+void requestModelTextures(Model* model, const std::vector<glm::mat4>& instances) {
+    //the single copy at the origin, drawn by submitModel
+    float nearest = glm::length(camera.Position);
+    float scale = 10.0f;
+    for (unsigned int i = 0; i < instances.size(); i++) {
+        float distance = glm::length(glm::vec3(instances[i][3]) - camera.Position);
+        if (distance < nearest) {
+            nearest = distance;
+            scale = glm::length(glm::vec3(instances[i][0]));
+        }
+    }
+    model->requestTextures(*residency, TextureResidency::screenSize(model->boundsRadius * scale, nearest, glm::radians(camera.Zoom), HEIGHT));
+}
+
+void scatterOnTerrain(Terrain& terrain, std::vector<glm::mat4>& instances, int count, float scale) {
+    //fixed seed, so the scene looks the same every run
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<float> position(0.0f, 2500.0f);
+    std::uniform_real_distribution<float> angle(0.0f, glm::two_pi<float>());
+
+    instances.clear();
+    for (int i = 0; i < count; i++) {
+        float x = terrain.position.x + position(random);
+        float z = terrain.position.z + position(random);
+
+        glm::mat4 world = glm::mat4(1.0f);
+        world = glm::translate(world, glm::vec3(x, terrain.getHeight(x, z), z));
+        world = glm::rotate(world, angle(random), glm::vec3(0, 1, 0));
+        world = glm::scale(world, glm::vec3(scale));
+        instances.push_back(world);
+    }
+}
 
 void processInput(GLFWwindow* window)
 {
@@ -161,6 +400,30 @@ void processInput(GLFWwindow* window)
         glfwSetWindowShouldClose(window, true);
     }
 
+    //toggles the depth pre-pass, once per press
+    static bool prepassKeyDown = false;
+    bool prepassKey = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (prepassKey && !prepassKeyDown)
+        depthPrepass = !depthPrepass;
+    prepassKeyDown = prepassKey;
+
+    //toggles occlusion culling
+    static bool occlusionKeyDown = false;
+    bool occlusionKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (occlusionKey && !occlusionKeyDown)
+        occlusionCulling = !occlusionCulling;
+    occlusionKeyDown = occlusionKey;
+
+    //switches the towers between GPU and CPU culling. The pyramid isn't built while it's off, the one left over
+    //is from another view.
+    static bool gpuCullingKeyDown = false;
+    bool gpuCullingKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gpuCullingKey && !gpuCullingKeyDown && gpuCulling) {
+        gpuCullingEnabled = !gpuCullingEnabled;
+        gpuCulling->invalidate();
+    }
+    gpuCullingKeyDown = gpuCullingKey;
+
 
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.ProcessKeyboard(FORWARD, deltaTime);
@@ -178,6 +441,9 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
+    //the depth pyramid of the old size maps onto the wrong pixels
+    if (gpuCulling)
+        gpuCulling->resize(width, height);
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -241,144 +507,216 @@ int init(GLFWwindow*& window)
         glfwTerminate();
         return -1;
     }
+    GLExtensions::load();
 
     return 0;
 }
 
+//all programs are submitted at once, the driver compiles them while the textures and models load
 void createShaders()
 {
     createProgram(simpleProgram, "shaders/simpleVertext.shader", "shaders/simpleFragment.shader");
     createProgram(skyProgram, "shaders/skyVertexShader.shader", "shaders/skyFragmentShader.shader");
     createProgram(terrainProgram, "shaders/terrainVertexShader.shader", "shaders/terrainFragmentShader.shader");
-    createProgram(modelProgram, "shaders/model.vs", "shaders/model.fs");
-
-    glUseProgram(modelProgram);
-    //set texture channels
-
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_diffuse1"), 0);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_specular1"), 1);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_normal1"), 2);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_roughness1"), 3);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_ao1"), 4);
+    createProgram(terrainFeedbackProgram, "shaders/terrainVertexShader.shader", "shaders/terrainFeedbackFragment.shader");
+    createProgram(terrainBakeProgram, "shaders/terrainBakeVertex.shader", "shaders/terrainBakeFragment.shader");
+    createProgram(terrainDepthProgram, "shaders/terrainVertexShader.shader", "shaders/depthOnlyFragment.shader");
+
+    //the variants are built when a material first needs them, Model::preparePrograms does that at load time
+    std::string modelVertex, modelFragment;
+    loadProgramSources("shaders/model.vs", "shaders/model.fs", modelVertex, modelFragment);
+    modelPrograms = new ShaderVariants(*programCache, modelVertex, modelFragment, Model::programFeatures(), [](Shader& program) {
+        program.bindBlock("Frame", FrameUniforms::FRAME_BLOCK_BINDING);
+        program.bindBlock("Object", FrameUniforms::OBJECT_BLOCK_BINDING);
+        Model::setupProgram(program);
+    });
 
 }
 
-void createProgram(GLuint& programID, const char* vertex, const char* fragment) {
+void createProgram(Shader& program, const char* vertex, const char* fragment) {
     //create a GL program with a vertex & fragment shader
-    char* vertexSource;
-    char* fragmentSource;
+    std::string vertexSource, fragmentSource;
+    loadProgramSources(vertex, fragment, vertexSource, fragmentSource);
 
-    loadFile(vertex, vertexSource);
-    loadFile(fragment, fragmentSource);
+    //loaded from the cache when these sources were linked before, compiled otherwise. Only started here, the
+    //program is finished by a later poll of the cache and nothing draws with it until then
+    programCache->submit(program, vertexSource, fragmentSource, "", [](Shader& linked) {
+        linked.bindBlock("Frame", FrameUniforms::FRAME_BLOCK_BINDING);
+        linked.bindBlock("Object", FrameUniforms::OBJECT_BLOCK_BINDING);
+    });
 
-    GLuint vertexShaderID, fragmentShaderID;
+}
 
-    vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderID, 1, &vertexSource, nullptr);
-    glCompileShader(vertexShaderID);
+bool loadComputeSource(const char* path, std::string& source) {
+    char* text;
+    loadFiles(&path, &text, 1);
 
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertexShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING VERTEX SHADER\n" << infoLog << std::endl;
-    }
-
-    fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderID, 1, &fragmentSource, nullptr);
-    glCompileShader(fragmentShaderID);
+    std::string error;
+    bool ok = ShaderPreprocessor::expand(text ? text : "", path, source, &error);
+    if (!ok)
+        std::cout << "ERROR PREPROCESSING SHADER\n" << error << std::endl;
+    delete[] text;
+    return ok && !source.empty();
+}
 
-    glGetShaderiv(fragmentShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragmentShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING FRAGMENT SHADER\n" << infoLog << std::endl;
+bool loadProgramSources(const char* vertex, const char* fragment, std::string& vertexSource, std::string& fragmentSource) {
+    const char* files[2] = { vertex, fragment };
+    char* sources[2];
+    loadFiles(files, sources, 2);
+
+    //the includes are pasted in here, the GL compiler doesn't know about them
+    std::string* outputs[2] = { &vertexSource, &fragmentSource };
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        std::string error;
+        if (!ShaderPreprocessor::expand(sources[i] ? sources[i] : "", files[i], *outputs[i], &error)) {
+            std::cout << "ERROR PREPROCESSING SHADER\n" << error << std::endl;
+            ok = false;
+        }
+        delete[] sources[i];
     }
+    return ok;
+}
 
-    programID = glCreateProgram();
-    glAttachShader(programID, vertexShaderID);
-    glAttachShader(programID, fragmentShaderID);
-    glLinkProgram(programID);
-
-    glGetProgramiv(programID, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(programID, 512, nullptr, infoLog);
-        std::cout << "ERROR LINKING PROGRAM\n" << infoLog << std::endl;
+void loadFiles(const char* const* filenames, char** outputs, int count) {
+    //the reader fetches all files at once, from the archive or from disk when they aren't packed
+    std::mutex mutex;
+    std::condition_variable finished;
+    int remaining = count;
+
+    for (int i = 0; i < count; i++) {
+        char*& output = outputs[i];
+        fileReader->loadAsset(filenames[i], [&output, &mutex, &finished, &remaining](bool ok, AssetData file) {
+            //if file was succesfully read, copy it into a char pointer with a null terminator
+            if (ok) {
+                output = new char[file.size + 1];
+                memcpy(output, file.data(), file.size);
+                output[file.size] = '\0';
+            }
+            else {
+                //if the file failed to open, set the char pointer to NULL
+                output = NULL;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            remaining--;
+            finished.notify_one();
+        });
     }
 
-
-    //cleanup
-    glDeleteShader(vertexShaderID);
-    glDeleteShader(fragmentShaderID);
-    delete vertexSource;
-    delete fragmentSource;
-
+    //wait for the last one
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&remaining] { return remaining == 0; });
 }
 
-void loadFile(const char* filename, char*& output) {
-    //open the file
-    std::ifstream file(filename, std::ios::binary);
-
-    //if file was succesfully opened
-    if (file.is_open()) {
-        //get file length
-        file.seekg(0, file.end);
-        int length = file.tellg();
-        file.seekg(0, file.beg);
-
-        //allocate memory for char pointer
-        output = new char[length + 1];
+GLuint loadTexture(const char* path, int comp) {
 
-        //read data as a block
-        file.read(output, length);
+    //a cooked version next to the image is used as-is, it's already compressed and has its mipmaps
+    std::string cookedPath = TextureCooker::cookedPath(path);
+    if (uploadQueue && AssetArchive::exists(cookedPath)) {
+        GLuint textureID = uploadQueue->createPlaceholderTexture();
+        GLState::get().editTexture(GL_TEXTURE_2D, textureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        //finer levels stream back in from the file, the residency manager keeps it around
+        std::shared_ptr<UploadTicket> ticket = std::make_shared<UploadTicket>(1);
+        std::shared_ptr<TextureResidency::Source> source = residency ? residency->add(textureID, GL_TEXTURE_2D, ticket) : nullptr;
+
+        //the file is read without blocking, parsing happens on the worker that gets the bytes
+        fileReader->loadAsset(cookedPath, [cookedPath, textureID, ticket, source](bool ok, AssetData file) {
+            CompressedImage cooked;
+            if (!ok || !TextureCooker::parseDds(file, cooked)) {
+                std::cout << "Error loading texture: " << cookedPath << std::endl;
+                ticket->pending--;
+                return;
+            }
+            if (source) {
+                source->width = cooked.width;
+                source->height = cooked.height;
+                source->compressed.push_back(cooked);
+            }
+            uploadQueue->enqueueCompressedTexture(textureID, -1, cooked, ticket);
+        });
+        return textureID;
+    }
 
-        //add null terminator to end of char pointer
-        output[length] = '\0';
+    CompressedImage cooked;
+    if (TextureCooker::readDds(cookedPath, cooked)) {
+        GLuint textureID = TextureCooker::upload(cooked);
 
-        //close the file
-        file.close();
-    }
-    else {
-        //if the file failed to open, set the char pointer to NULL
-        output = NULL;
+        //finer levels stream back in straight from the file mapping
+        if (residency) {
+            std::shared_ptr<TextureResidency::Source> source = residency->add(textureID, GL_TEXTURE_2D, nullptr);
+            source->width = cooked.width;
+            source->height = cooked.height;
+            source->compressed.push_back(cooked);
+        }
+        return textureID;
     }
-}
 
-GLuint loadTexture(const char* path, int comp) {
+    if (uploadQueue) {
+        //show a placeholder, decode on a worker and let the queue upload the pixels later
+        GLuint textureID = uploadQueue->createPlaceholderTexture();
+        GLState::get().editTexture(GL_TEXTURE_2D, textureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        //the residency manager keeps the decoded pixels to rebuild evicted levels from, it waits for the ticket
+        std::shared_ptr<UploadTicket> ticket = std::make_shared<UploadTicket>(1);
+        std::shared_ptr<TextureResidency::Source> source = residency ? residency->add(textureID, GL_TEXTURE_2D, ticket) : nullptr;
+
+        //the file is read without blocking, decoding happens on the worker that gets the bytes
+        std::string file = path;
+        fileReader->loadAsset(file, [file, comp, textureID, ticket, source](bool ok, AssetData bytes) {
+            DecodedImage image;
+            if (!ok || !ImageDecoder::decodeMemory(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size, comp, image)) {
+                std::cout << "Error loading texture: " << file << std::endl;
+                //nothing will be uploaded, the residency manager drops the texture
+                ticket->pending--;
+                return;
+            }
+            if (source) {
+                source->width = image.width;
+                source->height = image.height;
+                source->channels = image.channels;
+                source->pixels.push_back(image.pixels);
+            }
+            uploadQueue->enqueueTexture(textureID, image.width, image.height, image.channels, image.pixels, ticket);
+        });
+        return textureID;
+    }
     
     //Gen & bind ID
     GLuint textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    GLState::get().editTexture(GL_TEXTURE_2D, textureID);
 
     //Set texture parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    //load texture
-    int width, height, numChannels;
-    unsigned char* data = stbi_load(path, &width, &height, &numChannels, comp);
+    //load texture, decoded straight to the channel count of the GL format
+    DecodedImage image;
     //set data
-    if (data) {
-        if (comp != 0) numChannels = comp;
+    if (ImageDecoder::decodeFile(path, comp, image)) {
+        GLenum format = image.channels == 1 ? GL_RED : image.channels == 2 ? GL_RG : image.channels == 3 ? GL_RGB : GL_RGBA;
+        //rows of 1 or 3 channel images aren't necessarily 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.get());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
 
-        if (numChannels == 3) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        }
-        else if (numChannels == 4) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        //the residency manager keeps the pixels
+        if (residency) {
+            std::shared_ptr<TextureResidency::Source> source = residency->add(textureID, GL_TEXTURE_2D);
+            source->width = image.width;
+            source->height = image.height;
+            source->channels = image.channels;
+            source->pixels.push_back(image.pixels);
         }
-        glGenerateMipmap(GL_TEXTURE_2D);
     }
     else {
         std::cout << "Error loading texture: " << path << std::endl;
     }
 
-    //unload texture
-    stbi_image_free(data);
-
-    //unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
-
     return textureID;
 }
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    length = static_cast<size_t>(fileSize.QuadPart);
+    opened = true;
+
+    // mapping an empty file fails, there is nothing to map anyway
+    if (length == 0)
+        return true;
+
+    HANDLE view = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!view)
+    {
+        close();
+        return false;
+    }
+    mappingHandle = view;
+
+    mapping = static_cast<const char*>(MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0));
+    if (!mapping)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mapping)
+        UnmapViewOfFile(mapping);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+
+    mapping = nullptr;
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+    length = 0;
+    opened = false;
+}
+
+void MappedFile::prefetch() const
+{
+#if _WIN32_WINNT >= 0x0602
+    if (!mapping)
+        return;
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<char*>(mapping);
+    range.NumberOfBytes = length;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
+#else
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(file, &info) != 0)
+    {
+        ::close(file);
+        return false;
+    }
+
+    fileDescriptor = file;
+    length = static_cast<size_t>(info.st_size);
+    opened = true;
+
+    // mapping an empty file fails, there is nothing to map anyway
+    if (length == 0)
+        return true;
+
+    void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    mapping = static_cast<const char*>(view);
+    // we read front to back, let the kernel read ahead
+    madvise(view, length, MADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mapping)
+        munmap(const_cast<char*>(mapping), length);
+    if (fileDescriptor >= 0)
+        ::close(fileDescriptor);
+
+    mapping = nullptr;
+    fileDescriptor = -1;
+    length = 0;
+    opened = false;
+}
+
+void MappedFile::prefetch() const
+{
+    if (mapping)
+        madvise(const_cast<char*>(mapping), length, MADV_WILLNEED);
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// a read-only memory mapping of a whole file. The OS pages the contents in on demand, so nothing is copied to the heap.
+class MappedFile
+{
+public:
+    MappedFile() {}
+
+    MappedFile(const std::string& path)
+    {
+        open(path);
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // maps the file, returns false if it can't be opened. An empty file opens fine but has no data.
+    bool open(const std::string& path);
+    void close();
+
+    // asks the OS to read the whole file into the page cache now instead of page by page on first touch
+    void prefetch() const;
+
+    bool isOpen() const { return opened; }
+    const char* data() const { return mapping; }
+    size_t size() const { return length; }
+
+private:
+    const char* mapping = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
+#endif
@@ -0,0 +1,704 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.h"
+#include "AssetArchive.h"
+
+// a loader for Wavefront OBJ/MTL files that doesn't go through Assimp. The file is memory-mapped and split into
+// chunks that are parsed on separate threads, the result is written straight into our Vertex format.
+// It produces the same data as the Assimp path (triangulated, smooth normals when missing, flipped UVs, tangents).
+class ObjLoader
+{
+public:
+    struct Material {
+        string name;
+        // texture paths relative to the obj file, empty when the material doesn't have that map
+        string diffuse, specular, normal, height, roughness, ao;
+    };
+
+    // all triangles that use the same material
+    struct Group {
+        int material;   // index into the materials, -1 when the faces don't have one
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+    };
+
+    // chunks smaller than this aren't worth a thread
+    static const size_t minChunkSize = 1024 * 1024;
+
+    // parses the obj and the mtl files it references. The file is split into up to threadCount chunks, 0 is one per core.
+    static bool load(const string& path, vector<Group>& groups, vector<Material>& materials, unsigned int threadCount = 0)
+    {
+        AssetData file;
+        if (!AssetArchive::load(path, file))
+        {
+            cout << "ERROR::OBJ:: could not open " << path << endl;
+            return false;
+        }
+
+        string directory = path.substr(0, path.find_last_of('/'));
+        const char* begin = file.data();
+        const char* end = begin + file.size;
+
+        // split the file into chunks that end on a line break, one per thread
+        unsigned int threads = threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads, file.size / minChunkSize));
+        vector<Chunk> chunks(chunkCount);
+        const char* chunkBegin = begin;
+        for (size_t i = 0; i < chunkCount; i++)
+        {
+            const char* chunkEnd = (i + 1 == chunkCount) ? end : begin + file.size * (i + 1) / chunkCount;
+            if (chunkEnd < chunkBegin)
+                chunkEnd = chunkBegin;
+            while (chunkEnd < end && *chunkEnd != '\n')
+                chunkEnd++;
+            if (chunkEnd < end)
+                chunkEnd++;
+            chunks[i].begin = chunkBegin;
+            chunks[i].end = chunkEnd;
+            chunkBegin = chunkEnd;
+        }
+
+        forEachParallel(chunks.size(), [&chunks](size_t i) { parseChunk(chunks[i]); });
+
+        // negative indices count back from the last element read, now that we know how many elements came
+        // before each chunk they can be turned into absolute ones
+        Counts base = { 0, 0, 0 };
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            chunks[i].base = base;
+            base.positions += chunks[i].positions.size();
+            base.texCoords += chunks[i].texCoords.size();
+            base.normals += chunks[i].normals.size();
+        }
+        forEachParallel(chunks.size(), [&chunks](size_t i) { resolveRelative(chunks[i]); });
+
+        // merge the attribute arrays
+        vector<glm::vec3> positions, normals;
+        vector<glm::vec2> texCoords;
+        positions.reserve(base.positions);
+        texCoords.reserve(base.texCoords);
+        normals.reserve(base.normals);
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+            texCoords.insert(texCoords.end(), chunks[i].texCoords.begin(), chunks[i].texCoords.end());
+            normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+        }
+
+        // materials come from every mtllib statement in the file
+        map<string, int> materialIndex;
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            for (size_t j = 0; j < chunks[i].materialLibraries.size(); j++)
+                loadMaterials(directory + '/' + chunks[i].materialLibraries[j], materials, materialIndex);
+        }
+
+        // sort the triangles into one list of corners per material, the material carries over chunk boundaries
+        vector<vector<Corner>> groupCorners;
+        map<int, size_t> groupOfMaterial;
+        int material = -1;
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            Chunk& chunk = chunks[i];
+            size_t switchIndex = 0;
+            auto switchMaterial = [&]() {
+                map<string, int>::iterator found = materialIndex.find(chunk.materialSwitches[switchIndex].second);
+                material = found != materialIndex.end() ? found->second : -1;
+                switchIndex++;
+            };
+            for (size_t c = 0; c < chunk.corners.size(); c += 3)
+            {
+                while (switchIndex < chunk.materialSwitches.size() && chunk.materialSwitches[switchIndex].first <= c)
+                    switchMaterial();
+
+                if (groupOfMaterial.find(material) == groupOfMaterial.end())
+                {
+                    groupOfMaterial[material] = groupCorners.size();
+                    groupCorners.push_back(vector<Corner>());
+                    Group group;
+                    group.material = material;
+                    groups.push_back(group);
+                }
+                vector<Corner>& corners = groupCorners[groupOfMaterial[material]];
+                corners.insert(corners.end(), chunk.corners.begin() + c, chunk.corners.begin() + c + 3);
+            }
+            // a usemtl after the last face of the chunk is for the faces of the next one
+            while (switchIndex < chunk.materialSwitches.size())
+                switchMaterial();
+            // the chunk data has been copied into the groups
+            vector<Corner>().swap(chunk.corners);
+        }
+
+        // smooth normals for faces that don't have any, accumulated over every face that shares a position
+        vector<glm::vec3> smoothNormals;
+        bool needsSmoothNormals = false;
+        for (size_t g = 0; g < groupCorners.size() && !needsSmoothNormals; g++)
+        {
+            for (size_t c = 0; c < groupCorners[g].size(); c++)
+            {
+                if (groupCorners[g][c].vn < 0)
+                {
+                    needsSmoothNormals = true;
+                    break;
+                }
+            }
+        }
+        if (needsSmoothNormals)
+        {
+            smoothNormals.assign(positions.size(), glm::vec3(0.0f));
+            for (size_t g = 0; g < groupCorners.size(); g++)
+            {
+                const vector<Corner>& corners = groupCorners[g];
+                for (size_t c = 0; c + 2 < corners.size(); c += 3)
+                {
+                    if (!validPosition(corners[c], positions) || !validPosition(corners[c + 1], positions) || !validPosition(corners[c + 2], positions))
+                        continue;
+                    glm::vec3 a = positions[corners[c].v], b = positions[corners[c + 1].v], d = positions[corners[c + 2].v];
+                    // not normalized, so larger faces weigh more
+                    glm::vec3 faceNormal = glm::cross(b - a, d - a);
+                    for (int k = 0; k < 3; k++)
+                        smoothNormals[corners[c + k].v] += faceNormal;
+                }
+            }
+            for (size_t i = 0; i < smoothNormals.size(); i++)
+            {
+                float length = glm::length(smoothNormals[i]);
+                smoothNormals[i] = length > 0.0f ? smoothNormals[i] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+            }
+        }
+
+        // build the vertex and index buffers, the groups spread over the cores
+        forEachParallel(groups.size(), [&](size_t g) {
+            buildGroup(groups[g], groupCorners[g], positions, texCoords, normals, smoothNormals);
+        });
+        return true;
+    }
+
+    // parses a decimal floating point number like "-1.25e-3" and moves p past it. Digits are gathered into a 64-bit
+    // integer and scaled once at the end, which is a lot faster than strtod and doesn't depend on the locale.
+    static float parseFloat(const char*& p, const char* end)
+    {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        int digits = 0;
+        while (p < end && isDigit(*p))
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    digits++;
+            }
+            else
+            {
+                exponent++;
+            }
+            p++;
+        }
+        if (p < end && *p == '.')
+        {
+            p++;
+            while (p < end && isDigit(*p))
+            {
+                if (digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa != 0)
+                        digits++;
+                    exponent--;
+                }
+                p++;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                negativeExponent = *p++ == '-';
+            int value = 0;
+            while (p < end && isDigit(*p))
+            {
+                if (value < 10000)
+                    value = value * 10 + (*p - '0');
+                p++;
+            }
+            exponent += negativeExponent ? -value : value;
+        }
+
+        double result = static_cast<double>(mantissa);
+        if (exponent >= 0)
+            result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+        else
+            result = exponent >= -22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+        return static_cast<float>(negative ? -result : result);
+    }
+
+private:
+    // 0-based indices into the attribute arrays, -1 when the corner doesn't have one
+    struct Corner {
+        int v, vt, vn;
+    };
+
+    struct Counts {
+        size_t positions, texCoords, normals;
+    };
+
+    // the part of the file one thread parses, and what it found
+    struct Chunk {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        vector<glm::vec3> positions;
+        vector<glm::vec2> texCoords;
+        vector<glm::vec3> normals;
+        // three corners per triangle, polygons are split into a fan
+        vector<Corner> corners;
+        // bit 0, 1 and 2 are set when v, vt or vn of the corner was negative and is still relative to this chunk
+        vector<unsigned char> relative;
+        // corner index at which a usemtl statement switched the material
+        vector<pair<size_t, string>> materialSwitches;
+        vector<string> materialLibraries;
+        // number of elements in all chunks before this one
+        Counts base;
+    };
+
+    static bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    static bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    static void skipBlanks(const char*& p, const char* end)
+    {
+        while (p < end && isBlank(*p))
+            p++;
+    }
+
+    static void skipLine(const char*& p, const char* end)
+    {
+        while (p < end && *p != '\n')
+            p++;
+        if (p < end)
+            p++;
+    }
+
+    // the rest of the line without surrounding whitespace, used for names and paths which may contain spaces
+    static string restOfLine(const char*& p, const char* end)
+    {
+        skipBlanks(p, end);
+        const char* start = p;
+        while (p < end && *p != '\n' && *p != '\r')
+            p++;
+        const char* stop = p;
+        while (stop > start && isBlank(stop[-1]))
+            stop--;
+        return string(start, stop);
+    }
+
+    static bool startsWith(const char* p, const char* end, const char* keyword)
+    {
+        size_t length = strlen(keyword);
+        return static_cast<size_t>(end - p) > length && memcmp(p, keyword, length) == 0 && isBlank(p[length]);
+    }
+
+    static int parseInt(const char*& p, const char* end)
+    {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        int value = 0;
+        while (p < end && isDigit(*p))
+            value = value * 10 + (*p++ - '0');
+        return negative ? -value : value;
+    }
+
+    // turns an obj index into a 0-based one. Negative indices are stored relative to the chunk and flagged.
+    static int toIndex(int index, size_t localCount, unsigned char bit, unsigned char& relative)
+    {
+        if (index > 0)
+            return index - 1;
+        if (index < 0)
+        {
+            relative |= bit;
+            return static_cast<int>(localCount) + index;
+        }
+        return -1;
+    }
+
+    static void parseChunk(Chunk& chunk)
+    {
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+
+        // rough guess of the element counts, keeps reallocations down
+        size_t estimate = (end - p) / 40;
+        chunk.positions.reserve(estimate);
+        chunk.corners.reserve(estimate * 2);
+
+        vector<Corner> polygon;
+        vector<unsigned char> polygonRelative;
+        while (p < end)
+        {
+            skipBlanks(p, end);
+            if (p >= end)
+                break;
+
+            if (p[0] == 'v' && p + 1 < end && isBlank(p[1]))
+            {
+                p += 2;
+                glm::vec3 position;
+                for (int i = 0; i < 3; i++)
+                {
+                    skipBlanks(p, end);
+                    position[i] = parseFloat(p, end);
+                }
+                chunk.positions.push_back(position);
+            }
+            else if (p[0] == 'v' && p + 2 < end && p[1] == 't' && isBlank(p[2]))
+            {
+                p += 3;
+                glm::vec2 texCoord;
+                skipBlanks(p, end);
+                texCoord.x = parseFloat(p, end);
+                skipBlanks(p, end);
+                texCoord.y = parseFloat(p, end);
+                chunk.texCoords.push_back(texCoord);
+            }
+            else if (p[0] == 'v' && p + 2 < end && p[1] == 'n' && isBlank(p[2]))
+            {
+                p += 3;
+                glm::vec3 normal;
+                for (int i = 0; i < 3; i++)
+                {
+                    skipBlanks(p, end);
+                    normal[i] = parseFloat(p, end);
+                }
+                chunk.normals.push_back(normal);
+            }
+            else if (p[0] == 'f' && p + 1 < end && isBlank(p[1]))
+            {
+                p += 2;
+                polygon.clear();
+                polygonRelative.clear();
+                while (true)
+                {
+                    skipBlanks(p, end);
+                    if (p >= end || !(isDigit(*p) || *p == '-' || *p == '+'))
+                        break;
+
+                    // v, v/vt, v//vn or v/vt/vn
+                    unsigned char relative = 0;
+                    Corner corner;
+                    corner.v = toIndex(parseInt(p, end), chunk.positions.size(), 1, relative);
+                    corner.vt = -1;
+                    corner.vn = -1;
+                    if (p < end && *p == '/')
+                    {
+                        p++;
+                        if (p < end && *p != '/')
+                            corner.vt = toIndex(parseInt(p, end), chunk.texCoords.size(), 2, relative);
+                        if (p < end && *p == '/')
+                        {
+                            p++;
+                            corner.vn = toIndex(parseInt(p, end), chunk.normals.size(), 4, relative);
+                        }
+                    }
+                    polygon.push_back(corner);
+                    polygonRelative.push_back(relative);
+                }
+
+                // triangulate as a fan around the first corner
+                for (size_t i = 1; i + 1 < polygon.size(); i++)
+                {
+                    chunk.corners.push_back(polygon[0]);
+                    chunk.corners.push_back(polygon[i]);
+                    chunk.corners.push_back(polygon[i + 1]);
+                    chunk.relative.push_back(polygonRelative[0]);
+                    chunk.relative.push_back(polygonRelative[i]);
+                    chunk.relative.push_back(polygonRelative[i + 1]);
+                }
+            }
+            else if (startsWith(p, end, "usemtl"))
+            {
+                p += 6;
+                chunk.materialSwitches.push_back(make_pair(chunk.corners.size(), restOfLine(p, end)));
+            }
+            else if (startsWith(p, end, "mtllib"))
+            {
+                p += 6;
+                chunk.materialLibraries.push_back(restOfLine(p, end));
+            }
+
+            skipLine(p, end);
+        }
+    }
+
+    static void resolveRelative(Chunk& chunk)
+    {
+        for (size_t i = 0; i < chunk.corners.size(); i++)
+        {
+            unsigned char relative = chunk.relative[i];
+            if (relative == 0)
+                continue;
+            if (relative & 1)
+                chunk.corners[i].v += static_cast<int>(chunk.base.positions);
+            if (relative & 2)
+                chunk.corners[i].vt += static_cast<int>(chunk.base.texCoords);
+            if (relative & 4)
+                chunk.corners[i].vn += static_cast<int>(chunk.base.normals);
+        }
+        vector<unsigned char>().swap(chunk.relative);
+    }
+
+    static bool validPosition(const Corner& corner, const vector<glm::vec3>& positions)
+    {
+        return corner.v >= 0 && corner.v < static_cast<int>(positions.size());
+    }
+
+    struct CornerHash {
+        size_t operator()(const Corner& c) const
+        {
+            uint64_t key = static_cast<uint64_t>(static_cast<uint32_t>(c.v)) * 0x9E3779B97F4A7C15ull;
+            key ^= static_cast<uint64_t>(static_cast<uint32_t>(c.vt)) * 0xC2B2AE3D27D4EB4Full + (key >> 29);
+            key ^= static_cast<uint64_t>(static_cast<uint32_t>(c.vn)) * 0x165667B19E3779F9ull + (key >> 32);
+            return static_cast<size_t>(key);
+        }
+    };
+
+    struct CornerEqual {
+        bool operator()(const Corner& a, const Corner& b) const
+        {
+            return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+        }
+    };
+
+    // creates one vertex per unique v/vt/vn combination and calculates tangents
+    static void buildGroup(Group& group, const vector<Corner>& corners, const vector<glm::vec3>& positions, const vector<glm::vec2>& texCoords,
+                           const vector<glm::vec3>& normals, const vector<glm::vec3>& smoothNormals)
+    {
+        unordered_map<Corner, unsigned int, CornerHash, CornerEqual> unique;
+        unique.reserve(corners.size() / 2);
+        group.indices.reserve(corners.size());
+
+        bool hasTexCoords = false;
+        for (size_t c = 0; c < corners.size(); c++)
+        {
+            const Corner& corner = corners[c];
+            if (!validPosition(corner, positions))
+            {
+                // broken index, point at the first vertex so the triangle collapses instead of reading out of bounds
+                group.indices.push_back(0);
+                continue;
+            }
+
+            pair<unordered_map<Corner, unsigned int, CornerHash, CornerEqual>::iterator, bool> inserted =
+                unique.insert(make_pair(corner, static_cast<unsigned int>(group.vertices.size())));
+            if (inserted.second)
+            {
+                Vertex vertex;
+                memset(static_cast<void*>(&vertex), 0, sizeof(Vertex));
+                vertex.Position = positions[corner.v];
+                if (corner.vn >= 0 && corner.vn < static_cast<int>(normals.size()))
+                    vertex.Normal = normals[corner.vn];
+                else if (!smoothNormals.empty())
+                    vertex.Normal = smoothNormals[corner.v];
+                if (corner.vt >= 0 && corner.vt < static_cast<int>(texCoords.size()))
+                {
+                    // same as aiProcess_FlipUVs
+                    vertex.TexCoords = glm::vec2(texCoords[corner.vt].x, 1.0f - texCoords[corner.vt].y);
+                    hasTexCoords = true;
+                }
+                group.vertices.push_back(vertex);
+            }
+            group.indices.push_back(inserted.first->second);
+        }
+
+        if (hasTexCoords)
+            calculateTangents(group);
+    }
+
+    // per-triangle tangent and bitangent from the UV gradients, averaged over the triangles that share a vertex
+    static void calculateTangents(Group& group)
+    {
+        vector<Vertex>& vertices = group.vertices;
+        for (size_t i = 0; i + 2 < group.indices.size(); i += 3)
+        {
+            Vertex& a = vertices[group.indices[i]];
+            Vertex& b = vertices[group.indices[i + 1]];
+            Vertex& c = vertices[group.indices[i + 2]];
+
+            glm::vec3 edge1 = b.Position - a.Position;
+            glm::vec3 edge2 = c.Position - a.Position;
+            glm::vec2 deltaUV1 = b.TexCoords - a.TexCoords;
+            glm::vec2 deltaUV2 = c.TexCoords - a.TexCoords;
+
+            float determinant = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+            if (std::fabs(determinant) < 1e-12f)
+                continue;
+            float f = 1.0f / determinant;
+
+            glm::vec3 tangent = f * (deltaUV2.y * edge1 - deltaUV1.y * edge2);
+            glm::vec3 bitangent = f * (-deltaUV2.x * edge1 + deltaUV1.x * edge2);
+            a.Tangent += tangent; b.Tangent += tangent; c.Tangent += tangent;
+            a.Bitangent += bitangent; b.Bitangent += bitangent; c.Bitangent += bitangent;
+        }
+
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            if (glm::dot(vertices[i].Tangent, vertices[i].Tangent) > 0.0f)
+                vertices[i].Tangent = glm::normalize(vertices[i].Tangent);
+            if (glm::dot(vertices[i].Bitangent, vertices[i].Bitangent) > 0.0f)
+                vertices[i].Bitangent = glm::normalize(vertices[i].Bitangent);
+        }
+    }
+
+    // texture options like "-bm 0.5" come before the file name, this is how many values each of them takes
+    static int optionArguments(const string& option)
+    {
+        if (option == "-o" || option == "-s" || option == "-t")
+            return 3;
+        if (option == "-mm")
+            return 2;
+        return 1;
+    }
+
+    // the file name of a map_ statement, with windows separators turned into forward slashes
+    static string texturePath(const char*& p, const char* end)
+    {
+        string line = restOfLine(p, end);
+        size_t position = 0;
+        // skip options, the path is whatever is left
+        while (position < line.size() && line[position] == '-')
+        {
+            size_t optionEnd = line.find_first_of(" \t", position);
+            if (optionEnd == string::npos)
+                return "";
+            int arguments = optionArguments(line.substr(position, optionEnd - position));
+            position = optionEnd;
+            for (int i = 0; i < arguments; i++)
+            {
+                position = line.find_first_not_of(" \t", position);
+                if (position == string::npos)
+                    return "";
+                position = line.find_first_of(" \t", position);
+                if (position == string::npos)
+                    return "";
+            }
+            position = line.find_first_not_of(" \t", position);
+            if (position == string::npos)
+                return "";
+        }
+
+        string path;
+        for (size_t i = position; i < line.size(); i++)
+        {
+            char c = line[i] == '\\' ? '/' : line[i];
+            if (c == '/' && !path.empty() && path[path.size() - 1] == '/')
+                continue;
+            path += c;
+        }
+        return path;
+    }
+
+    static void loadMaterials(const string& path, vector<Material>& materials, map<string, int>& materialIndex)
+    {
+        AssetData file;
+        if (!AssetArchive::load(path, file))
+        {
+            cout << "ERROR::OBJ:: could not open material library " << path << endl;
+            return;
+        }
+
+        const char* p = file.data();
+        const char* end = p + file.size;
+        Material* material = nullptr;
+        while (p < end)
+        {
+            skipBlanks(p, end);
+            if (startsWith(p, end, "newmtl"))
+            {
+                p += 6;
+                Material newMaterial;
+                newMaterial.name = restOfLine(p, end);
+                materialIndex[newMaterial.name] = static_cast<int>(materials.size());
+                materials.push_back(newMaterial);
+                material = &materials.back();
+            }
+            else if (material)
+            {
+                // same mapping as Assimp's obj importer, so both paths pick the same samplers
+                if (startsWith(p, end, "map_Kd"))
+                    material->diffuse = texturePath(p += 6, end);
+                else if (startsWith(p, end, "map_Ks"))
+                    material->specular = texturePath(p += 6, end);
+                else if (startsWith(p, end, "map_Bump") || startsWith(p, end, "map_bump"))
+                    material->normal = texturePath(p += 8, end);
+                else if (startsWith(p, end, "bump") || startsWith(p, end, "norm"))
+                    material->normal = texturePath(p += 4, end);
+                else if (startsWith(p, end, "map_disp"))
+                    material->height = texturePath(p += 8, end);
+                else if (startsWith(p, end, "disp"))
+                    material->height = texturePath(p += 4, end);
+                else if (startsWith(p, end, "map_Ns"))
+                    material->roughness = texturePath(p += 6, end);
+                else if (startsWith(p, end, "map_Ka"))
+                    material->ao = texturePath(p += 6, end);
+            }
+            skipLine(p, end);
+        }
+    }
+
+    // runs function(0) ... function(count - 1) on up to a thread per core, each taking the next item until none are
+    // left. Uses plain threads instead of the ThreadPool, since the loader itself may be running on one of the pool's
+    // workers.
+    template<class F>
+    static void forEachParallel(size_t count, F function)
+    {
+        size_t threadCount = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+        if (threadCount <= 1)
+        {
+            for (size_t i = 0; i < count; i++)
+                function(i);
+            return;
+        }
+
+        std::atomic<size_t> next(0);
+        auto work = [&next, count, &function] {
+            for (size_t i = next++; i < count; i = next++)
+                function(i);
+        };
+        vector<std::thread> threads;
+        for (size_t t = 1; t < threadCount; t++)
+            threads.push_back(std::thread(work));
+        work();
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+    }
+};
+#endif
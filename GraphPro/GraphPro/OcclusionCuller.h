@@ -0,0 +1,423 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "FrustumCulling.h"
+#include "ThreadPool.h"
+
+// SSE is always there on x64, and on x86 when the compiler is allowed to use it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// software occlusion culling. Occluders (the terrain, big static meshes) are rasterized on the CPU into a small depth
+// buffer every frame, and the bounding boxes of everything else are tested against it before they're submitted: a box
+// whose every pixel already has something nearer in front of it can't be seen. Nothing touches the GPU, so what's culled
+// is known before a single draw is made, and it works the same without one.
+//
+// The buffer keeps 1/w per pixel, which is linear in screen space and larger for nearer points; 0 is nothing. Next to
+// it is a mask of 8x8 pixel tiles with the farthest value in each, so a box over a tile that's completely covered by
+// nearer occluders is decided without looking at its pixels. The rows are rasterized in bands on the thread pool, four
+// pixels at a time with SSE.
+//
+// Occluders have to be inside what they stand for: a triangle that sticks out of the real surface hides things that
+// can be seen. Pixels are covered when their center is, so at the resolution of the buffer a box can still be culled
+// while a sliver of it is visible through a gap narrower than a pixel.
+class OcclusionCuller
+{
+public:
+    static const int TILE = 8;
+
+    // the size of the buffer, rounded up to whole tiles
+    OcclusionCuller(int _width = 320, int _height = 180)
+    {
+        width = std::max((_width + TILE - 1) / TILE * TILE, TILE);
+        height = std::max((_height + TILE - 1) / TILE * TILE, TILE);
+        tilesX = width / TILE;
+        tilesY = height / TILE;
+        depth.assign(width * height, 0.0f);
+        tileFarthest.assign(tilesX * tilesY, 0.0f);
+    }
+
+    // adds triangles in world space that stay until clearOccluders
+    void addOccluder(const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indices)
+    {
+        uint32_t base = static_cast<uint32_t>(occluderVertices.size());
+        occluderVertices.insert(occluderVertices.end(), vertices.begin(), vertices.end());
+        for (size_t i = 0; i < indices.size(); i++)
+            occluderIndices.push_back(base + indices[i]);
+    }
+
+    void clearOccluders()
+    {
+        occluderVertices.clear();
+        occluderIndices.clear();
+    }
+
+    // rasterizes the occluders as seen through viewProjection. Without a pool everything runs on the calling thread.
+    void render(const glm::mat4& _viewProjection, ThreadPool* pool = nullptr)
+    {
+        viewProjection = _viewProjection;
+        tested = 0;
+        occluded = 0;
+
+        setupTriangles();
+
+        int bands = pool ? std::min(tilesY, static_cast<int>(pool->size()) * 2) : 1;
+        if (bands <= 1)
+        {
+            rasterize(0, tilesY);
+            return;
+        }
+        std::vector<std::future<void>> batches;
+        for (int band = 0; band < bands; band++)
+        {
+            int begin = tilesY * band / bands, end = tilesY * (band + 1) / bands;
+            batches.push_back(pool->async([this, begin, end] { rasterize(begin, end); }));
+        }
+        for (size_t i = 0; i < batches.size(); i++)
+            batches[i].wait();
+    }
+
+    // false when the box is hidden behind the occluders of the last render
+    bool visible(const glm::vec3& min, const glm::vec3& max)
+    {
+        tested++;
+
+        // the rectangle the corners cover on screen and the 1/w of the nearest one
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = 0.0f;
+        for (int c = 0; c < 8; c++)
+        {
+            glm::vec4 clip = viewProjection * glm::vec4((c & 1) ? max.x : min.x, (c & 2) ? max.y : min.y, (c & 4) ? max.z : min.z, 1.0f);
+            // reaches past the near plane, there's nothing in front of it
+            if (clip.z < -clip.w || clip.w <= 0.0f)
+                return true;
+            float invW = 1.0f / clip.w;
+            float x = (clip.x * invW * 0.5f + 0.5f) * width, y = (clip.y * invW * 0.5f + 0.5f) * height;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::max(nearest, invW);
+        }
+
+        // every pixel the rectangle touches
+        int x0 = std::max(static_cast<int>(std::floor(minX)), 0), x1 = std::min(static_cast<int>(std::ceil(maxX)), width);
+        int y0 = std::max(static_cast<int>(std::floor(minY)), 0), y1 = std::min(static_cast<int>(std::ceil(maxY)), height);
+        if (x0 >= x1 || y0 >= y1)
+            return true;
+
+        for (int tileY = y0 / TILE; tileY <= (y1 - 1) / TILE; tileY++)
+        {
+            for (int tileX = x0 / TILE; tileX <= (x1 - 1) / TILE; tileX++)
+            {
+                // the whole tile is nearer than the box
+                if (tileFarthest[tileY * tilesX + tileX] > nearest)
+                    continue;
+                int px0 = std::max(x0, tileX * TILE), px1 = std::min(x1, tileX * TILE + TILE);
+                int py0 = std::max(y0, tileY * TILE), py1 = std::min(y1, tileY * TILE + TILE);
+                for (int y = py0; y < py1; y++)
+                {
+                    const float* row = &depth[y * width];
+                    for (int x = px0; x < px1; x++)
+                    {
+                        if (row[x] <= nearest)
+                            return true;
+                    }
+                }
+            }
+        }
+        occluded++;
+        return false;
+    }
+
+    // the same for a sphere, through the box around it
+    bool visibleSphere(const glm::vec3& center, float radius)
+    {
+        return visible(center - glm::vec3(radius), center + glm::vec3(radius));
+    }
+
+    // drops the boxes in visible, indices into boxes as cullBoxes leaves them, that are hidden. The order is kept.
+    void cull(const BoxArray& boxes, std::vector<uint32_t>& visible)
+    {
+        size_t kept = 0;
+        for (size_t v = 0; v < visible.size(); v++)
+        {
+            uint32_t i = visible[v];
+            glm::vec3 center(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+            glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+            if (this->visible(center - extent, center + extent))
+                visible[kept++] = i;
+        }
+        visible.resize(kept);
+    }
+
+    // the same for spheres
+    void cull(const SphereArray& spheres, std::vector<uint32_t>& visible)
+    {
+        size_t kept = 0;
+        for (size_t v = 0; v < visible.size(); v++)
+        {
+            uint32_t i = visible[v];
+            if (visibleSphere(glm::vec3(spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i]), spheres.radius[i]))
+                visible[kept++] = i;
+        }
+        visible.resize(kept);
+    }
+
+    int bufferWidth() const
+    {
+        return width;
+    }
+
+    int bufferHeight() const
+    {
+        return height;
+    }
+
+    // 1/w per pixel, rows from the bottom of the screen up
+    const std::vector<float>& buffer() const
+    {
+        return depth;
+    }
+
+    // what visible was asked since the last render, and how much of it was hidden
+    unsigned int tested = 0, occluded = 0;
+
+private:
+    int width, height, tilesX, tilesY;
+    std::vector<float> depth;
+    std::vector<float> tileFarthest;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+
+    std::vector<glm::vec3> occluderVertices;
+    std::vector<uint32_t> occluderIndices;
+
+    // a triangle in pixel coordinates: three edge functions that are >= 0 inside, and 1/w as a plane
+    struct ScreenTriangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+        int minX, maxX, minY, maxY;
+    };
+    std::vector<glm::vec4> clipVertices;
+    std::vector<ScreenTriangle> triangles;
+
+    // transforms the occluders, clips them and sets up what the bands rasterize
+    void setupTriangles()
+    {
+        clipVertices.resize(occluderVertices.size());
+        for (size_t i = 0; i < occluderVertices.size(); i++)
+            clipVertices[i] = viewProjection * glm::vec4(occluderVertices[i], 1.0f);
+
+        triangles.clear();
+        for (size_t i = 0; i + 2 < occluderIndices.size(); i += 3)
+        {
+            glm::vec4 polygon[MAX_CLIPPED];
+            polygon[0] = clipVertices[occluderIndices[i]];
+            polygon[1] = clipVertices[occluderIndices[i + 1]];
+            polygon[2] = clipVertices[occluderIndices[i + 2]];
+            int count = clip(polygon);
+            // a fan, clipping can leave more than three corners
+            for (int v = 1; v + 1 < count; v++)
+                addTriangle(polygon[0], polygon[v], polygon[v + 1]);
+        }
+    }
+
+    // triangles are clipped to the near plane, so w stays positive, and to a guard band twice the size of the screen:
+    // a triangle next to the camera would otherwise reach millions of pixels out, where the edge functions lose all
+    // their precision. Each plane adds at most one corner to the polygon.
+    static const int CLIP_PLANES = 5;
+    static const int MAX_CLIPPED = 3 + CLIP_PLANES;
+
+    static float planeDistance(const glm::vec4& p, int plane)
+    {
+        const float guardBand = 2.0f;
+        switch (plane)
+        {
+        case 0:
+            return p.z + p.w;
+        case 1:
+            return guardBand * p.w - p.x;
+        case 2:
+            return guardBand * p.w + p.x;
+        case 3:
+            return guardBand * p.w - p.y;
+        default:
+            return guardBand * p.w + p.y;
+        }
+    }
+
+    // clips the triangle in polygon in place and returns how many corners are left, 0 when nothing is
+    static int clip(glm::vec4* polygon)
+    {
+        // which planes each corner is outside of: all outside one plane is nothing, none outside any is all of it
+        unsigned int outside[3] = {};
+        for (int i = 0; i < 3; i++)
+        {
+            for (int plane = 0; plane < CLIP_PLANES; plane++)
+                outside[i] |= planeDistance(polygon[i], plane) < 0.0f ? 1u << plane : 0u;
+        }
+        if (outside[0] & outside[1] & outside[2])
+            return 0;
+        if ((outside[0] | outside[1] | outside[2]) == 0)
+            return 3;
+
+        int count = 3;
+        glm::vec4 clipped[MAX_CLIPPED];
+        for (int plane = 0; plane < CLIP_PLANES && count > 0; plane++)
+        {
+            int out = 0;
+            for (int i = 0; i < count; i++)
+            {
+                const glm::vec4& p = polygon[i];
+                const glm::vec4& q = polygon[(i + 1) % count];
+                float dp = planeDistance(p, plane), dq = planeDistance(q, plane);
+                if (dp >= 0.0f)
+                    clipped[out++] = p;
+                if ((dp >= 0.0f) != (dq >= 0.0f))
+                    clipped[out++] = p + (q - p) * (dp / (dp - dq));
+            }
+            count = out;
+            for (int i = 0; i < count; i++)
+                polygon[i] = clipped[i];
+        }
+        return count;
+    }
+
+    void addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+    {
+        const glm::vec4* clip[3] = { &a, &b, &c };
+        float x[3], y[3], z[3];
+        for (int i = 0; i < 3; i++)
+        {
+            // at least the near distance after clipping, never 0
+            float invW = 1.0f / clip[i]->w;
+            x[i] = (clip[i]->x * invW * 0.5f + 0.5f) * width;
+            y[i] = (clip[i]->y * invW * 0.5f + 0.5f) * height;
+            z[i] = invW;
+        }
+
+        // both sides are drawn, the edges are turned so the inside is positive either way
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (std::fabs(area) < 1e-8f)
+            return;
+        if (area < 0.0f)
+        {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        ScreenTriangle triangle;
+        float minX = std::min(x[0], std::min(x[1], x[2])), maxX = std::max(x[0], std::max(x[1], x[2]));
+        float minY = std::min(y[0], std::min(y[1], y[2])), maxY = std::max(y[0], std::max(y[1], y[2]));
+        triangle.minX = std::max(static_cast<int>(std::floor(minX)), 0);
+        triangle.maxX = std::min(static_cast<int>(std::ceil(maxX)), width);
+        triangle.minY = std::max(static_cast<int>(std::floor(minY)), 0);
+        triangle.maxY = std::min(static_cast<int>(std::ceil(maxY)), height);
+        if (triangle.minX >= triangle.maxX || triangle.minY >= triangle.maxY)
+            return;
+
+        // edge i runs from vertex i to vertex i + 1, evaluated at pixel centers
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3;
+            triangle.edgeA[i] = y[i] - y[j];
+            triangle.edgeB[i] = x[j] - x[i];
+            triangle.edgeC[i] = x[i] * y[j] - x[j] * y[i];
+        }
+        // 1/w at a point is the barycentric mix of the corners, the weights are the opposite edges over the area
+        float scale = 1.0f / area;
+        triangle.depthA = (triangle.edgeA[1] * z[0] + triangle.edgeA[2] * z[1] + triangle.edgeA[0] * z[2]) * scale;
+        triangle.depthB = (triangle.edgeB[1] * z[0] + triangle.edgeB[2] * z[1] + triangle.edgeB[0] * z[2]) * scale;
+        triangle.depthC = (triangle.edgeC[1] * z[0] + triangle.edgeC[2] * z[1] + triangle.edgeC[0] * z[2]) * scale;
+        triangles.push_back(triangle);
+    }
+
+    // clears and draws the rows of tile rows [tileBegin, tileEnd), then finds the farthest value of each of their tiles
+    void rasterize(int tileBegin, int tileEnd)
+    {
+        int rowBegin = tileBegin * TILE, rowEnd = tileEnd * TILE;
+        std::fill(depth.begin() + rowBegin * width, depth.begin() + rowEnd * width, 0.0f);
+
+        for (size_t t = 0; t < triangles.size(); t++)
+        {
+            const ScreenTriangle& triangle = triangles[t];
+            int y0 = std::max(triangle.minY, rowBegin), y1 = std::min(triangle.maxY, rowEnd);
+            // whole groups of four, the width is a multiple of the tile size
+            int x0 = triangle.minX & ~3, x1 = triangle.maxX;
+            for (int y = y0; y < y1; y++)
+                rasterizeRow(triangle, y, x0, x1);
+        }
+
+        for (int tileY = tileBegin; tileY < tileEnd; tileY++)
+        {
+            for (int tileX = 0; tileX < tilesX; tileX++)
+            {
+                float farthest = FLT_MAX;
+                for (int y = tileY * TILE; y < tileY * TILE + TILE; y++)
+                {
+                    const float* row = &depth[y * width + tileX * TILE];
+                    for (int x = 0; x < TILE; x++)
+                        farthest = std::min(farthest, row[x]);
+                }
+                tileFarthest[tileY * tilesX + tileX] = farthest;
+            }
+        }
+    }
+
+    void rasterizeRow(const ScreenTriangle& triangle, int y, int x0, int x1)
+    {
+        float* row = &depth[y * width];
+        float centerY = y + 0.5f;
+#ifdef OCCLUSION_SSE
+        __m128 edges[3], steps[3];
+        __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        for (int i = 0; i < 3; i++)
+        {
+            // the edge at the centers of the first four pixels, and how much it changes over four
+            __m128 a = _mm_set1_ps(triangle.edgeA[i]);
+            edges[i] = _mm_add_ps(_mm_mul_ps(a, _mm_add_ps(_mm_set1_ps(static_cast<float>(x0)), offsets)), _mm_set1_ps(triangle.edgeB[i] * centerY + triangle.edgeC[i]));
+            steps[i] = _mm_mul_ps(a, _mm_set1_ps(4.0f));
+        }
+        __m128 depthA = _mm_set1_ps(triangle.depthA);
+        __m128 z = _mm_add_ps(_mm_mul_ps(depthA, _mm_add_ps(_mm_set1_ps(static_cast<float>(x0)), offsets)), _mm_set1_ps(triangle.depthB * centerY + triangle.depthC));
+        __m128 zStep = _mm_mul_ps(depthA, _mm_set1_ps(4.0f));
+        __m128 zero = _mm_setzero_ps();
+        for (int x = x0; x < x1; x += 4)
+        {
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edges[0], zero), _mm_cmpge_ps(edges[1], zero)), _mm_cmpge_ps(edges[2], zero));
+            if (_mm_movemask_ps(inside))
+            {
+                __m128 current = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_max_ps(current, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+            }
+            for (int i = 0; i < 3; i++)
+                edges[i] = _mm_add_ps(edges[i], steps[i]);
+            z = _mm_add_ps(z, zStep);
+        }
+#else
+        for (int x = x0; x < x1; x++)
+        {
+            float centerX = x + 0.5f;
+            bool inside = true;
+            for (int i = 0; i < 3; i++)
+                inside = inside && triangle.edgeA[i] * centerX + triangle.edgeB[i] * centerY + triangle.edgeC[i] >= 0.0f;
+            if (inside)
+                row[x] = std::max(row[x], triangle.depthA * centerX + triangle.depthB * centerY + triangle.depthC);
+        }
+#endif
+    }
+};
+#endif
@@ -0,0 +1,104 @@
+#ifndef PIPELINE_STATISTICS_H
+#define PIPELINE_STATISTICS_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+#include "GLExtensions.h"
+
+// counts the fragment shader invocations of each pass of a frame with ARB_pipeline_statistics_query. The results are
+// read a few frames late, when the GPU has them, so measuring never waits for it; fragments() is what the last frame
+// with results counted. Without the extension nothing is measured and every count stays 0.
+class PipelineStatistics
+{
+public:
+    static const int MAX_PASSES = 8;
+
+    PipelineStatistics()
+    {
+        supported = GLExtensions::get().pipelineStatistics;
+        if (supported)
+            glGenQueries(FRAMES * MAX_PASSES, &queries[0][0]);
+    }
+
+    ~PipelineStatistics()
+    {
+        if (supported)
+            glDeleteQueries(FRAMES * MAX_PASSES, &queries[0][0]);
+    }
+
+    // counts the draws that follow towards a pass, until endPass. One pass at a time.
+    void beginPass(int pass)
+    {
+        if (!supported || pass < 0 || pass >= MAX_PASSES)
+            return;
+        glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, queries[current][pass]);
+        issued[current][pass] = true;
+        active = true;
+    }
+
+    void endPass()
+    {
+        if (!active)
+            return;
+        glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+        active = false;
+    }
+
+    // moves on to the next set of queries, picking up the results of the oldest set if the GPU is done with it
+    void endFrame()
+    {
+        if (!supported)
+            return;
+        endPass();
+        current = (current + 1) % FRAMES;
+
+        // the set about to be reused, FRAMES - 1 frames old
+        bool any = false, available = true;
+        for (int pass = 0; pass < MAX_PASSES && available; pass++)
+        {
+            if (!issued[current][pass])
+                continue;
+            GLuint ready = GL_FALSE;
+            glGetQueryObjectuiv(queries[current][pass], GL_QUERY_RESULT_AVAILABLE, &ready);
+            available = ready == GL_TRUE;
+            any = true;
+        }
+        if (any && available)
+        {
+            for (int pass = 0; pass < MAX_PASSES; pass++)
+            {
+                GLuint64 count = 0;
+                if (issued[current][pass])
+                    glGetQueryObjectui64v(queries[current][pass], GL_QUERY_RESULT, &count);
+                counts[pass] = count;
+            }
+        }
+        for (int pass = 0; pass < MAX_PASSES; pass++)
+            issued[current][pass] = false;
+    }
+
+    // fragment shader invocations of a pass, 0 for passes that weren't drawn
+    uint64_t fragments(int pass) const
+    {
+        return pass >= 0 && pass < MAX_PASSES ? counts[pass] : 0;
+    }
+
+    bool available() const
+    {
+        return supported;
+    }
+
+private:
+    // a query is read FRAMES - 1 frames after it was issued
+    static const int FRAMES = 3;
+
+    bool supported = false;
+    bool active = false;
+    int current = 0;
+    GLuint queries[FRAMES][MAX_PASSES] = {};
+    bool issued[FRAMES][MAX_PASSES] = {};
+    uint64_t counts[MAX_PASSES] = {};
+};
+#endif
@@ -0,0 +1,18 @@
+#include "ProgramCache.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <errno.h>
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#endif
+
+bool ProgramCache::makeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
@@ -0,0 +1,332 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "GLExtensions.h"
+#include "MappedFile.h"
+#include "Shader.h"
+
+// builds GL programs from GLSL, keeping the linked binaries on disk. A program whose sources, defines and driver are
+// the same as last time is loaded with glProgramBinary instead of being compiled, so a warm start skips the shader
+// compiler entirely. Any mismatch (new driver, edited shader, a binary the driver refuses) compiles from source and
+// replaces the cached binary.
+//
+// Nothing waits on the compiler: submit only issues the work, and poll picks up the programs the driver has finished
+// (with KHR_parallel_shader_compile it compiles them on its own threads meanwhile). All programs of a start are
+// submitted together, and the rest of loading runs while they build.
+//
+// Each binary is stored as <directory>/<key>.bin, where the key is a hash of everything that went into it. The file
+// repeats the full driver string and the key so a hash collision or a stale file is never loaded.
+class ProgramCache
+{
+public:
+    // the directory is created when the first binary is written
+    ProgramCache(const std::string& _directory = "shadercache") : directory(_directory)
+    {
+        const char* vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+        const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+        const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        driver = std::string(vendor ? vendor : "") + "|" + (renderer ? renderer : "") + "|" + (version ? version : "");
+    }
+
+    // runs on a program once it's linked and reflected, for setup like block bindings
+    typedef std::function<void(Shader&)> Setup;
+
+    // programs loaded from the cache and compiled from source since the cache was created
+    unsigned int hits = 0, misses = 0;
+
+    // starts building a program into shader without waiting for it: the compiles and the link are only issued, or
+    // the binary is handed to the driver. The shader gets its program id right away but isn't ready() until a poll
+    // finds the program done. The defines go right after the #version line of both shaders, one "#define" per line.
+    // The shader must stay where it is until it's ready.
+    void submit(Shader& shader, const std::string& vertexSource, const std::string& fragmentSource, const std::string& defines = "", Setup setup = Setup())
+    {
+        Pending build;
+        build.shader = &shader;
+        build.setup = setup;
+        build.program = glCreateProgram();
+        shader.setPending(build.program);
+
+        GLExtensions& gl = GLExtensions::get();
+        if (gl.programBinary)
+        {
+            build.key = hash(driver);
+            build.key = hash(defines, build.key);
+            build.key = hash(vertexSource, build.key);
+            build.key = hash(fragmentSource, build.key);
+            build.path = cachePath(build.key);
+            if (load(build.path, build.key, build.program))
+            {
+                // kept in case the driver refuses the binary
+                build.fromBinary = true;
+                build.vertexSource = vertexSource;
+                build.fragmentSource = fragmentSource;
+                build.defines = defines;
+                pending.push_back(build);
+                return;
+            }
+        }
+        compile(build, vertexSource, fragmentSource, defines);
+        pending.push_back(build);
+    }
+
+    // finishes the programs the driver is done with: reports errors, stores the binary, reflects the program and runs
+    // its setup. With parallel shader compile this never waits, without it there's no way to ask whether a program is
+    // done, so the first poll waits for all of them. Returns how many programs are still being built.
+    size_t poll()
+    {
+        GLExtensions& gl = GLExtensions::get();
+        for (size_t i = 0; i < pending.size();)
+        {
+            GLint complete = GL_TRUE;
+            if (gl.parallelShaderCompile)
+                glGetProgramiv(pending[i].program, GL_COMPLETION_STATUS_KHR, &complete);
+            if (complete && finish(pending[i]))
+            {
+                pending[i] = pending.back();
+                pending.pop_back();
+            }
+            else
+                i++;
+        }
+        return pending.size();
+    }
+
+    // waits for every program that's still being built
+    void finishAll()
+    {
+        while (!pending.empty())
+        {
+            for (size_t i = 0; i < pending.size();)
+            {
+                if (finish(pending[i]))
+                {
+                    pending[i] = pending.back();
+                    pending.pop_back();
+                }
+                else
+                    i++;
+            }
+        }
+    }
+
+    size_t pendingCount() const
+    {
+        return pending.size();
+    }
+
+    // inserts the defines after the #version line, or at the start if there is none. A #line directive after them
+    // keeps compiler messages on the lines of the source (GLSL 3.30 numbers the line after "#line n" as n + 1).
+    static std::string applyDefines(const std::string& source, const std::string& defines)
+    {
+        if (defines.empty())
+            return source;
+        size_t version = source.find("#version");
+        if (version == std::string::npos)
+            return defines + "\n#line 0\n" + source;
+        size_t lineEnd = source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return source + "\n" + defines + "\n";
+        return source.substr(0, lineEnd + 1) + defines + "\n#line 1\n" + source.substr(lineEnd + 1);
+    }
+
+private:
+    static const uint32_t magic = 0x42504750;
+    static const uint32_t version = 1;
+
+    std::string directory;
+    std::string driver;
+
+    // 64 bit FNV-1a
+    static uint64_t hash(const std::string& text, uint64_t seed = 14695981039346656037ull)
+    {
+        uint64_t value = seed;
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            value ^= static_cast<unsigned char>(text[i]);
+            value *= 1099511628211ull;
+        }
+        // strings next to each other hash differently from one string of both
+        value ^= text.size();
+        value *= 1099511628211ull;
+        return value;
+    }
+
+    std::string cachePath(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+        return directory + "/" + name;
+    }
+
+    // creates the cache directory if it's not there yet (ProgramCache.cpp)
+    static bool makeDirectory(const std::string& path);
+
+    // a program the driver is still working on
+    struct Pending {
+        Shader* shader = nullptr;
+        Setup setup;
+        GLuint program = 0;
+        // attached until the program is finished, 0 for a program loaded from a binary
+        GLuint vertexShader = 0, fragmentShader = 0;
+        // empty when the program isn't cached
+        std::string path;
+        uint64_t key = 0;
+        bool fromBinary = false;
+        std::string vertexSource, fragmentSource, defines;
+    };
+
+    std::vector<Pending> pending;
+
+    // issues the compiles and the link without asking for their status, asking would wait for the compiler
+    void compile(Pending& build, const std::string& vertexSource, const std::string& fragmentSource, const std::string& defines)
+    {
+        misses++;
+        std::string vertex = applyDefines(vertexSource, defines);
+        std::string fragment = applyDefines(fragmentSource, defines);
+        const char* vertexText = vertex.c_str();
+        const char* fragmentText = fragment.c_str();
+
+        build.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(build.vertexShader, 1, &vertexText, nullptr);
+        glCompileShader(build.vertexShader);
+
+        build.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(build.fragmentShader, 1, &fragmentText, nullptr);
+        glCompileShader(build.fragmentShader);
+
+        // has to be set before linking, or the driver may not keep the binary around
+        if (!build.path.empty())
+            GLExtensions::get().ProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glAttachShader(build.program, build.vertexShader);
+        glAttachShader(build.program, build.fragmentShader);
+        glLinkProgram(build.program);
+    }
+
+    // false when the program has to go around again: a binary the driver refused is compiled from source into the
+    // same program object, so the id the shader already has stays valid
+    bool finish(Pending& build)
+    {
+        GLint linked = 0;
+        glGetProgramiv(build.program, GL_LINK_STATUS, &linked);
+        if (build.fromBinary)
+        {
+            if (!linked)
+            {
+                // the driver can refuse a binary for its own reasons, even one it made
+                build.fromBinary = false;
+                compile(build, build.vertexSource, build.fragmentSource, build.defines);
+                return false;
+            }
+            hits++;
+        }
+        else
+        {
+            char infoLog[512];
+            GLint success = 0;
+            glGetShaderiv(build.vertexShader, GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                glGetShaderInfoLog(build.vertexShader, 512, nullptr, infoLog);
+                std::cout << "ERROR COMPILING VERTEX SHADER\n" << infoLog << std::endl;
+            }
+            glGetShaderiv(build.fragmentShader, GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                glGetShaderInfoLog(build.fragmentShader, 512, nullptr, infoLog);
+                std::cout << "ERROR COMPILING FRAGMENT SHADER\n" << infoLog << std::endl;
+            }
+            if (!linked)
+            {
+                glGetProgramInfoLog(build.program, 512, nullptr, infoLog);
+                std::cout << "ERROR LINKING PROGRAM\n" << infoLog << std::endl;
+            }
+
+            glDetachShader(build.program, build.vertexShader);
+            glDetachShader(build.program, build.fragmentShader);
+            glDeleteShader(build.vertexShader);
+            glDeleteShader(build.fragmentShader);
+            build.vertexShader = build.fragmentShader = 0;
+            if (linked && !build.path.empty())
+                store(build.program, build.path, build.key);
+        }
+
+        // a program that failed to link stays not ready, whatever draws with it is never drawn
+        if (linked)
+        {
+            build.shader->reflect(build.program);
+            if (build.setup)
+                build.setup(*build.shader);
+        }
+        return true;
+    }
+
+    // file: magic, version, key (64 bit), binary format, driver string length, binary length, driver string, binary.
+    // Only hands the binary to the driver, whether it takes it is known once the program is finished.
+    bool load(const std::string& path, uint64_t key, GLuint program)
+    {
+        MappedFile file;
+        if (!file.open(path) || file.size() < headerSize)
+            return false;
+
+        const char* data = file.data();
+        uint32_t fileMagic, fileVersion, format, driverLength, binaryLength;
+        uint64_t fileKey;
+        memcpy(&fileMagic, data, 4);
+        memcpy(&fileVersion, data + 4, 4);
+        memcpy(&fileKey, data + 8, 8);
+        memcpy(&format, data + 16, 4);
+        memcpy(&driverLength, data + 20, 4);
+        memcpy(&binaryLength, data + 24, 4);
+        if (fileMagic != magic || fileVersion != version || fileKey != key
+            || static_cast<uint64_t>(headerSize) + driverLength + binaryLength != file.size()
+            || driver.compare(0, std::string::npos, data + headerSize, driverLength) != 0)
+            return false;
+
+        GLExtensions::get().ProgramBinary(program, format, data + headerSize + driverLength, static_cast<GLsizei>(binaryLength));
+        return true;
+    }
+
+    void store(GLuint program, const std::string& path, uint64_t key)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(static_cast<size_t>(length));
+        GLenum format = 0;
+        GLsizei written = 0;
+        GLExtensions::get().GetProgramBinary(program, length, &written, &format, binary.data());
+        if (written <= 0)
+            return;
+
+        uint32_t header[7] = { magic, version, 0, 0, format, static_cast<uint32_t>(driver.size()), static_cast<uint32_t>(written) };
+        memcpy(&header[2], &key, 8);
+
+        // written under a temporary name first, a half-written file must never be loaded
+        makeDirectory(directory);
+        std::string temporary = path + ".tmp";
+        FILE* out = fopen(temporary.c_str(), "wb");
+        if (!out)
+            return;
+        bool ok = fwrite(header, sizeof(header), 1, out) == 1
+            && fwrite(driver.data(), driver.size(), 1, out) == 1
+            && fwrite(binary.data(), static_cast<size_t>(written), 1, out) == 1;
+        ok = fclose(out) == 0 && ok;
+        remove(path.c_str());
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+            remove(temporary.c_str());
+    }
+
+    static const size_t headerSize = 28;
+};
+#endif
@@ -0,0 +1,269 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.h"
+#include "GLState.h"
+#include "OcclusionCuller.h"
+#include "PipelineStatistics.h"
+
+class FrameUniforms;
+
+class Drawable;
+
+// collects the draws of a frame as packets with a 64 bit sort key and draws them in key order. The key puts the pass
+// first, then the program, the material and the vertex array, so draws that share state end up next to each other and
+// the state cache has the least to switch. The view distance comes last: among draws with the same state the nearest
+// one is drawn first, which lets early depth testing skip what's behind it.
+//
+// The passes run in enum order and the queue sets their depth and color state, drawables only set their own (culling,
+// programs, textures):
+//   depth:       optional, depth only. Drawables with expensive fragment shaders submit a packet here as well when
+//                depthPrepass() is on, so the opaque pass shades every pixel about once.
+//   opaque:      LEQUAL, so what the depth pass laid down passes again. Depth is still written, for opaque draws
+//                that didn't take part in the depth pass.
+//   sky:         drawn at the far plane with LEQUAL and without writing depth, it only shades the pixels nothing
+//                else covered.
+//   transparent: LEQUAL, no depth writes.
+//
+// Key layout, from the top bit down:
+//   depth, opaque and sky: pass (4) | program (12) | material (12) | vertex array (12) | depth (24)
+//   transparent:           pass (4) | inverted depth (24) | program (12) | material (12) | vertex array (12)
+// Blending needs back to front above everything else, so transparent packets sort on depth first. Names are cut to
+// 12 bits, two that share the low bits only end up in the wrong place in the order, they're still drawn.
+//
+// The keys are sorted with an LSD radix sort on bytes, which is linear in the number of packets; bytes every key has
+// the same value in are skipped.
+//
+// With a PipelineStatistics set, the fragment shader invocations of each pass are counted. With an OcclusionCuller
+// set, drawables also leave out what's hidden behind its occluders.
+class RenderQueue
+{
+public:
+    enum Pass {
+        PASS_DEPTH = 0,
+        PASS_OPAQUE = 1,
+        PASS_SKY = 2,
+        PASS_TRANSPARENT = 3,
+        PASS_COUNT = 4
+    };
+
+    // the sort key of a packet, depth comes from depth or depthBits
+    static uint64_t key(Pass pass, GLuint program, unsigned int material, GLuint vertexArray, uint32_t depth)
+    {
+        uint64_t state = (static_cast<uint64_t>(program & 0xFFF) << 24) | (static_cast<uint64_t>(material & 0xFFF) << 12) | (vertexArray & 0xFFF);
+        uint64_t top = static_cast<uint64_t>(pass & 0xF) << 60;
+        if (pass == PASS_TRANSPARENT)
+            return top | (static_cast<uint64_t>(0xFFFFFF - (depth & 0xFFFFFF)) << 36) | state;
+        return top | (state << 24) | (depth & 0xFFFFFF);
+    }
+
+    // a view distance as 24 bits, nearer is smaller. Distances past the far plane all get the largest value.
+    static uint32_t depthBits(float distance, float farPlane)
+    {
+        if (!(distance > 0.0f))
+            return 0;
+        if (distance >= farPlane)
+            return 0xFFFFFF;
+        return static_cast<uint32_t>(distance / farPlane * 16777215.0f);
+    }
+
+    // starts a new frame seen from eye through viewProjection, the packets of the last one are dropped. The frustum
+    // planes are extracted once here, for every drawable to cull against.
+    void begin(const glm::vec3& _eye, float _farPlane, const glm::mat4& viewProjection)
+    {
+        eye = _eye;
+        farPlane = _farPlane;
+        view.extract(viewProjection);
+        packets.clear();
+        frameNumber++;
+    }
+
+    // the frustum of the frame, what's completely outside it shouldn't be submitted
+    const Frustum& frustum() const
+    {
+        return view;
+    }
+
+    // the depth of a bounding sphere: the distance from the eye to the nearest point of it, 0 when the eye is inside
+    uint32_t depth(const glm::vec3& center, float radius) const
+    {
+        return depthBits(glm::length(center - eye) - radius, farPlane);
+    }
+
+    // counts up with every begin, drawables that keep per frame data use it to notice a new frame
+    unsigned int frame() const
+    {
+        return frameNumber;
+    }
+
+    // whether drawables should submit depth pass packets, off by default
+    bool depthPrepass() const
+    {
+        return prepass;
+    }
+
+    void setDepthPrepass(bool enabled)
+    {
+        prepass = enabled;
+    }
+
+    // the occlusion culler of the frame, rendered before anything is submitted. Null when there's none.
+    OcclusionCuller* occlusion() const
+    {
+        return occluders;
+    }
+
+    void setOcclusion(OcclusionCuller* _occlusion)
+    {
+        occluders = _occlusion;
+    }
+
+    // counts the fragments of each pass into statistics, null to stop
+    void setStatistics(PipelineStatistics* _statistics)
+    {
+        statistics = _statistics;
+    }
+
+    static Pass passOf(uint64_t key)
+    {
+        return static_cast<Pass>(key >> 60);
+    }
+
+    void submit(uint64_t key, Drawable* drawable, unsigned int item = 0)
+    {
+        Packet packet;
+        packet.key = key;
+        packet.drawable = drawable;
+        packet.item = item;
+        packets.push_back(packet);
+    }
+
+    // sorts the packets and draws them pass by pass, defined after Drawable
+    inline void execute(FrameUniforms& frame);
+
+    size_t size() const
+    {
+        return packets.size();
+    }
+
+private:
+    struct Packet {
+        uint64_t key;
+        Drawable* drawable;
+        unsigned int item;
+    };
+
+    // what the sort moves around, smaller than a packet
+    struct SortEntry {
+        uint64_t key;
+        uint32_t packet;
+    };
+
+    std::vector<Packet> packets;
+    std::vector<SortEntry> order, scratch;
+    unsigned int frameNumber = 0;
+    bool prepass = false;
+    PipelineStatistics* statistics = nullptr;
+    OcclusionCuller* occluders = nullptr;
+    glm::vec3 eye = glm::vec3(0.0f);
+    Frustum view;
+    float farPlane = 1.0f;
+
+    // the depth and color state of a pass
+    static void beginPass(Pass pass)
+    {
+        GLState& state = GLState::get();
+        state.enable(GL_DEPTH_TEST);
+        state.depthFunc(pass == PASS_DEPTH ? GL_LESS : GL_LEQUAL);
+        state.depthMask(pass == PASS_DEPTH || pass == PASS_OPAQUE);
+        state.colorMask(pass != PASS_DEPTH);
+    }
+
+    void sort()
+    {
+        size_t count = packets.size();
+        order.resize(count);
+        scratch.resize(count);
+        if (count == 0)
+            return;
+
+        // the histograms of all eight bytes in one pass over the keys
+        uint32_t histograms[8][256] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t key = packets[i].key;
+            order[i].key = key;
+            order[i].packet = static_cast<uint32_t>(i);
+            for (int byte = 0; byte < 8; byte++)
+                histograms[byte][(key >> (byte * 8)) & 0xFF]++;
+        }
+
+        for (int byte = 0; byte < 8; byte++)
+        {
+            uint32_t* histogram = histograms[byte];
+            int shift = byte * 8;
+            // every key has the same value here, the pass wouldn't move anything
+            if (histogram[(order[0].key >> shift) & 0xFF] == count)
+                continue;
+
+            uint32_t offset = 0;
+            for (int value = 0; value < 256; value++)
+            {
+                uint32_t n = histogram[value];
+                histogram[value] = offset;
+                offset += n;
+            }
+            // stable, so the lower bytes sorted by earlier passes keep their order
+            for (size_t i = 0; i < count; i++)
+                scratch[histogram[(order[i].key >> shift) & 0xFF]++] = order[i];
+            order.swap(scratch);
+        }
+    }
+};
+
+// something that puts draw packets in a render queue and draws them once the queue gets to them. The item is
+// whatever the drawable passed along with the packet, like the index of a mesh; the pass is the one of its key.
+class Drawable
+{
+public:
+    virtual ~Drawable() {}
+
+    virtual void draw(RenderQueue::Pass pass, unsigned int item, FrameUniforms& frame) = 0;
+};
+
+void RenderQueue::execute(FrameUniforms& frame)
+{
+    sort();
+    int current = -1;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const Packet& packet = packets[order[i].packet];
+        Pass pass = passOf(packet.key);
+        if (pass != current)
+        {
+            if (statistics)
+            {
+                statistics->endPass();
+                statistics->beginPass(pass);
+            }
+            beginPass(pass);
+            current = pass;
+        }
+        packet.drawable->draw(pass, packet.item, frame);
+    }
+
+    if (statistics)
+        statistics->endFrame();
+    // glClear follows the masks, the next frame has to be able to clear
+    GLState& state = GLState::get();
+    state.depthMask(GL_TRUE);
+    state.colorMask(GL_TRUE);
+}
+#endif
@@ -0,0 +1,255 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "GLState.h"
+
+// a uniform of a linked program. The location is looked up once, setting it is a single GL call. Setting a uniform
+// the program doesn't use (location -1) does nothing, like it does in GL.
+struct Uniform {
+    GLint location = -1;
+    GLenum type = 0;
+
+    void set(int value) const
+    {
+        assert(location < 0 || type == GL_INT || type == GL_BOOL);
+        glUniform1i(location, value);
+    }
+
+    void set(float value) const
+    {
+        assert(location < 0 || type == GL_FLOAT);
+        glUniform1f(location, value);
+    }
+
+    void set(const glm::vec3& value) const
+    {
+        assert(location < 0 || type == GL_FLOAT_VEC3);
+        glUniform3fv(location, 1, glm::value_ptr(value));
+    }
+
+    void set(const glm::vec4& value) const
+    {
+        assert(location < 0 || type == GL_FLOAT_VEC4);
+        glUniform4fv(location, 1, glm::value_ptr(value));
+    }
+
+    // a whole array, from its first element
+    void set(const glm::vec4* values, int count) const
+    {
+        assert(location < 0 || type == GL_FLOAT_VEC4);
+        glUniform4fv(location, count, glm::value_ptr(values[0]));
+    }
+
+    void set(const glm::mat4& value) const
+    {
+        assert(location < 0 || type == GL_FLOAT_MAT4);
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+};
+
+// a sampler of a linked program with the texture unit it reads from and the texture target that goes with its type
+struct Sampler {
+    int unit = -1;
+    GLenum target = 0;
+
+    // binds a texture to the sampler's unit. A sampler the program doesn't use has no unit and binds nothing.
+    void bind(GLuint texture) const
+    {
+        if (unit < 0)
+            return;
+        GLState::get().bindTexture(unit, target, texture);
+    }
+};
+
+// a linked program and everything it reflects: every active uniform is looked up once after linking, and every
+// sampler gets a texture unit of its own. Code that draws with the program fetches the Uniform and Sampler handles it
+// needs when it's set up, the draws themselves never look anything up by name.
+class Shader
+{
+public:
+    GLuint id = 0;
+
+    Shader() {}
+
+    explicit Shader(GLuint program)
+    {
+        reflect(program);
+    }
+
+    // a program that's still being compiled or linked (see ProgramCache::submit). The id is known, but nothing can
+    // be drawn with it or looked up in it until it's ready.
+    void setPending(GLuint program)
+    {
+        id = program;
+        uniforms.clear();
+        linked = false;
+    }
+
+    // whether the program is linked and reflected. Draws that need a program which isn't ready are skipped until it is.
+    bool ready() const
+    {
+        return linked;
+    }
+
+    // reads the active uniforms of a linked program and assigns the sampler units, the program is left in use
+    void reflect(GLuint program)
+    {
+        id = program;
+        uniforms.clear();
+        linked = true;
+
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(static_cast<size_t>(std::max(maxLength, 1)));
+
+        GLState::get().useProgram(program);
+
+        int nextUnit = 0;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, static_cast<GLuint>(i), maxLength, &length, &size, &type, name.data());
+
+            Info info;
+            info.location = glGetUniformLocation(program, name.data());
+            // members of uniform blocks have no location, they're set through the buffer
+            if (info.location < 0)
+                continue;
+            info.name.assign(name.data(), static_cast<size_t>(length));
+            // arrays are reported as their first element, they're found by their own name
+            if (info.name.size() > 3 && info.name.compare(info.name.size() - 3, 3, "[0]") == 0)
+                info.name.resize(info.name.size() - 3);
+            info.type = type;
+            info.target = samplerTarget(type);
+            if (info.target)
+            {
+                info.unit = nextUnit++;
+                glUniform1i(info.location, info.unit);
+            }
+            uniforms.push_back(info);
+        }
+        std::sort(uniforms.begin(), uniforms.end(), [](const Info& a, const Info& b) { return a.name < b.name; });
+    }
+
+    void use() const
+    {
+        GLState::get().useProgram(id);
+    }
+
+    // the handle of a uniform, inactive if the program doesn't use it. Meant for setup, keep the handle around.
+    Uniform uniform(const char* name) const
+    {
+        Uniform handle;
+        const Info* info = find(name);
+        if (info)
+        {
+            handle.location = info->location;
+            handle.type = info->type;
+        }
+        return handle;
+    }
+
+    Sampler sampler(const char* name) const
+    {
+        Sampler handle;
+        const Info* info = find(name);
+        if (info && info->target)
+        {
+            handle.unit = info->unit;
+            handle.target = info->target;
+        }
+        return handle;
+    }
+
+    // moves a sampler to a given unit, for textures that are bound by code that doesn't know the program. The caller
+    // makes sure no other sampler of the program is left on that unit. The program has to be in use.
+    Sampler assignUnit(const char* name, int unit)
+    {
+        Info* info = const_cast<Info*>(find(name));
+        if (info && info->target)
+        {
+            info->unit = unit;
+            glUniform1i(info->location, unit);
+        }
+        return sampler(name);
+    }
+
+    // points a uniform block of the program at a binding, programs without the block are left alone
+    void bindBlock(const char* name, GLuint binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(id, name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(id, index, binding);
+    }
+
+    // how many texture units the samplers use, units from this one up are free
+    int unitCount() const
+    {
+        int count = 0;
+        for (unsigned int i = 0; i < uniforms.size(); i++)
+            count = std::max(count, uniforms[i].unit + 1);
+        return count;
+    }
+
+private:
+    struct Info {
+        std::string name;
+        GLint location = -1;
+        GLenum type = 0;
+        GLenum target = 0;
+        int unit = -1;
+    };
+
+    // sorted by name
+    std::vector<Info> uniforms;
+    bool linked = false;
+
+    const Info* find(const char* name) const
+    {
+        auto found = std::lower_bound(uniforms.begin(), uniforms.end(), name, [](const Info& info, const char* key) { return strcmp(info.name.c_str(), key) < 0; });
+        if (found == uniforms.end() || found->name != name)
+            return nullptr;
+        return &*found;
+    }
+
+    // the texture target a sampler type reads, 0 if the type isn't a sampler
+    static GLenum samplerTarget(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_SAMPLER_1D: case GL_SAMPLER_1D_SHADOW: case GL_INT_SAMPLER_1D: case GL_UNSIGNED_INT_SAMPLER_1D:
+            return GL_TEXTURE_1D;
+        case GL_SAMPLER_2D: case GL_SAMPLER_2D_SHADOW: case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+            return GL_TEXTURE_2D;
+        case GL_SAMPLER_3D: case GL_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_3D:
+            return GL_TEXTURE_3D;
+        case GL_SAMPLER_CUBE: case GL_SAMPLER_CUBE_SHADOW: case GL_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+            return GL_TEXTURE_CUBE_MAP;
+        case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_ARRAY_SHADOW: case GL_INT_SAMPLER_2D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+            return GL_TEXTURE_2D_ARRAY;
+        case GL_SAMPLER_BUFFER: case GL_INT_SAMPLER_BUFFER: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+            return GL_TEXTURE_BUFFER;
+        case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW: case GL_INT_SAMPLER_2D_RECT: case GL_UNSIGNED_INT_SAMPLER_2D_RECT:
+            return GL_TEXTURE_RECTANGLE;
+        case GL_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE:
+            return GL_TEXTURE_2D_MULTISAMPLE;
+        default:
+            return 0;
+        }
+    }
+};
+#endif
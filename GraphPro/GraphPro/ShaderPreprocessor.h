@@ -0,0 +1,110 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include <string>
+#include <vector>
+
+#include "AssetArchive.h"
+
+// expands the #include "file" lines of GLSL sources, which the GL compiler doesn't understand. Paths are relative to
+// the file doing the include, and every file is pasted in once no matter how often it's included, so an include can
+// pull in what it depends on itself.
+//
+// #line directives keep compiler messages pointing at the right place: an error at "3:12" is on line 12 of the
+// fourth file, in the order they were first included (0 is the shader itself).
+class ShaderPreprocessor
+{
+public:
+    // expands the includes of a shader read from path. Returns false and says why in error when an included file
+    // can't be read.
+    static bool expand(const std::string& source, const std::string& path, std::string& output, std::string* error = nullptr)
+    {
+        std::vector<std::string> files;
+        files.push_back(AssetArchive::normalize(path));
+        output.clear();
+        output.reserve(source.size());
+        return expandFile(source, 0, files, output, error, 0);
+    }
+
+private:
+    static const int maxDepth = 16;
+
+    static bool expandFile(const std::string& source, int fileIndex, std::vector<std::string>& files, std::string& output, std::string* error, int depth)
+    {
+        std::string directory = files[fileIndex];
+        size_t slash = directory.find_last_of('/');
+        directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+
+        int line = 0;
+        size_t start = 0;
+        while (start < source.size())
+        {
+            size_t end = source.find('\n', start);
+            if (end == std::string::npos)
+                end = source.size();
+            line++;
+
+            std::string name;
+            if (!includeName(source, start, end, name))
+            {
+                output.append(source, start, end - start);
+                output += '\n';
+                start = end + 1;
+                continue;
+            }
+            start = end + 1;
+
+            std::string includePath = AssetArchive::normalize(directory + name);
+            bool seen = false;
+            for (unsigned int i = 0; i < files.size(); i++)
+                seen = seen || files[i] == includePath;
+            if (seen)
+            {
+                // keeps the line numbers of the rest of the file right
+                output += '\n';
+                continue;
+            }
+
+            AssetData included;
+            if (depth >= maxDepth || !AssetArchive::load(includePath, included))
+            {
+                if (error)
+                    *error = files[fileIndex] + "(" + std::to_string(line) + "): can't include " + includePath;
+                return false;
+            }
+
+            int includeIndex = static_cast<int>(files.size());
+            files.push_back(includePath);
+            // GLSL 3.30 numbers the line after "#line n" as n + 1
+            output += "#line 0 " + std::to_string(includeIndex) + "\n";
+            if (!expandFile(std::string(included.data(), included.size), includeIndex, files, output, error, depth + 1))
+                return false;
+            output += "#line " + std::to_string(line) + " " + std::to_string(fileIndex) + "\n";
+        }
+        return true;
+    }
+
+    // the quoted file name if the line is an #include, whitespace is allowed around the # like the C preprocessor does
+    static bool includeName(const std::string& source, size_t start, size_t end, std::string& name)
+    {
+        size_t i = start;
+        while (i < end && (source[i] == ' ' || source[i] == '\t'))
+            i++;
+        if (i == end || source[i] != '#')
+            return false;
+        i++;
+        while (i < end && (source[i] == ' ' || source[i] == '\t'))
+            i++;
+        if (source.compare(i, 7, "include") != 0)
+            return false;
+        size_t open = source.find('"', i + 7);
+        if (open == std::string::npos || open >= end)
+            return false;
+        size_t close = source.find('"', open + 1);
+        if (close == std::string::npos || close >= end)
+            return false;
+        name = source.substr(open + 1, close - open - 1);
+        return true;
+    }
+};
+#endif
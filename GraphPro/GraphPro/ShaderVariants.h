@@ -0,0 +1,63 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ProgramCache.h"
+#include "Shader.h"
+
+// the specialized programs of one shader. Each feature is a define the shader checks with #ifdef, and every
+// combination of features is compiled into its own program, so a program only does the work the thing drawn with it
+// needs. A variant is built the first time it's asked for and kept; through the program cache that's a binary load
+// on every start after the first. Variants build in the background like every other program, preparing them all
+// up front only issues the work.
+class ShaderVariants
+{
+public:
+    // runs on every variant once it's linked, for the setup all variants share (block bindings, fixed sampler units)
+    typedef ProgramCache::Setup Setup;
+
+    // the sources have their includes expanded already, bit i of a feature mask turns on features[i]
+    ShaderVariants(ProgramCache& _cache, const std::string& _vertexSource, const std::string& _fragmentSource, const std::vector<std::string>& _features, Setup _setup = Setup())
+        : cache(_cache), vertexSource(_vertexSource), fragmentSource(_fragmentSource), features(_features), setup(_setup)
+    {
+    }
+
+    // the program for a set of features. Bits without a feature are ignored. A variant asked for the first time is
+    // only submitted to the cache, it's not ready() until a later ProgramCache::poll.
+    const Shader& get(unsigned int mask)
+    {
+        mask &= (1u << features.size()) - 1;
+        std::map<unsigned int, Shader>::iterator found = variants.find(mask);
+        if (found != variants.end())
+            return found->second;
+
+        std::string defines;
+        for (unsigned int i = 0; i < features.size(); i++)
+        {
+            if (mask & (1u << i))
+                defines += (defines.empty() ? "#define " : "\n#define ") + features[i];
+        }
+
+        Shader& shader = variants[mask];
+        cache.submit(shader, vertexSource, fragmentSource, defines, setup);
+        return shader;
+    }
+
+    // how many variants have been built so far
+    size_t count() const
+    {
+        return variants.size();
+    }
+
+private:
+    ProgramCache& cache;
+    std::string vertexSource, fragmentSource;
+    std::vector<std::string> features;
+    Setup setup;
+    // map nodes don't move, references handed out by get stay valid
+    std::map<unsigned int, Shader> variants;
+};
+#endif
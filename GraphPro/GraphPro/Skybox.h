@@ -8,49 +8,62 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.h"
+#include "Shader.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "FrameUniforms.h"
 
 
-class Skybox
+class Skybox : public Drawable
 {
 	private:
 
 	public:
 	GLuint program;
+    //may still be compiling, the sky isn't drawn until it's ready
+    const Shader* shader;
     GLuint VAO;
     int boxSize, boxIndexCount;
 
-    Skybox(GLuint& _program) {
+    Skybox(const Shader& _program) {
         createGeometry(VAO, boxSize, boxIndexCount);
-        program = _program;
+        shader = &_program;
+        program = _program.id;
     }
 
-    void renderSkyBox(Camera _cam, glm::vec3 _lightDir, glm::mat4 _projection) {
-        //glDisable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glDisable(GL_DEPTH);
+    //the sky goes in the sky pass, after everything opaque. The shader puts it on the far plane, so with LEQUAL only
+    //the pixels nothing else covered run its fragment shader
+    void submit(RenderQueue& _queue) {
+        if (!shader->ready()) return;
+        _queue.submit(RenderQueue::key(RenderQueue::PASS_SKY, program, 0, VAO, 0xFFFFFF), this);
+    }
+
+    void draw(RenderQueue::Pass /*_pass*/, unsigned int /*_item*/, FrameUniforms& _frame) {
+        renderSkyBox(_frame);
+    }
+
+    //the camera, projection and light come from the frame uniforms
+    void renderSkyBox(FrameUniforms& _frame) {
+        if (!shader->ready()) return;
+
+        //every pass sets the state it needs, the state cache drops what's already set. The depth test and mask are
+        //the sky pass's, set by the render queue
+        GLState& state = GLState::get();
+        state.disable(GL_CULL_FACE);
 
         //createGeometry(boxVAO, boxEBO, boxSize, boxIndexCount);
 
-        glUseProgram(program);
+        state.useProgram(program);
         //matrices
         glm::mat4 world = glm::mat4(1.0f);
-        world = glm::translate(world, _cam.Position);
+        world = glm::translate(world, _frame.cameraPosition());
         world = glm::scale(world, glm::vec3(1, 1, 1));
 
-        glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
-        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(_cam.GetViewMatrix()));
-        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(_projection));
-
-        glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(_lightDir));
-        glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(_cam.Position));
+        _frame.setWorld(world);
 
         //rendering
-        glBindVertexArray(VAO);
+        state.bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, boxIndexCount, GL_UNSIGNED_INT, 0);
-
-        //glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-        glEnable(GL_DEPTH);
     }
 
     void createGeometry(GLuint& VAO, int& size, int& numIndices)
@@ -125,7 +138,7 @@ class Skybox
         //referentie naar de vertex array
         glGenVertexArrays(1, &VAO);
         //configuratie id, binding
-        glBindVertexArray(VAO);
+        GLState::get().bindVertexArray(VAO);
 
         glGenBuffers(1, &VBO);
         //configuratie id, binding
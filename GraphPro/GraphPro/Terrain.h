@@ -7,10 +7,21 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "camera.h"
-#include "stb_image.h"
+#include <vector>
 
-class Terrain
+#include "camera.h"
+#include "Shader.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "FrameUniforms.h"
+#include "ImageDecoder.h"
+#include "UploadQueue.h"
+#include "TextureResidency.h"
+#include "VirtualTexture.h"
+#include "FrustumCulling.h"
+#include "OcclusionCuller.h"
+
+class Terrain : public Drawable
 {
 	private:
 	const char* heightmap;
@@ -23,18 +34,70 @@ class Terrain
 
 	GLuint dirt, sand, grass, rock, snow;
 
+	//heightmap samples in world units, kept for placing objects on the terrain
+	std::vector<float> heights;
+	int heightsWidth = 0, heightsHeight = 0;
+	float xzScale;
+
+	//the grid is cut into tiles of TILE_QUADS x TILE_QUADS quads, each a range of the index buffer in row order. Tiles
+	//outside the frustum aren't drawn, neighbouring visible tiles are drawn as one range.
+	static const int TILE_QUADS = 32;
+	struct TerrainTile {
+		GLsizei firstIndex, indexCount;
+		glm::vec3 boundsMin, boundsMax;
+	};
+	std::vector<TerrainTile> tiles;
+	BoxArray tileBounds;
+	std::vector<uint32_t> visibleTiles;
+	//the occluder is a coarse copy of the grid, one vertex every OCCLUDER_STEP samples. It has to divide TILE_QUADS.
+	static const int OCCLUDER_STEP = 8;
+	//the ranges cull found, for glMultiDrawElements
+	std::vector<GLsizei> drawCounts;
+	std::vector<const void*> drawOffsets;
+
+	//set while the heightmap and vertex data are still queued for upload
+	UploadQueue* uploads;
+	std::shared_ptr<UploadTicket> uploadTicket;
+
+	//unique albedo for the whole terrain, pages are baked from the layer textures once they're loaded
+	VirtualTexture* virtualTexture = nullptr;
+	GLuint feedbackProgram, bakeProgram;
+	GLuint bakeVAO;
+	int screenHeight = 0;
+
+	//the programs can still be compiling when the terrain is made, nothing is drawn until they're ready
+	const Shader* shader;
+	const Shader* feedbackShader = nullptr;
+	const Shader* bakeShader = nullptr;
+	//draws the terrain into the depth pre-pass, optional
+	const Shader* depthShader = nullptr;
+	bool handlesResolved = false;
+
+	//handles of the three programs, looked up once they're ready. The camera, projection and light come from the frame uniforms.
+	Sampler mainTex, normalTex, pageTable, pageAtlas;
+	Sampler feedbackHeightmap;
+	Uniform pageRect, pageLevel;
+	Sampler bakeSamplers[6];
+	float hScale;
+	bool layersLoaded = false;
+
 	public:
 	GLuint program;
 	int boxSize, indexCount;
+	glm::vec3 position = glm::vec3(-700, -20, -700);
 
-	Terrain(GLuint& _program, const char* _heightmap, GLuint _normalmapID, float _hScale, float _xzScale) {
-		program = _program;
+	Terrain(const Shader& _program, const char* _heightmap, GLuint _normalmapID, float _hScale, float _xzScale, UploadQueue* _uploads = nullptr) {
+		shader = &_program;
+		program = _program.id;
+		uploads = _uploads;
 		heightmap = _heightmap;
 		normalmapID = _normalmapID;
 		format = GL_RGBA;
+		xzScale = _xzScale;
+		hScale = _hScale;
 		//comp = 4;
 
-		terrainVAO = generatePlane(_hScale, _xzScale, indexCount);
+		terrainVAO = generatePlane(_hScale, _xzScale);
 	}
 
 	void assignTextures(GLuint _dirt, GLuint _sand, GLuint _grass, GLuint _rock, GLuint _snow) {
@@ -43,84 +106,341 @@ class Terrain
 		grass = _grass;
 		rock = _rock;
 		snow = _snow;
+	}
+
+	//sets up the virtual texture: the feedback program draws the terrain into a target 1/8th the size of the screen,
+	//the bake program fills pages of the atlas
+	void enableVirtualTexture(const Shader& _feedbackProgram, const Shader& _bakeProgram, const Shader& _program, int _screenWidth, int _screenHeight) {
+		feedbackShader = &_feedbackProgram;
+		bakeShader = &_bakeProgram;
+		shader = &_program;
+		feedbackProgram = _feedbackProgram.id;
+		bakeProgram = _bakeProgram.id;
+		program = _program.id;
+		screenHeight = _screenHeight;
+		handlesResolved = false;
+
+		//512 pages of 128 texels per side, about 26 texels per world unit with the default heightmap, in a 24x24 page atlas
+		virtualTexture = new VirtualTexture(512, 24, glm::max(_screenWidth / 8, 1), glm::max(_screenHeight / 8, 1), [this](int _level, const glm::vec4& _uvRect) { bakePage(_level, _uvRect); });
+
+		//the bake draws a triangle without vertex data, but core profile still wants a VAO
+		glGenVertexArrays(1, &bakeVAO);
+	}
+
+	//the program for the depth pre-pass: the terrain vertex shader with a fragment shader that does nothing. Without it
+	//the terrain isn't in the depth pass and its fragment shader runs for every layer of hills in view.
+	void enableDepthPrepass(const Shader& _depthProgram) {
+		depthShader = &_depthProgram;
+	}
+
+	//has to be called before glfwTerminate, while the GL context is still there
+	void releaseVirtualTexture() {
+		delete virtualTexture;
+		virtualTexture = nullptr;
+	}
+
+	//adds the terrain to the occluders, in world space at the current position. Each vertex of the coarse grid takes the
+	//lowest height around it, so the occluder stays under the real surface and only hides what the hills hide. The
+	//tile boxes are lowered to take in their part of it, a tile can't be hidden by its own occluder.
+	void addOccluder(OcclusionCuller& _occlusion) {
+		if (heights.empty()) return;
+
+		//the coarse columns and rows, the last sample always among them
+		std::vector<int> columns, rows;
+		for (int x = 0; x < heightsWidth - 1; x += OCCLUDER_STEP) columns.push_back(x);
+		columns.push_back(heightsWidth - 1);
+		for (int z = 0; z < heightsHeight - 1; z += OCCLUDER_STEP) rows.push_back(z);
+		rows.push_back(heightsHeight - 1);
+
+		std::vector<glm::vec3> vertices;
+		for (unsigned int r = 0; r < rows.size(); r++) {
+			for (unsigned int c = 0; c < columns.size(); c++) {
+				//the lowest sample of the coarse quads that share this vertex
+				int x0 = columns[c > 0 ? c - 1 : c], x1 = columns[c + 1 < columns.size() ? c + 1 : c];
+				int z0 = rows[r > 0 ? r - 1 : r], z1 = rows[r + 1 < rows.size() ? r + 1 : r];
+				float low = heights[z0 * heightsWidth + x0];
+				for (int z = z0; z <= z1; z++)
+					for (int x = x0; x <= x1; x++)
+						low = glm::min(low, heights[z * heightsWidth + x]);
+				vertices.push_back(position + glm::vec3(columns[c] * xzScale, low, rows[r] * xzScale));
+			}
+		}
+
+		std::vector<uint32_t> indices;
+		uint32_t rowLength = (uint32_t)columns.size();
+		for (uint32_t r = 0; r + 1 < rows.size(); r++) {
+			for (uint32_t c = 0; c + 1 < columns.size(); c++) {
+				uint32_t vertex = r * rowLength + c;
+				indices.insert(indices.end(), { vertex, vertex + rowLength, vertex + rowLength + 1, vertex, vertex + rowLength + 1, vertex + 1 });
+			}
+		}
+		_occlusion.addOccluder(vertices, indices);
+
+		//tile edges are on the coarse grid, the coarse vertices inside a tile's range are all its occluder touches
+		for (unsigned int t = 0; t < tiles.size(); t++) {
+			TerrainTile& tile = tiles[t];
+			for (unsigned int i = 0; i < vertices.size(); i++) {
+				glm::vec3 local = vertices[i] - position;
+				if (local.x >= tile.boundsMin.x && local.x <= tile.boundsMax.x && local.z >= tile.boundsMin.z && local.z <= tile.boundsMax.z)
+					tile.boundsMin.y = glm::min(tile.boundsMin.y, local.y);
+			}
+		}
+	}
 
-		glUseProgram(program);
-		//set texture channels
-		glUniform1i(glGetUniformLocation(program, "mainTex"), 0);
-		glUniform1i(glGetUniformLocation(program, "normalTex"), 1);
+	//finds the tiles in the frustum and, with an occlusion culler, the ones that aren't behind the occluders. Once per
+	//frame before anything of the terrain is drawn.
+	void cull(const Frustum& _frustum, OcclusionCuller* _occlusion = nullptr) {
+		tileBounds.resize(tiles.size());
+		for (unsigned int i = 0; i < tiles.size(); i++)
+			tileBounds.set(i, tiles[i].boundsMin + position, tiles[i].boundsMax + position);
+		FrustumCulling::cullBoxes(_frustum, tileBounds, visibleTiles);
+		if (_occlusion)
+			_occlusion->cull(tileBounds, visibleTiles);
+
+		//the indices come back in order, tiles that follow each other in the buffer merge
+		drawCounts.clear();
+		drawOffsets.clear();
+		GLsizei end = -1;
+		for (unsigned int v = 0; v < visibleTiles.size(); v++) {
+			const TerrainTile& tile = tiles[visibleTiles[v]];
+			if (tile.firstIndex == end)
+				drawCounts.back() += tile.indexCount;
+			else {
+				drawCounts.push_back(tile.indexCount);
+				drawOffsets.push_back((const void*)(tile.firstIndex * sizeof(unsigned int)));
+			}
+			end = tile.firstIndex + tile.indexCount;
+		}
+	}
+
+	//how many tiles the last cull kept, and how many there are
+	size_t visibleTileCount() const {
+		return visibleTiles.size();
+	}
 
-		glUniform1i(glGetUniformLocation(program, "dirt"), 2);
-		glUniform1i(glGetUniformLocation(program, "sand"), 3);
-		glUniform1i(glGetUniformLocation(program, "grass"), 4);
-		glUniform1i(glGetUniformLocation(program, "rock"), 5);
-		glUniform1i(glGetUniformLocation(program, "snow"), 6);
+	size_t tileCount() const {
+		return tiles.size();
 	}
 
-	void renderTerrain(Camera _cam, glm::vec3 _lightPos, glm::mat4 _projection) {
-		glEnable(GL_DEPTH);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
+	//draws the page feedback and bakes the pages it asked for last time, once per frame before renderTerrain
+	void updateVirtualTexture(FrameUniforms& _frame) {
+		if (!virtualTexture || !programsReady() || !texturesLoaded()) return;
 
-		glCullFace(GL_BACK);
+		virtualTexture->update();
+
+		if (virtualTexture->beginFeedback()) {
+			GLState& state = GLState::get();
+			state.enable(GL_DEPTH_TEST);
+			state.enable(GL_CULL_FACE);
+			state.cullFace(GL_BACK);
+
+			state.useProgram(feedbackProgram);
+			glm::mat4 world = glm::translate(glm::mat4(1.0f), position);
+			_frame.setWorld(world);
+			feedbackHeightmap.bind(heightmapID);
+
+			state.bindVertexArray(terrainVAO);
+			drawVisibleTiles();
+
+			virtualTexture->endFeedback();
+		}
+	}
+
+	//returns the world space height of the terrain below a world space x/z position
+	float getHeight(float _x, float _z) {
+		if (heights.empty()) return position.y;
+
+		//to heightmap coordinates
+		float fx = glm::clamp((_x - position.x) / xzScale, 0.0f, (float)(heightsWidth - 1));
+		float fz = glm::clamp((_z - position.z) / xzScale, 0.0f, (float)(heightsHeight - 1));
+		int x0 = (int)fx, z0 = (int)fz;
+		int x1 = glm::min(x0 + 1, heightsWidth - 1), z1 = glm::min(z0 + 1, heightsHeight - 1);
+		float tx = fx - x0, tz = fz - z0;
+
+		//bilinear interpolation between the four surrounding samples
+		float h0 = glm::mix(heights[z0 * heightsWidth + x0], heights[z0 * heightsWidth + x1], tx);
+		float h1 = glm::mix(heights[z1 * heightsWidth + x0], heights[z1 * heightsWidth + x1], tx);
+		return position.y + glm::mix(h0, h1, tz);
+	}
+
+	//the terrain is always right below the camera and its textures repeat across it, so they're wanted at full resolution
+	void requestTextures(TextureResidency& _residency) {
+		_residency.request(normalmapID, 0);
+		_residency.request(dirt, 0);
+		_residency.request(sand, 0);
+		_residency.request(grass, 0);
+		_residency.request(rock, 0);
+		_residency.request(snow, 0);
+	}
+
+	//the camera is always on the terrain, it sorts as the nearest thing there is. Only the tiles of the last cull are
+	//drawn, with none of them in view nothing is submitted.
+	void submit(RenderQueue& _queue) {
+		if (uploadTicket && !uploadTicket->resident()) return;
+		if (!programsReady()) return;
+		if (drawCounts.empty()) return;
+		_queue.submit(RenderQueue::key(RenderQueue::PASS_OPAQUE, program, 0, terrainVAO, 0), this);
+		if (_queue.depthPrepass() && depthShader && depthShader->ready())
+			_queue.submit(RenderQueue::key(RenderQueue::PASS_DEPTH, depthShader->id, 0, terrainVAO, 0), this);
+	}
+
+	void draw(RenderQueue::Pass _pass, unsigned int /*_item*/, FrameUniforms& _frame) {
+		if (_pass == RenderQueue::PASS_DEPTH)
+			renderDepth(_frame);
+		else
+			renderTerrain(_frame);
+	}
 
-		glUseProgram(program);
+	void renderTerrain(FrameUniforms& _frame) {
+		//nothing to draw until the vertex data is on the GPU and the programs are linked
+		if (uploadTicket && !uploadTicket->resident()) return;
+		if (!programsReady()) return;
 
+		GLState& state = GLState::get();
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
+
+		state.useProgram(program);
+		setWorld(_frame);
+
+		//bind textures
+		mainTex.bind(heightmapID);
+		normalTex.bind(normalmapID);
+
+		pageTable.bind(virtualTexture ? virtualTexture->pageTable : 0);
+		pageAtlas.bind(virtualTexture ? virtualTexture->atlas : 0);
+
+		//rendering
+		state.bindVertexArray(terrainVAO);
+		drawVisibleTiles();
+	}
+
+	//the same triangles without textures or shading, the render queue has color writes off
+	void renderDepth(FrameUniforms& _frame) {
+		if (uploadTicket && !uploadTicket->resident()) return;
+		if (!depthShader || !depthShader->ready()) return;
+
+		GLState& state = GLState::get();
+		state.enable(GL_CULL_FACE);
+		state.cullFace(GL_BACK);
+
+		state.useProgram(depthShader->id);
+		setWorld(_frame);
+
+		state.bindVertexArray(terrainVAO);
+		drawVisibleTiles();
+	}
+
+	private:
+	//the ranges of the tiles the last cull kept, one call for all of them
+	void drawVisibleTiles() {
+		if (drawCounts.empty()) return;
+		glMultiDrawElements(GL_TRIANGLES, &drawCounts[0], GL_UNSIGNED_INT, &drawOffsets[0], (GLsizei)drawCounts.size());
+	}
+
+	void setWorld(FrameUniforms& _frame) {
 		//matrices
 		glm::mat4 world = glm::mat4(1.0f);
-		world = glm::translate(world, glm::vec3(-700, -20, -700));
+		world = glm::translate(world, position);
 		//world = glm::scale(world, glm::vec3(0.5f, 0.5f, 0.5f));
 
-		glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
-		glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(_cam.GetViewMatrix()));
-		glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(_projection));
+		_frame.setWorld(world);
+	}
 
-		glUniform3fv(glGetUniformLocation(program, "lightPosition"), 1, glm::value_ptr(_lightPos));
-		glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(_cam.Position));
-		
-		//bind textures
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, heightmapID);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, normalmapID);
-
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, dirt);
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, sand);
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, grass);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, rock);
-		glActiveTexture(GL_TEXTURE6);
-		glBindTexture(GL_TEXTURE_2D, snow);
+	//looks up the handles and sets the constant uniforms the first time all programs are ready
+	bool programsReady() {
+		if (handlesResolved) return true;
+		if (!shader->ready()) return false;
+		if (virtualTexture && (!feedbackShader->ready() || !bakeShader->ready())) return false;
+
+		mainTex = shader->sampler("mainTex");
+		normalTex = shader->sampler("normalTex");
+		//the layers are only sampled when baking virtual texture pages
+		pageTable = shader->sampler("pageTable");
+		pageAtlas = shader->sampler("pageAtlas");
+
+		if (virtualTexture) {
+			//shares the vertex shader, which displaces the plane by the heightmap
+			feedbackHeightmap = feedbackShader->sampler("mainTex");
+			pageRect = bakeShader->uniform("pageRect");
+			pageLevel = bakeShader->uniform("pageLevel");
+			const char* bakeNames[6] = { "heightmap", "dirt", "sand", "grass", "rock", "snow" };
+			for (int i = 0; i < 6; i++)
+				bakeSamplers[i] = bakeShader->sampler(bakeNames[i]);
+
+			GLState::get().useProgram(bakeProgram);
+			bakeShader->uniform("heightScale").set(hScale);
+			bakeShader->uniform("terrainY").set(position.y);
+
+			GLState::get().useProgram(feedbackProgram);
+			virtualTexture->setUniforms(*feedbackShader);
+			feedbackShader->uniform("vtMipBias").set(virtualTexture->feedbackBias(screenHeight));
+
+			GLState::get().useProgram(program);
+			virtualTexture->setUniforms(*shader);
+		}
+		handlesResolved = true;
+		return true;
+	}
 
-		//rendering
-		glBindVertexArray(terrainVAO);
-		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+	//pages baked from placeholders would stay grey, so nothing is baked until the heightmap and layers are uploaded
+	bool texturesLoaded() {
+		if (layersLoaded) return true;
+		if (uploadTicket && !uploadTicket->resident()) return false;
+
+		GLuint layers[5] = { dirt, sand, grass, rock, snow };
+		for (int i = 0; i < 5; i++) {
+			//placeholders are 1x1, the residency manager may have moved the base level of a loaded texture
+			GLint baseLevel = 0, width = 0;
+			GLState::get().editTexture(GL_TEXTURE_2D, layers[i]);
+			glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &baseLevel);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, baseLevel, GL_TEXTURE_WIDTH, &width);
+			if (width <= 1) return false;
+		}
+		layersLoaded = true;
+		return true;
+	}
+
+	//draws one page of the virtual texture into the viewport the virtual texture set up
+	void bakePage(int _level, const glm::vec4& _uvRect) {
+		GLState& state = GLState::get();
+		state.disable(GL_DEPTH_TEST);
+		state.disable(GL_CULL_FACE);
 
-		glDisable(GL_CULL_FACE);
-		glDisable(GL_DEPTH);
-		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_CULL_FACE);
+		state.useProgram(bakeProgram);
+		pageRect.set(_uvRect);
+		pageLevel.set((float)_level);
+
+		GLuint textures[6] = { heightmapID, dirt, sand, grass, rock, snow };
+		for (int i = 0; i < 6; i++)
+			bakeSamplers[i].bind(textures[i]);
+
+		state.bindVertexArray(bakeVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
 	}
 
-	unsigned int generatePlane(float _hScale, float _xzScale, int _indexCount) {
+	unsigned int generatePlane(float _hScale, float _xzScale) {
 
-		int width, height, channels;
+		int width, height;
 		unsigned char* data = nullptr;
-
-		if (heightmap != nullptr) {
-			data = stbi_load(heightmap, &width, &height, &channels, comp);
-			if (data) {
+		DecodedImage decoded;
+
+		if (heightmap != nullptr && ImageDecoder::decodeFile(heightmap, comp, decoded)) {
+			data = static_cast<unsigned char*>(decoded.pixels.get());
+			width = decoded.width;
+			height = decoded.height;
+			if (data && uploads) {
+				heightmapID = uploads->createPlaceholderTexture();
+			}
+			else if (data) {
 				glGenTextures(1, &heightmapID);
-				glBindTexture(GL_TEXTURE_2D, heightmapID);
+				GLState::get().editTexture(GL_TEXTURE_2D, heightmapID);
 
 				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
 				glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 				glGenerateMipmap(GL_TEXTURE_2D);
-				glBindTexture(GL_TEXTURE_2D, 0);
 			}
 		}
 
@@ -128,6 +448,10 @@ class Terrain
 		float* vertices = new float[(width * height) * stride];
 		unsigned int* indices = new unsigned int[(width - 1) * (height - 1) * 6];
 
+		heightsWidth = width;
+		heightsHeight = height;
+		heights.resize(width * height);
+
 		int index = 0;
 		for (int i = 0; i < (width * height); i++) {
 			//calculate x/z values
@@ -135,6 +459,7 @@ class Terrain
 			int z = i / width;
 
 			float texHeight = (float)data[i * comp];
+			heights[i] = (texHeight / 255.0f) * _hScale;
 
 			//set position
 			vertices[index++] = x * _xzScale;
@@ -151,21 +476,42 @@ class Terrain
 			vertices[index++] = z / (float)height;
 		}
 
+		//the quads tile by tile, so every tile is one range of indices. The tiles on the far edges can be smaller.
 		index = 0;
-		for (int i = 0; i < (width - 1) * (height - 1); i++) {
-			//calculate x/z values
-			int x = i % (width - 1);
-			int z = i / (width - 1);
-
-			int vertex = z * width + x;
-
-			indices[index++] = vertex;
-			indices[index++] = vertex + width;
-			indices[index++] = vertex + width + 1;
-
-			indices[index++] = vertex;
-			indices[index++] = vertex + width + 1;
-			indices[index++] = vertex + 1;
+		tiles.clear();
+		for (int tileZ = 0; tileZ < height - 1; tileZ += TILE_QUADS) {
+			for (int tileX = 0; tileX < width - 1; tileX += TILE_QUADS) {
+				int endX = glm::min(tileX + TILE_QUADS, width - 1);
+				int endZ = glm::min(tileZ + TILE_QUADS, height - 1);
+
+				TerrainTile tile;
+				tile.firstIndex = index;
+				float low = heights[tileZ * width + tileX], high = low;
+				for (int z = tileZ; z < endZ; z++) {
+					for (int x = tileX; x < endX; x++) {
+						int vertex = z * width + x;
+
+						indices[index++] = vertex;
+						indices[index++] = vertex + width;
+						indices[index++] = vertex + width + 1;
+
+						indices[index++] = vertex;
+						indices[index++] = vertex + width + 1;
+						indices[index++] = vertex + 1;
+					}
+				}
+				//the box goes around the vertices, which reach one past the last quad
+				for (int z = tileZ; z <= endZ; z++) {
+					for (int x = tileX; x <= endX; x++) {
+						low = glm::min(low, heights[z * width + x]);
+						high = glm::max(high, heights[z * width + x]);
+					}
+				}
+				tile.indexCount = index - tile.firstIndex;
+				tile.boundsMin = glm::vec3(tileX * _xzScale, low, tileZ * _xzScale);
+				tile.boundsMax = glm::vec3(endX * _xzScale, high, endZ * _xzScale);
+				tiles.push_back(tile);
+			}
 		}
 
 		unsigned int vertSize = (width * height) * stride * sizeof(float);
@@ -176,12 +522,24 @@ class Terrain
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 
-		glBindVertexArray(VAO);
+		GLState::get().bindVertexArray(VAO);
 
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertSize, vertices, GL_STATIC_DRAW);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+		if (uploads) {
+			//the queue takes ownership of the arrays and frees them after the upload
+			uploadTicket = std::make_shared<UploadTicket>(3);
+			uploads->enqueueTexture(heightmapID, width, height, comp, decoded.pixels, uploadTicket);
+			uploads->enqueueBuffer(VBO, std::shared_ptr<void>(vertices, [](void* p) { delete[] (float*)p; }), vertSize, uploadTicket);
+			uploads->enqueueBuffer(EBO, std::shared_ptr<void>(indices, [](void* p) { delete[] (unsigned int*)p; }), indexCount * sizeof(unsigned int), uploadTicket);
+			data = nullptr;
+			vertices = nullptr;
+			indices = nullptr;
+		}
+		else {
+			glBufferData(GL_ARRAY_BUFFER, vertSize, vertices, GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+		}
 
 		// vertex information!
 		// position
@@ -196,13 +554,11 @@ class Terrain
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		glBindVertexArray(0);
+		GLState::get().bindVertexArray(0);
 
 		delete[] vertices;
 		delete[] indices;
 
-		stbi_image_free(data);
-
 		return VAO;
 	}
 };
@@ -0,0 +1,468 @@
+#ifndef TEXTURE_COOKER_H
+#define TEXTURE_COOKER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CompressedImage.h"
+#include "GLState.h"
+#include "ImageDecoder.h"
+#include "AssetArchive.h"
+
+// turns images into block-compressed DDS files with a full mip chain, offline, so loading a texture is a file read and
+// a glCompressedTexImage2D per level: no decoding, no glGenerateMipmap, and a quarter to an eighth of the memory.
+//   BC1 for opaque color, BC3 for color with alpha, BC5 for normal maps (x and y only, z is rebuilt in the shader)
+// Cooked files sit next to the source with a .dds extension, run "GraphPro --cook-textures <images...>" to make them.
+class TextureCooker
+{
+public:
+    enum Format { BC1, BC3, BC5 };
+
+    static GLenum glFormat(Format format)
+    {
+        return format == BC1 ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : format == BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RG_RGTC2;
+    }
+
+    // normal maps are recognised by the suffix of their name, like the ones in the repo (brick_normal.png,
+    // Wood_Tower_Nor.jpg). Only the end of the name counts, so wall_north.png or a_normalized_albedo.png stay colour.
+    static Format chooseFormat(const std::string& path, int channels)
+    {
+        std::string name = path.substr(path.find_last_of("/\\") + 1);
+        name = name.substr(0, name.find_last_of('.'));
+        std::transform(name.begin(), name.end(), name.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+        const char* suffixes[] = { "_n", "_nor", "_nrm", "_normal" };
+        for (const char* suffix : suffixes)
+        {
+            size_t length = strlen(suffix);
+            if (name.size() > length && name.compare(name.size() - length, length, suffix) == 0)
+                return BC5;
+        }
+        return channels == 4 || channels == 2 ? BC3 : BC1;
+    }
+
+    // where the cooked version of an image is stored
+    static std::string cookedPath(const std::string& path)
+    {
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return path + ".dds";
+        return path.substr(0, dot) + ".dds";
+    }
+
+    // compresses an image with 1 to 4 channels into the given format, with mipmaps down to 1x1
+    static CompressedImage cook(const unsigned char* pixels, int width, int height, int channels, Format format)
+    {
+        // work on RGBA, the block encoders all read from it
+        std::vector<unsigned char> level(static_cast<size_t>(width) * height * 4);
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+        {
+            const unsigned char* source = pixels + i * channels;
+            unsigned char* target = &level[i * 4];
+            target[0] = source[0];
+            target[1] = channels >= 3 ? source[1] : source[0];
+            target[2] = channels >= 3 ? source[2] : source[0];
+            target[3] = channels == 4 ? source[3] : channels == 2 ? source[1] : 255;
+        }
+
+        CompressedImage image;
+        image.format = glFormat(format);
+        image.width = width;
+        image.height = height;
+        image.levels = 1;
+        while ((width >> image.levels) > 0 || (height >> image.levels) > 0)
+            image.levels++;
+
+        std::shared_ptr<std::vector<unsigned char>> blocks = std::make_shared<std::vector<unsigned char>>();
+        int levelWidth = width, levelHeight = height;
+        for (int i = 0; i < image.levels; i++)
+        {
+            size_t offset = blocks->size();
+            blocks->resize(offset + CompressedImage::levelSize(image.format, levelWidth, levelHeight));
+            compressLevel(&level[0], levelWidth, levelHeight, format, &(*blocks)[offset]);
+
+            if (i + 1 < image.levels)
+                level = downsample(level, levelWidth, levelHeight, format == BC5);
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+
+        image.size = blocks->size();
+        image.data = std::shared_ptr<void>(blocks, &(*blocks)[0]);
+        return image;
+    }
+
+    // decodes an image file, cooks it and writes it to cookedPath
+    static bool cookFile(const std::string& path)
+    {
+        DecodedImage decoded;
+        if (!ImageDecoder::decodeFile(path, 0, decoded))
+        {
+            std::cout << "ERROR::COOKER:: could not load " << path << std::endl;
+            return false;
+        }
+
+        Format format = chooseFormat(path, decoded.channels);
+        CompressedImage image = cook(static_cast<const unsigned char*>(decoded.pixels.get()), decoded.width, decoded.height, decoded.channels, format);
+
+        std::string target = cookedPath(path);
+        if (!writeDds(target, image))
+        {
+            std::cout << "ERROR::COOKER:: could not write " << target << std::endl;
+            return false;
+        }
+        const char* names[] = { "BC1", "BC3", "BC5" };
+        std::cout << path << " -> " << target << " (" << names[format] << ", " << image.levels << " levels, "
+                  << static_cast<size_t>(decoded.width) * decoded.height * decoded.channels * 4 / 3 / 1024 << " KB -> " << image.size / 1024 << " KB)" << std::endl;
+        return true;
+    }
+
+    // handles "--cook-textures <images...>". Returns false if it isn't on the command line.
+    static bool run(int argc, char** argv)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (std::strcmp(argv[i], "--cook-textures") != 0)
+                continue;
+            for (int j = i + 1; j < argc; j++)
+                cookFile(argv[j]);
+            return true;
+        }
+        return false;
+    }
+
+    static bool writeDds(const std::string& path, const CompressedImage& image)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+
+        uint32_t header[32];
+        memset(header, 0, sizeof(header));
+        header[0] = ddsMagic;
+        header[1] = 124;                                            // header size
+        header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;   // caps, height, width, pixel format, mip count, linear size
+        header[3] = image.height;
+        header[4] = image.width;
+        header[5] = static_cast<uint32_t>(image.levelSize(0));
+        header[7] = image.levels;
+        header[19] = 32;                                            // pixel format size
+        header[20] = 0x4;                                           // four cc
+        header[21] = image.format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? fourCC("DXT1") : image.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? fourCC("DXT5") : fourCC("ATI2");
+        header[27] = 0x1000 | 0x8 | 0x400000;                       // texture, complex, mipmap
+
+        bool written = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(image.data.get(), image.size, 1, file) == 1;
+        fclose(file);
+        return written;
+    }
+
+    // reads a DDS file made by writeDds (or any BC1/BC3/BC5 DDS with a legacy header) through the asset archive. The
+    // image data points into the file's bytes, which stay alive for as long as the data is referenced.
+    static bool readDds(const std::string& path, CompressedImage& image)
+    {
+        AssetData file;
+        return AssetArchive::load(path, file) && parseDds(file, image);
+    }
+
+    // the same for a DDS file that has already been read
+    static bool parseDds(const AssetData& file, CompressedImage& image)
+    {
+        if (file.size < 128)
+            return false;
+
+        uint32_t header[32];
+        memcpy(header, file.data(), sizeof(header));
+        if (header[0] != ddsMagic || header[1] != 124)
+            return false;
+
+        uint32_t code = header[21];
+        if (code == fourCC("DXT1"))
+            image.format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+        else if (code == fourCC("DXT5"))
+            image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        else if (code == fourCC("ATI2") || code == fourCC("BC5U"))
+            image.format = GL_COMPRESSED_RG_RGTC2;
+        else
+            return false;
+
+        image.height = static_cast<int>(header[3]);
+        image.width = static_cast<int>(header[4]);
+        image.levels = std::max(1, static_cast<int>(header[7]));
+        image.size = image.levelOffset(image.levels);
+        if (image.width <= 0 || image.height <= 0 || 128 + image.size > file.size)
+            return false;
+        image.data = std::shared_ptr<void>(file.bytes, const_cast<char*>(file.data()) + 128);
+        return true;
+    }
+
+    // creates a texture from a compressed image right away (GL thread only)
+    static GLuint upload(const CompressedImage& image)
+    {
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        GLState::get().editTexture(GL_TEXTURE_2D, textureID);
+        const char* bytes = static_cast<const char*>(image.data.get());
+        for (int level = 0; level < image.levels; level++)
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, CompressedImage::levelDimension(image.width, level), CompressedImage::levelDimension(image.height, level),
+                                   0, static_cast<GLsizei>(image.levelSize(level)), bytes + image.levelOffset(level));
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return textureID;
+    }
+
+private:
+    static const uint32_t ddsMagic = 0x20534444;
+
+    static uint32_t fourCC(const char* code)
+    {
+        return static_cast<uint32_t>(code[0]) | (static_cast<uint32_t>(code[1]) << 8) | (static_cast<uint32_t>(code[2]) << 16) | (static_cast<uint32_t>(code[3]) << 24);
+    }
+
+    // halves an RGBA image with a 2x2 box filter. Normal maps are renormalized, averaging shortens the vectors.
+    static std::vector<unsigned char> downsample(const std::vector<unsigned char>& source, int width, int height, bool normalMap)
+    {
+        int targetWidth = std::max(1, width / 2), targetHeight = std::max(1, height / 2);
+        std::vector<unsigned char> target(static_cast<size_t>(targetWidth) * targetHeight * 4);
+        for (int y = 0; y < targetHeight; y++)
+        {
+            for (int x = 0; x < targetWidth; x++)
+            {
+                float sum[4] = { 0, 0, 0, 0 };
+                for (int i = 0; i < 4; i++)
+                {
+                    int sx = std::min(x * 2 + (i & 1), width - 1);
+                    int sy = std::min(y * 2 + (i >> 1), height - 1);
+                    const unsigned char* pixel = &source[(static_cast<size_t>(sy) * width + sx) * 4];
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += pixel[c];
+                }
+
+                unsigned char* pixel = &target[(static_cast<size_t>(y) * targetWidth + x) * 4];
+                if (normalMap)
+                {
+                    float n[3];
+                    for (int c = 0; c < 3; c++)
+                        n[c] = sum[c] / (4.0f * 127.5f) - 1.0f;
+                    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    if (length > 0.0f)
+                    {
+                        for (int c = 0; c < 3; c++)
+                            sum[c] = (n[c] / length + 1.0f) * 127.5f * 4.0f;
+                    }
+                }
+                for (int c = 0; c < 4; c++)
+                    pixel[c] = static_cast<unsigned char>(std::min(255.0f, sum[c] / 4.0f + 0.5f));
+            }
+        }
+        return target;
+    }
+
+    static void compressLevel(const unsigned char* rgba, int width, int height, Format format, unsigned char* out)
+    {
+        unsigned char block[16][4];
+        for (int by = 0; by < height; by += 4)
+        {
+            for (int bx = 0; bx < width; bx += 4)
+            {
+                // blocks that hang over the edge repeat the last row/column
+                for (int i = 0; i < 16; i++)
+                {
+                    int x = std::min(bx + (i & 3), width - 1);
+                    int y = std::min(by + (i >> 2), height - 1);
+                    memcpy(block[i], rgba + (static_cast<size_t>(y) * width + x) * 4, 4);
+                }
+
+                if (format == BC1)
+                {
+                    encodeColorBlock(block, out);
+                    out += 8;
+                }
+                else if (format == BC3)
+                {
+                    encodeSingleChannelBlock(block, 3, out);
+                    encodeColorBlock(block, out + 8);
+                    out += 16;
+                }
+                else
+                {
+                    encodeSingleChannelBlock(block, 0, out);
+                    encodeSingleChannelBlock(block, 1, out + 8);
+                    out += 16;
+                }
+            }
+        }
+    }
+
+    static uint16_t pack565(const float color[3])
+    {
+        int r = static_cast<int>(clampChannel(color[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+        int g = static_cast<int>(clampChannel(color[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+        int b = static_cast<int>(clampChannel(color[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    static void unpack565(uint16_t packed, float color[3])
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = static_cast<float>((r << 3) | (r >> 2));
+        color[1] = static_cast<float>((g << 2) | (g >> 4));
+        color[2] = static_cast<float>((b << 3) | (b >> 2));
+    }
+
+    static float clampChannel(float value, float low, float high)
+    {
+        return std::min(std::max(value, low), high);
+    }
+
+    // BC1 color block: two 565 endpoints along the main axis of the block's colors, and a 2-bit index per pixel
+    // into the four colors between them
+    static void encodeColorBlock(const unsigned char block[16][4], unsigned char* out)
+    {
+        float mean[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++)
+        {
+            for (int c = 0; c < 3; c++)
+                mean[c] += block[i][c] / 16.0f;
+        }
+
+        float covariance[6] = { 0, 0, 0, 0, 0, 0 };   // rr rg rb gg gb bb
+        for (int i = 0; i < 16; i++)
+        {
+            float r = block[i][0] - mean[0], g = block[i][1] - mean[1], b = block[i][2] - mean[2];
+            covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+            covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+        }
+
+        // a few rounds of power iteration find the main axis well enough
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 4; iteration++)
+        {
+            float next[3] = {
+                covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+            };
+            float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+            if (length < 1e-6f)
+                break;
+            for (int c = 0; c < 3; c++)
+                axis[c] = next[c] / length;
+        }
+
+        float minProjection = 1e30f, maxProjection = -1e30f;
+        for (int i = 0; i < 16; i++)
+        {
+            float projection = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+
+        float high[3], low[3];
+        for (int c = 0; c < 3; c++)
+        {
+            high[c] = mean[c] + axis[c] * maxProjection;
+            low[c] = mean[c] + axis[c] * minProjection;
+        }
+        uint16_t color0 = pack565(high), color1 = pack565(low);
+        // color0 > color1 selects the four color mode
+        if (color0 < color1)
+            std::swap(color0, color1);
+
+        uint32_t indices = 0;
+        if (color0 != color1)
+        {
+            float palette[4][3];
+            unpack565(color0, palette[0]);
+            unpack565(color1, palette[1]);
+            for (int c = 0; c < 3; c++)
+            {
+                palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+            }
+
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                float bestDistance = 1e30f;
+                for (int p = 0; p < 4; p++)
+                {
+                    float dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+                    float distance = dr * dr + dg * dg + db * db;
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= static_cast<uint32_t>(best) << (i * 2);
+            }
+        }
+
+        out[0] = static_cast<unsigned char>(color0 & 0xFF);
+        out[1] = static_cast<unsigned char>(color0 >> 8);
+        out[2] = static_cast<unsigned char>(color1 & 0xFF);
+        out[3] = static_cast<unsigned char>(color1 >> 8);
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = static_cast<unsigned char>(indices >> (i * 8));
+    }
+
+    // BC4 block, used for the alpha of BC3 and both channels of BC5: the channel's min and max, and a 3-bit index per
+    // pixel into the eight values between them
+    static void encodeSingleChannelBlock(const unsigned char block[16][4], int channel, unsigned char* out)
+    {
+        int high = 0, low = 255;
+        for (int i = 0; i < 16; i++)
+        {
+            high = std::max(high, static_cast<int>(block[i][channel]));
+            low = std::min(low, static_cast<int>(block[i][channel]));
+        }
+
+        uint64_t indices = 0;
+        if (high != low)
+        {
+            // with value0 > value1: index 0 is value0, 1 is value1, 2 to 7 are evenly spaced between them
+            float palette[8];
+            palette[0] = static_cast<float>(high);
+            palette[1] = static_cast<float>(low);
+            for (int p = 2; p < 8; p++)
+                palette[p] = ((8 - p) * palette[0] + (p - 1) * palette[1]) / 7.0f;
+
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                float bestDistance = 1e30f;
+                for (int p = 0; p < 8; p++)
+                {
+                    float distance = std::fabs(block[i][channel] - palette[p]);
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= static_cast<uint64_t>(best) << (i * 3);
+            }
+        }
+
+        out[0] = static_cast<unsigned char>(high);
+        out[1] = static_cast<unsigned char>(low);
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+    }
+};
+#endif
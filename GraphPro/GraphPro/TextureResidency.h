@@ -0,0 +1,379 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "CompressedImage.h"
+#include "GLState.h"
+#include "UploadQueue.h"
+
+// keeps the textures of the scene within a VRAM budget. Every frame the renderer says which textures it uses and how
+// fine a mip level it needs (from the distance or screen size of what they're on), the manager then streams finer
+// levels in for textures that need them and drops the finest levels of the least recently used ones to make room.
+// Only levels base..max are used for sampling, so GL_TEXTURE_BASE_LEVEL moves up and down and the levels below it are
+// re-specified with a size of zero, which releases their storage.
+//
+// Streaming a level back in needs its texels, so the manager keeps a source for every texture: the cooked image (a
+// file mapping, nothing is copied) or the decoded pixels of level 0, from which the finer levels are rebuilt.
+// Everything except filling in a source runs on the GL thread.
+class TextureResidency
+{
+public:
+    // where the levels of a texture come from: a cooked image per layer, or the decoded level 0 pixels per layer
+    struct Source {
+        int width = 0, height = 0, channels = 0;
+        std::vector<CompressedImage> compressed;
+        std::vector<std::shared_ptr<void>> pixels;
+    };
+
+    // bytes of texture storage the managed textures may use together
+    size_t budgetBytes;
+    // time update() may spend on streaming levels in each frame
+    float streamBudgetMs;
+    // levels this size and smaller always stay, so there is something to sample
+    static const int minResidentSize = 64;
+
+    TextureResidency(size_t _budgetBytes, float _streamBudgetMs = 1.0f) : budgetBytes(_budgetBytes), streamBudgetMs(_streamBudgetMs) {}
+
+    // starts managing a GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY whose levels are all allocated. The returned source has
+    // to be filled in before the ticket becomes resident (it may be done on the job that decodes the texture), the
+    // manager ignores the texture until then. A texture without a ticket is picked up on the next update.
+    std::shared_ptr<Source> add(GLuint texture, GLenum target, std::shared_ptr<UploadTicket> ticket = nullptr)
+    {
+        Entry& entry = entries[texture];
+        entry = Entry();
+        entry.target = target;
+        entry.ticket = ticket;
+        entry.source = std::make_shared<Source>();
+        return entry.source;
+    }
+
+    // asks for a texture at the given mip level (or finer) this frame
+    void request(GLuint texture, int level)
+    {
+        std::unordered_map<GLuint, Entry>::iterator found = entries.find(texture);
+        if (found == entries.end())
+            return;
+        Entry& entry = found->second;
+        entry.wantedLevel = std::min(entry.wantedLevel, std::max(level, 0));
+        entry.lastUsed = frame;
+    }
+
+    // asks for a texture that covers about this many pixels on screen. One texel per pixel is enough, every halving of
+    // the on-screen size allows one level coarser.
+    void requestScreenSize(GLuint texture, float pixels)
+    {
+        std::unordered_map<GLuint, Entry>::iterator found = entries.find(texture);
+        if (found == entries.end())
+            return;
+        const Entry& entry = found->second;
+        int size = std::max(entry.width, entry.height);
+        int level = pixels > 0.0f && size > 0 ? static_cast<int>(std::floor(std::log2(size / pixels))) : 0;
+        request(texture, level);
+    }
+
+    // the on-screen diameter in pixels of a sphere at some distance from the camera
+    static float screenSize(float radius, float distance, float fovY, int viewportHeight)
+    {
+        if (distance <= radius)
+            return FLT_MAX;
+        return radius * viewportHeight / (distance * std::tan(fovY * 0.5f));
+    }
+
+    // streams in and evicts levels according to this frame's requests, call once per frame after the requests
+    void update()
+    {
+        // the upload queue leaves the unpack buffer unbound, but make sure pointers below are read as pointers
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        std::vector<Entry*> wanting;
+        for (std::unordered_map<GLuint, Entry>::iterator it = entries.begin(); it != entries.end();)
+        {
+            Entry& entry = it->second;
+            if (!entry.active && !activate(it->first, entry))
+            {
+                // textures that failed to load are dropped once their upload is through
+                if (entry.ticket && !entry.ticket->resident())
+                    ++it;
+                else
+                    it = entries.erase(it);
+                continue;
+            }
+            if (entry.lastUsed == frame && entry.wantedLevel < entry.baseLevel)
+                wanting.push_back(&entry);
+            ++it;
+        }
+
+        // the textures that are furthest from what they need go first, one level at a time from coarse to fine
+        std::sort(wanting.begin(), wanting.end(), [](const Entry* a, const Entry* b) {
+            return a->baseLevel - a->wantedLevel > b->baseLevel - b->wantedLevel;
+        });
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool streaming = true;
+        for (unsigned int i = 0; i < wanting.size() && streaming; i++)
+        {
+            Entry& entry = *wanting[i];
+            while (entry.baseLevel > entry.wantedLevel)
+            {
+                float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (elapsedMs >= streamBudgetMs || !makeRoom(levelBytes(entry, entry.baseLevel - 1), &entry))
+                {
+                    streaming = false;
+                    break;
+                }
+                streamIn(entry);
+            }
+        }
+        // also when nothing was streamed, the budget may have been lowered or new textures added
+        makeRoom(0, nullptr);
+
+        for (std::unordered_map<GLuint, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+            it->second.wantedLevel = notRequested;
+        frame++;
+    }
+
+    // bytes of texture storage the managed textures use right now
+    size_t residentBytes() const
+    {
+        return resident;
+    }
+
+    // finest level of a texture that is resident, 0 for textures that aren't managed
+    int baseLevel(GLuint texture) const
+    {
+        std::unordered_map<GLuint, Entry>::const_iterator found = entries.find(texture);
+        return found == entries.end() ? 0 : found->second.baseLevel;
+    }
+
+private:
+    // wanted level of a texture nobody asked for
+    static const int notRequested = 1000;
+
+    struct Entry {
+        GLuint id = 0;
+        GLenum target = GL_TEXTURE_2D;
+        std::shared_ptr<UploadTicket> ticket;
+        std::shared_ptr<Source> source;
+        bool active = false;
+        int width = 0, height = 0, channels = 0, layers = 0;
+        GLenum compressedFormat = 0;
+        int levels = 0;
+        // finest resident level, and the coarsest one it may be evicted to
+        int baseLevel = 0;
+        int tailLevel = 0;
+        // finest level asked for this frame, and the frame it was last asked for
+        int wantedLevel = notRequested;
+        unsigned long long lastUsed = 0;
+    };
+
+    std::unordered_map<GLuint, Entry> entries;
+    unsigned long long frame = 1;
+    size_t resident = 0;
+
+    // takes over a texture once its upload is done. Returns false when it isn't ready or has nothing to stream from.
+    bool activate(GLuint texture, Entry& entry)
+    {
+        if (entry.ticket && !entry.ticket->resident())
+            return false;
+        const Source& source = *entry.source;
+        entry.layers = static_cast<int>(std::max(source.compressed.size(), source.pixels.size()));
+        if (entry.layers == 0 || source.width <= 0 || source.height <= 0)
+            return false;
+
+        entry.active = true;
+        entry.id = texture;
+        entry.width = source.width;
+        entry.height = source.height;
+        entry.channels = source.channels;
+        if (!source.compressed.empty())
+        {
+            entry.compressedFormat = source.compressed[0].format;
+            entry.levels = source.compressed[0].levels;
+        }
+        else
+        {
+            // glGenerateMipmap made the whole chain down to 1x1
+            entry.levels = 1 + static_cast<int>(std::floor(std::log2(static_cast<float>(std::max(entry.width, entry.height)))));
+        }
+        entry.tailLevel = entry.levels - 1;
+        for (int level = 0; level < entry.levels; level++)
+        {
+            if (std::max(CompressedImage::levelDimension(entry.width, level), CompressedImage::levelDimension(entry.height, level)) <= minResidentSize)
+            {
+                entry.tailLevel = level;
+                break;
+            }
+        }
+
+        GLState::get().editTexture(entry.target, texture);
+        glTexParameteri(entry.target, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(entry.target, GL_TEXTURE_MAX_LEVEL, entry.levels - 1);
+
+        for (int level = 0; level < entry.levels; level++)
+            resident += levelBytes(entry, level);
+        return true;
+    }
+
+    // storage of one level across all layers. Drivers pad 3 channel texels to 4 bytes.
+    static size_t levelBytes(const Entry& entry, int level)
+    {
+        int width = CompressedImage::levelDimension(entry.width, level), height = CompressedImage::levelDimension(entry.height, level);
+        if (entry.compressedFormat)
+            return CompressedImage::levelSize(entry.compressedFormat, width, height) * entry.layers;
+        int texelBytes = entry.channels == 3 ? 4 : entry.channels;
+        return static_cast<size_t>(width) * height * texelBytes * entry.layers;
+    }
+
+    // evicts levels until size more bytes fit in the budget. Textures that weren't used this frame go first, least
+    // recently used first, then the ones that have finer levels than they asked for. Returns false if it can't.
+    bool makeRoom(size_t size, const Entry* requester)
+    {
+        while (resident + size > budgetBytes)
+        {
+            Entry* victim = nullptr;
+            for (std::unordered_map<GLuint, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+            {
+                Entry& entry = it->second;
+                if (!entry.active || &entry == requester || entry.baseLevel >= entry.tailLevel)
+                    continue;
+                bool cold = entry.lastUsed != frame;
+                if (!cold && entry.baseLevel >= entry.wantedLevel)
+                    continue;
+                bool victimCold = victim && victim->lastUsed != frame;
+                if (!victim || (cold && !victimCold) || (cold == victimCold && entry.lastUsed < victim->lastUsed))
+                    victim = &entry;
+            }
+            if (!victim)
+                return false;
+            evict(*victim);
+        }
+        return true;
+    }
+
+    // drops the finest resident level of a texture
+    void evict(Entry& entry)
+    {
+        int level = entry.baseLevel;
+        GLState::get().editTexture(entry.target, entry.id);
+        glTexParameteri(entry.target, GL_TEXTURE_BASE_LEVEL, level + 1);
+        // a level of size zero has no storage
+        GLenum format = pixelFormat(entry.channels);
+        if (entry.target == GL_TEXTURE_2D_ARRAY)
+        {
+            if (entry.compressedFormat)
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, entry.compressedFormat, 0, 0, 0, 0, 0, nullptr);
+            else
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, 0, 0, 0, 0, format, GL_UNSIGNED_BYTE, nullptr);
+        }
+        else
+        {
+            if (entry.compressedFormat)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.compressedFormat, 0, 0, 0, 0, nullptr);
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, format, 0, 0, 0, format, GL_UNSIGNED_BYTE, nullptr);
+        }
+
+        entry.baseLevel = level + 1;
+        resident -= levelBytes(entry, level);
+    }
+
+    // uploads the level just above the finest resident one and makes it the new base
+    void streamIn(Entry& entry)
+    {
+        int level = entry.baseLevel - 1;
+        int width = CompressedImage::levelDimension(entry.width, level), height = CompressedImage::levelDimension(entry.height, level);
+        const Source& source = *entry.source;
+
+        GLState::get().editTexture(entry.target, entry.id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (entry.compressedFormat)
+        {
+            GLsizei size = static_cast<GLsizei>(CompressedImage::levelSize(entry.compressedFormat, width, height));
+            if (entry.target == GL_TEXTURE_2D_ARRAY)
+            {
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, entry.compressedFormat, width, height, entry.layers, 0, size * entry.layers, nullptr);
+                for (int layer = 0; layer < entry.layers; layer++)
+                {
+                    const CompressedImage& image = source.compressed[layer];
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, entry.compressedFormat, size,
+                                              static_cast<const char*>(image.data.get()) + image.levelOffset(level));
+                }
+            }
+            else
+            {
+                const CompressedImage& image = source.compressed[0];
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.compressedFormat, width, height, 0, size, static_cast<const char*>(image.data.get()) + image.levelOffset(level));
+            }
+        }
+        else
+        {
+            GLenum format = pixelFormat(entry.channels);
+            if (entry.target == GL_TEXTURE_2D_ARRAY)
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, width, height, entry.layers, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            for (int layer = 0; layer < entry.layers; layer++)
+            {
+                // layers that failed to decode stay undefined, like they were after the first upload
+                if (!source.pixels[layer])
+                    continue;
+                std::vector<unsigned char> pixels = levelPixels(static_cast<const unsigned char*>(source.pixels[layer].get()), entry.width, entry.height, entry.channels, level);
+                const void* data = level == 0 ? source.pixels[layer].get() : static_cast<const void*>(&pixels[0]);
+                if (entry.target == GL_TEXTURE_2D_ARRAY)
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, GL_UNSIGNED_BYTE, data);
+                else
+                    glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(entry.target, GL_TEXTURE_BASE_LEVEL, level);
+
+        entry.baseLevel = level;
+        resident += levelBytes(entry, level);
+    }
+
+    static GLenum pixelFormat(int channels)
+    {
+        return channels == 1 ? GL_RED : channels == 2 ? GL_RG : channels == 3 ? GL_RGB : GL_RGBA;
+    }
+
+    // rebuilds a mip level from level 0 by halving it level times with a 2x2 box filter, like glGenerateMipmap does.
+    // Level 0 itself isn't copied, the result is empty then.
+    static std::vector<unsigned char> levelPixels(const unsigned char* pixels, int width, int height, int channels, int level)
+    {
+        std::vector<unsigned char> current, next;
+        const unsigned char* source = pixels;
+        for (int i = 0; i < level; i++)
+        {
+            int targetWidth = std::max(1, width / 2), targetHeight = std::max(1, height / 2);
+            next.resize(static_cast<size_t>(targetWidth) * targetHeight * channels);
+            for (int y = 0; y < targetHeight; y++)
+            {
+                int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+                for (int x = 0; x < targetWidth; x++)
+                {
+                    int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                    for (int c = 0; c < channels; c++)
+                    {
+                        int sum = source[(static_cast<size_t>(y0) * width + x0) * channels + c] + source[(static_cast<size_t>(y0) * width + x1) * channels + c]
+                                + source[(static_cast<size_t>(y1) * width + x0) * channels + c] + source[(static_cast<size_t>(y1) * width + x1) * channels + c];
+                        next[(static_cast<size_t>(y) * targetWidth + x) * channels + c] = static_cast<unsigned char>((sum + 2) / 4);
+                    }
+                }
+            }
+            current.swap(next);
+            source = &current[0];
+            width = targetWidth;
+            height = targetHeight;
+        }
+        return current;
+    }
+};
+#endif
@@ -0,0 +1,112 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// a fixed set of worker threads that run jobs from a shared queue
+class ThreadPool
+{
+public:
+    // threadCount 0 uses one worker per core, minus the core the render thread runs on
+    ThreadPool(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            unsigned int cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    // queues a job, it runs on the first worker that becomes idle
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    // queues a job and returns a future for its result
+    template<class F>
+    auto async(F function) -> std::future<decltype(function())>
+    {
+        typedef decltype(function()) Result;
+        std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+        std::future<Result> result = task->get_future();
+        submit([task] { (*task)(); });
+        return result;
+    }
+
+    // blocks until every queued job has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this] { return jobs.empty() && running == 0; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable allDone;
+    unsigned int running = 0;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+                running++;
+            }
+
+            job();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                if (jobs.empty() && running == 0)
+                    allDone.notify_all();
+            }
+        }
+    }
+};
+#endif
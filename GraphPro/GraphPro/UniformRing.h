@@ -0,0 +1,110 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <vector>
+
+// hands out slots of one uniform buffer for values that change from draw to draw, like the world matrix of an object.
+// A draw writes its values into the next free slot and binds that slot's range, so switching objects costs one
+// glBindBufferRange instead of a set of glUniform calls.
+//
+// The buffer is split into a section per frame in flight. Slots are written unsynchronized, a fence per section makes
+// sure a section is only written again once the GPU is done with the frame that used it last. A frame that needs more
+// slots than a section has gets a buffer twice the size.
+class UniformRing
+{
+public:
+    // slotSize is the largest value a slot holds, it's rounded up to the uniform buffer offset alignment
+    UniformRing(size_t _slotSize, unsigned int _slotsPerFrame = 1024, unsigned int _frames = 3) : slotsPerFrame(_slotsPerFrame), frames(_frames)
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        size_t align = alignment > 0 ? static_cast<size_t>(alignment) : 256;
+        slotSize = (_slotSize + align - 1) / align * align;
+
+        glGenBuffers(1, &buffer);
+        allocate();
+    }
+
+    ~UniformRing()
+    {
+        for (unsigned int i = 0; i < fences.size(); i++)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // moves on to the next section, waiting for the GPU if it still reads it. Call once per frame before any push.
+    void beginFrame()
+    {
+        // the section of the frame that just ended is free once the GPU gets past this point
+        if (fences[section])
+            glDeleteSync(fences[section]);
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        section = (section + 1) % frames;
+        used = 0;
+        if (fences[section])
+        {
+            // with three sections this only blocks when the GPU is more than two frames behind
+            while (glClientWaitSync(fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+            glDeleteSync(fences[section]);
+            fences[section] = 0;
+        }
+    }
+
+    // copies the values into a free slot and binds that slot to a uniform block binding
+    void bind(GLuint binding, const void* data, size_t size)
+    {
+        if (used == slotsPerFrame)
+            grow();
+
+        GLintptr offset = static_cast<GLintptr>((section * static_cast<size_t>(slotsPerFrame) + used) * slotSize);
+        used++;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        void* slot = glMapBufferRange(GL_UNIFORM_BUFFER, offset, static_cast<GLsizeiptr>(slotSize), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (slot)
+        {
+            memcpy(slot, data, size < slotSize ? size : slotSize);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, static_cast<GLsizeiptr>(slotSize));
+    }
+
+private:
+    GLuint buffer = 0;
+    size_t slotSize;
+    unsigned int slotsPerFrame, frames;
+    unsigned int section = 0, used = 0;
+    std::vector<GLsync> fences;
+
+    void allocate()
+    {
+        fences.assign(frames, static_cast<GLsync>(0));
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, static_cast<GLsizeiptr>(slotSize * slotsPerFrame * frames), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // new storage twice the size. The draws already made keep reading the old storage, which the driver frees once
+    // they're done, so nothing has to wait.
+    void grow()
+    {
+        for (unsigned int i = 0; i < fences.size(); i++)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        }
+        slotsPerFrame *= 2;
+        allocate();
+        section = 0;
+        used = 0;
+    }
+};
+#endif
@@ -0,0 +1,379 @@
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CompressedImage.h"
+#include "GLState.h"
+
+// counts the uploads of an asset that haven't reached the GPU yet, the asset is resident once it drops to zero
+struct UploadTicket {
+    std::atomic<int> pending;
+
+    UploadTicket(int uploads = 0) : pending(uploads) {}
+
+    bool resident() const
+    {
+        return pending.load() == 0;
+    }
+};
+
+// collects decoded texture and buffer data from any thread and uploads it on the GL thread, a few milliseconds per frame.
+// Data is copied into a staging buffer (a PBO for textures) and the GL object is filled from there, a fence tells
+// when the copy is done so the staging buffer can be reused.
+class UploadQueue
+{
+public:
+    // time process() may spend on new uploads each frame
+    float budgetMs;
+
+    UploadQueue(float _budgetMs = 2.0f) : budgetMs(_budgetMs) {}
+
+    ~UploadQueue()
+    {
+        for (unsigned int i = 0; i < inFlight.size(); i++)
+        {
+            glDeleteSync(inFlight[i].fence);
+            glDeleteBuffers(1, &inFlight[i].staging.id);
+        }
+        for (unsigned int i = 0; i < freeStaging.size(); i++)
+            glDeleteBuffers(1, &freeStaging[i].id);
+    }
+
+    // creates a texture that shows a 1x1 grey placeholder until enqueueTexture replaces its contents (GL thread only)
+    GLuint createPlaceholderTexture()
+    {
+        const unsigned char grey[4] = { 128, 128, 128, 255 };
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        GLState::get().editTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return textureID;
+    }
+
+    // queues pixel data for an existing texture, mipmaps are generated after the upload. Safe to call from any thread.
+    void enqueueTexture(GLuint texture, int width, int height, int channels, std::shared_ptr<void> pixels, std::shared_ptr<UploadTicket> ticket = nullptr)
+    {
+        Upload upload;
+        upload.isTexture = true;
+        upload.target = texture;
+        upload.width = width;
+        upload.height = height;
+        upload.channels = channels;
+        upload.data = pixels;
+        upload.size = static_cast<size_t>(width) * height * channels;
+        upload.ticket = ticket;
+        push(upload);
+    }
+
+    // queues pixel data for one layer of an existing 2D array texture whose storage is already allocated. Set
+    // generateMipmaps on the last layer of the array, mipmaps are generated for all layers at once. Safe to call from any thread.
+    void enqueueTextureLayer(GLuint texture, int layer, int width, int height, int channels, std::shared_ptr<void> pixels, bool generateMipmaps, std::shared_ptr<UploadTicket> ticket = nullptr)
+    {
+        Upload upload;
+        upload.isTexture = true;
+        upload.target = texture;
+        upload.layer = layer;
+        upload.generateMipmaps = generateMipmaps;
+        upload.width = width;
+        upload.height = height;
+        upload.channels = channels;
+        upload.data = pixels;
+        upload.size = static_cast<size_t>(width) * height * channels;
+        upload.ticket = ticket;
+        push(upload);
+    }
+
+    // queues a block-compressed image with all its mip levels, for a 2D texture (layer -1) or a layer of a 2D array
+    // texture whose storage is already allocated. Safe to call from any thread.
+    void enqueueCompressedTexture(GLuint texture, int layer, const CompressedImage& image, std::shared_ptr<UploadTicket> ticket = nullptr)
+    {
+        Upload upload;
+        upload.isTexture = true;
+        upload.target = texture;
+        upload.layer = layer;
+        upload.generateMipmaps = false;
+        upload.compressedFormat = image.format;
+        upload.levels = image.levels;
+        upload.width = image.width;
+        upload.height = image.height;
+        upload.data = image.data;
+        upload.size = image.size;
+        upload.ticket = ticket;
+        push(upload);
+    }
+
+    // queues the contents of an existing buffer object. Safe to call from any thread.
+    void enqueueBuffer(GLuint buffer, std::shared_ptr<void> data, size_t size, std::shared_ptr<UploadTicket> ticket = nullptr)
+    {
+        Upload upload;
+        upload.isTexture = false;
+        upload.target = buffer;
+        upload.data = data;
+        upload.size = size;
+        upload.ticket = ticket;
+        push(upload);
+    }
+
+    // convenience overload that takes ownership of a vector
+    template<class T>
+    void enqueueBuffer(GLuint buffer, std::vector<T> data, std::shared_ptr<UploadTicket> ticket = nullptr)
+    {
+        size_t size = data.size() * sizeof(T);
+        std::shared_ptr<std::vector<T>> owner = std::make_shared<std::vector<T>>(std::move(data));
+        // aliasing constructor, keeps the vector alive while pointing at its contents
+        std::shared_ptr<void> bytes(owner, owner->empty() ? nullptr : &(*owner)[0]);
+        enqueueBuffer(buffer, bytes, size, ticket);
+    }
+
+    // retires finished uploads and starts new ones until the frame budget is used up (GL thread only)
+    void process()
+    {
+        retireFinished();
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        while (true)
+        {
+            Upload upload;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (pending.empty())
+                    break;
+                upload = pending.front();
+                pending.pop_front();
+            }
+
+            commit(upload);
+
+            // always do at least one upload per frame, so large items can't stall the queue forever
+            float elapsed = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (elapsed >= budgetMs)
+                break;
+        }
+    }
+
+    // uploads everything that is queued and waits until it's on the GPU (GL thread only)
+    void flush()
+    {
+        float budget = budgetMs;
+        budgetMs = FLT_MAX;
+        process();
+        budgetMs = budget;
+
+        for (unsigned int i = 0; i < inFlight.size(); i++)
+            glClientWaitSync(inFlight[i].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        retireFinished();
+    }
+
+    // true when nothing is waiting or in flight
+    bool idle()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending.empty() && inFlight.empty();
+    }
+
+private:
+    struct Upload {
+        bool isTexture = false;
+        GLuint target = 0;
+        int width = 0, height = 0, channels = 0;
+        // layer of a 2D array texture, -1 for a plain 2D texture
+        int layer = -1;
+        bool generateMipmaps = true;
+        // set for block-compressed data, which holds every mip level
+        GLenum compressedFormat = 0;
+        int levels = 1;
+        std::shared_ptr<void> data;
+        size_t size = 0;
+        std::shared_ptr<UploadTicket> ticket;
+    };
+
+    struct StagingBuffer {
+        GLuint id;
+        size_t size;
+    };
+
+    struct InFlight {
+        GLsync fence;
+        StagingBuffer staging;
+        std::shared_ptr<UploadTicket> ticket;
+    };
+
+    std::mutex mutex;
+    std::deque<Upload> pending;
+    // only touched on the GL thread
+    std::vector<InFlight> inFlight;
+    std::vector<StagingBuffer> freeStaging;
+    size_t freeStagingBytes = 0;
+    // staging memory kept around for reuse, anything above this is deleted once its upload is done
+    static const size_t maxFreeStagingBytes = 64 * 1024 * 1024;
+
+    void push(const Upload& upload)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(upload);
+    }
+
+    // returns the smallest free staging buffer that fits, or creates a new one
+    StagingBuffer acquireStaging(size_t size)
+    {
+        int best = -1;
+        for (unsigned int i = 0; i < freeStaging.size(); i++)
+        {
+            if (freeStaging[i].size >= size && (best < 0 || freeStaging[i].size < freeStaging[best].size))
+                best = i;
+        }
+
+        if (best >= 0)
+        {
+            StagingBuffer staging = freeStaging[best];
+            freeStaging.erase(freeStaging.begin() + best);
+            freeStagingBytes -= staging.size;
+            return staging;
+        }
+
+        StagingBuffer staging;
+        glGenBuffers(1, &staging.id);
+        staging.size = size;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, staging.id);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return staging;
+    }
+
+    void commit(Upload& upload)
+    {
+        if (upload.size == 0 || !upload.data)
+        {
+            if (upload.ticket)
+                upload.ticket->pending--;
+            // the array still needs its mipmaps, even if this layer had no pixels
+            if (upload.layer >= 0 && upload.generateMipmaps)
+            {
+                GLState::get().editTexture(GL_TEXTURE_2D_ARRAY, upload.target);
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            }
+            return;
+        }
+
+        StagingBuffer staging = acquireStaging(upload.size);
+        GLenum stagingTarget = upload.isTexture ? GL_PIXEL_UNPACK_BUFFER : GL_COPY_READ_BUFFER;
+
+        // copy into the staging buffer, invalidating it so we never wait on a previous upload
+        glBindBuffer(stagingTarget, staging.id);
+        void* mapped = glMapBufferRange(stagingTarget, 0, upload.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped)
+        {
+            memcpy(mapped, upload.data.get(), upload.size);
+            glUnmapBuffer(stagingTarget);
+        }
+
+        if (upload.isTexture && upload.compressedFormat)
+        {
+            // the levels lie back to back in the staging buffer, each is uploaded from its offset
+            GLenum target = upload.layer >= 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+            GLState::get().editTexture(target, upload.target);
+            size_t offset = 0;
+            for (int level = 0; level < upload.levels; level++)
+            {
+                int width = CompressedImage::levelDimension(upload.width, level);
+                int height = CompressedImage::levelDimension(upload.height, level);
+                GLsizei size = static_cast<GLsizei>(CompressedImage::levelSize(upload.compressedFormat, width, height));
+                if (upload.layer >= 0)
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, upload.layer, width, height, 1, upload.compressedFormat, size, (void*)offset);
+                else
+                    glCompressedTexImage2D(GL_TEXTURE_2D, level, upload.compressedFormat, width, height, 0, size, (void*)offset);
+                offset += size;
+            }
+            if (upload.layer < 0)
+            {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, upload.levels - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            }
+        }
+        else if (upload.isTexture && upload.layer >= 0)
+        {
+            GLenum format = upload.channels == 1 ? GL_RED : upload.channels == 2 ? GL_RG : upload.channels == 3 ? GL_RGB : GL_RGBA;
+
+            GLState::get().editTexture(GL_TEXTURE_2D_ARRAY, upload.target);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, upload.layer, upload.width, upload.height, 1, format, GL_UNSIGNED_BYTE, (void*)0);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            if (upload.generateMipmaps)
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+        else if (upload.isTexture)
+        {
+            GLenum format = upload.channels == 1 ? GL_RED : upload.channels == 2 ? GL_RG : upload.channels == 3 ? GL_RGB : GL_RGBA;
+
+            GLState::get().editTexture(GL_TEXTURE_2D, upload.target);
+            // rows of 1 or 3 channel images aren't necessarily 4 byte aligned
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            // with a PBO bound the data pointer is an offset into it
+            glTexImage2D(GL_TEXTURE_2D, 0, format, upload.width, upload.height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        }
+        else
+        {
+            // go through the copy binding points so the VAO's element buffer binding isn't touched
+            glBindBuffer(GL_COPY_WRITE_BUFFER, upload.target);
+            glBufferData(GL_COPY_WRITE_BUFFER, upload.size, nullptr, GL_STATIC_DRAW);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, upload.size);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        glBindBuffer(stagingTarget, 0);
+
+        InFlight flight;
+        flight.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        flight.staging = staging;
+        flight.ticket = upload.ticket;
+        inFlight.push_back(flight);
+
+        // the CPU copy isn't needed anymore
+        upload.data.reset();
+    }
+
+    // checks the fences of uploads in flight without blocking
+    void retireFinished()
+    {
+        for (unsigned int i = 0; i < inFlight.size();)
+        {
+            GLenum status = glClientWaitSync(inFlight[i].fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(inFlight[i].fence);
+                if (freeStagingBytes + inFlight[i].staging.size <= maxFreeStagingBytes)
+                {
+                    freeStaging.push_back(inFlight[i].staging);
+                    freeStagingBytes += inFlight[i].staging.size;
+                }
+                else
+                {
+                    glDeleteBuffers(1, &inFlight[i].staging.id);
+                }
+                if (inFlight[i].ticket)
+                    inFlight[i].ticket->pending--;
+                inFlight.erase(inFlight.begin() + i);
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,443 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "GLState.h"
+#include "Shader.h"
+
+// a texture far too big to keep in memory, split into square pages of which only the ones on screen are kept. The
+// pages live in a physical atlas, a page table with one texel per page and level tells the shader where each page is.
+// A page that isn't in the atlas points at its closest ancestor that is, so something coarser shows until it's baked.
+//
+// Every frame the geometry is drawn once more at a reduced resolution with a shader that writes the page and level
+// each pixel needs (see terrainFeedbackFragment.shader). The result is read back asynchronously and drives which pages
+// get baked, coarse before fine, and which ones are evicted, least recently used first. Page contents come from a bake
+// function that draws into the atlas, so nothing has to be stored on disk.
+//
+// All of it runs on the GL thread.
+class VirtualTexture
+{
+public:
+    // draws the contents of a page into the current viewport. uvRect is the area of the virtual texture it covers
+    // (min in xy, size in zw), borders included, level is the page's mip level.
+    typedef std::function<void(int level, const glm::vec4& uvRect)> BakeFunction;
+
+    // texels of a page, and the border around it that makes bilinear filtering work across page edges
+    static const int pagePayload = 128;
+    static const int pageBorder = 4;
+    static const int pageSize = pagePayload + 2 * pageBorder;
+
+    // pages per side at level 0 (a power of two), and the number of levels down to a single page
+    int virtualPages;
+    int levels;
+    // atlas slots per side
+    int atlasPages;
+    // pages baked per frame at most
+    int bakesPerFrame = 16;
+
+    GLuint pageTable = 0;
+    GLuint atlas = 0;
+
+    // the slots of the atlas are addressed with a byte each, so there are at most 256 per side
+    VirtualTexture(int _virtualPages, int _atlasPages, int _feedbackWidth, int _feedbackHeight, BakeFunction _bake)
+        : virtualPages(_virtualPages), atlasPages(std::min(_atlasPages, 256)), bake(_bake), feedbackWidth(_feedbackWidth), feedbackHeight(_feedbackHeight)
+    {
+        levels = 1;
+        while ((virtualPages >> (levels - 1)) > 1)
+            levels++;
+
+        pageSlots.resize(levels);
+        tableEntries.resize(levels);
+        for (int level = 0; level < levels; level++)
+        {
+            int pages = pagesAt(level);
+            pageSlots[level].assign(static_cast<size_t>(pages) * pages, -1);
+            tableEntries[level].assign(static_cast<size_t>(pages) * pages * 4, 0);
+        }
+        slots.resize(static_cast<size_t>(atlasPages) * atlasPages);
+        for (int i = static_cast<int>(slots.size()) - 1; i >= 0; i--)
+            freeSlots.push_back(i);
+
+        createTextures();
+        createFeedbackTarget();
+        markDirty(levels - 1, 0, 0);
+    }
+
+    ~VirtualTexture()
+    {
+        if (feedbackFence)
+            glDeleteSync(feedbackFence);
+        glDeleteBuffers(1, &feedbackBuffer);
+        glDeleteFramebuffers(1, &feedbackFramebuffer);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+        glDeleteFramebuffers(1, &bakeFramebuffer);
+        GLuint textures[3] = { feedbackColor, pageTable, atlas };
+        GLState::get().deleteTextures(3, textures);
+    }
+
+    int pagesAt(int level) const
+    {
+        return std::max(1, virtualPages >> level);
+    }
+
+    // level bias of the feedback pass, its derivatives are larger than the screen's by the resolution ratio
+    float feedbackBias(int screenHeight) const
+    {
+        return -std::log2(static_cast<float>(screenHeight) / feedbackHeight);
+    }
+
+    // the uniforms the shaders need to address the virtual texture, the program has to be in use
+    void setUniforms(const Shader& program) const
+    {
+        program.uniform("vtSize").set(static_cast<float>(virtualPages * pagePayload));
+        program.uniform("vtMaxLevel").set(levels - 1);
+        program.uniform("vtPagePayload").set(static_cast<float>(pagePayload));
+        program.uniform("vtPageBorder").set(static_cast<float>(pageBorder));
+        program.uniform("vtAtlasSize").set(static_cast<float>(atlasPages * pageSize));
+    }
+
+    // starts the feedback pass: binds the small render target and clears it. Returns false while the previous
+    // feedback is still being read back, the pass is skipped then.
+    bool beginFeedback()
+    {
+        if (feedbackFence)
+            return false;
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+        // alpha 0 marks pixels without a page
+        const GLuint clearColor[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, clearColor);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return true;
+    }
+
+    // ends the feedback pass and starts reading it back into a buffer, update picks it up once the GPU is done
+    void endFeedback()
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffer);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        feedbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+    }
+
+    // reads finished feedback, bakes the missing pages and updates the page table
+    void update()
+    {
+        frame++;
+        if (!rootBaked)
+        {
+            // the coarsest page covers everything and is never evicted, it's the fallback of every other page
+            bakePage(levels - 1, 0, 0);
+            rootBaked = true;
+        }
+
+        if (feedbackFence)
+        {
+            GLenum status = glClientWaitSync(feedbackFence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(feedbackFence);
+                feedbackFence = 0;
+                readFeedback();
+            }
+        }
+
+        if (!dirtyPages.empty())
+            uploadPageTable();
+    }
+
+    // throws every page away, for when the source of the contents changed. They're baked again as they're needed.
+    void invalidate()
+    {
+        for (int level = 0; level < levels; level++)
+            std::fill(pageSlots[level].begin(), pageSlots[level].end(), -1);
+        freeSlots.clear();
+        for (int i = static_cast<int>(slots.size()) - 1; i >= 0; i--)
+        {
+            slots[i] = Slot();
+            freeSlots.push_back(i);
+        }
+        rootBaked = false;
+        dirtyPages.clear();
+        markDirty(levels - 1, 0, 0);
+    }
+
+private:
+    struct Slot {
+        int level = -1, x = 0, y = 0;
+        unsigned long long lastUsed = 0;
+    };
+
+    BakeFunction bake;
+    int feedbackWidth, feedbackHeight;
+
+    // atlas slot of every page per level, -1 when it isn't baked
+    std::vector<std::vector<int>> pageSlots;
+    // the page table per level as uploaded: slot x, slot y, level of the page that's used, unused
+    std::vector<std::vector<unsigned char>> tableEntries;
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    bool rootBaked = false;
+    // pages that were baked or evicted since the last upload (x, y, level). Their entries and those of every page
+    // below them are rebuilt and uploaded, the rest of the table stays as it is. The root covers the whole table.
+    std::vector<glm::ivec3> dirtyPages;
+    unsigned long long frame = 0;
+
+    GLuint bakeFramebuffer = 0;
+    GLuint feedbackFramebuffer = 0, feedbackColor = 0, feedbackDepth = 0, feedbackBuffer = 0;
+    GLsync feedbackFence = 0;
+    GLint savedViewport[4];
+
+    void createTextures()
+    {
+        // integer texels, read with texelFetch so nothing is filtered
+        glGenTextures(1, &pageTable);
+        GLState::get().editTexture(GL_TEXTURE_2D, pageTable);
+        for (int level = 0; level < levels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, pagesAt(level), pagesAt(level), 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // the atlas has no mipmaps, every level of the virtual texture has its own pages
+        int atlasSize = atlasPages * pageSize;
+        glGenTextures(1, &atlas);
+        GLState::get().editTexture(GL_TEXTURE_2D, atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // pages are baked by rendering into the atlas, it starts out grey like the upload queue's placeholders
+        glGenFramebuffers(1, &bakeFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, bakeFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas, 0);
+        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void createFeedbackTarget()
+    {
+        glGenTextures(1, &feedbackColor);
+        GLState::get().editTexture(GL_TEXTURE_2D, feedbackColor);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16UI, feedbackWidth, feedbackHeight, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenRenderbuffers(1, &feedbackDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &feedbackFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &feedbackBuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<size_t>(feedbackWidth) * feedbackHeight * 4 * sizeof(unsigned short), nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // marks the requested pages (and their ancestors, they're the fallbacks) as used and bakes the missing ones
+    void readFeedback()
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffer);
+        const unsigned short* pixels = static_cast<const unsigned short*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<size_t>(feedbackWidth) * feedbackHeight * 4 * sizeof(unsigned short), GL_MAP_READ_BIT));
+        std::vector<glm::ivec3> missing;
+        if (pixels)
+        {
+            for (int i = 0; i < feedbackWidth * feedbackHeight; i++)
+            {
+                const unsigned short* pixel = pixels + i * 4;
+                if (pixel[3] == 0)
+                    continue;
+                // neighbouring pixels mostly ask for the same page, skip repeats cheaply
+                if (i > 0 && pixel[0] == pixels[i * 4 - 4] && pixel[1] == pixels[i * 4 - 3] && pixel[2] == pixels[i * 4 - 2])
+                    continue;
+                int level = std::min(static_cast<int>(pixel[2]), levels - 1);
+                int x = pixel[0], y = pixel[1];
+                for (; level < levels; level++, x >>= 1, y >>= 1)
+                {
+                    if (x >= pagesAt(level) || y >= pagesAt(level))
+                        break;
+                    int slot = pageSlots[level][static_cast<size_t>(y) * pagesAt(level) + x];
+                    if (slot >= 0)
+                    {
+                        // everything above a resident page is resident too, at least this frame
+                        if (slots[slot].lastUsed == frame)
+                            break;
+                        slots[slot].lastUsed = frame;
+                    }
+                    else
+                    {
+                        missing.push_back(glm::ivec3(x, y, level));
+                    }
+                }
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // coarse pages first, they fill in the most screen at once and are the fallbacks of the finer ones
+        std::sort(missing.begin(), missing.end(), [](const glm::ivec3& a, const glm::ivec3& b) {
+            return a.z != b.z ? a.z > b.z : a.y != b.y ? a.y < b.y : a.x < b.x;
+        });
+        missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+        for (unsigned int i = 0; i < missing.size() && static_cast<int>(i) < bakesPerFrame; i++)
+        {
+            if (!bakePage(missing[i].z, missing[i].x, missing[i].y))
+                break;
+        }
+    }
+
+    // returns a free slot, evicting the least recently used page that wasn't needed this frame. -1 if all are in use.
+    int acquireSlot()
+    {
+        if (!freeSlots.empty())
+        {
+            int slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+
+        int oldest = -1;
+        for (unsigned int i = 0; i < slots.size(); i++)
+        {
+            const Slot& slot = slots[i];
+            if (slot.level == levels - 1 || slot.lastUsed == frame)
+                continue;
+            if (oldest < 0 || slot.lastUsed < slots[oldest].lastUsed)
+                oldest = i;
+        }
+        if (oldest < 0)
+            return -1;
+        const Slot& evicted = slots[oldest];
+        pageSlots[evicted.level][static_cast<size_t>(evicted.y) * pagesAt(evicted.level) + evicted.x] = -1;
+        markDirty(evicted.level, evicted.x, evicted.y);
+        return oldest;
+    }
+
+    bool bakePage(int level, int x, int y)
+    {
+        int slot = acquireSlot();
+        if (slot < 0)
+            return false;
+
+        int slotX = slot % atlasPages, slotY = slot / atlasPages;
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, bakeFramebuffer);
+        glViewport(slotX * pageSize, slotY * pageSize, pageSize, pageSize);
+
+        // the page plus its border, in virtual texture coordinates
+        float size = 1.0f / pagesAt(level);
+        float border = size * pageBorder / pagePayload;
+        bake(level, glm::vec4(x * size - border, y * size - border, size + 2.0f * border, size + 2.0f * border));
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+
+        slots[slot].level = level;
+        slots[slot].x = x;
+        slots[slot].y = y;
+        slots[slot].lastUsed = frame;
+        pageSlots[level][static_cast<size_t>(y) * pagesAt(level) + x] = slot;
+        markDirty(level, x, y);
+        return true;
+    }
+
+    void markDirty(int level, int x, int y)
+    {
+        dirtyPages.push_back(glm::ivec3(x, y, level));
+    }
+
+    // every entry points at the page itself when it's baked, otherwise at whatever its parent points at. Only the
+    // dirty pages and what's below them are rebuilt, coarse ones first so the parents are current when the children
+    // copy them.
+    void uploadPageTable()
+    {
+        std::sort(dirtyPages.begin(), dirtyPages.end(), [](const glm::ivec3& a, const glm::ivec3& b) {
+            return a.z != b.z ? a.z > b.z : a.y != b.y ? a.y < b.y : a.x < b.x;
+        });
+        dirtyPages.erase(std::unique(dirtyPages.begin(), dirtyPages.end()), dirtyPages.end());
+
+        GLState::get().editTexture(GL_TEXTURE_2D, pageTable);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (unsigned int i = 0; i < dirtyPages.size(); i++)
+        {
+            const glm::ivec3& page = dirtyPages[i];
+            // a page below another dirty one was rebuilt with it
+            bool covered = false;
+            for (unsigned int j = 0; j < i && !covered; j++)
+            {
+                const glm::ivec3& above = dirtyPages[j];
+                int shift = above.z - page.z;
+                covered = shift > 0 && (page.x >> shift) == above.x && (page.y >> shift) == above.y;
+            }
+            if (covered)
+                continue;
+
+            for (int level = page.z; level >= 0; level--)
+            {
+                int shift = page.z - level;
+                int pages = pagesAt(level);
+                int x0 = page.x << shift, y0 = page.y << shift;
+                int size = std::min(1 << shift, pages);
+                for (int y = y0; y < y0 + size; y++)
+                {
+                    for (int x = x0; x < x0 + size; x++)
+                        updateEntry(level, x, y);
+                }
+
+                // the rectangle straight out of the level's entries
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, pages);
+                glPixelStorei(GL_UNPACK_SKIP_PIXELS, x0);
+                glPixelStorei(GL_UNPACK_SKIP_ROWS, y0);
+                glTexSubImage2D(GL_TEXTURE_2D, level, x0, y0, size, size, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &tableEntries[level][0]);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        dirtyPages.clear();
+    }
+
+    void updateEntry(int level, int x, int y)
+    {
+        int pages = pagesAt(level);
+        unsigned char* entry = &tableEntries[level][(static_cast<size_t>(y) * pages + x) * 4];
+        int slot = pageSlots[level][static_cast<size_t>(y) * pages + x];
+        if (slot >= 0)
+        {
+            entry[0] = static_cast<unsigned char>(slot % atlasPages);
+            entry[1] = static_cast<unsigned char>(slot / atlasPages);
+            entry[2] = static_cast<unsigned char>(level);
+            entry[3] = 1;
+        }
+        else if (level < levels - 1)
+        {
+            const unsigned char* parent = &tableEntries[level + 1][(static_cast<size_t>(y / 2) * pagesAt(level + 1) + x / 2) * 4];
+            memcpy(entry, parent, 4);
+        }
+    }
+};
+#endif
@@ -6,8 +6,16 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <memory>
 #include <string>
 #include <vector>
+
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Shader.h"
+#include "UploadQueue.h"
 using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
@@ -29,6 +37,18 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// where a vertex attribute is read from, for meshes whose vertex data doesn't use the Vertex layout
+struct VertexAttribute {
+    GLuint location;
+    GLuint buffer;
+    GLint size;             // number of components
+    GLenum type;            // component type, e.g. GL_FLOAT or GL_SHORT
+    GLboolean normalized;   // integer components are mapped to [0, 1] or [-1, 1]
+    bool integer;           // integer components reach the shader as integers (glVertexAttribIPointer)
+    GLsizei stride;         // 0 when the components are tightly packed
+    size_t offset;
+};
+
 struct Texture {
     unsigned int id;
     string type;
@@ -41,23 +61,189 @@ public:
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    // world transforms of every node that references this mesh, drawn as instances
+    vector<glm::mat4>    instanceTransforms;
+    // object space bounding box of the vertices, and a sphere around them for distances and quick tests
+    glm::vec3 boundsMin, boundsMax;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
     unsigned int VAO;
+    // what a draw call needs, without an element buffer the vertices are drawn in order
+    unsigned int elementCount;
+    GLenum indexType;
+    size_t indexOffset;
+    // vertices carry bone ids and weights, the vertex shader blends the bone palette of the instance
+    bool skinned = false;
+    // index into the material table of the model the mesh belongs to, -1 when the mesh binds its own textures
+    int material = -1;
 
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor, with an upload queue the vertex data is uploaded in the background and the mesh isn't drawn until it's resident
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, UploadQueue* uploads = nullptr)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->instanceTransforms.push_back(glm::mat4(1.0f));
+        elementCount = static_cast<unsigned int>(indices.size());
+        indexType = GL_UNSIGNED_INT;
+        indexOffset = 0;
+
+        boundsMin = glm::vec3(0.0f);
+        boundsMax = glm::vec3(0.0f);
+        if (!vertices.empty())
+        {
+            boundsMin = boundsMax = vertices[0].Position;
+            for (unsigned int i = 1; i < vertices.size(); i++)
+            {
+                boundsMin = glm::min(boundsMin, vertices[i].Position);
+                boundsMax = glm::max(boundsMax, vertices[i].Position);
+            }
+        }
+        // centered on the box, but only as big as the farthest vertex, which is often well inside the box's corners
+        boundsCenter = (boundsMin + boundsMax) * 0.5f;
+        float radiusSquared = 0.0f;
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            glm::vec3 offset = vertices[i].Position - boundsCenter;
+            radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+        }
+        boundsRadius = std::sqrt(radiusSquared);
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(uploads);
+    }
+
+    // constructor for vertex data that already lives in buffer objects, e.g. the buffer views of a glTF file. The buffers
+    // belong to the caller. elementBuffer 0 draws elementCount vertices without indices. A ticket keeps the mesh hidden
+    // until the buffers are resident.
+    Mesh(const vector<VertexAttribute>& attributes, GLuint elementBuffer, GLenum indexType, size_t indexOffset, unsigned int elementCount,
+         const glm::vec3& boundsMin, const glm::vec3& boundsMax, vector<Texture> textures, shared_ptr<UploadTicket> ticket = nullptr)
+    {
+        this->textures = textures;
+        this->instanceTransforms.push_back(glm::mat4(1.0f));
+        this->boundsMin = boundsMin;
+        this->boundsMax = boundsMax;
+        // the vertices aren't in memory, the sphere goes around the box
+        boundsCenter = (boundsMin + boundsMax) * 0.5f;
+        boundsRadius = glm::length(boundsMax - boundsCenter);
+        this->elementCount = elementCount;
+        this->indexType = indexType;
+        this->indexOffset = indexOffset;
+        uploadTicket = ticket;
+        VBO = 0;
+        EBO = elementBuffer;
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &instanceVBO);
+        GLState::get().bindVertexArray(VAO);
+        for (unsigned int i = 0; i < attributes.size(); i++)
+        {
+            const VertexAttribute& attribute = attributes[i];
+            glBindBuffer(GL_ARRAY_BUFFER, attribute.buffer);
+            glEnableVertexAttribArray(attribute.location);
+            if (attribute.integer)
+                glVertexAttribIPointer(attribute.location, attribute.size, attribute.type, attribute.stride, (void*)attribute.offset);
+            else
+                glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, attribute.stride, (void*)attribute.offset);
+        }
+        if (EBO)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        setupInstanceAttributes();
+        GLState::get().bindVertexArray(0);
+    }
+
+    // replaces the per-instance transforms and re-uploads the instance buffer
+    void setInstances(const vector<glm::mat4>& transforms)
+    {
+        instanceTransforms = transforms;
+        uploadInstances(instanceTransforms);
+    }
+
+    // false while the vertex data is still queued for upload
+    bool resident() const
+    {
+        return !uploadTicket || uploadTicket->resident();
     }
 
     // render the mesh
-    void Draw(unsigned int program)
+    void Draw(const Shader& program)
+    {
+        // a mesh that no node references has nothing to draw
+        if (instanceTransforms.empty() || !resident())
+            return;
+
+        // the instance buffer might still hold the transforms of a previous DrawInstances call
+        if (!instanceBufferHoldsNodes)
+            uploadInstances(instanceTransforms);
+
+        drawInstances(program, instanceTransforms.size());
+    }
+
+    // render the mesh once for every transform in the list, instead of the transforms of its nodes
+    void DrawInstances(const Shader& program, const vector<glm::mat4>& transforms)
     {
-        // bind appropriate textures
+        if (transforms.empty() || !resident())
+            return;
+
+        uploadInstances(transforms);
+        drawInstances(program, transforms.size());
+    }
+
+    // true when the mesh has indices and can be drawn by DrawIndirect
+    bool indexed() const
+    {
+        return EBO != 0 && indexType == GL_UNSIGNED_INT;
+    }
+
+    // draws the command at commandOffset in the bound GL_DRAW_INDIRECT_BUFFER, with the instance transforms read from
+    // instanceBuffer instead of the mesh's own. See GpuCulling.h, needs GL 4.3.
+    void DrawIndirect(const Shader& program, GLuint instanceBuffer, const void* commandOffset)
+    {
+        if (!indexed() || !resident())
+            return;
+
+        bindTextures(program);
+        GLState::get().bindVertexArray(VAO);
+        pointInstanceAttributes(instanceBuffer);
+        GLExtensions::get().MultiDrawElementsIndirect(GL_TRIANGLES, indexType, commandOffset, 1, 0);
+    }
+
+private:
+    // render data 
+    unsigned int VBO, EBO, instanceVBO;
+    // the buffer the instance attributes of the VAO read, instanceVBO unless DrawIndirect pointed them elsewhere
+    unsigned int instanceSource = 0;
+    // number of matrices the instance buffer has room for
+    size_t instanceCapacity = 0;
+    bool instanceBufferHoldsNodes = false;
+    shared_ptr<UploadTicket> uploadTicket;
+    // the samplers of the program last drawn with, one per texture
+    vector<Sampler> textureSamplers;
+    unsigned int samplerProgram = 0;
+
+    // writes the matrices into the instance buffer, growing it when needed
+    void uploadInstances(const vector<glm::mat4>& transforms)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        if (transforms.size() > instanceCapacity)
+            instanceCapacity = transforms.size();
+        // orphan the old storage so we don't have to wait for draws that still read from it
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        if (!transforms.empty())
+            glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4), &transforms[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        instanceBufferHoldsNodes = (&transforms == &instanceTransforms);
+    }
+
+    // finds the sampler each texture goes to (texture_diffuseN and so on), only when the program changes
+    void resolveSamplers(const Shader& program)
+    {
+        if (samplerProgram == program.id && textureSamplers.size() == textures.size())
+            return;
+        samplerProgram = program.id;
+        textureSamplers.clear();
+
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr = 1;
@@ -66,7 +252,6 @@ public:
         unsigned int ambientOcclusionNr = 1;
         for (unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -83,43 +268,64 @@ public:
             else if (name == "texture_ao")
                 number = std::to_string(ambientOcclusionNr++); // transfer unsigned int to string
 
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(program, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            textureSamplers.push_back(program.sampler((name + number).c_str()));
         }
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // bind appropriate textures
+    void bindTextures(const Shader& program)
+    {
+        if (!textures.empty())
+        {
+            resolveSamplers(program);
+            for (unsigned int i = 0; i < textures.size(); i++)
+                textureSamplers[i].bind(textures[i].id);
+        }
     }
 
-private:
-    // render data 
-    unsigned int VBO, EBO;
+    void drawInstances(const Shader& program, size_t instanceCount)
+    {
+        bindTextures(program);
+
+        // draw mesh, the vertex array stays bound for the next draw of the same mesh
+        GLState::get().bindVertexArray(VAO);
+        pointInstanceAttributes(instanceVBO);
+        if (EBO)
+            glDrawElementsInstanced(GL_TRIANGLES, elementCount, indexType, (void*)indexOffset, static_cast<GLsizei>(instanceCount));
+        else
+            glDrawArraysInstanced(GL_TRIANGLES, 0, elementCount, static_cast<GLsizei>(instanceCount));
+    }
 
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(UploadQueue* uploads)
     {
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
+        glGenBuffers(1, &instanceVBO);
 
-        glBindVertexArray(VAO);
+        GLState::get().bindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        // with an upload queue the buffers stay empty for now, the queue fills them once it gets to them
+        if (uploads)
+        {
+            uploadTicket = make_shared<UploadTicket>(2);
+            uploads->enqueueBuffer(VBO, vertices, uploadTicket);
+            uploads->enqueueBuffer(EBO, indices, uploadTicket);
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        }
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        if (!uploads)
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -144,7 +350,34 @@ private:
         // weights
         glEnableVertexAttribArray(6);
         glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+
+        setupInstanceAttributes();
+        GLState::get().bindVertexArray(0);
+    }
+
+    // instance transforms, a mat4 takes up four consecutive attribute slots. Expects the VAO to be bound.
+    void setupInstanceAttributes()
+    {
+        uploadInstances(instanceTransforms);
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(7 + i);
+            glVertexAttribDivisor(7 + i, 1);
+        }
+        pointInstanceAttributes(instanceVBO);
+    }
+
+    // makes the instance attributes read the transforms from buffer, only when they don't already. Expects the VAO
+    // to be bound.
+    void pointInstanceAttributes(unsigned int buffer)
+    {
+        if (instanceSource == buffer)
+            return;
+        instanceSource = buffer;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (unsigned int i = 0; i < 4; i++)
+            glVertexAttribPointer(7 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4) * i));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 };
 #endif
\ No newline at end of file
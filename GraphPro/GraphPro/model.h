@@ -5,12 +5,28 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include "stb_image.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "Animation.h"
+#include "Frustum.h"
+#include "FrustumCulling.h"
+#include "GpuCulling.h"
+#include "ObjLoader.h"
+#include "GltfLoader.h"
+#include "TextureCooker.h"
+#include "TextureResidency.h"
+#include "ImageDecoder.h"
+#include "ArchiveIOSystem.h"
+#include "ThreadPool.h"
+#include "ShaderVariants.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "FrameUniforms.h"
 
 #include <string>
 #include <fstream>
@@ -18,39 +34,784 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cfloat>
+#include <algorithm>
+#include <cstring>
+#include <cassert>
 using namespace std;
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false, UploadQueue* uploads = nullptr);
+unsigned int TextureFromData(int width, int height, int nrComponents, shared_ptr<void> data, UploadQueue* uploads = nullptr);
 
-class Model
+// a decoded image that still has to be turned into a GL texture
+struct TextureData {
+    string path;
+    int width, height, nrComponents;
+    shared_ptr<void> pixels;
+    // set instead of pixels when a cooked version of the texture exists
+    CompressedImage compressed;
+};
+
+// vertex data of a mesh that still has to be uploaded, textures refer to Model::pendingTextures
+struct MeshData {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<pair<unsigned int, string>> textures;   // texture index and sampler type
+    // set instead of vertices and indices when the data is uploaded as-is (glTF), buffers refer to Model::pendingBuffers
+    vector<VertexAttribute> attributes;
+    int elementBuffer = -1;
+    GLenum indexType = GL_UNSIGNED_INT;
+    size_t indexOffset = 0;
+    unsigned int elementCount = 0;
+    glm::vec3 boundsMin, boundsMax;
+    bool skinned = false;
+};
+
+// texture slots of a material, in the order of the samplers in model.fs
+const int MATERIAL_SLOTS = 5;
+const char* const MATERIAL_SLOT_TYPES[MATERIAL_SLOTS] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_roughness", "texture_ao" };
+// the sampler2DArray each slot is read from, and the define that makes model.fs read it
+const char* const MATERIAL_SLOT_SAMPLERS[MATERIAL_SLOTS] = { "diffuseArray", "specularArray", "normalArray", "roughnessArray", "aoArray" };
+const char* const MATERIAL_SLOT_DEFINES[MATERIAL_SLOTS] = { "HAS_DIFFUSE_MAP", "HAS_SPECULAR_MAP", "HAS_NORMAL_MAP", "HAS_ROUGHNESS_MAP", "HAS_AO_MAP" };
+
+// a unique set of material textures. Every slot refers to a layer of one of the model's texture arrays, -1 when unused.
+struct ModelMaterial {
+    int arrays[MATERIAL_SLOTS];
+    int layers[MATERIAL_SLOTS];
+};
+
+// all textures of a model that have the same size and channel count, one layer per texture
+struct TextureArray {
+    unsigned int id;
+    int width, height, channels;
+    // block-compressed arrays have their format and the number of cooked mip levels, 0 for uncompressed ones
+    GLenum compressedFormat;
+    int levels;
+    int layers;
+    shared_ptr<UploadTicket> ticket;
+
+    bool resident() const
+    {
+        return !ticket || ticket->resident();
+    }
+};
+
+// bytes that become a GL buffer without being converted, usually pointing into a memory-mapped file
+struct BufferData {
+    shared_ptr<void> bytes;
+    size_t size;
+};
+
+// a node of the imported scene graph. Nodes are stored parents-first, so a parent's index is always lower than its children's.
+struct ModelNode {
+    string name;
+    int parent;
+    vector<int> children;
+    // indices into Model::meshes, a mesh can be referenced by several nodes
+    vector<unsigned int> meshes;
+    glm::mat4 localTransform;
+    glm::mat4 worldTransform;
+    // set when localTransform changed and worldTransform has to be recalculated
+    bool dirty;
+};
+
+class Model : public Drawable
 {
 public:
     // model data 
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
-    vector<Mesh>    meshes;
+    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once. The id is that of the texture array holding it.
+    vector<TextureArray> textureArrays;
+    // materials shared by the meshes, deduplicated at import. Mesh::material indexes it.
+    vector<ModelMaterial> materials;
+    vector<Mesh>    meshes;             // one entry per aiMesh, indexed like scene->mMeshes
+    vector<ModelNode> nodes;
+    // bones and animation clips, empty for models that aren't animated
+    Skeleton skeleton;
+    vector<AnimationClip> animations;
+    // buffer objects shared by several meshes, used by glTF files where every buffer view becomes one buffer
+    vector<unsigned int> buffers;
+    // bounding sphere around all meshes in model space
+    glm::vec3 boundsCenter;
+    float boundsRadius;
     string directory;
     bool gammaCorrection;
+    // when set, textures and vertex data are uploaded in the background and show placeholders until they're resident
+    UploadQueue* uploads;
+    // when set, the texture arrays are handed to it and only keep the mip levels that are asked for
+    TextureResidency* residency;
+    // .obj files are read with ObjLoader instead of Assimp
+    bool nativeObj = true;
+
+    // uniform block binding of the material table, the program's Materials block has to be bound to it
+    static const unsigned int MATERIAL_BLOCK_BINDING = 1;
+    // the texture arrays are bound to the unit of their slot in every program variant, the bone palette comes after
+    // them, so switching variants between meshes keeps what's bound
+    static const unsigned int BONE_PALETTE_UNIT = MATERIAL_SLOTS;
+    // size of the Materials block in model.fs
+    static const int MAX_MATERIALS = 256;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const& path, bool gamma = false, UploadQueue* _uploads = nullptr, TextureResidency* _residency = nullptr) : boundsCenter(0.0f), boundsRadius(0.0f), gammaCorrection(gamma), uploads(_uploads), residency(_residency)
+    {
+        importModel(path);
+        finishLoad();
+    }
+
+    // imports all models at the same time on the pool's workers, each worker with its own Assimp importer.
+    // Reading, post-processing, vertex conversion and texture decoding all happen on the workers, only the GL work
+    // runs on the calling thread (which has to own the GL context).
+    static vector<Model*> LoadConcurrent(const vector<string>& paths, ThreadPool& pool, UploadQueue* uploads = nullptr, bool gamma = false, TextureResidency* residency = nullptr)
+    {
+        vector<Model*> models;
+        vector<future<void>> imports;
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            Model* model = new Model(gamma, uploads, residency);
+            string path = paths[i];
+            models.push_back(model);
+            imports.push_back(pool.async([model, path] { model->importModel(path); }));
+        }
+
+        // hand each model over to the GL thread once its import is done
+        for (unsigned int i = 0; i < models.size(); i++)
+        {
+            imports[i].wait();
+            models[i]->finishLoad();
+        }
+        return models;
+    }
+
+    // the variant of the model program that draws the depth pre-pass, a feature bit after the material slots
+    static const unsigned int DEPTH_ONLY_FEATURE = 1u << MATERIAL_SLOTS;
+
+    // the defines of the model program's variants, in the order of the bits of materialFeatures, then DEPTH_ONLY
+    static vector<string> programFeatures()
+    {
+        vector<string> features(MATERIAL_SLOT_DEFINES, MATERIAL_SLOT_DEFINES + MATERIAL_SLOTS);
+        features.push_back("DEPTH_ONLY");
+        return features;
+    }
+
+    // what every variant of the model program needs once it's linked: the material table and the fixed units
+    static void setupProgram(Shader& program)
+    {
+        program.use();
+        for (int slot = 0; slot < MATERIAL_SLOTS; slot++)
+            program.assignUnit(MATERIAL_SLOT_SAMPLERS[slot], slot);
+        program.assignUnit("bonePalette", BONE_PALETTE_UNIT);
+        program.bindBlock("Materials", MATERIAL_BLOCK_BINDING);
+    }
+
+    // starts building the program variants the model's materials need up front, so the first draw doesn't have to
+    void preparePrograms(ShaderVariants& programs) const
+    {
+        programs.get(0);
+        programs.get(DEPTH_ONLY_FEATURE);
+        for (unsigned int i = 0; i < materials.size(); i++)
+            programs.get(materialFeatures(materials[i]));
+    }
+
+    // puts the model in the render queue, a packet per mesh. Every mesh is drawn once, instanced for each node that
+    // references it. Each material is drawn with the variant of the program that samples just the maps it has.
+    // Meshes whose box is outside the frustum are left out, the others sort by their own distance.
+    void Submit(RenderQueue& queue, ShaderVariants& programs, const glm::mat4& world)
+    {
+        updateTransforms();
+
+        Submission& submission = beginSubmission(queue, programs, SUBMIT_NODES);
+        submission.world = world;
+
+        // the boxes of all meshes in world space, tested in one batch
+        cullBoxes.resize(meshes.size());
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            cullBoxes.set(i, world, meshBoundsMin[i], meshBoundsMax[i]);
+        FrustumCulling::cullBoxes(queue.frustum(), cullBoxes, cullVisible);
+        if (queue.occlusion())
+            queue.occlusion()->cull(cullBoxes, cullVisible);
+        if (cullVisible.empty())
+        {
+            submissionCount--;
+            return;
+        }
+
+        meshDepths.assign(meshes.size(), CULLED);
+        float scale = maxScale(world);
+        for (unsigned int v = 0; v < cullVisible.size(); v++)
+        {
+            // the nearest node that draws the mesh
+            unsigned int i = cullVisible[v];
+            const Mesh& mesh = meshes[i];
+            for (unsigned int j = 0; j < mesh.instanceTransforms.size(); j++)
+            {
+                const glm::mat4& t = mesh.instanceTransforms[j];
+                glm::vec3 center = glm::vec3(world * t * glm::vec4(mesh.boundsCenter, 1.0f));
+                meshDepths[i] = std::min(meshDepths[i], queue.depth(center, mesh.boundsRadius * maxScale(t) * scale));
+            }
+        }
+        submitMeshes(queue, submissionCount - 1);
+    }
+
+    // puts a copy of the model in the queue for every transform in the list. Copies whose bounds lie outside the
+    // frustum are culled right away, the remaining ones are drawn with one instanced draw call per mesh.
+    void SubmitInstanced(RenderQueue& queue, ShaderVariants& programs, const vector<glm::mat4>& transforms)
+    {
+        updateTransforms();
+
+        Submission& submission = beginSubmission(queue, programs, SUBMIT_INSTANCES);
+        cullInstances(queue, transforms.size(), [&transforms](unsigned int i) -> const glm::mat4& { return transforms[i]; });
+        for (unsigned int v = 0; v < cullVisible.size(); v++)
+            submission.visibleInstances.push_back(transforms[cullVisible[v]]);
+
+        if (submission.visibleInstances.empty())
+        {
+            submissionCount--;
+            return;
+        }
+        submitMeshes(queue, submissionCount - 1);
+    }
+
+    // puts the copies in the queue without culling them on the CPU: GpuCulling culls them on the GPU against the frustum
+    // and its depth pyramid and writes an indirect draw per mesh, which is what the packets draw. Returns false when
+    // the model can't be drawn that way (a mesh without indices, or the culling programs didn't build), the caller
+    // falls back to SubmitInstanced. Like SubmitAnimated, once per model and frame: the draws live in the model.
+    bool SubmitIndirect(RenderQueue& queue, ShaderVariants& programs, GpuCulling& culling, const GpuInstances& copies)
+    {
+        if (!culling.ready())
+            return false;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if (!meshes[i].indexed())
+                return false;
+        }
+        updateTransforms();
+        if (copies.size() == 0)
+            return true;
+
+        // room for every copy, laid out again when the nodes move
+        if (indirectDirty || indirectDraws.capacity < copies.size())
+        {
+            vector<IndirectDraws::MeshDraw> draws(meshes.size());
+            for (unsigned int i = 0; i < meshes.size(); i++)
+            {
+                draws[i].count = meshes[i].elementCount;
+                draws[i].firstIndex = static_cast<GLuint>(meshes[i].indexOffset / sizeof(GLuint));
+                draws[i].nodes = meshes[i].instanceTransforms;
+            }
+            indirectDraws.setup(draws, copies.size());
+            indirectDirty = false;
+        }
+
+        beginSubmission(queue, programs, SUBMIT_INDIRECT);
+        culling.cullInstances(copies, queue.frustum(), glm::vec4(boundsCenter, boundsRadius), indirectDraws);
+        // how many copies are left, and which is nearest, is only known on the GPU. They sort by state alone.
+        meshDepths.assign(meshes.size(), 0);
+        submitMeshes(queue, submissionCount - 1);
+        return true;
+    }
+
+    // puts every instance of an animator in the queue, after culling them like SubmitInstanced. Skinned meshes get the
+    // bone palettes of the visible instances through a buffer texture (one palette per instance, in draw order),
+    // meshes that aren't skinned follow the animated transforms of their nodes. The palettes live in one buffer per
+    // model, so a model can only be submitted animated once per frame.
+    void SubmitAnimated(RenderQueue& queue, ShaderVariants& programs, const Animator& animator)
+    {
+        updateTransforms();
+
+        // the bounds are those of the bind pose, animations are expected to stay roughly inside them
+        Submission& submission = beginSubmission(queue, programs, SUBMIT_ANIMATED);
+        submission.animator = &animator;
+        cullInstances(queue, animator.instances.size(), [&animator](unsigned int i) -> const glm::mat4& { return animator.instances[i].transform; });
+        for (unsigned int v = 0; v < cullVisible.size(); v++)
+        {
+            submission.visibleInstances.push_back(animator.instances[cullVisible[v]].transform);
+            submission.visibleAnimated.push_back(cullVisible[v]);
+        }
+
+        if (submission.visibleInstances.empty())
+        {
+            submissionCount--;
+            return;
+        }
+
+        // the palettes of the visible instances back to back, so instance i of a draw reads palette i
+        submission.boneCount = animator.boneCount();
+        if (submission.boneCount > 0)
+        {
+            paletteScratch.resize(submission.visibleAnimated.size() * submission.boneCount);
+            for (unsigned int i = 0; i < submission.visibleAnimated.size(); i++)
+                std::copy(animator.palette(submission.visibleAnimated[i]), animator.palette(submission.visibleAnimated[i]) + submission.boneCount, paletteScratch.begin() + i * submission.boneCount);
+            uploadPalettes();
+        }
+        submitMeshes(queue, submissionCount - 1);
+    }
+
+    // draws one mesh of a submission when the render queue gets to its packet. In the depth pass that's without
+    // a material, with the DEPTH_ONLY variant.
+    void draw(RenderQueue::Pass pass, unsigned int item, FrameUniforms& frame)
+    {
+        const Submission& submission = submissions[item >> 16];
+        unsigned int i = item & 0xFFFF;
+
+        GLState& state = GLState::get();
+        state.enable(GL_CULL_FACE);
+        state.cullFace(GL_BACK);
+
+        ProgramHandles* handles = nullptr;
+        const Shader* shader = pass == RenderQueue::PASS_DEPTH ? bindDepthProgram(*submission.programs, handles) : bindMaterial(*submission.programs, meshes[i].material, handles);
+        if (!shader)
+            return;
+
+        if (submission.kind == SUBMIT_NODES)
+        {
+            frame.setWorld(submission.world);
+            // the program is shared, an animated model may have left its bone count on it
+            handles->boneCount.set(0);
+            meshes[i].Draw(*shader);
+            return;
+        }
+
+        if (submission.kind == SUBMIT_INDIRECT)
+        {
+            frame.setWorld(glm::mat4(1.0f));
+            handles->boneCount.set(0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectDraws.commands);
+            meshes[i].DrawIndirect(*shader, indirectDraws.instances, IndirectDraws::commandOffset(i));
+            return;
+        }
+
+        // the instance transforms already place the copies in the world
+        frame.setWorld(glm::mat4(1.0f));
+        meshInstances.clear();
+        if (submission.kind == SUBMIT_ANIMATED && meshes[i].skinned && submission.boneCount > 0)
+        {
+            // the palette already places the vertices in model space
+            state.bindTexture(BONE_PALETTE_UNIT, GL_TEXTURE_BUFFER, paletteTexture);
+            handles->boneCount.set(static_cast<int>(submission.boneCount));
+            meshInstances = submission.visibleInstances;
+        }
+        else if (submission.kind == SUBMIT_ANIMATED)
+        {
+            handles->boneCount.set(0);
+            for (unsigned int j = 0; j < submission.visibleAnimated.size(); j++)
+            {
+                for (unsigned int k = 0; k < meshNodes[i].size(); k++)
+                    meshInstances.push_back(submission.visibleInstances[j] * submission.animator->nodeTransform(submission.visibleAnimated[j], meshNodes[i][k]));
+            }
+        }
+        else
+        {
+            handles->boneCount.set(0);
+            // every node that references the mesh is repeated for each visible copy
+            const vector<glm::mat4>& nodeTransforms = meshes[i].instanceTransforms;
+            for (unsigned int j = 0; j < submission.visibleInstances.size(); j++)
+            {
+                for (unsigned int k = 0; k < nodeTransforms.size(); k++)
+                    meshInstances.push_back(submission.visibleInstances[j] * nodeTransforms[k]);
+            }
+        }
+        meshes[i].DrawInstances(*shader, meshInstances);
+    }
+
+    // tells the residency manager how big the model is on screen this frame, all its texture arrays are asked for at
+    // the matching mip level
+    void requestTextures(TextureResidency& residency, float screenPixels) const
+    {
+        for (unsigned int i = 0; i < textureArrays.size(); i++)
+            residency.requestScreenSize(textureArrays[i].id, screenPixels);
+    }
+
+    // returns the index of the first node with the given name, or -1 if there is none
+    int findNode(const string& name) const
+    {
+        for (unsigned int i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].name == name)
+                return i;
+        }
+        return -1;
+    }
+
+    // changes the local transform of a node, its world transform (and those of its children) is updated on the next draw
+    void setNodeTransform(int node, const glm::mat4& localTransform)
     {
-        loadModel(path);
+        nodes[node].localTransform = localTransform;
+        nodes[node].dirty = true;
+        transformsDirty = true;
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(unsigned int shader)
+    // recalculates the world transforms of all dirty nodes and their children, and re-uploads the instances of the affected meshes
+    void updateTransforms()
     {
+        if (!transformsDirty)
+            return;
+
+        vector<bool> meshChanged(meshes.size(), false);
+        // parents come before their children, so a single forward pass is enough to propagate changes down the tree
+        for (unsigned int i = 0; i < nodes.size(); i++)
+        {
+            ModelNode& node = nodes[i];
+            if (node.parent >= 0 && nodes[node.parent].dirty)
+                node.dirty = true;
+            if (!node.dirty)
+                continue;
+
+            node.worldTransform = node.parent >= 0 ? nodes[node.parent].worldTransform * node.localTransform : node.localTransform;
+            for (unsigned int j = 0; j < node.meshes.size(); j++)
+                meshChanged[node.meshes[j]] = true;
+        }
+
+        // collect the world transforms of every node that references a changed mesh
+        vector<vector<glm::mat4>> instances(meshes.size());
+        for (unsigned int i = 0; i < nodes.size(); i++)
+        {
+            nodes[i].dirty = false;
+            for (unsigned int j = 0; j < nodes[i].meshes.size(); j++)
+            {
+                if (meshChanged[nodes[i].meshes[j]])
+                    instances[nodes[i].meshes[j]].push_back(nodes[i].worldTransform);
+            }
+        }
+
         for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        {
+            if (meshChanged[i])
+            {
+                meshes[i].setInstances(instances[i]);
+                indirectDirty = true;
+            }
+        }
+
+        updateBounds();
+        transformsDirty = false;
     }
 
 private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const& path)
+    bool transformsDirty = false;
+    // output of importModel, consumed by finishLoad
+    vector<MeshData> pendingMeshes;
+    vector<TextureData> pendingTextures;
+    vector<BufferData> pendingBuffers;
+    // name of every bone in skeleton.boneNodes order, bones are matched to nodes once the node tree is read
+    vector<string> boneNames;
+    // the nodes that reference each mesh
+    vector<vector<int>> meshNodes;
+    // mesh indices sorted by material, and each material's place in that order, see sortDrawOrder
+    vector<unsigned int> drawOrder;
+    vector<unsigned int> materialRank;
+    // the material table as a uniform buffer
+    unsigned int materialBuffer = 0;
+
+    // the uniforms of a program variant the model has drawn with, looked up the first time it's used
+    struct ProgramHandles {
+        unsigned int program;
+        Uniform materialID, boneCount;
+    };
+    vector<ProgramHandles> programHandles;
+
+    ProgramHandles& handlesOf(const Shader& shader)
+    {
+        for (unsigned int i = 0; i < programHandles.size(); i++)
+        {
+            if (programHandles[i].program == shader.id)
+                return programHandles[i];
+        }
+        ProgramHandles handles;
+        handles.program = shader.id;
+        handles.materialID = shader.uniform("materialID");
+        handles.boneCount = shader.uniform("boneCount");
+        programHandles.push_back(handles);
+        return programHandles.back();
+    }
+
+    // the variant of the model program a material needs, a bit per slot it has a texture for. model.fs doesn't do
+    // normal mapping, that doesn't make a variant of its own.
+    static unsigned int materialFeatures(const ModelMaterial& material)
+    {
+        unsigned int features = 0;
+        for (int slot = 0; slot < MATERIAL_SLOTS; slot++)
+        {
+            if (material.arrays[slot] >= 0)
+                features |= 1u << slot;
+        }
+        // bits in slot order, see MATERIAL_SLOT_TYPES
+        const unsigned int normal = 1u << 2;
+        features &= ~normal;
+        return features;
+    }
+
+    // the program variant a material is drawn with. Materials whose textures are still uploading, and those whose
+    // variant is still compiling, draw with the variant that has no maps and become material -1. Null while even that
+    // variant is still compiling, the mesh isn't drawn then.
+    const Shader* programFor(ShaderVariants& programs, int& material)
+    {
+        if (material >= 0)
+        {
+            const ModelMaterial& m = materials[material];
+            for (int slot = 0; slot < MATERIAL_SLOTS; slot++)
+            {
+                if (m.arrays[slot] >= 0 && !textureArrays[m.arrays[slot]].resident())
+                    material = -1;
+            }
+        }
+
+        const Shader* shader = &programs.get(material >= 0 ? materialFeatures(materials[material]) : 0);
+        if (!shader->ready())
+        {
+            material = -1;
+            shader = &programs.get(0);
+        }
+        return shader->ready() ? shader : nullptr;
+    }
+
+    // binds the material table, the texture arrays of a material and the program to draw it with, and selects the
+    // material. The state cache drops whatever the previous mesh already bound, the shader finds the layers through the
+    // material ID.
+    const Shader* bindMaterial(ShaderVariants& programs, int material, ProgramHandles*& handles)
+    {
+        const Shader* shader = programFor(programs, material);
+        if (!shader)
+            return nullptr;
+
+        GLState& state = GLState::get();
+        if (materialBuffer)
+            state.bindUniformBuffer(MATERIAL_BLOCK_BINDING, materialBuffer);
+        if (material >= 0)
+        {
+            const ModelMaterial& m = materials[material];
+            for (int slot = 0; slot < MATERIAL_SLOTS; slot++)
+            {
+                if (m.arrays[slot] >= 0)
+                    state.bindTexture(slot, GL_TEXTURE_2D_ARRAY, textureArrays[m.arrays[slot]].id);
+            }
+        }
+
+        shader->use();
+        handles = &handlesOf(*shader);
+        handles->materialID.set(material);
+        return shader;
+    }
+
+    // the program of the depth pre-pass, null while it's still compiling
+    const Shader* bindDepthProgram(ShaderVariants& programs, ProgramHandles*& handles)
+    {
+        const Shader* shader = &programs.get(DEPTH_ONLY_FEATURE);
+        if (!shader->ready())
+            return nullptr;
+        shader->use();
+        handles = &handlesOf(*shader);
+        return shader;
+    }
+
+    // what a Submit call left for the packets it queued
+    enum SubmissionKind { SUBMIT_NODES, SUBMIT_INSTANCES, SUBMIT_ANIMATED, SUBMIT_INDIRECT };
+    struct Submission {
+        SubmissionKind kind;
+        ShaderVariants* programs;
+        glm::mat4 world;
+        const Animator* animator;
+        unsigned int boneCount;
+        vector<glm::mat4> visibleInstances;
+        vector<unsigned int> visibleAnimated;
+    };
+    // the submissions of the frame the queue is on, kept around to reuse their lists
+    vector<Submission> submissions;
+    unsigned int submissionCount = 0;
+    unsigned int submissionFrame = 0;
+
+    Submission& beginSubmission(RenderQueue& queue, ShaderVariants& programs, SubmissionKind kind)
+    {
+        if (queue.frame() != submissionFrame)
+        {
+            submissionFrame = queue.frame();
+            submissionCount = 0;
+        }
+        if (submissionCount == submissions.size())
+            submissions.push_back(Submission());
+        Submission& submission = submissions[submissionCount++];
+        submission.kind = kind;
+        submission.programs = &programs;
+        submission.world = glm::mat4(1.0f);
+        submission.animator = nullptr;
+        submission.boneCount = 0;
+        submission.visibleInstances.clear();
+        submission.visibleAnimated.clear();
+        return submission;
+    }
+
+    // the bounds tests of a submission: the boxes of the meshes for Submit, the spheres of the copies for
+    // SubmitInstanced and SubmitAnimated. The indices of what's in the frustum, and not behind the occluders of the
+    // queue, end up in cullVisible.
+    BoxArray cullBoxes;
+    SphereArray cullSpheres;
+    vector<uint32_t> cullVisible;
+    // the depth of every mesh of a submission, CULLED for those that aren't drawn
+    static const uint32_t CULLED = 0xFFFFFFFFu;
+    vector<uint32_t> meshDepths;
+
+    // tests the bounding spheres of count copies of the model in one batch. The meshes all sort by the nearest
+    // visible copy.
+    template <typename Transforms>
+    void cullInstances(RenderQueue& queue, size_t count, Transforms transformOf)
+    {
+        cullSpheres.resize(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const glm::mat4& t = transformOf(i);
+            // scale the radius by the largest axis scale of the transform
+            cullSpheres.set(i, glm::vec3(t * glm::vec4(boundsCenter, 1.0f)), boundsRadius * maxScale(t));
+        }
+        FrustumCulling::cullSpheres(queue.frustum(), cullSpheres, cullVisible);
+        if (queue.occlusion())
+            queue.occlusion()->cull(cullSpheres, cullVisible);
+
+        uint32_t depth = 0xFFFFFF;
+        for (unsigned int v = 0; v < cullVisible.size(); v++)
+        {
+            unsigned int i = cullVisible[v];
+            depth = std::min(depth, queue.depth(glm::vec3(cullSpheres.centerX[i], cullSpheres.centerY[i], cullSpheres.centerZ[i]), cullSpheres.radius[i]));
+        }
+        meshDepths.assign(meshes.size(), depth);
+    }
+
+    // a packet per mesh that has something to draw and isn't culled, at its depth in meshDepths. Packets of the same
+    // program sort by material rank, which keeps materials with the same texture arrays together (see sortDrawOrder).
+    // With the depth pre-pass on every mesh gets a depth packet too, they all share the DEPTH_ONLY program and sort by
+    // vertex array and distance.
+    void submitMeshes(RenderQueue& queue, unsigned int submission)
+    {
+        assert(meshes.size() <= 0x10000);
+        const Shader* depthShader = nullptr;
+        if (queue.depthPrepass())
+        {
+            depthShader = &submissions[submission].programs->get(DEPTH_ONLY_FEATURE);
+            if (!depthShader->ready())
+                depthShader = nullptr;
+        }
+        for (unsigned int o = 0; o < drawOrder.size(); o++)
+        {
+            unsigned int i = drawOrder[o];
+            if (!meshes[i].resident() || meshDepths[i] == CULLED)
+                continue;
+            uint32_t depth = meshDepths[i];
+            if (submissions[submission].kind == SUBMIT_NODES && meshes[i].instanceTransforms.empty())
+                continue;
+            int material = meshes[i].material;
+            const Shader* shader = programFor(*submissions[submission].programs, material);
+            if (!shader)
+                continue;
+            unsigned int rank = material >= 0 ? materialRank[material] + 1 : 0;
+            queue.submit(RenderQueue::key(RenderQueue::PASS_OPAQUE, shader->id, rank, meshes[i].VAO, depth), this, submission << 16 | i);
+            if (depthShader)
+                queue.submit(RenderQueue::key(RenderQueue::PASS_DEPTH, depthShader->id, 0, meshes[i].VAO, depth), this, submission << 16 | i);
+        }
+    }
+
+    // the largest axis scale of a transform, for scaling bounding spheres
+    static float maxScale(const glm::mat4& t)
+    {
+        return glm::max(glm::length(glm::vec3(t[0])), glm::max(glm::length(glm::vec3(t[1])), glm::length(glm::vec3(t[2]))));
+    }
+
+    // the draws SubmitIndirect has the GPU write, laid out again when the node transforms change
+    IndirectDraws indirectDraws;
+    bool indirectDirty = true;
+
+    // the bone palettes of SubmitAnimated and their buffer texture
+    vector<glm::mat4> paletteScratch;
+    unsigned int paletteBuffer = 0, paletteTexture = 0;
+    size_t paletteCapacity = 0;
+
+    // writes paletteScratch into the bone palette buffer texture
+    void uploadPalettes()
+    {
+        if (!paletteBuffer)
+        {
+            glGenBuffers(1, &paletteBuffer);
+            glGenTextures(1, &paletteTexture);
+            // the buffer only exists once it's been bound
+            glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+            // every matrix is four RGBA32F texels, one per column. The texture follows the buffer when it's orphaned.
+            GLState::get().editTexture(GL_TEXTURE_BUFFER, paletteTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, paletteBuffer);
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+        paletteCapacity = std::max(paletteCapacity, paletteScratch.size());
+        // orphan, the previous frame's draws might still read the old palettes
+        glBufferData(GL_TEXTURE_BUFFER, paletteCapacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, paletteScratch.size() * sizeof(glm::mat4), &paletteScratch[0]);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+    // the instance transforms of the mesh being drawn, kept around to avoid reallocating them every draw
+    vector<glm::mat4> meshInstances;
+
+    // the box around every node's copy of each mesh, in model space
+    vector<glm::vec3> meshBoundsMin, meshBoundsMax;
+
+    // fits a box around the instances of every mesh, and a bounding sphere around those boxes
+    void updateBounds()
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+        meshBoundsMin.assign(meshes.size(), glm::vec3(0.0f));
+        meshBoundsMax.assign(meshes.size(), glm::vec3(0.0f));
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            const Mesh& mesh = meshes[i];
+            glm::vec3 meshMin(FLT_MAX), meshMax(-FLT_MAX);
+            for (unsigned int j = 0; j < mesh.instanceTransforms.size(); j++)
+            {
+                for (int c = 0; c < 8; c++)
+                {
+                    glm::vec3 corner((c & 1) ? mesh.boundsMax.x : mesh.boundsMin.x, (c & 2) ? mesh.boundsMax.y : mesh.boundsMin.y, (c & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+                    corner = glm::vec3(mesh.instanceTransforms[j] * glm::vec4(corner, 1.0f));
+                    meshMin = glm::min(meshMin, corner);
+                    meshMax = glm::max(meshMax, corner);
+                }
+            }
+            if (meshMin.x > meshMax.x)
+                continue;
+            meshBoundsMin[i] = meshMin;
+            meshBoundsMax[i] = meshMax;
+            min = glm::min(min, meshMin);
+            max = glm::max(max, meshMax);
+        }
+
+        if (min.x > max.x)
+        {
+            boundsCenter = glm::vec3(0.0f);
+            boundsRadius = 0.0f;
+            return;
+        }
+        boundsCenter = (min + max) * 0.5f;
+        boundsRadius = glm::length(max - boundsCenter);
+    }
+
+    // empty model, filled in by importModel and finishLoad
+    Model(bool gamma, UploadQueue* _uploads, TextureResidency* _residency) : boundsCenter(0.0f), boundsRadius(0.0f), gammaCorrection(gamma), uploads(_uploads), residency(_residency)
+    {
+    }
+
+    // loads a model with supported ASSIMP extensions from file into pendingMeshes and pendingTextures.
+    // Doesn't touch GL, so it can run on any thread.
+    void importModel(string const& path)
+    {
+        if (nativeObj && path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0)
+        {
+            importObj(path);
+            return;
+        }
+        if (path.size() > 4 && path.compare(path.size() - 4, 4, ".glb") == 0)
+        {
+            importGlb(path);
+            return;
+        }
+
+        // read file via ASSIMP, every thread keeps its own importer around so they can run side by side
+        static thread_local Assimp::Importer importer;
+        // the importer owns its IO handler, files it opens come from the asset archive
+        if (importer.IsDefaultIOHandler())
+            importer.SetIOHandler(new ArchiveIOSystem());
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights);
         // check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
@@ -60,35 +821,653 @@ private:
         // retrieve the directory path of the filepath
         directory = path.substr(0, path.find_last_of('/'));
 
+        // process every mesh exactly once, nodes refer to them by index
+        for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+            pendingMeshes.push_back(processMesh(scene->mMeshes[i], scene));
+
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        processNode(scene->mRootNode, -1);
+
+        // now that the nodes are known, hook up the bones and read the animations
+        buildSkeleton();
+        processAnimations(scene);
+
+        // the converted data is all we need, release the scene now instead of on the next import
+        importer.FreeScene();
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode* node, const aiScene* scene)
+    // same as importModel, but parses the file with ObjLoader. Every material becomes a mesh, referenced by a single root node.
+    void importObj(string const& path)
     {
-        // process each mesh located at the current node
-        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        vector<ObjLoader::Group> groups;
+        vector<ObjLoader::Material> materials;
+        if (!ObjLoader::load(path, groups, materials))
+            return;
+        directory = path.substr(0, path.find_last_of('/'));
+
+        ModelNode root;
+        root.name = path.substr(path.find_last_of('/') + 1);
+        root.parent = -1;
+        root.localTransform = glm::mat4(1.0f);
+        root.worldTransform = glm::mat4(1.0f);
+        root.dirty = true;
+
+        for (unsigned int i = 0; i < groups.size(); i++)
+        {
+            MeshData data;
+            data.vertices.swap(groups[i].vertices);
+            data.indices.swap(groups[i].indices);
+            if (groups[i].material >= 0)
+            {
+                const ObjLoader::Material& material = materials[groups[i].material];
+                // same order and sampler names as processMesh
+                const string* maps[] = { &material.diffuse, &material.specular, &material.normal, &material.height, &material.roughness, &material.ao };
+                const char* types[] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height", "texture_roughness", "texture_ao" };
+                for (int j = 0; j < 6; j++)
+                {
+                    if (!maps[j]->empty())
+                        data.textures.push_back(make_pair(decodeTexture(*maps[j]), string(types[j])));
+                }
+            }
+            root.meshes.push_back(static_cast<unsigned int>(pendingMeshes.size()));
+            pendingMeshes.push_back(std::move(data));
+        }
+        nodes.push_back(root);
+    }
+
+    // same as importModel for binary glTF files. The buffer views are handed to finishLoad as they are in the mapped file,
+    // every primitive becomes a mesh that reads them with the layout the file describes.
+    void importGlb(string const& path)
+    {
+        GltfLoader::Scene scene;
+        if (!GltfLoader::load(path, scene))
+            return;
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // only views that are used by a primitive are uploaded
+        vector<int> bufferOfView(scene.views.size(), -1);
+        for (unsigned int i = 0; i < scene.primitives.size(); i++)
+        {
+            GltfLoader::Primitive& primitive = scene.primitives[i];
+            MeshData data;
+            data.attributes = primitive.attributes;
+            for (unsigned int j = 0; j < data.attributes.size(); j++)
+                data.attributes[j].buffer = glbBuffer(scene, data.attributes[j].buffer, bufferOfView);
+            if (primitive.indexView >= 0)
+                data.elementBuffer = glbBuffer(scene, primitive.indexView, bufferOfView);
+            data.indexType = primitive.indexType;
+            data.indexOffset = primitive.indexOffset;
+            data.elementCount = primitive.elementCount;
+            data.boundsMin = primitive.boundsMin;
+            data.boundsMax = primitive.boundsMax;
+
+            if (primitive.material >= 0)
+            {
+                const GltfLoader::Material& material = scene.materials[primitive.material];
+                const int images[] = { material.baseColor, material.normal, material.metallicRoughness, material.occlusion };
+                const char* types[] = { "texture_diffuse", "texture_normal", "texture_roughness", "texture_ao" };
+                for (int j = 0; j < 4; j++)
+                {
+                    if (images[j] < 0 || images[j] >= static_cast<int>(scene.images.size()))
+                        continue;
+                    int texture = static_cast<int>(decodeGlbImage(path, scene, images[j]));
+                    // the roughness slot holds glossiness in red (map_Ns), glTF keeps roughness in green
+                    if (j == 2)
+                        texture = glossFromRoughness(texture);
+                    if (texture >= 0)
+                        data.textures.push_back(make_pair(static_cast<unsigned int>(texture), string(types[j])));
+                }
+            }
+            pendingMeshes.push_back(std::move(data));
+        }
+
+        for (unsigned int i = 0; i < scene.nodes.size(); i++)
+        {
+            ModelNode node;
+            node.name = scene.nodes[i].name;
+            node.parent = scene.nodes[i].parent;
+            node.localTransform = scene.nodes[i].localTransform;
+            node.worldTransform = glm::mat4(1.0f);
+            node.dirty = true;
+            for (unsigned int j = 0; j < scene.nodes[i].primitives.size(); j++)
+                node.meshes.push_back(scene.nodes[i].primitives[j]);
+            nodes.push_back(node);
+            if (node.parent >= 0)
+                nodes[node.parent].children.push_back(static_cast<int>(i));
+        }
+    }
+
+    // index into pendingBuffers for a buffer view, adds it the first time it's used
+    unsigned int glbBuffer(const GltfLoader::Scene& scene, unsigned int view, vector<int>& bufferOfView)
+    {
+        if (bufferOfView[view] < 0)
+        {
+            BufferData buffer;
+            buffer.bytes = scene.bytes(scene.views[view].offset);
+            buffer.size = scene.views[view].size;
+            bufferOfView[view] = static_cast<int>(pendingBuffers.size());
+            pendingBuffers.push_back(buffer);
+        }
+        return static_cast<unsigned int>(bufferOfView[view]);
+    }
+
+    // decodes an image of a glTF file into pendingTextures, embedded images straight from the mapped file
+    unsigned int decodeGlbImage(const string& path, const GltfLoader::Scene& scene, int index)
+    {
+        const GltfLoader::Image& image = scene.images[index];
+        if (!image.uri.empty())
+            return decodeTexture(image.uri);
+
+        // embedded images have no path, so they're told apart by their index
+        string key = path + '#' + to_string(index);
+        for (unsigned int j = 0; j < pendingTextures.size(); j++)
+        {
+            if (pendingTextures[j].path == key)
+                return j;
+        }
+
+        TextureData texture;
+        texture.path = key;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(scene.file.data() + image.offset);
+        DecodedImage decoded;
+        if (!ImageDecoder::decodeMemory(bytes, image.size, 0, decoded))
+            std::cout << "Texture failed to load: image " << index << " of " << path << std::endl;
+        texture.width = decoded.width;
+        texture.height = decoded.height;
+        texture.nrComponents = decoded.channels;
+        texture.pixels = decoded.pixels;
+        pendingTextures.push_back(texture);
+        return static_cast<unsigned int>(pendingTextures.size() - 1);
+    }
+
+    // a one channel texture of 1 - roughness from the green channel of a glTF metallic-roughness map. The map itself
+    // is left as it is, its red channel is often the occlusion. -1 for cooked maps, their channels can't be reached.
+    int glossFromRoughness(int source)
+    {
+        string key = pendingTextures[source].path + "#gloss";
+        for (unsigned int j = 0; j < pendingTextures.size(); j++)
+        {
+            if (pendingTextures[j].path == key)
+                return static_cast<int>(j);
+        }
+        if (!pendingTextures[source].pixels)
+            return -1;
+
+        const TextureData& roughness = pendingTextures[source];
+        TextureData texture;
+        texture.path = key;
+        texture.width = roughness.width;
+        texture.height = roughness.height;
+        texture.nrComponents = 1;
+        size_t count = static_cast<size_t>(roughness.width) * roughness.height;
+        const unsigned char* from = static_cast<const unsigned char*>(roughness.pixels.get());
+        unsigned char* gloss = new unsigned char[count];
+        int channel = roughness.nrComponents > 1 ? 1 : 0;
+        for (size_t i = 0; i < count; i++)
+            gloss[i] = 255 - from[i * roughness.nrComponents + channel];
+        texture.pixels = shared_ptr<void>(gloss, [](void* p) { delete[] static_cast<unsigned char*>(p); });
+        pendingTextures.push_back(texture);
+        return static_cast<int>(pendingTextures.size() - 1);
+    }
+
+    // creates the textures and meshes from the imported data, has to run on the GL thread
+    void finishLoad()
+    {
+        // every decoded texture becomes a layer of a texture array
+        vector<pair<int, int>> textureLayers = buildTextureArrays();
+        for (unsigned int i = 0; i < pendingTextures.size(); i++)
+        {
+            Texture texture;
+            texture.id = textureLayers[i].first >= 0 ? textureArrays[textureLayers[i].first].id : 0;
+            texture.path = pendingTextures[i].path;
+            textures_loaded.push_back(texture);
+        }
+
+        // shared buffers are filled straight from the imported bytes, all meshes that use them wait for the last one
+        unsigned int firstBuffer = static_cast<unsigned int>(buffers.size());
+        shared_ptr<UploadTicket> buffersTicket;
+        if (uploads && !pendingBuffers.empty())
+            buffersTicket = make_shared<UploadTicket>(static_cast<int>(pendingBuffers.size()));
+        for (unsigned int i = 0; i < pendingBuffers.size(); i++)
+        {
+            unsigned int buffer;
+            glGenBuffers(1, &buffer);
+            if (uploads)
+            {
+                uploads->enqueueBuffer(buffer, pendingBuffers[i].bytes, pendingBuffers[i].size, buffersTicket);
+            }
+            else
+            {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, pendingBuffers[i].size, pendingBuffers[i].bytes.get(), GL_STATIC_DRAW);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            }
+            buffers.push_back(buffer);
+        }
+
+        for (unsigned int i = 0; i < pendingMeshes.size(); i++)
+        {
+            MeshData& data = pendingMeshes[i];
+            // the textures are bound through the material, the mesh doesn't bind any itself
+            int material = findMaterial(data.textures, textureLayers);
+            if (data.attributes.empty())
+            {
+                meshes.push_back(Mesh(data.vertices, data.indices, vector<Texture>(), uploads));
+            }
+            else
+            {
+                for (unsigned int j = 0; j < data.attributes.size(); j++)
+                    data.attributes[j].buffer = buffers[firstBuffer + data.attributes[j].buffer];
+                GLuint elementBuffer = data.elementBuffer >= 0 ? buffers[firstBuffer + data.elementBuffer] : 0;
+                meshes.push_back(Mesh(data.attributes, elementBuffer, data.indexType, data.indexOffset, data.elementCount, data.boundsMin, data.boundsMax, vector<Texture>(), buffersTicket));
+            }
+            meshes.back().skinned = data.skinned;
+            meshes.back().material = material;
+        }
+        uploadMaterials();
+        sortDrawOrder();
+
+        pendingMeshes.clear();
+        pendingTextures.clear();
+        // the upload queue holds on to the bytes (and the file mapping) until they're uploaded
+        pendingBuffers.clear();
+
+        meshNodes.assign(meshes.size(), vector<int>());
+        for (unsigned int i = 0; i < nodes.size(); i++)
+        {
+            for (unsigned int j = 0; j < nodes[i].meshes.size(); j++)
+                meshNodes[nodes[i].meshes[j]].push_back(i);
+        }
+
+        transformsDirty = true;
+        updateTransforms();
+    }
+
+    // puts every pending texture into a texture array with others of the same size and channel count, and starts the
+    // uploads. Returns the array and layer of each pending texture, (-1, -1) for textures that failed to decode.
+    vector<pair<int, int>> buildTextureArrays()
+    {
+        vector<pair<int, int>> textureLayers(pendingTextures.size(), make_pair(-1, -1));
+        int firstArray = static_cast<int>(textureArrays.size());
+        for (unsigned int i = 0; i < pendingTextures.size(); i++)
+        {
+            const TextureData& texture = pendingTextures[i];
+            if (!texture.pixels && !texture.compressed.valid())
+                continue;
+
+            GLenum compressedFormat = texture.compressed.valid() ? texture.compressed.format : 0;
+            int levels = texture.compressed.valid() ? texture.compressed.levels : 0;
+            int array = -1;
+            for (int j = firstArray; j < static_cast<int>(textureArrays.size()) && array < 0; j++)
+            {
+                const TextureArray& candidate = textureArrays[j];
+                if (candidate.width == texture.width && candidate.height == texture.height && candidate.channels == texture.nrComponents
+                    && candidate.compressedFormat == compressedFormat && candidate.levels == levels)
+                    array = j;
+            }
+            if (array < 0)
+            {
+                TextureArray newArray;
+                newArray.id = 0;
+                newArray.width = texture.width;
+                newArray.height = texture.height;
+                newArray.channels = texture.nrComponents;
+                newArray.compressedFormat = compressedFormat;
+                newArray.levels = levels;
+                newArray.layers = 0;
+                array = static_cast<int>(textureArrays.size());
+                textureArrays.push_back(newArray);
+            }
+            textureLayers[i] = make_pair(array, textureArrays[array].layers++);
+        }
+
+        // allocate the storage of the new arrays, the layers are filled in below
+        for (unsigned int i = firstArray; i < textureArrays.size(); i++)
+        {
+            TextureArray& array = textureArrays[i];
+            GLenum format = array.channels == 1 ? GL_RED : array.channels == 2 ? GL_RG : array.channels == 3 ? GL_RGB : GL_RGBA;
+            glGenTextures(1, &array.id);
+            GLState::get().editTexture(GL_TEXTURE_2D_ARRAY, array.id);
+            if (array.compressedFormat)
+            {
+                // every cooked level is allocated up front, nothing gets generated
+                for (int level = 0; level < array.levels; level++)
+                {
+                    int width = CompressedImage::levelDimension(array.width, level), height = CompressedImage::levelDimension(array.height, level);
+                    GLsizei size = static_cast<GLsizei>(CompressedImage::levelSize(array.compressedFormat, width, height) * array.layers);
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.compressedFormat, width, height, array.layers, 0, size, nullptr);
+                }
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, array.levels - 1);
+            }
+            else
+            {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, array.width, array.height, array.layers, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            if (uploads)
+                array.ticket = make_shared<UploadTicket>(array.layers);
+        }
+
+        // the residency manager keeps the decoded layers (or the cooked files' mappings) to stream levels back in
+        vector<shared_ptr<TextureResidency::Source>> sources(textureArrays.size());
+        for (unsigned int i = firstArray; i < textureArrays.size() && residency; i++)
         {
-            // the node object only contains indices to index the actual objects in the scene. 
-            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            const TextureArray& array = textureArrays[i];
+            sources[i] = residency->add(array.id, GL_TEXTURE_2D_ARRAY, array.ticket);
+            sources[i]->width = array.width;
+            sources[i]->height = array.height;
+            sources[i]->channels = array.channels;
+            if (array.compressedFormat)
+                sources[i]->compressed.resize(array.layers);
+            else
+                sources[i]->pixels.resize(array.layers);
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (unsigned int i = 0; i < pendingTextures.size(); i++)
+        {
+            if (textureLayers[i].first < 0)
+                continue;
+            const TextureData& texture = pendingTextures[i];
+            TextureArray& array = textureArrays[textureLayers[i].first];
+            int layer = textureLayers[i].second;
+            if (residency)
+            {
+                if (texture.compressed.valid())
+                    sources[textureLayers[i].first]->compressed[layer] = texture.compressed;
+                else
+                    sources[textureLayers[i].first]->pixels[layer] = texture.pixels;
+            }
+            if (texture.compressed.valid())
+            {
+                if (uploads)
+                {
+                    uploads->enqueueCompressedTexture(array.id, layer, texture.compressed, array.ticket);
+                }
+                else
+                {
+                    const char* bytes = static_cast<const char*>(texture.compressed.data.get());
+                    GLState::get().editTexture(GL_TEXTURE_2D_ARRAY, array.id);
+                    for (int level = 0; level < texture.compressed.levels; level++)
+                    {
+                        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, CompressedImage::levelDimension(texture.width, level), CompressedImage::levelDimension(texture.height, level), 1,
+                                                  texture.compressed.format, static_cast<GLsizei>(texture.compressed.levelSize(level)), bytes + texture.compressed.levelOffset(level));
+                    }
+                }
+            }
+            else if (uploads)
+            {
+                // the queue uploads in order, so the mipmaps are made once the last layer is in
+                uploads->enqueueTextureLayer(array.id, layer, texture.width, texture.height, texture.nrComponents, texture.pixels, layer == array.layers - 1, array.ticket);
+            }
+            else
+            {
+                GLenum format = array.channels == 1 ? GL_RED : array.channels == 2 ? GL_RG : array.channels == 3 ? GL_RGB : GL_RGBA;
+                GLState::get().editTexture(GL_TEXTURE_2D_ARRAY, array.id);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, texture.width, texture.height, 1, format, GL_UNSIGNED_BYTE, texture.pixels.get());
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        if (!uploads)
+        {
+            for (unsigned int i = firstArray; i < textureArrays.size(); i++)
+            {
+                if (textureArrays[i].compressedFormat)
+                    continue;
+                GLState::get().editTexture(GL_TEXTURE_2D_ARRAY, textureArrays[i].id);
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            }
+        }
+        return textureLayers;
+    }
+
+    // returns the index of the material with these textures, adding it to the table if it's new
+    int findMaterial(const vector<pair<unsigned int, string>>& textures, const vector<pair<int, int>>& textureLayers)
+    {
+        ModelMaterial material;
+        for (int slot = 0; slot < MATERIAL_SLOTS; slot++)
+        {
+            material.arrays[slot] = -1;
+            material.layers[slot] = -1;
+        }
+        // the shader samples the first texture of every type, like texture_diffuse1
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            for (int slot = 0; slot < MATERIAL_SLOTS; slot++)
+            {
+                if (textures[i].second == MATERIAL_SLOT_TYPES[slot] && material.arrays[slot] < 0)
+                {
+                    material.arrays[slot] = textureLayers[textures[i].first].first;
+                    material.layers[slot] = textureLayers[textures[i].first].second;
+                }
+            }
+        }
+
+        for (unsigned int i = 0; i < materials.size(); i++)
+        {
+            if (memcmp(&materials[i], &material, sizeof(ModelMaterial)) == 0)
+                return i;
+        }
+        if (materials.size() >= MAX_MATERIALS)
+        {
+            cout << "WARNING::MODEL:: more than " << MAX_MATERIALS << " materials in " << directory << ", reusing the last one" << endl;
+            return MAX_MATERIALS - 1;
+        }
+        materials.push_back(material);
+        return static_cast<int>(materials.size() - 1);
+    }
+
+    // writes the material table into the uniform buffer, two ivec4 per material: the layers of the first four slots, then the fifth
+    void uploadMaterials()
+    {
+        if (materials.empty())
+            return;
+
+        vector<glm::ivec4> table;
+        for (unsigned int i = 0; i < materials.size(); i++)
+        {
+            const int* layers = materials[i].layers;
+            table.push_back(glm::ivec4(layers[0], layers[1], layers[2], layers[3]));
+            table.push_back(glm::ivec4(layers[4], -1, -1, -1));
+        }
+
+        if (!materialBuffer)
+            glGenBuffers(1, &materialBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+        // always the full block size, the shader declares all MAX_MATERIALS entries
+        glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * 2 * sizeof(glm::ivec4), nullptr, GL_STATIC_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, table.size() * sizeof(glm::ivec4), &table[0]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // orders the meshes so those with the same texture arrays are drawn one after the other
+    void sortDrawOrder()
+    {
+        drawOrder.clear();
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            drawOrder.push_back(i);
+
+        const vector<ModelMaterial>& table = materials;
+        const vector<Mesh>& meshList = meshes;
+        std::stable_sort(drawOrder.begin(), drawOrder.end(), [&table, &meshList](unsigned int a, unsigned int b) {
+            int materialA = meshList[a].material, materialB = meshList[b].material;
+            if (materialA < 0 || materialB < 0)
+                return materialA < materialB;
+            // program switches cost more than texture switches
+            unsigned int featuresA = materialFeatures(table[materialA]), featuresB = materialFeatures(table[materialB]);
+            if (featuresA != featuresB)
+                return featuresA < featuresB;
+            for (int slot = 0; slot < MATERIAL_SLOTS; slot++)
+            {
+                if (table[materialA].arrays[slot] != table[materialB].arrays[slot])
+                    return table[materialA].arrays[slot] < table[materialB].arrays[slot];
+            }
+            return materialA < materialB;
+        });
+
+        // render queue keys carry the rank instead of the material, so materials sharing arrays sort next to each other
+        materialRank.assign(materials.size(), 0);
+        unsigned int rank = 0;
+        vector<bool> ranked(materials.size(), false);
+        for (unsigned int o = 0; o < drawOrder.size(); o++)
+        {
+            int material = meshes[drawOrder[o]].material;
+            if (material >= 0 && !ranked[material])
+            {
+                ranked[material] = true;
+                materialRank[material] = rank++;
+            }
+        }
+    }
+
+    // fills the skeleton from the node tree, the bones themselves were collected by processMesh
+    void buildSkeleton()
+    {
+        skeleton.parents.clear();
+        skeleton.bindTransforms.clear();
+        for (unsigned int i = 0; i < nodes.size(); i++)
+        {
+            skeleton.parents.push_back(nodes[i].parent);
+            skeleton.bindTransforms.push_back(nodes[i].localTransform);
+        }
+
+        skeleton.boneNodes.clear();
+        for (unsigned int i = 0; i < boneNames.size(); i++)
+            skeleton.boneNodes.push_back(findNode(boneNames[i]));
+
+        // bones end up relative to the root, like the vertices of a mesh that isn't skinned
+        if (!nodes.empty())
+            skeleton.globalInverse = glm::inverse(nodes[0].localTransform);
+    }
+
+    // converts the animations of the scene, with key times in seconds
+    void processAnimations(const aiScene* scene)
+    {
+        for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+        {
+            const aiAnimation* animation = scene->mAnimations[i];
+            // files without a rate are usually authored at 25 ticks per second
+            double ticksPerSecond = animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+
+            AnimationClip clip;
+            clip.name = animation->mName.C_Str();
+            clip.duration = static_cast<float>(animation->mDuration / ticksPerSecond);
+            for (unsigned int j = 0; j < animation->mNumChannels; j++)
+            {
+                const aiNodeAnim* source = animation->mChannels[j];
+                AnimationChannel channel;
+                channel.node = findNode(source->mNodeName.C_Str());
+                if (channel.node < 0)
+                    continue;
+                for (unsigned int k = 0; k < source->mNumPositionKeys; k++)
+                {
+                    const aiVectorKey& key = source->mPositionKeys[k];
+                    channel.positionTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+                    channel.positions.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+                }
+                for (unsigned int k = 0; k < source->mNumRotationKeys; k++)
+                {
+                    const aiQuatKey& key = source->mRotationKeys[k];
+                    channel.rotationTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+                    channel.rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+                }
+                for (unsigned int k = 0; k < source->mNumScalingKeys; k++)
+                {
+                    const aiVectorKey& key = source->mScalingKeys[k];
+                    channel.scaleTimes.push_back(static_cast<float>(key.mTime / ticksPerSecond));
+                    channel.scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+                }
+                clip.channels.push_back(channel);
+            }
+            animations.push_back(clip);
+        }
+    }
+
+    // stores the bone influences of a mesh in its vertices, up to MAX_BONE_INFLUENCE per vertex
+    void extractBoneWeights(vector<Vertex>& vertices, aiMesh* mesh)
+    {
+        for (unsigned int i = 0; i < mesh->mNumBones; i++)
+        {
+            const aiBone* bone = mesh->mBones[i];
+            string name = bone->mName.C_Str();
+
+            // bones are shared by all meshes of the model
+            int boneID = -1;
+            for (unsigned int j = 0; j < boneNames.size(); j++)
+            {
+                if (boneNames[j] == name)
+                {
+                    boneID = j;
+                    break;
+                }
+            }
+            if (boneID < 0)
+            {
+                boneID = static_cast<int>(boneNames.size());
+                boneNames.push_back(name);
+                skeleton.boneOffsets.push_back(glm::transpose(glm::make_mat4(&bone->mOffsetMatrix.a1)));
+            }
+
+            for (unsigned int j = 0; j < bone->mNumWeights; j++)
+            {
+                Vertex& vertex = vertices[bone->mWeights[j].mVertexId];
+                // aiProcess_LimitBoneWeights keeps it at four, so there's always a free slot
+                for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+                {
+                    if (vertex.m_Weights[k] == 0.0f)
+                    {
+                        vertex.m_BoneIDs[k] = boneID;
+                        vertex.m_Weights[k] = bone->mWeights[j].mWeight;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // processes a node in a recursive fashion. Stores the node with its transform and mesh references and repeats this process on its children nodes (if any).
+    void processNode(aiNode* node, int parent)
+    {
+        int index = static_cast<int>(nodes.size());
+
+        ModelNode modelNode;
+        modelNode.name = node->mName.C_Str();
+        modelNode.parent = parent;
+        // assimp matrices are row-major, glm matrices are column-major
+        modelNode.localTransform = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+        modelNode.worldTransform = glm::mat4(1.0f);
+        modelNode.dirty = true;
+        // the node object only contains indices to index the actual objects in the scene. 
+        // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+            modelNode.meshes.push_back(node->mMeshes[i]);
+        nodes.push_back(modelNode);
+
+        if (parent >= 0)
+            nodes[parent].children.push_back(index);
+
+        // after we've stored the node we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], index);
         }
 
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    MeshData processMesh(aiMesh* mesh, const aiScene* scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        vector<pair<unsigned int, string>>& textures = data.textures;
+
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
 
         // walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -130,9 +1509,17 @@ private:
             }
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+            // no bone influences until extractBoneWeights fills them in
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                vertex.m_BoneIDs[j] = 0;
+                vertex.m_Weights[j] = 0.0f;
+            }
 
             vertices.push_back(vertex);
         }
+        extractBoneWeights(vertices, mesh);
+        data.skinned = mesh->HasBones();
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
@@ -151,98 +1538,133 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+        vector<pair<unsigned int, string>> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
         textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+        vector<pair<unsigned int, string>> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
         textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+        std::vector<pair<unsigned int, string>> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
         textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height");
+        std::vector<pair<unsigned int, string>> heightMaps = loadMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         // 5. roughness maps
-        std::vector<Texture> roughMaps = loadMaterialTextures(material, aiTextureType_SHININESS, "texture_roughness");
+        std::vector<pair<unsigned int, string>> roughMaps = loadMaterialTextures(material, aiTextureType_SHININESS, "texture_roughness");
         textures.insert(textures.end(), roughMaps.begin(), roughMaps.end());
         // 6. ao maps
-        std::vector<Texture> aoMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ao");
+        std::vector<pair<unsigned int, string>> aoMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ao");
         textures.insert(textures.end(), aoMaps.begin(), aoMaps.end());
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return the extracted mesh data, the mesh object is created by finishLoad
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    // checks all material textures of a given type and decodes the textures if they're not decoded yet.
+    // returns the index of each texture in pendingTextures together with the sampler type it's used as.
+    vector<pair<unsigned int, string>> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
     {
-        vector<Texture> textures;
+        vector<pair<unsigned int, string>> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(make_pair(decodeTexture(str.C_Str()), typeName));
         }
         return textures;
     }
+
+    // decodes the texture at the given path (relative to the model) into pendingTextures, unless it was decoded before.
+    // returns its index in pendingTextures.
+    unsigned int decodeTexture(const string& path)
+    {
+        // check if texture was decoded before and if so, skip decoding a new texture
+        for (unsigned int j = 0; j < pendingTextures.size(); j++)
+        {
+            if (pendingTextures[j].path == path)
+                return j; // a texture with the same filepath has already been decoded, continue to next one. (optimization)
+        }
+
+        TextureData texture;
+        texture.path = path;
+        string filename = this->directory + '/' + texture.path;
+
+        // a cooked texture is mapped instead of decoded, it already has its mip levels
+        if (TextureCooker::readDds(TextureCooker::cookedPath(filename), texture.compressed))
+        {
+            texture.width = texture.compressed.width;
+            texture.height = texture.compressed.height;
+            texture.nrComponents = 0;
+            pendingTextures.push_back(texture);
+            return static_cast<unsigned int>(pendingTextures.size() - 1);
+        }
+
+        DecodedImage decoded;
+        if (!ImageDecoder::decodeFile(filename, 0, decoded))
+            std::cout << "Texture failed to load at path: " << texture.path << std::endl;
+        texture.width = decoded.width;
+        texture.height = decoded.height;
+        texture.nrComponents = decoded.channels;
+        texture.pixels = decoded.pixels;
+        pendingTextures.push_back(texture);  // store it as texture decoded for entire model, to ensure we won't unnecesery decode duplicate textures.
+        return static_cast<unsigned int>(pendingTextures.size() - 1);
+    }
 };
 
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma, UploadQueue* uploads)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
 
+    DecodedImage image;
+    if (!ImageDecoder::decodeFile(filename, 0, image))
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+
+    return TextureFromData(image.width, image.height, image.channels, image.pixels, uploads);
+}
+
+// creates a texture from decoded pixels. With an upload queue it returns a placeholder right away and the pixels follow later.
+unsigned int TextureFromData(int width, int height, int nrComponents, shared_ptr<void> data, UploadQueue* uploads)
+{
     unsigned int textureID;
-    glGenTextures(1, &textureID);
+    if (uploads)
+        textureID = uploads->createPlaceholderTexture();
+    else
+        glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    if (data && uploads)
+    {
+        GLState::get().editTexture(GL_TEXTURE_2D, textureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // the queue releases the pixels once they've been copied to the GPU
+        uploads->enqueueTexture(textureID, width, height, nrComponents, data);
+    }
+    else if (data)
     {
         GLenum format;
         if (nrComponents == 1)
             format = GL_RED;
+        else if (nrComponents == 2)
+            format = GL_RG;
         else if (nrComponents == 3)
             format = GL_RGB;
-        else if (nrComponents == 4)
+        else
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        GLState::get().editTexture(GL_TEXTURE_2D, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data.get());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         glGenerateMipmap(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
     }
 
     return textureID;
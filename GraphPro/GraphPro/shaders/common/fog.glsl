@@ -0,0 +1,20 @@
+//distance fog that fades into the sky, so the far end of the terrain blends into the horizon behind it
+#include "frame.glsl"
+#include "lerp.glsl"
+
+//the sky's gradient for a view direction, from the horizon up
+vec3 skyColor(vec3 viewDir) {
+	vec3 topColor = vec3(68.0 / 255.0, 118.0 / 255.0, 189.0 / 255.0);
+	vec3 botColor = vec3(118.0 / 255.0, 214.0 / 255.0, 231.0 / 255.0);
+	return lerp(botColor, topColor, max(viewDir.y, 0.0));
+}
+
+//how much of a point this far from the camera is hidden
+float fogAmount(float dist) {
+	return pow(clamp((dist - 250) / 1000, 0, 1), 2);
+}
+
+vec3 applyFog(vec3 color, vec3 worldPosition) {
+	vec3 toPoint = worldPosition - cameraPosition;
+	return lerp(color, skyColor(normalize(toPoint)), fogAmount(length(toPoint)));
+}
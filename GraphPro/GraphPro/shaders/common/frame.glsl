@@ -0,0 +1,8 @@
+//camera, projection and light, the same for every program and filled once per frame (FrameUniforms.h)
+layout(std140) uniform Frame {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	vec3 cameraPosition;
+	vec3 lightPosition;
+};
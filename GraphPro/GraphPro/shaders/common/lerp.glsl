@@ -0,0 +1,15 @@
+float lerp(float a, float b, float t) {
+	return a + (b - a) * t;
+}
+
+vec2 lerp(vec2 a, vec2 b, float t) {
+	return a + (b - a) * t;
+}
+
+vec3 lerp(vec3 a, vec3 b, float t) {
+	return a + (b - a) * t;
+}
+
+vec4 lerp(vec4 a, vec4 b, float t) {
+	return a + (b - a) * t;
+}
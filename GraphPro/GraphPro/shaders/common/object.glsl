@@ -0,0 +1,4 @@
+//the world matrix of the draw, a slot of the per-object ring (FrameUniforms.h)
+layout(std140) uniform Object {
+	mat4 world;
+};
@@ -0,0 +1,21 @@
+//addressing of the terrain's virtual texture, the uniforms are set by VirtualTexture::setUniforms
+uniform float vtSize;
+uniform int vtMaxLevel;
+uniform float vtPagePayload;
+
+//the level a pixel needs, from how many virtual texels it covers
+int vtLevel(vec2 uv, float bias) {
+	vec2 texel = uv * vtSize;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	return int(clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + bias, 0.0, float(vtMaxLevel)));
+}
+
+//pages across the texture on a level
+int vtPages(int level) {
+	return max(int(vtSize / vtPagePayload) >> level, 1);
+}
+
+ivec2 vtPage(vec2 uv, int level) {
+	int pages = vtPages(level);
+	return clamp(ivec2(uv * float(pages)), ivec2(0), ivec2(pages - 1));
+}
@@ -0,0 +1,5 @@
+#version 330 core
+//the depth pre-pass only needs the depth the rasterizer writes, nothing is shaded
+
+void main(){
+}
@@ -0,0 +1,35 @@
+#version 430 core
+//one level of the hierarchical depth pyramid: every texel keeps the farthest depth of the texels below it. Level 0 is
+//a copy of the depth buffer. When the level below has an odd size the last row and column take in the one left over,
+//so every texel covers at least its part of the screen.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D depth;
+//0 copies depth into level 0, otherwise the level below is read from lower
+uniform int level;
+layout(r32f, binding = 0) uniform readonly image2D lower;
+layout(r32f, binding = 1) uniform writeonly image2D upper;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(upper);
+    if (texel.x >= size.x || texel.y >= size.y)
+        return;
+
+    if (level == 0) {
+        imageStore(upper, texel, vec4(texelFetch(depth, texel, 0).r));
+        return;
+    }
+
+    ivec2 lowerSize = imageSize(lower);
+    ivec2 first = texel * 2;
+    //three when this is the last texel of an odd row or column
+    ivec2 last = first + 1 + ivec2(texel.x == size.x - 1 && (lowerSize.x & 1) == 1 ? 1 : 0, texel.y == size.y - 1 && (lowerSize.y & 1) == 1 ? 1 : 0);
+    last = min(last, lowerSize - 1);
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; y++)
+        for (int x = first.x; x <= last.x; x++)
+            farthest = max(farthest, imageLoad(lower, ivec2(x, y)).r);
+    imageStore(upper, texel, vec4(farthest));
+}
@@ -0,0 +1,116 @@
+#version 430 core
+//culls copies of a model on the GPU and writes the indirect draws of its meshes. Two dispatches of this shader:
+//  cull:     one invocation per copy. Copies whose bounding sphere is inside the frustum and not behind the depth
+//            pyramid of the last frame get a slot, and the transforms of every node of every mesh are written for it.
+//  commands: one invocation per mesh, sets the instance count of its draw to the number of visible copies.
+//Mesh m's instances start at baseInstance = firstNode(m) * capacity, copy s and node k are instance s * nodeCount + k.
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Copies { mat4 copies[]; };
+layout(std430, binding = 1) buffer Commands { DrawCommand commands[]; };
+layout(std430, binding = 2) writeonly buffer Instances { mat4 instances[]; };
+//x first node, y node count
+layout(std430, binding = 3) readonly buffer Meshes { uvec4 meshes[]; };
+layout(std430, binding = 4) readonly buffer Nodes { mat4 nodes[]; };
+layout(std430, binding = 5) buffer Counter { uint visibleCount; };
+
+//0 culls, 1 writes the commands
+uniform int stage;
+uniform int copyCount;
+uniform int meshCount;
+uniform int capacity;
+//the frustum of this frame, normals pointing in
+uniform vec4 planes[6];
+//the bounding sphere of the model, in model space
+uniform vec4 bounds;
+
+//the depth pyramid and the view projection it was drawn with, useHiZ is 0 until there is one
+uniform int useHiZ;
+uniform sampler2D hiz;
+uniform mat4 hizViewProjection;
+uniform int hizLevels;
+
+bool inFrustum(vec3 center, float radius)
+{
+    for (int i = 0; i < 6; i++) {
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius)
+            return false;
+    }
+    return true;
+}
+
+//true when every pixel the box around the sphere covers had something nearer in it last frame
+bool hidden(vec3 center, float radius)
+{
+    vec2 minUV = vec2(1.0), maxUV = vec2(0.0);
+    float nearest = 1.0;
+    for (int c = 0; c < 8; c++) {
+        vec3 corner = center + radius * vec3((c & 1) != 0 ? 1.0 : -1.0, (c & 2) != 0 ? 1.0 : -1.0, (c & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = hizViewProjection * vec4(corner, 1.0);
+        //reaches past the near plane, nothing can be in front of it
+        if (clip.w <= 0.0 || clip.z < -clip.w)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    //off the screen of the last frame, the pyramid knows nothing about it
+    if (any(lessThan(maxUV, vec2(0.0))) || any(greaterThan(minUV, vec2(1.0))))
+        return false;
+    minUV = clamp(minUV, 0.0, 1.0);
+    maxUV = clamp(maxUV, 0.0, 1.0);
+
+    //the level where the rectangle is at most two texels wide, four texels cover it
+    vec2 size = vec2(textureSize(hiz, 0));
+    vec2 pixels = (maxUV - minUV) * size;
+    int level = clamp(int(ceil(log2(max(max(pixels.x, pixels.y), 1.0)))), 0, hizLevels - 1);
+    //each level is half the one below, rounded down. Worked out here rather than asked with textureSize, which some
+    //drivers (llvmpipe) get wrong when the level differs between invocations.
+    ivec2 levelSize = max(ivec2(size) >> level, ivec2(1));
+    ivec2 first = min(ivec2(minUV * size) >> level, levelSize - 1);
+    ivec2 last = min(ivec2(maxUV * size) >> level, levelSize - 1);
+
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; y++)
+        for (int x = first.x; x <= last.x; x++)
+            farthest = max(farthest, texelFetch(hiz, ivec2(x, y), level).r);
+    return nearest > farthest;
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (stage == 1) {
+        if (index < uint(meshCount)) {
+            commands[index].instanceCount = visibleCount * meshes[index].y;
+            commands[index].baseInstance = meshes[index].x * uint(capacity);
+        }
+        return;
+    }
+
+    if (index >= uint(copyCount))
+        return;
+    mat4 copy = copies[index];
+    //the radius grows with the largest axis scale of the copy
+    float scale = max(length(copy[0].xyz), max(length(copy[1].xyz), length(copy[2].xyz)));
+    vec3 center = (copy * vec4(bounds.xyz, 1.0)).xyz;
+    float radius = bounds.w * scale;
+    if (!inFrustum(center, radius) || (useHiZ != 0 && hidden(center, radius)))
+        return;
+
+    uint slot = atomicAdd(visibleCount, 1u);
+    for (int m = 0; m < meshCount; m++) {
+        uint first = meshes[m].x * uint(capacity) + slot * meshes[m].y;
+        for (uint k = 0u; k < meshes[m].y; k++)
+            instances[first + k] = copy * nodes[meshes[m].x + k];
+    }
+}
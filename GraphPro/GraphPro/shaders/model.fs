@@ -5,55 +5,84 @@ in vec2 TexCoords;
 in vec3 Normals;
 in vec4 FragPos;
 
-uniform sampler2D texture_diffuse1;
-uniform sampler2D texture_specular1;
-uniform sampler2D texture_normal1;
-uniform sampler2D texture_roughness1;
-uniform sampler2D texture_ao1;
+// DEPTH_ONLY is the variant of the depth pre-pass, it has no maps and shades nothing
+#ifdef DEPTH_ONLY
+void main()
+{
+}
+#else
 
-uniform vec3 cameraPosition;
-uniform vec3 lightPosition;
+// built once per combination of the maps a material has (HAS_DIFFUSE_MAP, HAS_SPECULAR_MAP, HAS_ROUGHNESS_MAP,
+// HAS_AO_MAP), a map the material doesn't have is neither declared nor sampled
 
+// the model's textures live in texture arrays, the material table says which layer each slot uses
+#ifdef HAS_DIFFUSE_MAP
+uniform sampler2DArray diffuseArray;
+#endif
+#ifdef HAS_SPECULAR_MAP
+uniform sampler2DArray specularArray;
+#endif
+#ifdef HAS_ROUGHNESS_MAP
+uniform sampler2DArray roughnessArray;
+#endif
+#ifdef HAS_AO_MAP
+uniform sampler2DArray aoArray;
+#endif
 
-vec3 lerp(vec3 a, vec3 b, float t) {
-	return a + (b - a) * t;
-}
+// two entries per material: the diffuse, specular, normal and roughness layers, then the ao layer
+layout(std140) uniform Materials {
+    ivec4 materialLayers[512];
+};
+uniform int materialID;
 
+#include "common/frame.glsl"
+#include "common/fog.glsl"
 
-vec4 lerp(vec4 a, vec4 b, float t) {
-	return a + (b - a) * t;
-}
-
-float lerp(float a, float b, float t) {
-    return a + (b - a) * t;
+vec4 sampleLayer(sampler2DArray textures, int layer) {
+    return texture(textures, vec3(TexCoords, float(layer)));
 }
 
 void main()
 {
     vec3 lightDir = vec3(lightPosition.x, -lightPosition.y, lightPosition.z);//normalize(vec3(lightPosition.x, -lightPosition.y, lightPosition.z) - FragPos.xyz);
     
-    vec4 diffuse = texture(texture_diffuse1, TexCoords);
-    vec4 specTex = texture(texture_specular1, TexCoords);
+    ivec4 layers = materialLayers[materialID * 2];
+    int aoLayer = materialLayers[materialID * 2 + 1].x;
+
+#ifdef HAS_DIFFUSE_MAP
+    vec4 diffuse = sampleLayer(diffuseArray, layers.x);
+#else
+    vec4 diffuse = vec4(0.5, 0.5, 0.5, 1.0);
+#endif
 
     float light = max(dot(lightDir, Normals), 1.0);
 
+#ifdef HAS_AO_MAP
+    float ambientOcclusion = sampleLayer(aoArray, aoLayer).r;
+#else
+    float ambientOcclusion = 1.0;
+#endif
+
+    vec3 specular = vec3(0.0);
+#if defined(HAS_SPECULAR_MAP) || defined(HAS_ROUGHNESS_MAP)
     vec3 viewDir = normalize(FragPos.rgb - cameraPosition);
     vec3 refl = reflect(lightDir, Normals);
-
-    float ambientOcclusion = texture(texture_ao1, TexCoords).r;
-    
-    float roughness = texture(texture_roughness1, TexCoords).r;
+#ifdef HAS_ROUGHNESS_MAP
+    float roughness = sampleLayer(roughnessArray, layers.w).r;
+#else
+    float roughness = 0.0;
+#endif
     float spec = pow(max(dot(viewDir, refl), 0.0), lerp(1, 128, roughness));
-    vec3 specular = spec * specTex.rgb;
-
-    float dist = length(FragPos.xyz - cameraPosition);
+#ifdef HAS_SPECULAR_MAP
+    specular = spec * sampleLayer(specularArray, layers.y).rgb;
+#else
+    // glTF materials have no specular map, the highlight is white and as strong as the surface is glossy
+    specular = vec3(spec * roughness);
+#endif
+#endif
 
-    vec3 topColor = vec3(68.0 / 255.0, 118.0 / 255.0, 189.0 / 255.0);
-    vec3 botColor = vec3(118.0 / 255.0, 214.0 / 255.0, 231.0 / 255.0);
-
-    float fog = pow(clamp((dist - 250) / 1000, 0, 1), 2);
-    vec3 fogColor = lerp(botColor, topColor, max(viewDir.y, 0.0));
-    
     //FragColor = lerp(diffuse * max(light, 0.2), vec4(fogColor, 1.0), fog);
-    FragColor = lerp(diffuse * max(light * ambientOcclusion, 0.2 * ambientOcclusion) + vec4(specular, 0), vec4(fogColor, 1.0), fog);
-}
\ No newline at end of file
+    vec4 color = diffuse * max(light * ambientOcclusion, 0.2 * ambientOcclusion) + vec4(specular, 0);
+    FragColor = vec4(applyFog(color.rgb, FragPos.xyz), color.a);
+}
+#endif
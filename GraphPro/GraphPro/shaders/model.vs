@@ -2,21 +2,49 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
+layout(location = 5) in ivec4 aBoneIDs;
+layout(location = 6) in vec4 aWeights;
+layout(location = 7) in mat4 aInstance;
 
 out vec2 TexCoords;
 out vec3 Normals;
 out vec4 FragPos;
 
-uniform mat4 world;
-uniform mat4 view;
-uniform mat4 projection;
+#include "common/frame.glsl"
+#include "common/object.glsl"
+
+// the DEPTH_ONLY variant draws the depth pre-pass, every variant has to come up with the exact same depth
+invariant gl_Position;
+
+// bone matrices of all instances in the draw, boneCount per instance, four texels (columns) per matrix.
+// boneCount is 0 for meshes that aren't skinned.
+uniform samplerBuffer bonePalette;
+uniform int boneCount;
+
+mat4 boneMatrix(int bone)
+{
+    int texel = (gl_InstanceID * boneCount + bone) * 4;
+    return mat4(texelFetch(bonePalette, texel), texelFetch(bonePalette, texel + 1), texelFetch(bonePalette, texel + 2), texelFetch(bonePalette, texel + 3));
+}
 
 void main()
 {
     TexCoords = aTexCoords;
-    FragPos = world * vec4(aPos, 1.0);
-    gl_Position = projection * view * FragPos;
+    mat4 instanceWorld = world * aInstance;
+
+    // blend the bones that influence the vertex, vertices without any influence keep their bind pose
+    mat4 skin = mat4(1.0);
+    float totalWeight = aWeights.x + aWeights.y + aWeights.z + aWeights.w;
+    if (boneCount > 0 && totalWeight > 0.0)
+    {
+        skin = boneMatrix(aBoneIDs.x) * aWeights.x + boneMatrix(aBoneIDs.y) * aWeights.y
+             + boneMatrix(aBoneIDs.z) * aWeights.z + boneMatrix(aBoneIDs.w) * aWeights.w;
+    }
+    instanceWorld = instanceWorld * skin;
+
+    FragPos = instanceWorld * vec4(aPos, 1.0);
+    gl_Position = viewProjection * FragPos;
 
     // not the most efficient, but it works
-    Normals = normalize( mat3(inverse(transpose(world)))* aNormal );
+    Normals = normalize( mat3(inverse(transpose(instanceWorld)))* aNormal );
 }
\ No newline at end of file
@@ -10,13 +10,12 @@ uniform sampler2D mainTex;
 uniform sampler2D normalTex;
 uniform sampler2D specularTex;
 
-uniform vec3 lightPosition;
-uniform vec3 cameraPosition;
+#include "common/frame.glsl"
 
 void main(){
-	//normal map
-	vec3 normal = texture(normalTex, uv).rgb;
-	normal = normalize(normal * 2.0 - 1.0);
+	//normal map, only x and y are read so cooked BC5 maps (which have no z) work too
+	vec2 normalXY = texture(normalTex, uv).rg * 2.0 - 1.0;
+	vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
 
 	//scale down
 	normal.rg = normal.rg * .75f;
@@ -35,10 +34,10 @@ void main(){
 	float specular = pow(max(-dot(reflDir, viewDir), 0.0), 2);
 
 	//seperate RGB and RGBA
-	vec4 output = vec4(color, 1.0) * texture(mainTex, uv);
-	output.rgb = output.rgb * min(diffuse + 0.5, 1.0) + vec3(texture(specularTex, uv) * specular);
+	vec4 result = vec4(color, 1.0) * texture(mainTex, uv);
+	result.rgb = result.rgb * min(diffuse + 0.5, 1.0) + vec3(texture(specularTex, uv) * specular);
 
-	FragColor = output;
+	FragColor = result;
 
 	//returns uv as colors
 	//FragColor = vec4(uv, 0.0f, 1.0f);
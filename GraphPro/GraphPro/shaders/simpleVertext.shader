@@ -11,11 +11,12 @@ out vec2 uv;
 out mat3 tbn;
 out vec3 worldPosition;
 
-uniform mat4 world, view, projection;
+#include "common/frame.glsl"
+#include "common/object.glsl"
 
 void main()
 {
-	gl_Position = projection * view *  world * vec4(aPos, 1.0);
+	gl_Position = viewProjection * world * vec4(aPos, 1.0);
 
 	color = vColor;
 	uv = vUV;
@@ -4,11 +4,13 @@ layout(location = 3) in vec3 vNormal;
 
 out vec4 worldPosition;
 
-uniform mat4 world, view, projection;
+#include "common/frame.glsl"
+#include "common/object.glsl"
 
 void main()
 {
-	gl_Position = projection * view *  world * vec4(aPos, 1.0);
+	//z = w puts the box on the far plane, it's drawn last and only where nothing else is
+	gl_Position = (viewProjection * world * vec4(aPos, 1.0)).xyww;
 
 	worldPosition = world * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#version 330 core
+//bakes a page of the terrain's virtual texture: the layer textures blended by height bands
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D heightmap;
+uniform sampler2D dirt, sand, grass, rock, snow;
+
+uniform float heightScale;
+uniform float terrainY;
+//mip level of the page, coarse pages are only ever seen from far away
+uniform float pageLevel;
+
+#include "common/lerp.glsl"
+
+void main(){
+	//the heightmap texel a vertex was made from sits at its center, borders outside the terrain repeat the edge
+	vec2 heightmapSize = vec2(textureSize(heightmap, 0));
+	vec2 heightmapUV = clamp(uv, vec2(0.0), 1.0 - 1.0 / heightmapSize) + 0.5 / heightmapSize;
+	float y = terrainY + texture(heightmap, heightmapUV).r * heightScale;
+
+	float ds = clamp((y - 25) / 10, -1, 1) * 0.5 + 0.5;			//dirt to sand
+	float sg = clamp((y - 50) / 10, -1, 1) * 0.5 + 0.5;		//sand to grass
+	float gr = clamp((y - 100) / 10, -1, 1) * 0.5 + 0.5;		//grass to rock
+	float rs = clamp((y - 200) / 10, -1, 1) * 0.5 + 0.5;		//rock to snow
+
+	//the layers repeat 100 times across the terrain up close and 10 times further away, which hides the tiling
+	float uvLerp = clamp((pageLevel - 2.0) / 2.0, 0.0, 1.0);
+
+	vec3 dirtColor = lerp(texture(dirt, uv * 100).rgb, texture(dirt, uv * 10).rgb, uvLerp);
+	vec3 sandColor = lerp(texture(sand, uv * 100).rgb, texture(sand, uv * 10).rgb, uvLerp);
+	vec3 grassColor = lerp(texture(grass, uv * 100).rgb, texture(grass, uv * 10).rgb, uvLerp);
+	vec3 rockColor = lerp(texture(rock, uv * 100).rgb, texture(rock, uv * 10).rgb, uvLerp);
+	vec3 snowColor = texture(snow, uv * 100).rgb;
+
+	vec3 diffuse = lerp(lerp(lerp(lerp(dirtColor, sandColor, ds), grassColor, sg), rockColor, gr), snowColor, rs);
+
+	FragColor = vec4(diffuse, 1.0);
+}
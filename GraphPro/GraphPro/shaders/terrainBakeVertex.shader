@@ -0,0 +1,13 @@
+#version 330 core
+//a triangle that covers the whole viewport, without any vertex data
+out vec2 uv;
+
+//area of the virtual texture the page covers: min in xy, size in zw
+uniform vec4 pageRect;
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	uv = pageRect.xy + corner * pageRect.zw;
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
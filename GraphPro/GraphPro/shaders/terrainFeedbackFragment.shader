@@ -0,0 +1,18 @@
+#version 330 core
+//writes the virtual texture page and level every pixel of the terrain needs, drawn at a reduced resolution
+out uvec4 FragColor;
+
+in vec2 uv;
+in vec4 worldPosition;
+
+#include "common/virtualTexture.glsl"
+//the feedback target is smaller than the screen, this takes its larger derivatives back to the screen's
+uniform float vtMipBias;
+
+void main(){
+	int level = vtLevel(uv, vtMipBias);
+	ivec2 page = vtPage(uv, level);
+
+	//alpha marks a pixel that needs a page, the cleared background has 0
+	FragColor = uvec4(uvec2(page), uint(level), 1u);
+}
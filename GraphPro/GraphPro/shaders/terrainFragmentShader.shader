@@ -7,24 +7,30 @@ in vec4 worldPosition;
 uniform sampler2D mainTex;
 uniform sampler2D normalTex;
 
-uniform sampler2D dirt, sand, grass, rock, snow;
-
-uniform vec3 lightPosition;
-uniform vec3 cameraPosition;
-
-
-vec3 lerp(vec3 a, vec3 b, float t) {
-	return a + (b - a) * t;
-}
-
-vec2 lerp(vec2 a, vec2 b, float t) {
-	return a + (b - a) * t;
+//virtual texture: a page table entry per page and level (atlas slot x, y and the level actually baked) and the atlas
+uniform usampler2D pageTable;
+uniform sampler2D pageAtlas;
+#include "common/virtualTexture.glsl"
+uniform float vtPageBorder;
+uniform float vtAtlasSize;
+
+#include "common/fog.glsl"
+
+vec3 sampleVirtual(vec2 uv) {
+	int level = vtLevel(uv, 0.0);
+	uvec4 entry = texelFetch(pageTable, vtPage(uv, level), level);
+
+	//the entry may point at a coarser page that contains this one, find the position inside that page
+	float residentPages = float(vtPages(int(entry.b)));
+	vec2 pageUV = fract(uv * residentPages);
+	vec2 atlasTexel = vec2(entry.rg) * (vtPagePayload + 2.0 * vtPageBorder) + vtPageBorder + pageUV * vtPagePayload;
+	return textureLod(pageAtlas, atlasTexel / vtAtlasSize, 0.0).rgb;
 }
 
 void main(){
-	//normal map
-	vec3 normal = texture(normalTex, uv).rgb;
-	normal = normalize(normal * 2.0 - 1.0);
+	//normal map, only x and y are read so cooked BC5 maps (which have no z) work too
+	vec2 normalXY = texture(normalTex, uv).rg * 2.0 - 1.0;
+	vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
 	normal.gb = normal.bg;
 
 	//specular data
@@ -36,41 +42,11 @@ void main(){
 	float lightValue = max(-dot(normal, lightPosition), 0.0);
 	//float specular = pow(max(-dot(reflDir, viewDir), 0.0), 2);
 
-	//build color
-	float y = worldPosition.y;
-	float ds = clamp((y - 25) / 10, -1, 1) * 0.5 + 0.5;			//dirt to sand
-	float sg = clamp((y - 50) / 10, -1, 1) * 0.5 + 0.5;		//sand to grass
-	float gr = clamp((y - 100) / 10, -1, 1) * 0.5 + 0.5;		//grass to rock
-	float rs = clamp((y - 200) / 10, -1, 1) * 0.5 + 0.5;		//rock to snow
-
-	float dist = length(worldPosition.xyz - cameraPosition);
-	float uvLerp = clamp((dist - 250) / 150, -1, 1) * 0.5 + 0.5;
-
-	vec3 dirtColorClose = texture(dirt, uv * 100).rgb;		vec3 dirtColorFar = texture(dirt, uv * 10).rgb;
-	vec3 sandColorClose = texture(sand, uv * 100).rgb;		vec3 sandColorFar = texture(sand, uv * 10).rgb;
-	vec3 grassColorClose = texture(grass, uv * 100).rgb;	vec3 grassColorFar = texture(grass, uv * 10).rgb;
-	vec3 rockColorClose = texture(rock, uv * 100).rgb;		vec3 rockColorFar = texture(rock, uv * 10).rgb;
-	vec3 snowColorClose = texture(snow, uv * 100).rgb;		vec3 snowColorFar = texture(snow, uv * 100).rgb;
-
-	vec3 dirtColor = lerp(dirtColorClose, dirtColorFar, uvLerp);
-	vec3 sandColor = lerp(sandColorClose, sandColorFar, uvLerp);
-	vec3 grassColor = lerp(grassColorClose, grassColorFar, uvLerp);
-	vec3 rockColor = lerp(rockColorClose, rockColorFar, uvLerp);
-	vec3 snowColor = lerp(snowColorClose, snowColorFar, uvLerp);
-
-	vec3 diffuse = lerp(lerp(lerp(lerp(dirtColor, sandColor, ds), grassColor, sg), rockColor, gr), snowColor, rs);
-
-	float fog = pow(clamp((dist - 250) / 1000, 0, 1), 2);
-
-	vec3 topColor = vec3(68.0 / 255.0, 118.0 / 255.0, 189.0 / 255.0);
-	vec3 botColor = vec3(118.0 / 255.0, 214.0 / 255.0, 231.0 / 255.0);
-
-	vec3 fogColor = lerp(botColor, topColor, max(viewDir.y, 0.0));
+	//unique albedo, baked from the height bands into the virtual texture's pages
+	vec3 diffuse = sampleVirtual(uv);
 
 	//seperate RGB and RGBA
-	vec4 output = vec4( lerp(diffuse * min(lightValue + 0.1, 1.0), fogColor, fog), 1.0); //+ vec3(texture(specularTex, uv) * specular)
-
-	FragColor = output;
+	FragColor = vec4(applyFog(diffuse * min(lightValue + 0.1, 1.0), worldPosition.xyz), 1.0); //+ vec3(texture(specularTex, uv) * specular)
 
 	//returns uv as colors
     //FragColor = vec4(uv, 0.0f, 1.0f);
@@ -6,7 +6,11 @@ layout(location = 2) in vec2 vUV;
 out vec2 uv;
 out vec4 worldPosition;
 
-uniform mat4 world, view, projection;
+#include "common/frame.glsl"
+#include "common/object.glsl"
+
+//the depth pre-pass draws with this shader in another program, both have to come up with the exact same depth
+invariant gl_Position;
 
 uniform sampler2D mainTex;
 uniform sampler2D normalTex;
@@ -17,6 +21,6 @@ void main()
 	//world space offset
 	//worldPos.y += texture(mainTex, vUV).r * 200.0f;
 	
-	gl_Position = projection * view *  worldPosition;
+	gl_Position = viewProjection * worldPosition;
 	uv = vUV;
 }
\ No newline at end of file